@@ -0,0 +1,149 @@
+-- Copyright (c) 2021 PG1003
+--
+-- Permission is hereby granted, free of charge, to any person obtaining a copy
+-- of this software and associated documentation files (the "Software"), to
+-- deal in the Software without restriction, including without limitation the
+-- rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+-- sell copies of the Software, and to permit persons to whom the Software is
+-- furnished to do so, subject to the following conditions:
+
+-- The above copyright notice and this permission notice shall be included in
+-- all copies or substantial portions of the Software.
+
+-- THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+-- IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+-- FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+-- AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+-- LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+-- OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+-- SOFTWARE.
+
+
+-- Benchmark harness. When the suite runs in the native driver the global 'bench_native' provides a
+-- monotonic clock and an allocation counter; with a plain Lua interpreter 'os.clock' is used and the
+-- allocations are not counted.
+
+local bench = {}
+
+local native      = rawget( _G, "bench_native" )
+local clock       = native and native.clock or os.clock
+local allocations = native and native.allocations
+
+local _config  = { min_time = 0.2, filter = nil }
+local _results = {}
+
+local function _encode( value )
+    local t = type( value )
+    if t == "number" then
+        if value ~= value or value == math.huge or value == -math.huge then
+            return "null"
+        end
+        return math.type and math.type( value ) == "integer" and tostring( value ) or string.format( "%.6g", value )
+    elseif t == "string" then
+        return '"' .. string.gsub( value, '[%c"\\]', function( c ) return string.format( "\\u%04x", string.byte( c ) ) end ) .. '"'
+    elseif t == "boolean" then
+        return tostring( value )
+    end
+    return "null"
+end
+
+-- Writes 'record' as one line of JSON; 'keys' gives the order of the fields.
+local function _emit( record, keys )
+    local fields = {}
+    for _, key in ipairs( keys ) do
+        fields[ #fields + 1 ] = '"' .. key .. '":' .. _encode( record[ key ] )
+    end
+    io.write( "{", table.concat( fields, "," ), "}\n" )
+    io.flush()
+end
+
+function bench.configure( config )
+    for key, value in pairs( config ) do
+        _config[ key ] = value
+    end
+end
+
+function bench.is_native()
+    return native ~= nil
+end
+
+function bench.native()
+    return native
+end
+
+-- Writes the configuration record that precedes the results.
+function bench.header( fields )
+    local record = { type = "config", lua = _VERSION, driver = native and "native" or "lua", time = os.time() }
+    local keys   = { "type", "lua", "driver", "time" }
+    for key, value in pairs( fields ) do
+        record[ key ] = value
+        keys[ #keys + 1 ] = key
+    end
+    table.sort( keys, function( a, b ) return a == "type" or ( b ~= "type" and a < b ) end )
+    _emit( record, keys )
+end
+
+-- Runs 'f( n )', which performs 'n' iterations and returns the number of operations it did, or 'n'
+-- when it returns nothing. The iteration count doubles until a run takes at least 'min_time' seconds.
+-- The allocations and Lua heap growth are measured in a separate run of at most 1000 iterations with
+-- the garbage collector stopped.
+function bench.measure( suite, name, f )
+    if _config.filter and not string.find( suite .. "." .. name, _config.filter ) then
+        return
+    end
+
+    f( 1 )
+
+    local n       = 1
+    local ops     = 0
+    local elapsed = 0
+    while true do
+        collectgarbage( "collect" )
+        local start = clock()
+        ops     = f( n ) or n
+        elapsed = clock() - start
+        if elapsed >= _config.min_time or n >= 1 << 40 then
+            break
+        end
+        n = elapsed > 0 and math.max( n * 2, math.ceil( n * _config.min_time / elapsed * 1.2 ) ) or n * 16
+        n = math.tointeger( n ) or math.floor( n )
+    end
+
+    local alloc_n = math.min( n, 1000 )
+    collectgarbage( "collect" )
+    collectgarbage( "stop" )
+    local allocs_before = allocations and allocations()
+    local kb_before     = collectgarbage( "count" )
+    local alloc_ops     = f( alloc_n ) or alloc_n
+    local kb_after      = collectgarbage( "count" )
+    local allocs_after  = allocations and allocations()
+    collectgarbage( "restart" )
+
+    local result =
+    {
+        type          = "result",
+        suite         = suite,
+        name          = name,
+        ops           = ops,
+        seconds       = elapsed,
+        ops_per_sec   = ops / elapsed,
+        ns_per_op     = elapsed * 1e9 / ops,
+        allocs_per_op = allocations and ( allocs_after - allocs_before ) / alloc_ops,
+        bytes_per_op  = ( kb_after - kb_before ) * 1024 / alloc_ops
+    }
+    _results[ #_results + 1 ] = result
+    _emit( result, { "type", "suite", "name", "ops", "seconds", "ops_per_sec", "ns_per_op", "allocs_per_op", "bytes_per_op" } )
+
+    return result
+end
+
+-- Prints a table of the results to stderr, so stdout only has the JSON records.
+function bench.summary()
+    io.stderr:write( string.format( "%-40s %14s %12s %10s\n", "benchmark", "ops/sec", "ns/op", "allocs/op" ) )
+    for _, r in ipairs( _results ) do
+        io.stderr:write( string.format( "%-40s %14.0f %12.1f %10s\n", r.suite .. "." .. r.name, r.ops_per_sec, r.ns_per_op,
+                                        r.allocs_per_op and string.format( "%.2f", r.allocs_per_op ) or "-" ) )
+    end
+end
+
+return bench
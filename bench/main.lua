@@ -0,0 +1,181 @@
+-- Usage: lua bench/main.lua [key=value ...]
+--
+-- depth      Levels of directories below the root of the generated tree, default 2
+-- fanout     Directories in every directory above the last level, default 4
+-- files      Regular files in every directory, at least 1, default 64
+-- file_size  Bytes in every file, default 4096
+-- min_time   Minimum seconds per measurement, default 0.2
+-- filter     Lua pattern matched against "suite.name" to select benchmarks
+-- root       Directory in which the tree is generated, default the temporary directory
+
+local short_src  = debug.getinfo( 1 ).short_src
+local bench_path = string.gsub( short_src, "main.lua$", "?.lua" )
+
+package.path     = package.path .. ";./".. bench_path
+
+local build_path = string.gsub( short_src, "bench/main.lua$", "build/?.so" )
+package.cpath    = package.cpath .. ";./".. build_path
+
+local bench = require( "bench" )
+local fs    = require( "filesystem" )
+
+local config =
+{
+    depth     = 2,
+    fanout    = 4,
+    files     = 64,
+    file_size = 4096,
+    min_time  = 0.2
+}
+
+for i = 1, #arg do
+    local key, value = string.match( arg[ i ], "^([%w_]+)=(.*)$" )
+    if not key or ( config[ key ] == nil and key ~= "filter" and key ~= "root" ) then
+        io.stderr:write( "Invalid argument '" .. arg[ i ] .. "'.\n" )
+        os.exit( 1 )
+    end
+    config[ key ] = tonumber( value ) or value
+end
+
+-- The entry and file benchmarks use the files of a directory on the last level
+if math.type( config.files ) ~= "integer" or config.files < 1 then
+    io.stderr:write( "files must be an integer of at least 1.\n" )
+    os.exit( 1 )
+end
+
+bench.configure( { min_time = config.min_time, filter = config.filter } )
+
+-- Generates a tree of 'depth' levels of 'fanout' directories with 'files' files of 'file_size' bytes
+-- in every directory. Returns the number of entries and the path of a directory on the last level.
+local function _generate_tree( root )
+    local data    = string.rep( "x", config.file_size )
+    local entries = 0
+    local leaf
+
+    local function generate( dir, level )
+        fs.create_directories( dir )
+        for i = 1, config.files do
+            fs.write_file( dir .. "/file" .. i .. ".txt", data )
+        end
+        entries = entries + config.files
+        leaf    = leaf or ( level == config.depth and dir )
+        if level < config.depth then
+            for i = 1, config.fanout do
+                generate( dir .. "/dir" .. i, level + 1 )
+                entries = entries + 1
+            end
+        end
+    end
+
+    generate( root, 0 )
+    return entries, leaf or root
+end
+
+local root = tostring( config.root or fs.temp_directory_path() ) .. "/filesystem_bench"
+fs.remove_all( root )
+
+local tree             = root .. "/tree"
+local entries, leaf    = _generate_tree( tree )
+local file             = leaf .. "/file1.txt"
+local copy_target      = root .. "/copy.txt"
+local leaf_entries     = {}
+for e in fs.directory( leaf ) do
+    leaf_entries[ #leaf_entries + 1 ] = e
+end
+
+bench.header( { depth = config.depth, fanout = config.fanout, files = config.files, file_size = config.file_size, entries = entries } )
+
+-- path
+
+bench.measure( "path", "construct", function( n )
+    for _ = 1, n do
+        fs.path( "bench/tree/dir1/file1.txt" )
+    end
+end )
+
+local p = fs.path( "bench/tree/dir1/file1.txt" )
+
+bench.measure( "path", "filename", function( n )
+    for _ = 1, n do
+        p:filename()
+    end
+end )
+
+bench.measure( "path", "tostring", function( n )
+    for _ = 1, n do
+        tostring( p )
+    end
+end )
+
+-- directory_iterator; an operation is one directory element
+
+bench.measure( "directory_iterator", "directory", function( n )
+    local ops = 0
+    for _ = 1, n do
+        for _ in fs.directory( leaf ) do
+            ops = ops + 1
+        end
+    end
+    return ops
+end )
+
+bench.measure( "directory_iterator", "recursive_directory", function( n )
+    local ops = 0
+    for _ = 1, n do
+        for _ in fs.recursive_directory( tree ) do
+            ops = ops + 1
+        end
+    end
+    return ops
+end )
+
+-- directory_entry
+
+local entry_count = #leaf_entries
+
+for _, method in ipairs( { "path", "is_regular_file", "file_size", "last_write_time" } ) do
+    bench.measure( "directory_entry", method, function( n )
+        for i = 1, n do
+            local e = leaf_entries[ i % entry_count + 1 ]
+            e[ method ]( e )
+        end
+    end )
+end
+
+-- non_member_functions
+
+bench.measure( "non_member_functions", "status", function( n )
+    for _ = 1, n do
+        fs.status( file )
+    end
+end )
+
+bench.measure( "non_member_functions", "file_size", function( n )
+    for _ = 1, n do
+        fs.file_size( file )
+    end
+end )
+
+bench.measure( "non_member_functions", "copy_file", function( n )
+    for _ = 1, n do
+        fs.copy_file( file, copy_target, fs.copy_options.overwrite_existing )
+    end
+end )
+
+-- The same operations done by the native driver with std::filesystem directly, which shows the
+-- overhead of the binding.
+
+local native = bench.native()
+if native then
+    bench.measure( "native", "path_construct", function( n ) return native.path_construct( n, "bench/tree/dir1/file1.txt" ) end )
+    bench.measure( "native", "directory", function( n ) return native.directory( n, leaf ) end )
+    bench.measure( "native", "recursive_directory", function( n ) return native.recursive_directory( n, tree ) end )
+    bench.measure( "native", "entry_is_regular_file", function( n ) return native.entry_is_regular_file( n, leaf ) end )
+    bench.measure( "native", "entry_file_size", function( n ) return native.entry_file_size( n, leaf ) end )
+    bench.measure( "native", "status", function( n ) return native.status( n, file ) end )
+    bench.measure( "native", "copy_file", function( n ) return native.copy_file( n, file, copy_target ) end )
+end
+
+fs.remove_all( root )
+
+bench.summary()
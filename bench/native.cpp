@@ -0,0 +1,339 @@
+// See LICENSE for the Copyright Notice
+
+// Native driver of the benchmark suite. It runs the Lua suite with the filesystem module linked in and
+// provides the global table 'bench_native' with a monotonic clock, a counter of the allocations by Lua
+// and by C++ code, and the operations of the suite done with std::filesystem directly.
+//
+// Usage: bench [script] [key=value ...], the script defaults to bench/main.lua.
+
+#include <lua.hpp>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+#include <new>
+#include <stdexcept>
+
+extern "C" int luaopen_filesystem( lua_State * L ) noexcept;
+
+static std::atomic< std::uint64_t > allocation_count{ 0 };
+
+void * operator new( std::size_t size )
+{
+    allocation_count.fetch_add( 1, std::memory_order_relaxed );
+    if( void * p = std::malloc( size ? size : 1 ) )
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void * operator new[]( std::size_t size )
+{
+    return ::operator new( size );
+}
+
+void * operator new( std::size_t size, const std::nothrow_t & ) noexcept
+{
+    allocation_count.fetch_add( 1, std::memory_order_relaxed );
+    return std::malloc( size ? size : 1 );
+}
+
+void * operator new[]( std::size_t size, const std::nothrow_t & tag ) noexcept
+{
+    return ::operator new( size, tag );
+}
+
+void operator delete( void * p ) noexcept
+{
+    std::free( p );
+}
+
+void operator delete[]( void * p ) noexcept
+{
+    std::free( p );
+}
+
+void operator delete( void * p, std::size_t ) noexcept
+{
+    std::free( p );
+}
+
+void operator delete[]( void * p, std::size_t ) noexcept
+{
+    std::free( p );
+}
+
+// Allocator of the Lua state; new blocks and blocks that grow count as allocation.
+static void * counting_alloc( void *, void * ptr, std::size_t osize, std::size_t nsize ) noexcept
+{
+    if( nsize == 0 )
+    {
+        std::free( ptr );
+        return nullptr;
+    }
+    if( ptr == nullptr || nsize > osize )
+    {
+        allocation_count.fetch_add( 1, std::memory_order_relaxed );
+    }
+    return std::realloc( ptr, nsize );
+}
+
+// Keeps the results of the benchmarked operations alive so the compiler can't remove them.
+static volatile std::uintmax_t sink = 0;
+
+// Runs 'f' and turns a C++ exception into a Lua error after the stack of 'f' is unwound.
+template< typename F >
+static int guarded( lua_State * const L, F f )
+{
+    std::string message;
+    try
+    {
+        lua_pushinteger( L, static_cast< lua_Integer >( f() ) );
+        return 1;
+    }
+    catch( const std::exception & e )
+    {
+        message = e.what();
+    }
+    return luaL_error( L, "%s", message.c_str() );
+}
+
+static std::size_t check_count( lua_State * const L )
+{
+    const auto n = luaL_checkinteger( L, 1 );
+    luaL_argcheck( L, n >= 0, 1, "count must not be negative" );
+    return static_cast< std::size_t >( n );
+}
+
+static std::filesystem::path check_path( lua_State * const L, int arg )
+{
+    std::size_t  size = 0;
+    const char * s    = luaL_checklstring( L, arg, &size );
+    return std::filesystem::path( std::string( s, size ) );
+}
+
+// The entries of a directory, read once so that only the calls on the entries are measured.
+// The directory must not be empty, the benchmarks cycle through its entries.
+static const std::vector< std::filesystem::directory_entry > & cached_entries( const std::filesystem::path & dir )
+{
+    static std::map< std::filesystem::path, std::vector< std::filesystem::directory_entry > > cache;
+
+    auto & entries = cache[ dir ];
+    if( entries.empty() )
+    {
+        for( const auto & e : std::filesystem::directory_iterator( dir ) )
+        {
+            entries.push_back( e );
+        }
+    }
+    if( entries.empty() )
+    {
+        throw std::runtime_error( dir.string() + ": the directory is empty" );
+    }
+    return entries;
+}
+
+static int native_clock( lua_State * const L )
+{
+    const auto now = std::chrono::steady_clock::now().time_since_epoch();
+    lua_pushnumber( L, std::chrono::duration< double >( now ).count() );
+    return 1;
+}
+
+static int native_allocations( lua_State * const L )
+{
+    lua_pushinteger( L, static_cast< lua_Integer >( allocation_count.load( std::memory_order_relaxed ) ) );
+    return 1;
+}
+
+static int native_path_construct( lua_State * const L )
+{
+    const auto   n    = check_count( L );
+    std::size_t  size = 0;
+    const char * s    = luaL_checklstring( L, 2, &size );
+    return guarded( L, [ & ]
+    {
+        for( std::size_t i = 0 ; i < n ; ++i )
+        {
+            const std::filesystem::path p( s, s + size );
+            sink = sink + p.native().size();
+        }
+        return n;
+    } );
+}
+
+static int native_directory( lua_State * const L )
+{
+    const auto n   = check_count( L );
+    const auto dir = check_path( L, 2 );
+    return guarded( L, [ & ]
+    {
+        std::size_t ops = 0;
+        for( std::size_t i = 0 ; i < n ; ++i )
+        {
+            for( const auto & e : std::filesystem::directory_iterator( dir ) )
+            {
+                sink = sink + e.path().native().size();
+                ++ops;
+            }
+        }
+        return ops;
+    } );
+}
+
+static int native_recursive_directory( lua_State * const L )
+{
+    const auto n   = check_count( L );
+    const auto dir = check_path( L, 2 );
+    return guarded( L, [ & ]
+    {
+        std::size_t ops = 0;
+        for( std::size_t i = 0 ; i < n ; ++i )
+        {
+            for( const auto & e : std::filesystem::recursive_directory_iterator( dir ) )
+            {
+                sink = sink + e.path().native().size();
+                ++ops;
+            }
+        }
+        return ops;
+    } );
+}
+
+static int native_entry_is_regular_file( lua_State * const L )
+{
+    const auto n   = check_count( L );
+    const auto dir = check_path( L, 2 );
+    return guarded( L, [ & ]
+    {
+        const auto & entries = cached_entries( dir );
+        for( std::size_t i = 0 ; i < n ; ++i )
+        {
+            sink = sink + entries[ i % entries.size() ].is_regular_file();
+        }
+        return n;
+    } );
+}
+
+static int native_entry_file_size( lua_State * const L )
+{
+    const auto n   = check_count( L );
+    const auto dir = check_path( L, 2 );
+    return guarded( L, [ & ]
+    {
+        const auto & entries = cached_entries( dir );
+        for( std::size_t i = 0 ; i < n ; ++i )
+        {
+            const auto & e = entries[ i % entries.size() ];
+            sink = sink + ( e.is_regular_file() ? e.file_size() : 0 );
+        }
+        return n;
+    } );
+}
+
+static int native_status( lua_State * const L )
+{
+    const auto n = check_count( L );
+    const auto p = check_path( L, 2 );
+    return guarded( L, [ & ]
+    {
+        for( std::size_t i = 0 ; i < n ; ++i )
+        {
+            sink = sink + static_cast< std::uintmax_t >( std::filesystem::status( p ).permissions() );
+        }
+        return n;
+    } );
+}
+
+static int native_copy_file( lua_State * const L )
+{
+    const auto n    = check_count( L );
+    const auto from = check_path( L, 2 );
+    const auto to   = check_path( L, 3 );
+    return guarded( L, [ & ]
+    {
+        for( std::size_t i = 0 ; i < n ; ++i )
+        {
+            sink = sink + std::filesystem::copy_file( from, to, std::filesystem::copy_options::overwrite_existing );
+        }
+        return n;
+    } );
+}
+
+static constexpr const luaL_Reg native_functions[] =
+{
+    { "clock",                 native_clock },
+    { "allocations",           native_allocations },
+    { "path_construct",        native_path_construct },
+    { "directory",             native_directory },
+    { "recursive_directory",   native_recursive_directory },
+    { "entry_is_regular_file", native_entry_is_regular_file },
+    { "entry_file_size",       native_entry_file_size },
+    { "status",                native_status },
+    { "copy_file",             native_copy_file },
+    { NULL,                    NULL }
+};
+
+static int traceback( lua_State * const L )
+{
+    luaL_traceback( L, L, lua_tostring( L, 1 ), 1 );
+    return 1;
+}
+
+int main( int argc, char * argv[] )
+{
+    const char * script = "bench/main.lua";
+    int          first  = 1;
+    if( argc > 1 && std::string( argv[ 1 ] ).find( '=' ) == std::string::npos )
+    {
+        script = argv[ 1 ];
+        first  = 2;
+    }
+
+    lua_State * const L = lua_newstate( counting_alloc, nullptr );
+    if( L == nullptr )
+    {
+        std::fputs( "cannot create Lua state\n", stderr );
+        return EXIT_FAILURE;
+    }
+    luaL_openlibs( L );
+
+    lua_getglobal( L, "package" );
+    lua_getfield( L, -1, "preload" );
+    lua_pushcfunction( L, luaopen_filesystem );
+    lua_setfield( L, -2, "filesystem" );
+    lua_pop( L, 2 );
+
+    luaL_newlib( L, native_functions );
+    lua_setglobal( L, "bench_native" );
+
+    lua_createtable( L, argc - first, 1 );
+    lua_pushstring( L, script );
+    lua_rawseti( L, -2, 0 );
+    for( int i = first ; i < argc ; ++i )
+    {
+        lua_pushstring( L, argv[ i ] );
+        lua_rawseti( L, -2, i - first + 1 );
+    }
+    lua_setglobal( L, "arg" );
+
+    lua_pushcfunction( L, traceback );
+    int result = luaL_loadfile( L, script );
+    if( result == LUA_OK )
+    {
+        result = lua_pcall( L, 0, 0, -2 );
+    }
+    if( result != LUA_OK )
+    {
+        std::fprintf( stderr, "%s\n", lua_tostring( L, -1 ) );
+    }
+
+    lua_close( L );
+    return result == LUA_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
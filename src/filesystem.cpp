@@ -3,7 +3,64 @@
 #include <lua.hpp>
 #include <filesystem>
 #include <string_view>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <algorithm>
+#include <utility>
+#include <optional>
+#include <chrono>
+#include <string>
+#include <cstring>
+#include <array>
+#include <iterator>
+#include <unordered_map>
+#include <unordered_set>
+#include <set>
 #include <cassert>
+#include <cstdint>
+#include <tuple>
+#include <limits>
+#include <fstream>
+
+#if defined( __linux__ )
+# include <dirent.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/stat.h>
+# include <poll.h>
+# include <sys/eventfd.h>
+# include <sys/inotify.h>
+# include <sys/ioctl.h>
+# include <sys/mman.h>
+# include <sys/sendfile.h>
+# include <sys/syscall.h>
+# include <sys/sysmacros.h>
+# include <linux/fs.h>
+#endif
+
+// io_uring is used through its system calls, so only the kernel header is needed; the metadata
+// operations were added in Linux 5.15, IORING_FEAT_CQE_SKIP marks a header of 5.17 or later.
+#if defined( __linux__ ) && defined( __has_include )
+# if __has_include( <linux/io_uring.h> )
+#  include <linux/io_uring.h>
+#  if defined( IORING_FEAT_CQE_SKIP )
+#   define PG_IO_URING
+#  endif
+# endif
+#endif
+
+#if ( defined( __x86_64__ ) || defined( __i386__ ) ) && defined( __GNUC__ )
+# define PG_SHA_NI
+# include <cpuid.h>
+# include <immintrin.h>
+#endif
 
 #if defined( _WIN32 )
 # define EXPORT __declspec( dllexport )
@@ -91,12 +148,49 @@ const auto& type_error = luaL_typeerror;
 
 using path_iterator                = std::pair< std::filesystem::path::iterator, const std::filesystem::path::iterator >;
 using directory_iterator           = std::pair< std::filesystem::directory_iterator, const std::filesystem::directory_iterator >;
-using recursive_directory_iterator = std::pair< std::filesystem::recursive_directory_iterator, const std::filesystem::recursive_directory_iterator >;
+
+struct recursive_directory_iterator;
+
+class parallel_walk_state;
+
+class file_watcher;
+
+class stat_cache;
+
+class mapped_file;
+
+class atomic_batch;
+
+class operation_batch;
+
+struct async_handle;
+
+struct async_pool;
+
+class snapshot_diff;
+
+struct directory_batch_iterator;
+
+struct glob_iterator;
+
+struct lines_iterator;
 
 static constexpr const char path_meta_traits[]                         = "path.filesystem";
 static constexpr const char path_iterator_meta_traits[]                = "path_iterator_state.filesystem";
 static constexpr const char directory_iterator_meta_traits[]           = "directory_iterator_state.filesystem";
 static constexpr const char recursive_directory_iterator_meta_traits[] = "recursive_directory_iterator_state.filesystem";
+static constexpr const char parallel_walk_state_meta_traits[]          = "parallel_walk_state.filesystem";
+static constexpr const char directory_batch_iterator_meta_traits[]     = "directory_batch_iterator_state.filesystem";
+static constexpr const char glob_iterator_meta_traits[]                = "glob_iterator_state.filesystem";
+static constexpr const char lines_iterator_meta_traits[]               = "lines_iterator_state.filesystem";
+static constexpr const char file_watcher_meta_traits[]                 = "watcher.filesystem";
+static constexpr const char stat_cache_meta_traits[]                   = "stat_cache.filesystem";
+static constexpr const char mapped_file_meta_traits[]                  = "mapped_file.filesystem";
+static constexpr const char atomic_batch_meta_traits[]                 = "atomic_batch.filesystem";
+static constexpr const char operation_batch_meta_traits[]              = "batch.filesystem";
+static constexpr const char async_handle_meta_traits[]                 = "async_handle.filesystem";
+static constexpr const char async_pool_meta_traits[]                   = "async_pool.filesystem";
+static constexpr const char snapshot_diff_meta_traits[]                = "snapshot_diff_state.filesystem";
 static constexpr const char directory_entry_meta_traits[]              = "directory_entry.path.filesystem";
 static constexpr const char directory_options_meta_traits[]            = "directory_options.path.filesystem";
 static constexpr const char copy_options_meta_traits[]                 = "copy_options.filesystem";
@@ -137,6 +231,90 @@ struct meta_traits< recursive_directory_iterator >
     static constexpr const char name[] = "recursive_directory_iterator_state";
 };
 
+template<>
+struct meta_traits< directory_batch_iterator >
+{
+    static constexpr auto       id     = directory_batch_iterator_meta_traits;
+    static constexpr const char name[] = "directory_batch_iterator_state";
+};
+
+template<>
+struct meta_traits< glob_iterator >
+{
+    static constexpr auto       id     = glob_iterator_meta_traits;
+    static constexpr const char name[] = "glob_iterator_state";
+};
+
+template<>
+struct meta_traits< lines_iterator >
+{
+    static constexpr auto       id     = lines_iterator_meta_traits;
+    static constexpr const char name[] = "lines_iterator_state";
+};
+
+template<>
+struct meta_traits< parallel_walk_state >
+{
+    static constexpr auto       id     = parallel_walk_state_meta_traits;
+    static constexpr const char name[] = "parallel_walk_state";
+};
+
+template<>
+struct meta_traits< file_watcher >
+{
+    static constexpr auto       id     = file_watcher_meta_traits;
+    static constexpr const char name[] = "watcher";
+};
+
+template<>
+struct meta_traits< stat_cache >
+{
+    static constexpr auto       id     = stat_cache_meta_traits;
+    static constexpr const char name[] = "stat_cache";
+};
+
+template<>
+struct meta_traits< mapped_file >
+{
+    static constexpr auto       id     = mapped_file_meta_traits;
+    static constexpr const char name[] = "mapped_file";
+};
+
+template<>
+struct meta_traits< atomic_batch >
+{
+    static constexpr auto       id     = atomic_batch_meta_traits;
+    static constexpr const char name[] = "atomic_batch";
+};
+
+template<>
+struct meta_traits< operation_batch >
+{
+    static constexpr auto       id     = operation_batch_meta_traits;
+    static constexpr const char name[] = "batch";
+};
+
+template<>
+struct meta_traits< async_handle >
+{
+    static constexpr auto       id     = async_handle_meta_traits;
+    static constexpr const char name[] = "async_handle";
+};
+
+template<>
+struct meta_traits< async_pool >
+{
+    static constexpr auto       id     = async_pool_meta_traits;
+    static constexpr const char name[] = "async_pool";
+};
+
+template<>
+struct meta_traits< snapshot_diff >
+{
+    static constexpr auto       id     = snapshot_diff_meta_traits;
+    static constexpr const char name[] = "snapshot_diff_state";
+};
+
 template<>
 struct meta_traits< std::filesystem::directory_entry >
 {
@@ -286,13 +464,215 @@ int return_number( lua_State * const L, lua_Number n ) noexcept
     return 1;
 }
 
+// Key in the registry of the table with the interned objects of enum type 'E'.
+template< typename E >
+struct interned_enum
+{
+    static inline const char key = 0;
+};
+
+// Pushes the interned object for 'value' of enum type 'E'. Enum objects are immutable so every
+// function that returns an enum value shares one object per value instead of creating a new one.
+template< typename E >
+void push_enum( lua_State * const L, const E value )
+{
+    lua_checkstack( L, 4 );
+
+    if( lua_rawgetp( L, LUA_REGISTRYINDEX, &interned_enum< E >::key ) != LUA_TTABLE )
+    {
+        lua_pop( L, 1 );
+        lua_newtable( L );
+        lua_pushvalue( L, -1 );
+        lua_rawsetp( L, LUA_REGISTRYINDEX, &interned_enum< E >::key );
+    }
+
+    const auto key = static_cast< lua_Integer >( value );
+    if( lua_rawgeti( L, -1, key ) == LUA_TNIL )
+    {
+        lua_pop( L, 1 );
+        pg::new_user_data< E >( L, value );
+        lua_pushvalue( L, -1 );
+        lua_rawseti( L, -3, key );
+    }
+    lua_remove( L, -2 );
+}
+
+template< typename E >
+int return_enum( lua_State * const L, const E value )
+{
+    pg::push_enum( L, value );
+
+    return 1;
+}
+
+// Pushes 'value' as interned enum object or as plain integer.
+template< typename E >
+void push_enum( lua_State * const L, const E value, bool as_integer )
+{
+    if( as_integer )
+    {
+        lua_pushinteger( L, static_cast< lua_Integer >( value ) );
+    }
+    else
+    {
+        pg::push_enum( L, value );
+    }
+}
+
 template< typename T >
 void set_table_field( lua_State * const L, const char * const key, const T value ) noexcept
 {
-    pg::new_user_data< T >( L, value );
+    pg::push_enum< T >( L, value );
     lua_setfield( L, -2, key );
 }
 
+template< typename T >
+void set_integer_field( lua_State * const L, const char * const key, const T value ) noexcept
+{
+    lua_pushinteger( L, static_cast< lua_Integer >( value ) );
+    lua_setfield( L, -2, key );
+}
+
+// Pushes the interned enum object for 'value' and keeps it in the table at index 'cache',
+// so bulk operations look it up in a small local table instead of the registry.
+template< typename E >
+void push_cached_enum( lua_State * const L, int cache, const E value )
+{
+    const auto key = static_cast< lua_Integer >( value );
+    if( lua_rawgeti( L, cache, key ) == LUA_TNIL )
+    {
+        lua_pop( L, 1 );
+        pg::push_enum( L, value );
+        lua_pushvalue( L, -1 );
+        lua_rawseti( L, cache, key );
+    }
+}
+
+// Returns the permissions and the type of 'file_status' as enum objects or as integers.
+int return_file_status( lua_State * const L, const std::filesystem::file_status & file_status, bool as_integer )
+{
+    lua_settop( L, 0 );
+    pg::push_enum( L, file_status.permissions(), as_integer );
+    pg::push_enum( L, file_status.type(), as_integer );
+
+    return 2;
+}
+
+// Returns nil, a message and the error code like the functions of the io library do.
+int return_error_code( lua_State * const L, const std::error_code & ec, const std::filesystem::path & p )
+{
+    const auto & path    = p.string();
+    const auto   message = ec.message();
+
+    lua_settop( L, 0 );
+    lua_pushnil( L );
+    lua_pushfstring( L, "%s: %s", path.c_str(), message.c_str() );
+    lua_pushinteger( L, ec.value() );
+
+    return 3;
+}
+
+std::filesystem::path check_path_arg( lua_State * const L, int arg )
+{
+    if( lua_type( L, arg ) == LUA_TSTRING )
+    {
+        return std::filesystem::path( pg::to_string_view( L, arg ) );
+    }
+
+    return pg::check_user_data_arg< std::filesystem::path >( L, arg, "path or string" );
+}
+
+// Raises the error of check_path_arg without constructing the path. Functions that take several arguments check
+// them all before the first C++ object is created, because a Lua error doesn't run destructors.
+void check_path_type( lua_State * const L, int arg )
+{
+    if( lua_type( L, arg ) != LUA_TSTRING )
+    {
+        pg::check_user_data_arg< std::filesystem::path >( L, arg, "path or string" );
+    }
+}
+
+// Helpers for reading the fields of an optional options table at 'index'.
+// A missing table or field results in the default value.
+
+lua_Integer opt_integer_field( lua_State * const L, int index, const char * const key, lua_Integer def )
+{
+    if( lua_type( L, index ) != LUA_TTABLE )
+    {
+        return def;
+    }
+
+    lua_getfield( L, index, key );
+    int        is_integer = 0;
+    const auto value      = lua_tointegerx( L, -1, &is_integer );
+    const bool is_nil     = lua_isnil( L, -1 );
+    lua_pop( L, 1 );
+
+    if( is_nil )
+    {
+        return def;
+    }
+    if( !is_integer ) PG_UNLIKELY
+    {
+        luaL_error( L, "option '%s' must be an integer", key );
+    }
+
+    return value;
+}
+
+bool opt_boolean_field( lua_State * const L, int index, const char * const key, bool def )
+{
+    if( lua_type( L, index ) != LUA_TTABLE )
+    {
+        return def;
+    }
+
+    lua_getfield( L, index, key );
+    const bool value = lua_isnil( L, -1 ) ? def : lua_toboolean( L, -1 );
+    lua_pop( L, 1 );
+
+    return value;
+}
+
+template< typename T >
+T opt_user_data_field( lua_State * const L, int index, const char * const key, T def )
+{
+    if( lua_type( L, index ) != LUA_TTABLE )
+    {
+        return def;
+    }
+
+    lua_getfield( L, index, key );
+    if( lua_isnil( L, -1 ) )
+    {
+        lua_pop( L, 1 );
+        return def;
+    }
+
+    const auto value = pg::test_user_data< T >( L, -1 );
+    if( !value ) PG_UNLIKELY
+    {
+        luaL_error( L, "option '%s' must be a %s", key, meta_traits< T >::name );
+    }
+
+    const T result = *value;
+    lua_pop( L, 1 );
+
+    return result;
+}
+
+std::size_t opt_thread_count( lua_State * const L, int index )
+{
+    const auto hardware_threads = std::max( std::thread::hardware_concurrency(), 1u );
+    const auto threads          = pg::opt_integer_field( L, index, "threads", hardware_threads );
+    if( threads < 1 ) PG_UNLIKELY
+    {
+        luaL_error( L, "thread count must be at least 1" );
+    }
+
+    return static_cast< std::size_t >( threads );
+}
+
 template< typename E >
 struct enum_flags
 {
@@ -307,27 +687,27 @@ struct enum_flags
         const auto & left  = pg::check_user_data_arg< E >( L, 1 );
         const auto & right = pg::check_user_data_arg< E >( L, 2 );
 
-        return pg::return_new_user_data< E >( L, left & right );
+        return pg::return_enum< E >( L, left & right );
     END_FUNCTION
 
     BEGIN_FUNCTION( bor )
         const auto & left  = pg::check_user_data_arg< E >( L, 1 );
         const auto & right = pg::check_user_data_arg< E >( L, 2 );
 
-        return pg::return_new_user_data< E >( L, left | right );
+        return pg::return_enum< E >( L, left | right );
     END_FUNCTION
 
     BEGIN_FUNCTION( bxor )
         const auto & left  = pg::check_user_data_arg< E >( L, 1 );
         const auto & right = pg::check_user_data_arg< E >( L, 2 );
 
-        return pg::return_new_user_data< E >( L, left ^ right );
+        return pg::return_enum< E >( L, left ^ right );
     END_FUNCTION
 
     BEGIN_FUNCTION( bnot )
         const auto & self  = pg::check_user_data_arg< E >( L, 1 );
 
-        return pg::return_new_user_data< E >( L, ~self );
+        return pg::return_enum< E >( L, ~self );
     END_FUNCTION
 
     static constexpr const luaL_Reg operators[ 6 ] =
@@ -362,1079 +742,8391 @@ struct enumeration
     static constexpr const luaL_Reg * methods = nullptr;
 };
 
+// Returns the type of the entry itself (symlinks are not followed).
+// Unlike directory_entry::symlink_status, the type predicates use the type that the directory
+// iterator cached while reading the directory and only query the filesystem when it's unknown.
+inline std::filesystem::file_type cached_symlink_type( const std::filesystem::directory_entry & entry, std::error_code & ec )
+{
+    using std::filesystem::file_type;
+
+    if( entry.is_symlink( ec ) )         return file_type::symlink;
+    if( ec )                             return file_type::none;
+    if( entry.is_regular_file( ec ) )    return file_type::regular;
+    if( entry.is_directory( ec ) )       return file_type::directory;
+    if( entry.is_block_file( ec ) )      return file_type::block;
+    if( entry.is_character_file( ec ) )  return file_type::character;
+    if( entry.is_fifo( ec ) )            return file_type::fifo;
+    if( entry.is_socket( ec ) )          return file_type::socket;
+
+    return entry.symlink_status( ec ).type();
 }
 
-BEGIN_FUNCTION( path_to_string )
-    const auto & path = pg::check_user_data_arg< std::filesystem::path >( L, 1 );
-    const auto & str  = path.string();
+// Converts a POSIX time to a file_time.
+// The epoch of the file_time clock is implementation defined but it differs a whole number of
+// seconds from the epoch of the system clock for all known implementations.
+inline std::filesystem::file_time_type file_time_from_posix( std::int64_t seconds, std::int64_t nanoseconds )
+{
+    using std::filesystem::file_time_type;
 
-    lua_settop( L, 0 );
-    lua_pushlstring( L, str.c_str(), str.size() );
+    static const auto epoch_offset = []
+    {
+        const auto file_now   = std::chrono::duration_cast< std::chrono::nanoseconds >( file_time_type::clock::now().time_since_epoch() );
+        const auto system_now = std::chrono::duration_cast< std::chrono::nanoseconds >( std::chrono::system_clock::now().time_since_epoch() );
 
-    return 1;
-END_FUNCTION
+        return std::chrono::round< std::chrono::seconds >( file_now - system_now );
+    }();
 
-BEGIN_FUNCTION( path_gc )
-    auto & self = pg::to_user_data< std::filesystem::path >( L, 1 );
+    const auto since_epoch = epoch_offset + std::chrono::seconds( seconds ) + std::chrono::nanoseconds( nanoseconds );
 
-    self.~path();
+    return file_time_type( std::chrono::duration_cast< file_time_type::duration >( since_epoch ) );
+}
 
-    return 0;
-END_FUNCTION
+#if defined( __linux__ )
 
-#define PATH_COMPARE( NAME, OP )\
-BEGIN_PROTECTED_FUNCTION( path_##NAME )\
-    if( lua_type( L, 1 ) == LUA_TSTRING )\
-    {\
-        auto p1 = pg::to_string_view( L, 1 );\
-        if( lua_type( L, 2 ) == LUA_TSTRING )\
-        {\
-            return pg::return_boolean( L, std::filesystem::path( p1 ) OP  pg::to_string_view( L, 2 ) );\
-        }\
-        else\
-        {\
-            const auto & p2 = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );\
-            return pg::return_boolean( L, p1 OP p2 );\
-        }\
-    }\
-    else\
-    {\
-        const auto & p1 = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );\
-        if( lua_type( L, 2 ) == LUA_TSTRING )\
-        {\
-            return pg::return_boolean( L, p1 OP pg::to_string_view( L, 2 ) );\
-        }\
-        else\
-        {\
-            const auto & p2 = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );\
-            return pg::return_boolean( L, p1 OP p2 );\
-        }\
-    }\
-CATCH_BAD_ALLOC \
-END_PROTECTED_FUNCTION
+inline std::filesystem::file_type file_type_from_mode( mode_t mode ) noexcept
+{
+    using std::filesystem::file_type;
 
-PATH_COMPARE( eq, == )
-PATH_COMPARE( lt, < )
-PATH_COMPARE( le, <= )
+    switch( mode & S_IFMT )
+    {
+    case S_IFREG:  return file_type::regular;
+    case S_IFDIR:  return file_type::directory;
+    case S_IFLNK:  return file_type::symlink;
+    case S_IFBLK:  return file_type::block;
+    case S_IFCHR:  return file_type::character;
+    case S_IFIFO:  return file_type::fifo;
+    case S_IFSOCK: return file_type::socket;
+    default:       return file_type::unknown;
+    }
+}
 
-BEGIN_PROTECTED_FUNCTION( path_concat )
-    auto & self = pg::check_user_data_arg< std::filesystem::path >( L, 1 );
+// Closes a file descriptor when it goes out of scope.
+class unique_fd
+{
+public:
+    unique_fd() noexcept = default;
 
-    if( lua_type( L, 2 ) == LUA_TSTRING )
+    explicit unique_fd( int fd ) noexcept
+        : fd( fd )
+    {}
+
+    unique_fd( unique_fd && other ) noexcept
+        : fd( std::exchange( other.fd, -1 ) )
+    {}
+
+    unique_fd & operator =( unique_fd && other ) noexcept
     {
-        self.concat( pg::to_string_view( L, 2 ) );
+        reset( std::exchange( other.fd, -1 ) );
+        return *this;
     }
-    else
-    {
-        const auto & path = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
 
-        self += path;
+    ~unique_fd()
+    {
+        reset();
     }
 
-    lua_settop( L, 1 );
-    return 1;
-CATCH_BAD_ALLOC
-END_PROTECTED_FUNCTION
-
-BEGIN_PROTECTED_FUNCTION( path_append )
-    auto & self = pg::check_user_data_arg< std::filesystem::path >( L, 1 );
+    int get() const noexcept
+    {
+        return fd;
+    }
 
-    if( lua_type( L, 2 ) == LUA_TSTRING )
+    explicit operator bool() const noexcept
     {
-        self.append( pg::to_string_view( L, 2 ) );
+        return fd >= 0;
     }
-    else
+
+    // Gives up the ownership of the file descriptor without closing it.
+    int release() noexcept
     {
-        const auto & path = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
+        return std::exchange( fd, -1 );
+    }
 
-        self /= path;
+    void reset( int new_fd = -1 ) noexcept
+    {
+        if( fd >= 0 )
+        {
+            ::close( fd );
+        }
+        fd = new_fd;
     }
 
-    lua_settop( L, 1 );
-    return 1;
-CATCH_BAD_ALLOC
-END_PROTECTED_FUNCTION
+private:
+    int fd = -1;
+};
 
-static int path_clear( lua_State * const L ) noexcept
+#endif
+
+// Walks the entries of a directory, and optionally its subdirectories, without creating path
+// or directory_entry objects.
+// On Linux the entries are read with getdents64 into a large buffer and their type is taken from
+// d_type; the entries are only stat'ed when the filesystem doesn't report a type or when the size
+// or modification time is requested. Other platforms use the std::filesystem directory iterators.
+class raw_directory_walk
 {
-    auto & self = pg::check_user_data_arg< std::filesystem::path >( L, 1 );
+public:
+    raw_directory_walk( const std::filesystem::path & root, std::filesystem::directory_options options, bool recursive )
+        : root( root )
+        , options( options )
+        , recursive( recursive )
+    {
+#if defined( __linux__ )
+        unique_fd fd( ::open( root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC ) );
+        if( !fd )
+        {
+            const auto error = errno;
+            if( error == EACCES && skip_permission_denied() )
+            {
+                return;
+            }
+            throw std::filesystem::filesystem_error( "directory iterator cannot open directory", root, std::error_code( error, std::generic_category() ) );
+        }
+        levels.push_back( level{ std::move( fd ), 0 } );
+#else
+        if( recursive )
+        {
+            rdi = std::filesystem::recursive_directory_iterator( root, options );
+        }
+        else
+        {
+            di = std::filesystem::directory_iterator( root, options );
+        }
+        first = true;
+#endif
+    }
 
-    self.clear();
+    // Advances to the next entry, returns false at the end of the walk.
+    bool next()
+    {
+#if defined( __linux__ )
+        status.reset();
+        if( pending_directory )
+        {
+            pending_directory = false;
+            enter_directory();
+        }
 
-    return 0;
-}
+        while( !levels.empty() )
+        {
+            auto & current = levels.back();
+            if( current.position == current.length && !read_entries( current ) )
+            {
+                levels.pop_back();
+                continue;
+            }
 
-#define PATH_METHOD( METHOD )\
-BEGIN_PROTECTED_FUNCTION( path_##METHOD )\
-    auto & self = pg::check_user_data_arg< std::filesystem::path >( L, 1 );\
-    self.METHOD();\
-    return 1;\
-END_PROTECTED_FUNCTION
+            const auto entry = reinterpret_cast< const dirent64 * >( current.buffer.get() + current.position );
+            current.position += entry->d_reclen;
 
-PATH_METHOD( make_preferred )
-PATH_METHOD( remove_filename )
+            const std::string_view entry_name( entry->d_name );
+            if( entry_name == "." || entry_name == ".." )
+            {
+                continue;
+            }
 
-BEGIN_PROTECTED_FUNCTION( path_replace_filename )
-    auto & self = pg::check_user_data_arg< std::filesystem::path >( L, 1 );
+            relative.resize( current.prefix_length );
+            relative.append( entry_name );
+            name_length = entry_name.size();
+            entry_type  = type_from_dirent( current, entry->d_type );
 
-    if( lua_type( L, 2 ) == LUA_TSTRING )
-    {
-        self.replace_filename( pg::to_string_view( L, 2 ) );
+            if( recursive )
+            {
+                pending_directory = entry_type == std::filesystem::file_type::directory ||
+                                    ( entry_type == std::filesystem::file_type::symlink && follow_directory_symlink() &&
+                                      stat() && S_ISDIR( status->st_mode ) );
+            }
+
+            return true;
+        }
+
+        return false;
+#else
+        return recursive ? advance( rdi ) : advance( di );
+#endif
     }
-    else
-    {
-        const auto & path = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
 
-        self.replace_filename( path );
+    // The path of the current entry relative to the root of the walk.
+    std::string_view relative_path() const noexcept
+    {
+#if defined( __linux__ )
+        return relative;
+#else
+        return relative_name;
+#endif
     }
 
-    lua_settop( L, 1 );
-    return 1;
-END_PROTECTED_FUNCTION
+    // The filename of the current entry.
+    std::string_view filename() const noexcept
+    {
+        const auto path = relative_path();
 
-BEGIN_PROTECTED_FUNCTION( path_replace_extension )
-    auto & self = pg::check_user_data_arg< std::filesystem::path >( L, 1 );
+        return path.substr( path.size() - name_length );
+    }
 
-    const int type = lua_type( L, 2 );
-    if( type == LUA_TSTRING )
+    // The type of the current entry, symbolic links are not followed.
+    std::filesystem::file_type type() const noexcept
     {
-        self.replace_extension( pg::to_string_view( L, 2 ) );
+        return entry_type;
     }
-    else if( type == LUA_TNONE || type == LUA_TNIL )
+
+    // The size of the current entry when it is a regular file; symbolic links are followed.
+    std::optional< std::uintmax_t > file_size()
     {
-        self.replace_extension();
+#if defined( __linux__ )
+        if( entry_type != std::filesystem::file_type::regular && entry_type != std::filesystem::file_type::symlink )
+        {
+            return std::nullopt;
+        }
+        if( !stat() || !S_ISREG( status->st_mode ) )
+        {
+            return std::nullopt;
+        }
+        return static_cast< std::uintmax_t >( status->st_size );
+#else
+        std::error_code ec;
+        if( !current_entry().is_regular_file( ec ) )
+        {
+            return std::nullopt;
+        }
+        const auto size = current_entry().file_size( ec );
+        return ec ? std::nullopt : std::optional< std::uintmax_t >( size );
+#endif
     }
-    else
+
+    // The time of the last modification of the current entry; symbolic links are followed.
+    std::optional< std::filesystem::file_time_type > last_write_time()
     {
-        const auto & path = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path, string or nil" );
+#if defined( __linux__ )
+        if( !stat() )
+        {
+            return std::nullopt;
+        }
+        return pg::file_time_from_posix( status->st_mtim.tv_sec, status->st_mtim.tv_nsec );
+#else
+        std::error_code ec;
+        const auto time = current_entry().last_write_time( ec );
+        return ec ? std::nullopt : std::optional< std::filesystem::file_time_type >( time );
+#endif
+    }
 
-        self.replace_extension( path );
+    // The number of stat calls made by the walk and the number of entries of which the type was
+    // known without a stat call.
+    std::size_t stat_calls    = 0;
+    std::size_t stats_avoided = 0;
+
+private:
+    bool skip_permission_denied() const noexcept
+    {
+        return ( options & std::filesystem::directory_options::skip_permission_denied ) != std::filesystem::directory_options::none;
     }
 
-    lua_settop( L, 1 );
-    return 1;
-END_PROTECTED_FUNCTION
+    bool follow_directory_symlink() const noexcept
+    {
+        return ( options & std::filesystem::directory_options::follow_directory_symlink ) != std::filesystem::directory_options::none;
+    }
 
-#define PATH_METHOD_RETURN_NEW( METHOD )\
-BEGIN_PROTECTED_FUNCTION( path_##METHOD )\
-    const auto & self = pg::check_user_data_arg< std::filesystem::path >( L, 1 );\
-    return pg::return_new_user_data< std::filesystem::path >( L, self.METHOD() );\
-END_PROTECTED_FUNCTION
+#if defined( __linux__ )
+    static constexpr std::size_t buffer_size = 64 * 1024;
 
-PATH_METHOD_RETURN_NEW( root_name )
-PATH_METHOD_RETURN_NEW( root_directory )
-PATH_METHOD_RETURN_NEW( root_path )
-PATH_METHOD_RETURN_NEW( relative_path )
-PATH_METHOD_RETURN_NEW( parent_path )
-PATH_METHOD_RETURN_NEW( filename )
-PATH_METHOD_RETURN_NEW( stem )
-PATH_METHOD_RETURN_NEW( extension )
+    struct level
+    {
+        unique_fd                 fd;
+        std::size_t               prefix_length;
+        std::unique_ptr< char[] > buffer   = std::make_unique< char[] >( buffer_size );
+        std::size_t               position = 0;
+        std::size_t               length   = 0;
+    };
 
-#define PATH_PROPERTY( METHOD )\
-BEGIN_PROTECTED_FUNCTION( path_##METHOD )\
-    const auto & self = pg::check_user_data_arg< std::filesystem::path >( L, 1 );\
-    return pg::return_boolean( L, self.METHOD() );\
-END_PROTECTED_FUNCTION
+    bool read_entries( level & current )
+    {
+        const auto result = ::syscall( SYS_getdents64, current.fd.get(), current.buffer.get(), buffer_size );
+        if( result < 0 )
+        {
+            throw std::filesystem::filesystem_error( "directory iterator cannot advance", root / relative.substr( 0, current.prefix_length ),
+                                                     std::error_code( errno, std::generic_category() ) );
+        }
 
-PATH_PROPERTY( empty )
-PATH_PROPERTY( has_root_path )
-PATH_PROPERTY( has_root_name )
-PATH_PROPERTY( has_root_directory )
-PATH_PROPERTY( has_relative_path )
-PATH_PROPERTY( has_parent_path )
-PATH_PROPERTY( has_filename )
-PATH_PROPERTY( has_stem )
-PATH_PROPERTY( has_extension )
-PATH_PROPERTY( is_absolute )
-PATH_PROPERTY( is_relative )
+        current.position = 0;
+        current.length   = static_cast< std::size_t >( result );
 
-BEGIN_PROTECTED_FUNCTION( path_lexically_relative )
-    const auto & self = pg::check_user_data_arg< std::filesystem::path >( L, 1 );
+        return result > 0;
+    }
 
-    if( lua_type( L, 2 ) == LUA_TSTRING )
+    std::filesystem::file_type type_from_dirent( const level & current, unsigned char d_type )
     {
-        return pg::return_new_user_data< std::filesystem::path >( L, self.lexically_relative( pg::to_string_view( L, 2 ) ) );
+        using std::filesystem::file_type;
+
+        switch( d_type )
+        {
+        case DT_REG:  ++stats_avoided; return file_type::regular;
+        case DT_DIR:  ++stats_avoided; return file_type::directory;
+        case DT_LNK:  ++stats_avoided; return file_type::symlink;
+        case DT_BLK:  ++stats_avoided; return file_type::block;
+        case DT_CHR:  ++stats_avoided; return file_type::character;
+        case DT_FIFO: ++stats_avoided; return file_type::fifo;
+        case DT_SOCK: ++stats_avoided; return file_type::socket;
+        default:
+            break;
+        }
+
+        struct stat st;
+        ++stat_calls;
+        if( ::fstatat( current.fd.get(), filename_cstr(), &st, AT_SYMLINK_NOFOLLOW ) != 0 )
+        {
+            return file_type::none;
+        }
+        return pg::file_type_from_mode( st.st_mode );
     }
-    else
+
+    const char * filename_cstr() const noexcept
     {
-        const auto & path = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
+        return relative.c_str() + relative.size() - name_length;
+    }
 
-        return pg::return_new_user_data< std::filesystem::path >( L, self.lexically_relative( path ) );
+    // Stats the current entry, following symbolic links, once.
+    bool stat()
+    {
+        if( !status )
+        {
+            struct stat st;
+            ++stat_calls;
+            if( ::fstatat( levels.back().fd.get(), filename_cstr(), &st, 0 ) != 0 )
+            {
+                return false;
+            }
+            status = st;
+        }
+        return true;
     }
-END_PROTECTED_FUNCTION
 
-BEGIN_PROTECTED_FUNCTION( path_lexically_proximate )
-    auto & self = pg::check_user_data_arg< std::filesystem::path >( L, 1 );
+    void enter_directory()
+    {
+        const int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC | ( entry_type == std::filesystem::file_type::symlink ? 0 : O_NOFOLLOW );
+        unique_fd fd( ::openat( levels.back().fd.get(), filename_cstr(), flags ) );
+        if( !fd )
+        {
+            const auto error = errno;
+            if( error == EACCES && skip_permission_denied() )
+            {
+                return;
+            }
+            throw std::filesystem::filesystem_error( "cannot open directory", root / relative, std::error_code( error, std::generic_category() ) );
+        }
 
-    if( lua_type( L, 2 ) == LUA_TSTRING )
+        relative.push_back( '/' );
+        levels.push_back( level{ std::move( fd ), relative.size() } );
+    }
+
+    std::vector< level >         levels;
+    std::string                  relative;
+    std::optional< struct stat > status;
+    bool                         pending_directory = false;
+#else
+    const std::filesystem::directory_entry & current_entry() const
     {
-        return pg::return_new_user_data< std::filesystem::path >( L, self.lexically_proximate( pg::to_string_view( L, 2 ) ) );
+        return recursive ? *rdi : *di;
     }
-    else
+
+    template< typename Iterator >
+    bool advance( Iterator & it )
     {
-        const auto & path = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
+        if( !first )
+        {
+            ++it;
+        }
+        first = false;
 
-        return pg::return_new_user_data< std::filesystem::path >( L, self.lexically_proximate( path ) );
-    }
-END_PROTECTED_FUNCTION
+        if( it == Iterator() )
+        {
+            return false;
+        }
 
-PATH_METHOD_RETURN_NEW( lexically_normal )
+        std::error_code ec;
+        relative_name = it->path().lexically_relative( root ).generic_string();
+        name_length   = it->path().filename().generic_string().size();
+        entry_type    = pg::cached_symlink_type( *it, ec );
 
-BEGIN_FUNCTION( path_iterator_gc )
-    auto self = &pg::to_user_data< pg::path_iterator >( L, 1 );
+        return true;
+    }
 
-    self->~pair< std::filesystem::path::iterator, const std::filesystem::path::iterator >();
+    std::filesystem::directory_iterator           di;
+    std::filesystem::recursive_directory_iterator rdi;
+    std::string                                   relative_name;
+    bool                                          first = true;
+#endif
 
-    return 0;
-END_FUNCTION
+    const std::filesystem::path              root;
+    const std::filesystem::directory_options options;
+    const bool                               recursive;
+    std::size_t                              name_length = 0;
+    std::filesystem::file_type               entry_type  = std::filesystem::file_type::none;
+};
 
-struct path_iterator_state
+struct directory_batch_iterator
 {
-    static constexpr luaL_Reg operators[] =
+    raw_directory_walk walk;
+    std::size_t        batch_size;
+    bool               with_size;
+    bool               with_mtime;
+    bool               as_integers;
+    std::size_t        previous_count = 0;
+};
+
+// Matches 'name' against the glob 'pattern' of one path segment with '*', '?', '[...]', '[!...]' and '\\' escapes.
+inline bool wildcard_match( std::string_view pattern, std::string_view name ) noexcept
+{
+    // Matches the pattern token at 'p' with 'c' and advances 'p' past the token
+    const auto match_one = [ &pattern ]( std::size_t & p, char c ) noexcept
     {
-        { "__gc", path_iterator_gc },
-        { NULL,   NULL }
+        const char t = pattern[ p++ ];
+        if( t == '?' )
+        {
+            return true;
+        }
+        if( t == '\\' && p < pattern.size() )
+        {
+            return pattern[ p++ ] == c;
+        }
+        if( t == '[' )
+        {
+            const bool negate = p < pattern.size() && ( pattern[ p ] == '!' || pattern[ p ] == '^' );
+            const auto close  = pattern.find( ']', p + negate + 1 );     // A ']' right after the '[' is a member
+            if( close != std::string_view::npos )
+            {
+                bool found = false;
+                for( auto i = p + negate ; i < close ; ++i )
+                {
+                    if( i + 2 < close && pattern[ i + 1 ] == '-' )
+                    {
+                        found = found || ( pattern[ i ] <= c && c <= pattern[ i + 2 ] );
+                        i    += 2;
+                    }
+                    else
+                    {
+                        found = found || pattern[ i ] == c;
+                    }
+                }
+                p = close + 1;
+                return found != negate;
+            }
+        }
+        return t == c;
     };
 
-    static constexpr const luaL_Reg * methods = nullptr;
-};
-
-BEGIN_PROTECTED_FUNCTION( next_path_element )
-    auto & self = pg::check_user_data_arg< pg::path_iterator >( L, 1 );
-    if( self.first == self.second )
+    std::size_t p      = 0;
+    std::size_t n      = 0;
+    std::size_t star_p = std::string_view::npos;
+    std::size_t star_n = 0;
+    while( n < name.size() )
     {
-        return pg::return_nil( L );
+        if( p < pattern.size() && pattern[ p ] == '*' )
+        {
+            star_p = ++p;
+            star_n = n;
+            continue;
+        }
+        if( p < pattern.size() )
+        {
+            auto next = p;
+            if( match_one( next, name[ n ] ) )
+            {
+                p = next;
+                ++n;
+                continue;
+            }
+        }
+        if( star_p == std::string_view::npos )
+        {
+            return false;
+        }
+        p = star_p;
+        n = ++star_n;
+    }
+    while( p < pattern.size() && pattern[ p ] == '*' )
+    {
+        ++p;
     }
 
-    return pg::return_new_user_data< std::filesystem::path >( L, *self.first++ );
-END_PROTECTED_FUNCTION
-
-BEGIN_PROTECTED_FUNCTION( path_elements )
-    auto & self     = pg::check_user_data_arg< std::filesystem::path >( L, 1 );
-    auto   it_begin = self.begin();
-    auto   it_end   = self.end();
-
-    lua_settop( L, 0 );
-    lua_pushcfunction( L, next_path_element );
-    pg::new_user_data< pg::path_iterator >( L, it_begin, it_end );
-
-    return 2;
-END_PROTECTED_FUNCTION
+    return p == pattern.size();
+}
 
-struct path
+// Glob patterns compiled into an automaton over the names in a path. 'step' advances a set of positions in the
+// patterns by one name, so a directory is only read when a pattern can still match an entry below it.
+// The patterns use '/' as separator and support '*', '?', '[...]' and '[!...]' within a name, '**' as a name for
+// any number of directories, '{a,b}' alternatives that may contain separators and '\\' to escape the next character.
+// Names starting with a '.' only match a pattern that starts with a literal '.', unless 'hidden' is set.
+class glob_matcher
 {
-    static constexpr const luaL_Reg operators[] =
+public:
+    struct position
     {
-        { "__tostring", path_to_string },
-        { "__gc",       path_gc },
-        { "__eq",       path_eq },
-        { "__lt",       path_lt },
-        { "__le",       path_le },
-        { NULL,         NULL }
+        std::uint32_t pattern;
+        std::uint32_t segment;
+
+        bool operator ==( const position & other ) const noexcept
+        {
+            return pattern == other.pattern && segment == other.segment;
+        }
     };
 
-    static constexpr const luaL_Reg methods[] =
+    using state = std::vector< position >;
+
+    glob_matcher( const std::vector< std::string > & patterns, bool hidden )
+        : hidden( hidden )
     {
-        { "concat",              path_concat },
-        { "append",              path_append },
-        { "clear",               path_clear },
-        { "make_preferred",      path_make_preferred },
-        { "remove_filename",     path_remove_filename },
-        { "replace_filename",    path_replace_filename },
-        { "replace_extension",   path_replace_extension },
-        { "root_name",           path_root_name },
-        { "root_directory",      path_root_directory },
-        { "root_path",           path_root_path },
-        { "relative_path",       path_relative_path },
-        { "parent_path",         path_parent_path },
-        { "filename",            path_filename },
-        { "stem",                path_stem },
-        { "extension",           path_extension },
-        { "empty",               path_empty },
-        { "has_root_path",       path_has_root_path },
-        { "has_root_name",       path_has_root_name },
-        { "has_root_directory",  path_has_root_directory },
-        { "has_relative_path",   path_has_relative_path },
-        { "has_parent_path",     path_has_parent_path },
-        { "has_filename",        path_has_filename },
-        { "has_stem",            path_has_stem },
-        { "has_extension",       path_has_extension },
-        { "is_absolute",         path_is_absolute },
-        { "is_relative",         path_is_relative },
-        { "lexically_normal",    path_lexically_normal },
-        { "lexically_relative",  path_lexically_relative },
-        { "lexically_proximate", path_lexically_proximate },
-        { "elements",            path_elements },
-        { NULL,                  NULL }
-    };
-};
-
-BEGIN_FUNCTION( ft_gc )
-    auto & self = pg::to_user_data< std::filesystem::file_time_type >( L, 1 );
+        std::vector< std::string > expanded;
+        for( const auto & pattern : patterns )
+        {
+            expand_braces( pattern, expanded );
+        }
 
-    typedef std::filesystem::file_time_type file_time_type;
-    self.~file_time_type();
+        bool absolute = false;
+        for( const auto & pattern : expanded )
+        {
+            if( pattern.empty() || ( !compiled.empty() && absolute != ( pattern.front() == '/' ) ) ) PG_UNLIKELY
+            {
+                throw std::filesystem::filesystem_error( pattern.empty() ? "empty glob pattern" : "glob patterns must be all absolute or all relative",
+                                                         pattern, std::make_error_code( std::errc::invalid_argument ) );
+            }
+            absolute = pattern.front() == '/';
+            compiled.push_back( compile( pattern ) );
+            if( compiled.back().empty() ) PG_UNLIKELY
+            {
+                throw std::filesystem::filesystem_error( "glob pattern without names", pattern, std::make_error_code( std::errc::invalid_argument ) );
+            }
+        }
 
-    return 0;
-END_FUNCTION
+        // The literal names that all patterns start with are the base directory of the walk;
+        // every pattern keeps at least one name to match
+        std::size_t prefix = std::numeric_limits< std::size_t >::max();
+        for( const auto & segments : compiled )
+        {
+            prefix = std::min( prefix, segments.size() - 1 );
+            for( std::size_t i = 0 ; i < prefix ; ++i )
+            {
+                if( segments[ i ].kind != segment_kind::literal || segments[ i ].text != compiled.front()[ i ].text )
+                {
+                    prefix = i;
+                }
+            }
+        }
 
-BEGIN_FUNCTION( ft_eq )
-    const auto & left  = pg::check_user_data_arg< std::filesystem::file_time_type >( L, 1 );
-    const auto & right = pg::check_user_data_arg< std::filesystem::file_time_type >( L, 2 );
+        base_directory = absolute ? "/" : "";
+        for( std::size_t i = 0 ; i < prefix ; ++i )
+        {
+            base_directory += compiled.front()[ i ].text;
+            base_directory += '/';
+        }
+        for( std::uint32_t p = 0 ; p < compiled.size() ; ++p )
+        {
+            add( initial_state, position{ p, static_cast< std::uint32_t >( prefix ) } );
+        }
+    }
 
-    return pg::return_boolean( L, left == right );
-END_FUNCTION
+    // The directory where matching starts, empty or ending with a '/'.
+    const std::string & base() const noexcept
+    {
+        return base_directory;
+    }
 
-BEGIN_FUNCTION( ft_lt )
-    const auto & left  = pg::check_user_data_arg< std::filesystem::file_time_type >( L, 1 );
-    const auto & right = pg::check_user_data_arg< std::filesystem::file_time_type >( L, 2 );
+    const state & initial() const noexcept
+    {
+        return initial_state;
+    }
 
-    return pg::return_boolean( L, left < right );
-END_FUNCTION
+    // Sets 'to' to the positions after the entry 'name' in the directory of the positions 'from' and returns
+    // whether the entry matches a pattern. 'to' is empty when no pattern can match an entry below 'name'.
+    bool step( const state & from, std::string_view name, state & to ) const
+    {
+        to.clear();
+        const bool is_hidden = !name.empty() && name.front() == '.';
+        for( const auto & p : from )
+        {
+            if( p.segment == compiled[ p.pattern ].size() )
+            {
+                continue;
+            }
+            const auto & s = compiled[ p.pattern ][ p.segment ];
+            if( s.kind == segment_kind::any_directories )
+            {
+                if( hidden || !is_hidden )
+                {
+                    add( to, p );
+                }
+            }
+            else if( matches( s, name, is_hidden ) )
+            {
+                add( to, position{ p.pattern, p.segment + 1 } );
+            }
+        }
 
-BEGIN_FUNCTION( ft_le )
-    const auto & left  = pg::check_user_data_arg< std::filesystem::file_time_type >( L, 1 );
-    const auto & right = pg::check_user_data_arg< std::filesystem::file_time_type >( L, 2 );
+        bool matched = false;
+        to.erase( std::remove_if( to.begin(), to.end(), [ this, &matched ]( const position & p )
+        {
+            const bool end = p.segment == compiled[ p.pattern ].size();
+            matched        = matched || end;
+            return end;
+        } ), to.end() );
 
-    return pg::return_boolean( L, left <= right );
-END_FUNCTION
+        return matched;
+    }
 
-BEGIN_FUNCTION( ft_add )
-    using duration = std::filesystem::file_time_type::duration;
-    using period   = std::filesystem::file_time_type::period;
-    using rep      = std::filesystem::file_time_type::rep;
+private:
+    enum class segment_kind
+    {
+        literal,
+        prefix,             // 'text*'
+        suffix,             // '*text', like '*.cpp'
+        wildcard,
+        any_directories     // '**'
+    };
 
-    const auto & self = pg::check_user_data_arg< std::filesystem::file_time_type >( L, 1 );
+    struct segment
+    {
+        segment_kind kind;
+        std::string  text;          // Without escapes, except for 'wildcard'
+        bool         literal_dot;   // Matches hidden names
+    };
 
-    if( auto right = pg::test_user_data< duration >( L, 2 ) )
+    static void expand_braces( const std::string & pattern, std::vector< std::string > & out )
     {
-        return pg::return_new_user_data< std::filesystem::file_time_type >( L, self + *right );
+        constexpr std::size_t max_patterns = 4096;
+
+        for( std::size_t open = 0 ; open < pattern.size() ; ++open )
+        {
+            if( pattern[ open ] == '\\' )
+            {
+                ++open;
+                continue;
+            }
+            if( pattern[ open ] != '{' )
+            {
+                continue;
+            }
+
+            std::vector< std::size_t > commas;
+            int                        depth = 0;
+            for( auto i = open + 1 ; i < pattern.size() ; ++i )
+            {
+                if( pattern[ i ] == '\\' )
+                {
+                    ++i;
+                }
+                else if( pattern[ i ] == '{' )
+                {
+                    ++depth;
+                }
+                else if( pattern[ i ] == ',' && depth == 0 )
+                {
+                    commas.push_back( i );
+                }
+                else if( pattern[ i ] == '}' && depth-- == 0 )
+                {
+                    if( commas.empty() )
+                    {
+                        break;
+                    }
+                    commas.push_back( i );
+                    auto begin = open + 1;
+                    for( const auto end : commas )
+                    {
+                        expand_braces( pattern.substr( 0, open ) + pattern.substr( begin, end - begin ) + pattern.substr( i + 1 ), out );
+                        begin = end + 1;
+                    }
+                    return;
+                }
+            }
+        }
+
+        if( out.size() == max_patterns ) PG_UNLIKELY
+        {
+            throw std::filesystem::filesystem_error( "too many glob patterns after brace expansion", pattern, std::make_error_code( std::errc::argument_list_too_long ) );
+        }
+        out.push_back( pattern );
     }
-    else if( lua_isinteger( L, 2 ) )
+
+    static std::vector< segment > compile( std::string_view pattern )
     {
-        const auto seconds = static_cast< rep >( lua_tointeger( L, 2 ) );
-        const auto count   = seconds * period::den / period::num;
+        std::vector< segment > segments;
+        while( !pattern.empty() )
+        {
+            const auto separator = pattern.find( '/' );
+            const auto raw       = pattern.substr( 0, separator );
+            pattern              = separator == std::string_view::npos ? std::string_view() : pattern.substr( separator + 1 );
+            if( raw.empty() )
+            {
+                continue;
+            }
+            if( raw == "**" )
+            {
+                segments.push_back( segment{ segment_kind::any_directories, {}, false } );
+                continue;
+            }
 
-        return pg::return_new_user_data< std::filesystem::file_time_type >( L, self + duration( count ) );
+            // The positions of the unescaped wildcards and the text without escapes
+            std::vector< std::size_t > wildcards;
+            std::string                text;
+            for( std::size_t i = 0 ; i < raw.size() ; ++i )
+            {
+                if( raw[ i ] == '\\' && i + 1 < raw.size() )
+                {
+                    text += raw[ ++i ];
+                }
+                else
+                {
+                    if( raw[ i ] == '*' || raw[ i ] == '?' || raw[ i ] == '[' )
+                    {
+                        wildcards.push_back( i );
+                    }
+                    text += raw[ i ];
+                }
+            }
+
+            const bool literal_dot = raw.front() == '.' || ( raw.size() > 1 && raw[ 0 ] == '\\' && raw[ 1 ] == '.' );
+            if( wildcards.empty() )
+            {
+                segments.push_back( segment{ segment_kind::literal, std::move( text ), literal_dot } );
+            }
+            else if( wildcards.size() == 1 && wildcards.front() == 0 && raw.front() == '*' )
+            {
+                segments.push_back( segment{ segment_kind::suffix, text.substr( 1 ), literal_dot } );
+            }
+            else if( wildcards.size() == 1 && wildcards.front() == raw.size() - 1 && raw.back() == '*' )
+            {
+                text.pop_back();
+                segments.push_back( segment{ segment_kind::prefix, std::move( text ), literal_dot } );
+            }
+            else
+            {
+                segments.push_back( segment{ segment_kind::wildcard, std::string( raw ), literal_dot } );
+            }
+        }
+
+        return segments;
     }
-    else if( lua_isnumber( L, 2 ) )
+
+    bool matches( const segment & s, std::string_view name, bool is_hidden ) const noexcept
     {
-        const auto seconds = lua_tonumber( L, 2 );
-        const auto count   = static_cast< rep >( seconds * period::den / period::num );
+        if( is_hidden && !hidden && !s.literal_dot )
+        {
+            return false;
+        }
 
-        return pg::return_new_user_data< std::filesystem::file_time_type >( L, self + duration( count ) );
+        switch( s.kind )
+        {
+        case segment_kind::literal:
+            return name == s.text;
+        case segment_kind::prefix:
+            return name.substr( 0, s.text.size() ) == s.text;
+        case segment_kind::suffix:
+            return name.size() >= s.text.size() && name.substr( name.size() - s.text.size() ) == s.text;
+        case segment_kind::wildcard:
+            return pg::wildcard_match( s.text, name );
+        default:
+            return false;
+        }
     }
-    else
+
+    // Adds 'p' and the positions after the '**' names at 'p' that match no names
+    void add( state & s, position p ) const
     {
-        return pg::type_error( L, 2, "file time duration, number or integer" );
+        for( ;; )
+        {
+            if( std::find( s.begin(), s.end(), p ) != s.end() )
+            {
+                return;
+            }
+            s.push_back( p );
+            if( p.segment == compiled[ p.pattern ].size() || compiled[ p.pattern ][ p.segment ].kind != segment_kind::any_directories )
+            {
+                return;
+            }
+            ++p.segment;
+        }
     }
-END_FUNCTION
-
-BEGIN_FUNCTION( ft_sub )
-    using duration = std::filesystem::file_time_type::duration;
-    using period   = std::filesystem::file_time_type::period;
-    using rep      = std::filesystem::file_time_type::rep;
 
-    const auto & self  = pg::check_user_data_arg< std::filesystem::file_time_type >( L, 1 );
+    std::vector< std::vector< segment > > compiled;
+    std::string                           base_directory;
+    state                                 initial_state;
+    const bool                            hidden;
+};
 
-    if( auto right_duration = pg::test_user_data< duration >( L, 2 ) )
+// Walks the directories that can hold matches of a 'glob_matcher'. Directories are read one at a time;
+// the subdirectories in which no pattern can match are never opened.
+class glob_walk
+{
+public:
+    glob_walk( glob_matcher m, std::optional< std::filesystem::path > root, std::filesystem::directory_options options )
+        : matcher( std::move( m ) )
+        , root( std::move( root ) )
+        , options( options )
     {
-        return pg::return_new_user_data< std::filesystem::file_time_type >( L, self - *right_duration );
+        pending.push_back( frame{ matcher.base(), matcher.initial() } );
     }
-    else if( lua_isnumber( L, 2 ) )
+
+    // Advances to the next matching path, returns false when there are no more matches.
+    bool next( std::filesystem::path & match )
     {
-        const auto seconds = lua_tonumber( L, 2 );
-        const auto count   = static_cast< rep >( seconds * period::den / period::num );
-        
-        return pg::return_new_user_data< std::filesystem::file_time_type >( L, self - duration( count ) );
+        for( ;; )
+        {
+            if( !walk )
+            {
+                if( pending.empty() )
+                {
+                    return false;
+                }
+                current = std::move( pending.back() );
+                pending.pop_back();
+                try
+                {
+                    walk.emplace( path_of( current.relative.empty() ? std::string( "." ) : current.relative ), options, false );
+                }
+                catch( const std::filesystem::filesystem_error & e )
+                {
+                    // A base directory that doesn't exist has no matches
+                    if( e.code() == std::errc::no_such_file_or_directory || e.code() == std::errc::not_a_directory )
+                    {
+                        continue;
+                    }
+                    throw;
+                }
+            }
+
+            if( !walk->next() )
+            {
+                walk.reset();
+                continue;
+            }
+
+            const auto name    = walk->filename();
+            const bool matched = matcher.step( current.state, name, next_state );
+            if( !next_state.empty() && is_directory() )
+            {
+                pending.push_back( frame{ current.relative + std::string( name ) + '/', std::move( next_state ) } );
+            }
+            if( matched )
+            {
+                match = path_of( current.relative + std::string( name ) );
+                return true;
+            }
+        }
     }
-    else
+
+private:
+    struct frame
     {
-        const auto & right_file_time = pg::check_user_data_arg< std::filesystem::file_time_type >( L, 2, "number, file time or file time duration" );
+        std::string         relative;   // Empty or ending with a '/'
+        glob_matcher::state state;
+    };
 
-        return pg::return_new_user_data< duration >( L, self - right_file_time );
+    std::filesystem::path path_of( const std::string & relative ) const
+    {
+        return root ? *root / relative : std::filesystem::path( relative );
     }
-END_FUNCTION
 
-struct fs_file_time
-{
-    static constexpr const luaL_Reg operators[] =
+    bool is_directory() const
     {
-        { "__gc",  ft_gc },
-        { "__eq",  ft_eq },
-        { "__lt",  ft_lt },
-        { "__le",  ft_le },
-        { "__add", ft_add },
-        { "__sub", ft_sub },
-        { NULL,    NULL }
-    };
+        if( walk->type() == std::filesystem::file_type::directory )
+        {
+            return true;
+        }
+        if( walk->type() != std::filesystem::file_type::symlink ||
+            ( options & std::filesystem::directory_options::follow_directory_symlink ) == std::filesystem::directory_options::none )
+        {
+            return false;
+        }
+        std::error_code ec;
+        return std::filesystem::is_directory( path_of( current.relative + std::string( walk->filename() ) ), ec );
+    }
 
-    static constexpr const luaL_Reg * methods = nullptr;
+    const glob_matcher                                 matcher;
+    const std::optional< std::filesystem::path >       root;
+    const std::filesystem::directory_options           options;
+    std::vector< frame >                               pending;
+    frame                                              current;
+    glob_matcher::state                                next_state;
+    std::optional< raw_directory_walk >                walk;
 };
 
-BEGIN_FUNCTION( ftd_gc )
-    auto & self = pg::to_user_data< std::filesystem::file_time_type::duration >( L, 1 );
-
-    typedef std::filesystem::file_time_type::duration file_time_type;
-    self.~file_time_type();
+struct glob_iterator
+{
+    glob_walk   walk;
+    std::size_t batch_size;
+};
 
-    return 0;
-END_FUNCTION
+// The status fields that can be requested from 'stat_path'.
+enum stat_fields : unsigned
+{
+    stat_type      = 1u << 0,
+    stat_perms     = 1u << 1,
+    stat_size      = 1u << 2,
+    stat_mtime     = 1u << 3,
+    stat_nlink     = 1u << 4,
+    stat_inode     = 1u << 5,
+    stat_device    = 1u << 6,
+    stat_allocated = 1u << 7
+};
 
-BEGIN_FUNCTION( ftd_eq )
-    const auto & left  = pg::check_user_data_arg< std::filesystem::file_time_type::duration >( L, 1 );
-    const auto & right = pg::check_user_data_arg< std::filesystem::file_time_type::duration >( L, 2 );
+struct stat_record
+{
+    bool                            exists      = false;
+    std::filesystem::file_type      type        = std::filesystem::file_type::not_found;
+    std::filesystem::perms          permissions = std::filesystem::perms::unknown;
+    std::optional< std::uintmax_t > size;       // Only for regular files
+    std::filesystem::file_time_type mtime;
+    std::uintmax_t                  hard_links  = 0;
+    std::optional< std::uintmax_t > inode;      // Not available on all platforms
+    std::optional< std::uintmax_t > device;
+    std::optional< std::uintmax_t > allocated;  // Bytes allocated on disk, not available on all platforms
+    std::error_code                 error;      // The reason when the query failed
+};
 
-    return pg::return_boolean( L, left == right );
-END_FUNCTION
+#if defined( __linux__ ) && defined( STATX_BASIC_STATS )
+inline stat_record stat_record_from_statx( const struct statx & stx ) noexcept
+{
+    stat_record record;
+    record.exists      = true;
+    record.type        = pg::file_type_from_mode( stx.stx_mode );
+    record.permissions = static_cast< std::filesystem::perms >( stx.stx_mode & 07777 );
+    record.mtime       = pg::file_time_from_posix( stx.stx_mtime.tv_sec, stx.stx_mtime.tv_nsec );
+    record.hard_links  = stx.stx_nlink;
+    record.inode       = stx.stx_ino;
+    record.device      = makedev( stx.stx_dev_major, stx.stx_dev_minor );
+    record.allocated   = stx.stx_blocks * 512;
+    if( record.type == std::filesystem::file_type::regular )
+    {
+        record.size = stx.stx_size;
+    }
+    return record;
+}
+#endif
 
-BEGIN_FUNCTION( ftd_lt )
-    const auto & left  = pg::check_user_data_arg< std::filesystem::file_time_type::duration >( L, 1 );
-    const auto & right = pg::check_user_data_arg< std::filesystem::file_time_type::duration >( L, 2 );
+// Queries the requested status 'fields' of 'p' without throwing; 'exists' is false when the query failed.
+// On Linux statx is used to ask only for the requested fields.
+inline stat_record stat_path( const std::filesystem::path & p, unsigned fields, bool follow_symlinks ) noexcept
+{
+    stat_record record;
 
-    return pg::return_boolean( L, left < right );
-END_FUNCTION
+#if defined( __linux__ ) && defined( STATX_BASIC_STATS )
+    static std::atomic< bool > has_statx = true;
 
-BEGIN_FUNCTION( ftd_le )
-    const auto & left  = pg::check_user_data_arg< std::filesystem::file_time_type::duration >( L, 1 );
-    const auto & right = pg::check_user_data_arg< std::filesystem::file_time_type::duration >( L, 2 );
+    unsigned mask = 0;
+    mask |= ( fields & ( stat_type | stat_size ) ) ? STATX_TYPE : 0;
+    mask |= ( fields & stat_perms ) ? STATX_MODE : 0;
+    mask |= ( fields & stat_size ) ? STATX_SIZE : 0;
+    mask |= ( fields & stat_mtime ) ? STATX_MTIME : 0;
+    mask |= ( fields & stat_nlink ) ? STATX_NLINK : 0;
+    mask |= ( fields & stat_inode ) ? STATX_INO : 0;
+    mask |= ( fields & stat_allocated ) ? STATX_BLOCKS : 0;
 
-    return pg::return_boolean( L, left <= right );
-END_FUNCTION
+    const int flags = AT_STATX_SYNC_AS_STAT | ( follow_symlinks ? 0 : AT_SYMLINK_NOFOLLOW );
 
-BEGIN_FUNCTION( ftd_add )
-    using duration = std::filesystem::file_time_type::duration;
-    using period   = std::filesystem::file_time_type::period;
-    using rep      = std::filesystem::file_time_type::rep;
+    struct statx stx;
+    if( has_statx && ::statx( AT_FDCWD, p.c_str(), flags, mask, &stx ) == 0 )
+    {
+        return stat_record_from_statx( stx );
+    }
+    else if( has_statx && errno == ENOSYS )
+    {
+        has_statx = false;
+    }
+    else if( has_statx )
+    {
+        record.error = std::error_code( errno, std::generic_category() );
+        return record;
+    }
+#endif
 
-    if( const auto self = pg::test_user_data< duration >( L, 1 ) )
+#if defined( __linux__ )
+    struct stat st;
+    if( ( follow_symlinks ? ::stat( p.c_str(), &st ) : ::lstat( p.c_str(), &st ) ) != 0 )
     {
-        if( const auto right_duration = pg::test_user_data< duration >( L, 2 ) )
-        {
-            return pg::return_new_user_data< duration >( L, *self + *right_duration );
-        }
-        else if( const auto right_file_time = pg::test_user_data< std::filesystem::file_time_type >( L, 2 ) )
-        {
-            return pg::return_new_user_data< std::filesystem::file_time_type >( L, *self + *right_file_time );
-        }
-        else if( lua_isinteger( L, 2 ) )
-        {
-            const auto seconds = static_cast< rep >( lua_tointeger( L, 2 ) );
-            const auto count   = seconds * period::den / period::num;
+        record.error = std::error_code( errno, std::generic_category() );
+        return record;
+    }
 
-            return pg::return_new_user_data< duration >( L, *self + duration( count ) );
-        }
-        else if( lua_isnumber( L, 2 ) )
-        {
-            const auto seconds = lua_tonumber( L, 2 );
-            const auto count   = static_cast< rep >( seconds * period::den / period::num );
+    record.exists      = true;
+    record.type        = pg::file_type_from_mode( st.st_mode );
+    record.permissions = static_cast< std::filesystem::perms >( st.st_mode & 07777 );
+    record.mtime       = pg::file_time_from_posix( st.st_mtim.tv_sec, st.st_mtim.tv_nsec );
+    record.hard_links  = st.st_nlink;
+    record.inode       = st.st_ino;
+    record.device      = st.st_dev;
+    record.allocated   = static_cast< std::uintmax_t >( st.st_blocks ) * 512;
+    if( record.type == std::filesystem::file_type::regular )
+    {
+        record.size = static_cast< std::uintmax_t >( st.st_size );
+    }
+#else
+    std::error_code ec;
+    const auto      status = follow_symlinks ? std::filesystem::status( p, ec ) : std::filesystem::symlink_status( p, ec );
+    if( ec || !std::filesystem::exists( status ) )
+    {
+        record.error = ec ? ec : std::make_error_code( std::errc::no_such_file_or_directory );
+        return record;
+    }
 
-            return pg::return_new_user_data< duration >( L, *self + duration( count ) );
-        }
-        else
-        {
-            return pg::type_error( L, 2, "file time duration, number or integer" );
-        }
+    record.exists      = true;
+    record.type        = status.type();
+    record.permissions = status.permissions();
+    if( ( fields & stat_size ) && record.type == std::filesystem::file_type::regular )
+    {
+        const auto size = std::filesystem::file_size( p, ec );
+        record.size     = ec ? std::nullopt : std::optional< std::uintmax_t >( size );
     }
-    else
+    if( fields & stat_mtime )
     {
-        const auto right = pg::check_user_data_arg< duration >( L, 2 );
+        record.mtime = std::filesystem::last_write_time( p, ec );
+    }
+    if( fields & stat_nlink )
+    {
+        record.hard_links = std::filesystem::hard_link_count( p, ec );
+    }
+#endif
 
-        if( lua_isinteger( L, 1 ) )
-        {
-            const auto seconds = static_cast< rep >( lua_tointeger( L, 1 ) );
-            const auto count   = seconds * period::den / period::num;
+    return record;
+}
 
-            return pg::return_new_user_data< duration >( L, duration( count ) + right );
+// A declarative filter for the entries of a recursive directory iteration, so the entries that are rejected
+// never reach Lua. An empty member doesn't filter. Only 'skip_directories' affects the recursion itself.
+struct directory_filter
+{
+    std::vector< std::filesystem::file_type >                        types;              // Symbolic links are not followed
+    std::unordered_set< std::filesystem::path::string_type >         extensions;         // Including the dot
+    std::optional< std::uintmax_t >                                  min_size;           // Rejects the entries that aren't regular files
+    std::optional< std::uintmax_t >                                  max_size;
+    std::optional< std::filesystem::file_time_type >                 newer_than;
+    std::optional< std::filesystem::file_time_type >                 older_than;
+    std::unordered_set< std::filesystem::path::string_type >         skip_directories;   // Filenames of directories to skip with their contents
+
+    // Returns whether the current entry of 'it' passes the filter; disables the recursion into skipped directories.
+    bool accepts( std::filesystem::recursive_directory_iterator & it ) const
+    {
+        const auto &    entry = *it;
+        std::error_code ec;
+
+        if( !skip_directories.empty() && entry.is_directory( ec ) &&
+            skip_directories.count( entry.path().filename().native() ) )
+        {
+            it.disable_recursion_pending();
+            return false;
         }
-        else if( lua_isnumber( L, 1 ) )
+        if( !types.empty() && std::find( types.begin(), types.end(), pg::cached_symlink_type( entry, ec ) ) == types.end() )
         {
-            const auto seconds = lua_tonumber( L, 1 );
-            const auto count   = static_cast< rep >( seconds * period::den / period::num );
-
-            return pg::return_new_user_data< duration >( L, duration( count ) + right );
+            return false;
         }
-        else
+        if( !extensions.empty() && !extensions.count( entry.path().extension().native() ) )
         {
-            return pg::type_error( L, 1, "file time duration, number or integer" );
+            return false;
         }
-    }
-END_FUNCTION
-
-BEGIN_FUNCTION( ftd_sub )
-    using duration = std::filesystem::file_time_type::duration;
-    using period   = std::filesystem::file_time_type::period;
-    using rep      = std::filesystem::file_time_type::rep;
-
-    const auto & self = pg::check_user_data_arg< duration >( L, 1 );
 
-    if( lua_isinteger( L, 2 ) )
-    {
-        const auto seconds = lua_tointeger( L, 2 );
-        const auto count   = seconds * period::den / period::num;
+        const unsigned fields = ( min_size || max_size ? stat_size : 0u ) | ( newer_than || older_than ? stat_mtime : 0u );
+        if( fields )
+        {
+            const auto record = pg::stat_path( entry.path(), fields, true );
+            if( !record.exists )
+            {
+                return false;
+            }
+            if( ( fields & stat_size ) && ( !record.size || *record.size < min_size.value_or( 0 ) || *record.size > max_size.value_or( *record.size ) ) )
+            {
+                return false;
+            }
+            if( ( newer_than && record.mtime <= *newer_than ) || ( older_than && record.mtime >= *older_than ) )
+            {
+                return false;
+            }
+        }
 
-        return pg::return_new_user_data< duration >( L, self - duration( count ) );
+        return true;
     }
-    else if( lua_isnumber( L, 2 ) )
-    {
-        const auto seconds = lua_tonumber( L, 2 );
-        const auto count   = static_cast< rep >( seconds * period::den / period::num );
+};
 
-        return pg::return_new_user_data< duration >( L, self - duration( count ) );
-    }
-    else
+struct recursive_directory_iterator
+{
+    recursive_directory_iterator( std::filesystem::recursive_directory_iterator first, std::filesystem::recursive_directory_iterator second,
+                                  std::optional< directory_filter > filter = std::nullopt )
+        : first( std::move( first ) )
+        , second( std::move( second ) )
+        , filter( std::move( filter ) )
+    {}
+
+    // Skips the entries from the current one that are rejected by the filter
+    void skip_rejected()
     {
-        const auto right = pg::check_user_data_arg< duration >( L, 2, "number, file time or file time duration" );
-
-        return pg::return_new_user_data< duration >( L, self - right );
+        while( filter && first != second && !filter->accepts( first ) )
+        {
+            ++first;
+        }
     }
-END_FUNCTION
 
-BEGIN_FUNCTION( ftd_seconds )
-    const auto & duration = pg::check_user_data_arg< std::filesystem::file_time_type::duration >( L, 1 );
+    std::filesystem::recursive_directory_iterator       first;
+    const std::filesystem::recursive_directory_iterator second;
+    const std::optional< directory_filter >             filter;
+};
 
-    const auto count_num = static_cast< lua_Number >( duration.count() ) * std::filesystem::file_time_type::period::num;
-    const auto seconds   = count_num / std::filesystem::file_time_type::period::den;
+// The ways 'copy_file_contents' can copy the data of a file.
+// 'automatic' tries them in the order of this enumeration and falls back to the next one when
+// a strategy isn't supported for the pair of files. 'library' is std::filesystem::copy_file,
+// which is used on platforms without the other strategies.
+enum class copy_strategy
+{
+    automatic,
+    reflink,
+    copy_file_range,
+    sendfile,
+    readwrite,
+    library
+};
 
-    return pg::return_number( L, seconds );
-END_FUNCTION
+static constexpr const char * const copy_strategy_names[] = { "auto", "reflink", "copy_file_range", "sendfile", "readwrite", "copy_file", nullptr };
 
-struct fs_file_time_duration
+struct copy_result
 {
-    static constexpr const luaL_Reg operators[] =
-    {
-        { "__gc",  ftd_gc },
-        { "__eq",  ftd_eq },
-        { "__lt",  ftd_lt },
-        { "__le",  ftd_le },
-        { "__add", ftd_add },
-        { "__sub", ftd_sub },
-        { NULL,    NULL }
-    };
-
-    static constexpr const luaL_Reg methods[] =
-    {
-        { "seconds", ftd_seconds },
-        { NULL,      NULL }
-    };
+    bool          copied;
+    copy_strategy strategy;
 };
 
-BEGIN_FUNCTION( de_to_string )
-    const auto & path = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 1 ).path();
-    const auto & str  = path.string();
+[[noreturn]] inline void throw_copy_error( const std::filesystem::path & from, const std::filesystem::path & to, std::error_code ec )
+{
+    throw std::filesystem::filesystem_error( "cannot copy file", from, to, ec );
+}
 
-    lua_settop( L, 0 );
-    lua_pushlstring( L, str.c_str(), str.size() );
+#if defined( __linux__ )
+// Errors for which the next strategy is tried instead of failing the copy.
+inline bool is_unsupported_copy_error( int error ) noexcept
+{
+    return error == ENOSYS || error == EOPNOTSUPP || error == ENOTTY || error == EXDEV || error == EINVAL ||
+           error == ENOTSUP || error == EPERM || error == EBADF;
+}
 
-    return 1;
-END_FUNCTION
+// Copies the data from 'in' to 'out' from 'offset' until the end of the input file with 'strategy'.
+// Returns 0 when done or the errno value of the failure; 'offset' is updated with the data copied so far.
+inline int copy_data( int in, int out, copy_strategy strategy, off_t size, off_t & offset ) noexcept
+{
+    constexpr std::size_t chunk_size = std::size_t( 1 ) << 30;
 
-BEGIN_FUNCTION( de_gc )
-    auto & self = pg::to_user_data< std::filesystem::directory_entry >( L, 1 );
+    switch( strategy )
+    {
+    case copy_strategy::reflink:
+# if defined( FICLONE )
+        if( offset != 0 )
+        {
+            return EINVAL;
+        }
+        if( ::ioctl( out, FICLONE, in ) != 0 )
+        {
+            return errno;
+        }
+        offset = size;
+        return 0;
+# else
+        return ENOSYS;
+# endif
 
-    self.~directory_entry();
+    case copy_strategy::copy_file_range:
+# if defined( SYS_copy_file_range )
+        for( ;; )
+        {
+            loff_t     in_offset = offset;
+            loff_t     out_offset = offset;
+            const auto n         = ::syscall( SYS_copy_file_range, in, &in_offset, out, &out_offset, chunk_size, 0u );
+            if( n < 0 )
+            {
+                if( errno == EINTR )
+                {
+                    continue;
+                }
+                return errno;
+            }
+            if( n == 0 )
+            {
+                // Files of pseudo filesystems (e.g. procfs) may report a wrong size and return no data,
+                // these files and empty files are left to 'readwrite'.
+                return offset < size || offset == 0 ? EINVAL : 0;
+            }
+            offset += static_cast< off_t >( n );
+        }
+# else
+        return ENOSYS;
+# endif
 
-    return 0;
-END_FUNCTION
+    case copy_strategy::sendfile:
+        // sendfile writes at the file position of 'out', which the strategies before it leave at 0
+        // as they write at explicit offsets; a copy that falls back after copying part of the data
+        // must continue at 'offset'.
+        if( ::lseek( out, offset, SEEK_SET ) < 0 )
+        {
+            return errno;
+        }
+        for( ;; )
+        {
+            const auto n = ::sendfile( out, in, &offset, chunk_size );
+            if( n < 0 )
+            {
+                if( errno == EINTR )
+                {
+                    continue;
+                }
+                return errno;
+            }
+            if( n == 0 )
+            {
+                return offset < size || offset == 0 ? EINVAL : 0;
+            }
+        }
 
-BEGIN_FUNCTION( de_eq )
-    const auto & left  = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 1 );
-    const auto & right = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 2 );
+    default:
+    {
+        constexpr std::size_t buffer_size = std::size_t( 1 ) << 20;
 
-    return pg::return_boolean( L, left == right );
-END_FUNCTION
+        std::unique_ptr< char[] > buffer( new( std::nothrow ) char[ buffer_size ] );
+        if( !buffer )
+        {
+            return ENOMEM;
+        }
+        ::posix_fadvise( in, offset, 0, POSIX_FADV_SEQUENTIAL );
+        for( ;; )
+        {
+            const auto n = ::pread( in, buffer.get(), buffer_size, offset );
+            if( n < 0 )
+            {
+                if( errno == EINTR )
+                {
+                    continue;
+                }
+                return errno;
+            }
+            if( n == 0 )
+            {
+                return 0;
+            }
+            for( ssize_t written = 0 ; written < n ; )
+            {
+                const auto w = ::pwrite( out, buffer.get() + written, static_cast< std::size_t >( n - written ), offset + written );
+                if( w < 0 )
+                {
+                    if( errno == EINTR )
+                    {
+                        continue;
+                    }
+                    return errno;
+                }
+                written += w;
+            }
+            offset += static_cast< off_t >( n );
+        }
+    }
+    }
+}
+#endif
 
-BEGIN_FUNCTION( de_lt )
-    const auto & left  = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 1 );
-    const auto & right = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 2 );
+// Copies the regular file 'from' to 'to' like std::filesystem::copy_file does with 'options',
+// but with the data copied by 'strategy' or one of the strategies after it when it isn't supported.
+// Returns whether the file was copied and the strategy that copied the data.
+inline copy_result copy_file_contents( const std::filesystem::path & from, const std::filesystem::path & to,
+                                       std::filesystem::copy_options options, copy_strategy strategy )
+{
+    using std::filesystem::copy_options;
 
-    return pg::return_boolean( L, left < right );
-END_FUNCTION
+#if defined( __linux__ )
+    if( strategy == copy_strategy::library )
+    {
+        return { std::filesystem::copy_file( from, to, options ), copy_strategy::library };
+    }
 
-BEGIN_FUNCTION( de_le )
-    const auto & left  = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 1 );
-    const auto & right = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 2 );
+    const auto error = []( int e ){ return std::error_code( e, std::generic_category() ); };
 
-    return pg::return_boolean( L, left <= right );
-END_FUNCTION
+    pg::unique_fd in( ::open( from.c_str(), O_RDONLY | O_CLOEXEC ) );
+    struct stat   from_st;
+    if( !in || ::fstat( in.get(), &from_st ) != 0 )
+    {
+        pg::throw_copy_error( from, to, error( errno ) );
+    }
+    if( !S_ISREG( from_st.st_mode ) )
+    {
+        pg::throw_copy_error( from, to, std::make_error_code( std::errc::not_supported ) );
+    }
 
-BEGIN_PROTECTED_FUNCTION( de_assign )
-    auto & self = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 1 );
-    if( lua_type( L, 2 ) == LUA_TSTRING )
+    struct stat to_st;
+    const bool  to_exists = ::stat( to.c_str(), &to_st ) == 0;
+    if( !to_exists && errno != ENOENT )
     {
-        self.assign( pg::to_string_view( L, 2 ) );
+        pg::throw_copy_error( from, to, error( errno ) );
     }
-    else
+    if( to_exists )
     {
-        const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
-        self.assign( p );
+        if( !S_ISREG( to_st.st_mode ) )
+        {
+            pg::throw_copy_error( from, to, std::make_error_code( std::errc::not_supported ) );
+        }
+        if( to_st.st_dev == from_st.st_dev && to_st.st_ino == from_st.st_ino )
+        {
+            pg::throw_copy_error( from, to, std::make_error_code( std::errc::file_exists ) );
+        }
+        if( ( options & copy_options::skip_existing ) != copy_options::none )
+        {
+            return { false, strategy };
+        }
+        if( ( options & copy_options::update_existing ) != copy_options::none )
+        {
+            const bool newer = from_st.st_mtim.tv_sec > to_st.st_mtim.tv_sec ||
+                               ( from_st.st_mtim.tv_sec == to_st.st_mtim.tv_sec && from_st.st_mtim.tv_nsec > to_st.st_mtim.tv_nsec );
+            if( !newer )
+            {
+                return { false, strategy };
+            }
+        }
+        else if( ( options & copy_options::overwrite_existing ) == copy_options::none )
+        {
+            pg::throw_copy_error( from, to, std::make_error_code( std::errc::file_exists ) );
+        }
     }
-    return pg::return_nothing( L );
-CATCH_BAD_ALLOC
-CATCH_FILESYSTEM_ERROR
-END_PROTECTED_FUNCTION
 
-BEGIN_PROTECTED_FUNCTION( de_replace_filename )
-    auto & self = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 1 );
-    if( lua_type( L, 2 ) == LUA_TSTRING )
+    pg::unique_fd out( ::open( to.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | ( to_exists ? O_TRUNC : O_EXCL ), S_IWUSR ) );
+    if( !out )
     {
-        self.replace_filename( pg::to_string_view( L, 2 ) );
+        pg::throw_copy_error( from, to, error( errno ) );
     }
-    else
+
+    auto  used   = strategy == copy_strategy::automatic ? copy_strategy::reflink : strategy;
+    off_t offset = 0;
+    for( ;; )
     {
-        const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
-        self.replace_filename( p );
+        const int result = pg::copy_data( in.get(), out.get(), used, from_st.st_size, offset );
+        if( result == 0 )
+        {
+            break;
+        }
+        if( used == copy_strategy::readwrite || !pg::is_unsupported_copy_error( result ) )
+        {
+            pg::throw_copy_error( from, to, error( result ) );
+        }
+        used = static_cast< copy_strategy >( static_cast< int >( used ) + 1 );
     }
-    return pg::return_nothing( L );
-CATCH_BAD_ALLOC
-CATCH_FILESYSTEM_ERROR
-END_PROTECTED_FUNCTION
 
-BEGIN_PROTECTED_FUNCTION( de_refresh )
-    auto & self = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 1 );
-    self.refresh();
-    return pg::return_nothing( L );
-CATCH_BAD_ALLOC
-CATCH_FILESYSTEM_ERROR
-END_PROTECTED_FUNCTION
+    if( ::fchmod( out.get(), from_st.st_mode & 07777 ) != 0 )
+    {
+        pg::throw_copy_error( from, to, error( errno ) );
+    }
 
-BEGIN_PROTECTED_FUNCTION( de_path )
-    const auto & self = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 1 );
-    return pg::return_new_user_data< std::filesystem::path >( L, self.path() );
-CATCH_BAD_ALLOC
-CATCH_FILESYSTEM_ERROR
-END_PROTECTED_FUNCTION
+    return { true, used };
+#else
+    return { std::filesystem::copy_file( from, to, options ), copy_strategy::library };
+#endif
+}
 
-#define DE_CHECK_PROPERTY( PROPERTY )\
-BEGIN_PROTECTED_FUNCTION( de_##PROPERTY )\
-    const auto & self = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 1 );\
-    return pg::return_boolean( L, self.PROPERTY() );\
-CATCH_BAD_ALLOC \
-CATCH_FILESYSTEM_ERROR \
-END_PROTECTED_FUNCTION
+// The number of files copied with every strategy, indexed by copy_strategy.
+using copy_counts = std::array< std::size_t, std::size( copy_strategy_names ) - 1 >;
 
-DE_CHECK_PROPERTY( exists )
-DE_CHECK_PROPERTY( is_block_file )
-DE_CHECK_PROPERTY( is_character_file )
-DE_CHECK_PROPERTY( is_directory )
-DE_CHECK_PROPERTY( is_fifo )
-DE_CHECK_PROPERTY( is_other )
-DE_CHECK_PROPERTY( is_regular_file )
-DE_CHECK_PROPERTY( is_socket )
-DE_CHECK_PROPERTY( is_symlink )
+// Copies the entries of the directory 'from' into the existing directory 'to'.
+using copy_directory_function = std::function< void( const std::filesystem::path & from, const std::filesystem::path & to ) >;
 
-BEGIN_PROTECTED_FUNCTION( de_file_size )
-    const auto & self = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 1 );
-    return pg::return_integer( L, self.file_size() );
-CATCH_BAD_ALLOC
-CATCH_FILESYSTEM_ERROR
+// std::filesystem::copy with the regular files copied by 'copy_file_contents'.
+// The contents of a directory are copied by 'copy_directory' when it's set, otherwise recursively by this function.
+inline void copy_entry( const std::filesystem::path & from, const std::filesystem::path & to,
+                        std::filesystem::copy_options options, copy_strategy strategy, copy_counts & counts, bool in_recursive_copy = false,
+                        const copy_directory_function & copy_directory = nullptr )
+{
+    using std::filesystem::copy_options;
+
+    const auto has = [ options ]( copy_options option ){ return ( options & option ) != copy_options::none; };
+
+    const bool no_follow = has( copy_options::skip_symlinks ) || has( copy_options::copy_symlinks );
+    const auto f         = no_follow ? std::filesystem::symlink_status( from ) : std::filesystem::status( from );
+    const auto t         = ( no_follow || has( copy_options::create_symlinks ) ) ? std::filesystem::symlink_status( to )
+                                                                                 : std::filesystem::status( to );
+
+    if( !std::filesystem::exists( f ) )
+    {
+        pg::throw_copy_error( from, to, std::make_error_code( std::errc::no_such_file_or_directory ) );
+    }
+    if( std::filesystem::exists( t ) && std::filesystem::equivalent( from, to ) )
+    {
+        pg::throw_copy_error( from, to, std::make_error_code( std::errc::file_exists ) );
+    }
+    if( std::filesystem::is_other( f ) || std::filesystem::is_other( t ) ||
+        ( std::filesystem::is_directory( f ) && std::filesystem::is_regular_file( t ) ) )
+    {
+        pg::throw_copy_error( from, to, std::make_error_code( std::errc::not_supported ) );
+    }
+
+    if( std::filesystem::is_symlink( f ) )
+    {
+        if( has( copy_options::skip_symlinks ) )
+        {
+            return;
+        }
+        if( !std::filesystem::exists( t ) && has( copy_options::copy_symlinks ) )
+        {
+            std::filesystem::copy_symlink( from, to );
+            return;
+        }
+        pg::throw_copy_error( from, to, std::make_error_code( std::errc::not_supported ) );
+    }
+    else if( std::filesystem::is_regular_file( f ) )
+    {
+        if( has( copy_options::directories_only ) )
+        {
+            return;
+        }
+        if( has( copy_options::create_symlinks ) )
+        {
+            std::filesystem::create_symlink( from, to );
+            return;
+        }
+        if( has( copy_options::create_hard_links ) )
+        {
+            std::filesystem::create_hard_link( from, to );
+            return;
+        }
+
+        const auto result = std::filesystem::is_directory( t ) ? pg::copy_file_contents( from, to / from.filename(), options, strategy )
+                                                               : pg::copy_file_contents( from, to, options, strategy );
+        if( result.copied )
+        {
+            ++counts[ static_cast< std::size_t >( result.strategy ) ];
+        }
+    }
+    else if( std::filesystem::is_directory( f ) )
+    {
+        if( has( copy_options::create_symlinks ) )
+        {
+            pg::throw_copy_error( from, to, std::make_error_code( std::errc::is_a_directory ) );
+        }
+        if( !has( copy_options::recursive ) && ( options != copy_options::none || in_recursive_copy ) )
+        {
+            return;
+        }
+        if( !std::filesystem::exists( t ) )
+        {
+            std::filesystem::create_directory( to, from );
+        }
+        if( copy_directory )
+        {
+            copy_directory( from, to );
+            return;
+        }
+        for( const auto & entry : std::filesystem::directory_iterator( from ) )
+        {
+            pg::copy_entry( entry.path(), to / entry.path().filename(), options, strategy, counts, true );
+        }
+    }
+}
+
+// Reads the contents of file 'p' and passes them to 'consume( const unsigned char * data, std::size_t size )'
+// in blocks of 1 MiB. The file is read rather than mapped in memory; a file that is truncated while it's
+// read just ends early, where reading a mapping beyond the new end raises SIGBUS.
+// Failures are thrown as a filesystem_error with 'what' as message.
+template< typename F >
+void read_file_contents( const std::filesystem::path & p, const char * const what, F && consume )
+{
+    constexpr std::size_t block_size = std::size_t( 1 ) << 20;
+
+    // Every thread reuses its buffer, files are hashed by many tasks on the same workers
+    thread_local std::unique_ptr< unsigned char[] > buffer;
+    if( !buffer )
+    {
+        buffer.reset( new unsigned char[ block_size ] );
+    }
+
+#if defined( __linux__ )
+    const unique_fd fd( ::open( p.c_str(), O_RDONLY | O_CLOEXEC ) );
+    if( !fd ) PG_UNLIKELY
+    {
+        throw std::filesystem::filesystem_error( what, p, std::error_code( errno, std::generic_category() ) );
+    }
+    ::posix_fadvise( fd.get(), 0, 0, POSIX_FADV_SEQUENTIAL );
+
+    for( ;; )
+    {
+        const auto n = ::read( fd.get(), buffer.get(), block_size );
+        if( n > 0 )
+        {
+            consume( buffer.get(), static_cast< std::size_t >( n ) );
+        }
+        else if( n == 0 )
+        {
+            return;
+        }
+        else if( errno != EINTR ) PG_UNLIKELY
+        {
+            throw std::filesystem::filesystem_error( what, p, std::error_code( errno, std::generic_category() ) );
+        }
+    }
+#else
+    std::ifstream file( p, std::ios::binary );
+    if( !file ) PG_UNLIKELY
+    {
+        throw std::filesystem::filesystem_error( what, p, std::make_error_code( std::errc::no_such_file_or_directory ) );
+    }
+
+    while( file )
+    {
+        file.read( reinterpret_cast< char * >( buffer.get() ), static_cast< std::streamsize >( block_size ) );
+        if( file.gcount() > 0 )
+        {
+            consume( buffer.get(), static_cast< std::size_t >( file.gcount() ) );
+        }
+    }
+    if( file.bad() ) PG_UNLIKELY
+    {
+        throw std::filesystem::filesystem_error( what, p, std::make_error_code( std::errc::io_error ) );
+    }
+#endif
+}
+
+// The contents of a file read by read_file.
+struct file_contents
+{
+    std::unique_ptr< char[] > data;
+    std::size_t               size = 0;
+};
+
+// Reads the whole file 'p' into one buffer.
+// The buffer of a regular file is allocated once with the size reported by fstat, so the file is
+// read with one large read plus the read that detects the end of the file. Files of which the
+// size is unknown, like the ones in /proc, or that grow while they're read, are read into a
+// buffer that doubles in size.
+file_contents read_file( const std::filesystem::path & p )
+{
+    constexpr std::size_t min_capacity = std::size_t( 1 ) << 16;
+    // Linux transfers at most 0x7ffff000 bytes per read.
+    constexpr std::size_t max_read     = 0x7ffff000;
+
+    file_contents contents;
+    std::size_t   capacity = min_capacity;
+
+    const auto grow = [ &contents, &capacity ]( std::size_t new_capacity )
+    {
+        std::unique_ptr< char[] > data( new char[ new_capacity ] );
+        if( contents.size )
+        {
+            std::memcpy( data.get(), contents.data.get(), contents.size );
+        }
+        contents.data = std::move( data );
+        capacity      = new_capacity;
+    };
+
+#if defined( __linux__ )
+    const unique_fd fd( ::open( p.c_str(), O_RDONLY | O_CLOEXEC ) );
+    struct stat     st;
+    if( !fd || ::fstat( fd.get(), &st ) != 0 ) PG_UNLIKELY
+    {
+        throw std::filesystem::filesystem_error( "cannot read file", p, std::error_code( errno, std::generic_category() ) );
+    }
+    if( S_ISDIR( st.st_mode ) ) PG_UNLIKELY
+    {
+        throw std::filesystem::filesystem_error( "cannot read file", p, std::make_error_code( std::errc::is_a_directory ) );
+    }
+    if( S_ISREG( st.st_mode ) && st.st_size > 0 )
+    {
+        // One byte more than the size, a full buffer means the file has grown
+        capacity = static_cast< std::size_t >( st.st_size ) + 1;
+        ::posix_fadvise( fd.get(), 0, 0, POSIX_FADV_SEQUENTIAL );
+    }
+    grow( capacity );
+
+    for( ;; )
+    {
+        if( contents.size == capacity )
+        {
+            grow( capacity * 2 );
+        }
+
+        const auto n = ::read( fd.get(), contents.data.get() + contents.size, std::min( capacity - contents.size, max_read ) );
+        if( n > 0 )
+        {
+            contents.size += static_cast< std::size_t >( n );
+        }
+        else if( n == 0 )
+        {
+            return contents;
+        }
+        else if( errno != EINTR ) PG_UNLIKELY
+        {
+            throw std::filesystem::filesystem_error( "cannot read file", p, std::error_code( errno, std::generic_category() ) );
+        }
+    }
+#else
+    std::ifstream file( p, std::ios::binary );
+    if( !file || std::filesystem::is_directory( p ) ) PG_UNLIKELY
+    {
+        throw std::filesystem::filesystem_error( "cannot read file", p, std::make_error_code( std::errc::no_such_file_or_directory ) );
+    }
+
+    std::error_code ec;
+    const auto      size = std::filesystem::file_size( p, ec );
+    if( !ec && size > 0 )
+    {
+        capacity = static_cast< std::size_t >( size ) + 1;
+    }
+    grow( capacity );
+
+    while( file )
+    {
+        if( contents.size == capacity )
+        {
+            grow( capacity * 2 );
+        }
+        file.read( contents.data.get() + contents.size, static_cast< std::streamsize >( std::min( capacity - contents.size, max_read ) ) );
+        contents.size += static_cast< std::size_t >( file.gcount() );
+    }
+    if( file.bad() ) PG_UNLIKELY
+    {
+        throw std::filesystem::filesystem_error( "cannot read file", p, std::make_error_code( std::errc::io_error ) );
+    }
+    return contents;
+#endif
+}
+
+// Reads the lines of a file through one large buffer.
+// The newlines are found with memchr, which the C library implements with vector instructions,
+// and the lines are returned as views in the buffer that are valid until the next call of 'next'.
+// The buffer grows when a line doesn't fit, up to 'max_line' bytes when it's not 0; a longer
+// line is an error. When 'crlf' is set a carriage return before the newline is dropped as well.
+// The last line is returned even when it doesn't end with a newline.
+class line_reader
+{
+public:
+    line_reader( const std::filesystem::path & p, std::size_t buffer_size, std::size_t max_line, bool crlf )
+        : p( p )
+        , capacity( std::max< std::size_t >( buffer_size, 1 ) )
+        , max_line( max_line )
+        , crlf( crlf )
+    {
+#if defined( __linux__ )
+        fd.reset( ::open( p.c_str(), O_RDONLY | O_CLOEXEC ) );
+        struct stat st;
+        if( !fd || ::fstat( fd.get(), &st ) != 0 ) PG_UNLIKELY
+        {
+            throw std::filesystem::filesystem_error( "cannot read file", p, std::error_code( errno, std::generic_category() ) );
+        }
+        // A small file doesn't need a large buffer
+        if( S_ISREG( st.st_mode ) && static_cast< std::uintmax_t >( st.st_size ) < capacity )
+        {
+            capacity = static_cast< std::size_t >( st.st_size ) + 1;
+        }
+        ::posix_fadvise( fd.get(), 0, 0, POSIX_FADV_SEQUENTIAL );
+#else
+        file.open( p, std::ios::binary );
+        if( !file ) PG_UNLIKELY
+        {
+            throw std::filesystem::filesystem_error( "cannot read file", p, std::make_error_code( std::errc::no_such_file_or_directory ) );
+        }
+#endif
+        buffer.reset( new char[ capacity ] );
+    }
+
+    // Sets 'line' to the next line, returns false at the end of the file.
+    bool next( std::string_view & line )
+    {
+        for( ;; )
+        {
+            const auto available = end - begin;
+            const auto newline   = static_cast< const char * >( std::memchr( buffer.get() + begin, '\n', available ) );
+            if( newline )
+            {
+                const auto length = static_cast< std::size_t >( newline - ( buffer.get() + begin ) );
+                line  = trim( std::string_view( buffer.get() + begin, length ) );
+                begin += length + 1;
+                check_length( line.size() );
+                return true;
+            }
+
+            if( eof )
+            {
+                if( available == 0 )
+                {
+                    return false;
+                }
+                line  = trim( std::string_view( buffer.get() + begin, available ) );
+                begin = end;
+                check_length( line.size() );
+                return true;
+            }
+            // The carriage return of the incomplete line may still be followed by its newline
+            check_length( crlf && available > 0 ? available - 1 : available );
+
+            fill();
+        }
+    }
+
+private:
+    void check_length( std::size_t length ) const
+    {
+        if( max_line && length > max_line ) PG_UNLIKELY
+        {
+            throw std::filesystem::filesystem_error( "line too long", p, std::make_error_code( std::errc::value_too_large ) );
+        }
+    }
+
+    std::string_view trim( std::string_view line ) const noexcept
+    {
+        if( crlf && !line.empty() && line.back() == '\r' )
+        {
+            line.remove_suffix( 1 );
+        }
+        return line;
+    }
+
+    // Moves the incomplete line to the start of the buffer, grows the buffer when the line fills it,
+    // and reads as much as fits after it.
+    void fill()
+    {
+        const auto available = end - begin;
+        if( available == capacity )
+        {
+            // Room for the longest line, its carriage return and its newline is enough
+            const auto new_capacity = max_line ? std::min( capacity * 2, max_line + 3 ) : capacity * 2;
+            std::unique_ptr< char[] > new_buffer( new char[ new_capacity ] );
+            std::memcpy( new_buffer.get(), buffer.get() + begin, available );
+            buffer   = std::move( new_buffer );
+            capacity = new_capacity;
+        }
+        else if( begin > 0 )
+        {
+            std::memmove( buffer.get(), buffer.get() + begin, available );
+        }
+        begin = 0;
+        end   = available;
+
+#if defined( __linux__ )
+        for( ;; )
+        {
+            const auto n = ::read( fd.get(), buffer.get() + end, capacity - end );
+            if( n > 0 )
+            {
+                end += static_cast< std::size_t >( n );
+                return;
+            }
+            else if( n == 0 )
+            {
+                eof = true;
+                return;
+            }
+            else if( errno != EINTR ) PG_UNLIKELY
+            {
+                throw std::filesystem::filesystem_error( "cannot read file", p, std::error_code( errno, std::generic_category() ) );
+            }
+        }
+#else
+        file.read( buffer.get() + end, static_cast< std::streamsize >( capacity - end ) );
+        end += static_cast< std::size_t >( file.gcount() );
+        if( file.bad() ) PG_UNLIKELY
+        {
+            throw std::filesystem::filesystem_error( "cannot read file", p, std::make_error_code( std::errc::io_error ) );
+        }
+        eof = file.gcount() == 0;
+#endif
+    }
+
+    const std::filesystem::path p;
+    std::size_t                 capacity;
+    std::unique_ptr< char[] >   buffer;
+    std::size_t                 begin = 0;
+    std::size_t                 end   = 0;
+    const std::size_t           max_line;
+    const bool                  crlf;
+    bool                        eof   = false;
+#if defined( __linux__ )
+    unique_fd                   fd;
+#else
+    std::ifstream               file;
+#endif
+};
+
+struct lines_iterator
+{
+    line_reader reader;
+    // The number of lines in a table per call or 0 to return one string per call
+    std::size_t batch_size;
+};
+
+#if defined( __linux__ )
+// Writes 'size' bytes from 'data' to 'fd', returns false with errno set when a write fails.
+inline bool write_all( int fd, const char * data, std::size_t size ) noexcept
+{
+    // Linux transfers at most 0x7ffff000 bytes per write.
+    constexpr std::size_t max_write = 0x7ffff000;
+
+    while( size > 0 )
+    {
+        const auto n = ::write( fd, data, std::min( size, max_write ) );
+        if( n >= 0 )
+        {
+            data += n;
+            size -= static_cast< std::size_t >( n );
+        }
+        else if( errno != EINTR )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+struct write_file_options
+{
+    bool append      = false;
+    bool preallocate = false;
+    bool sync        = false;
+};
+
+// Writes 'size' bytes from 'data' to file 'p', which is created when it doesn't exist and
+// truncated unless 'append' is set.
+// On Linux the file is opened, written with as few writes as the kernel allows and closed.
+// 'preallocate' reserves the blocks with fallocate before the first write so the filesystem can
+// allocate them contiguously without changing the size of the file, it's silently skipped when
+// the filesystem doesn't support it.
+// 'sync' flushes the data to the device with fdatasync before the file is closed.
+void write_file( const std::filesystem::path & p, const char * data, std::size_t size, const write_file_options & options )
+{
+#if defined( __linux__ )
+    const auto fail = [ &p ]()
+    {
+        throw std::filesystem::filesystem_error( "cannot write file", p, std::error_code( errno, std::generic_category() ) );
+    };
+
+    unique_fd fd( ::open( p.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | ( options.append ? O_APPEND : O_TRUNC ), 0666 ) );
+    if( !fd ) PG_UNLIKELY
+    {
+        fail();
+    }
+
+    if( options.preallocate && size > 0 )
+    {
+        off_t offset = 0;
+        if( options.append )
+        {
+            struct stat st;
+            if( ::fstat( fd.get(), &st ) != 0 ) PG_UNLIKELY
+            {
+                fail();
+            }
+            offset = st.st_size;
+        }
+        if( ::fallocate( fd.get(), FALLOC_FL_KEEP_SIZE, offset, static_cast< off_t >( size ) ) != 0 && errno != EOPNOTSUPP && errno != ENOSYS ) PG_UNLIKELY
+        {
+            fail();
+        }
+    }
+
+    if( !write_all( fd.get(), data, size ) ) PG_UNLIKELY
+    {
+        fail();
+    }
+
+    if( options.sync && ::fdatasync( fd.get() ) != 0 ) PG_UNLIKELY
+    {
+        fail();
+    }
+    // Errors of delayed writes may only be reported by close
+    if( ::close( fd.release() ) != 0 ) PG_UNLIKELY
+    {
+        fail();
+    }
+#else
+    std::ofstream file( p, std::ios::binary | ( options.append ? std::ios::app : std::ios::trunc ) );
+    if( file )
+    {
+        file.write( data, static_cast< std::streamsize >( size ) );
+        file.close();
+    }
+    if( !file ) PG_UNLIKELY
+    {
+        throw std::filesystem::filesystem_error( "cannot write file", p, std::make_error_code( std::errc::io_error ) );
+    }
+#endif
+}
+
+inline std::uint32_t load_le32( const unsigned char * p ) noexcept
+{
+    return std::uint32_t( p[ 0 ] ) | std::uint32_t( p[ 1 ] ) << 8 | std::uint32_t( p[ 2 ] ) << 16 | std::uint32_t( p[ 3 ] ) << 24;
+}
+
+inline std::uint64_t load_le64( const unsigned char * p ) noexcept
+{
+    return std::uint64_t( load_le32( p ) ) | std::uint64_t( load_le32( p + 4 ) ) << 32;
+}
+
+inline std::uint32_t load_be32( const unsigned char * p ) noexcept
+{
+    return std::uint32_t( p[ 0 ] ) << 24 | std::uint32_t( p[ 1 ] ) << 16 | std::uint32_t( p[ 2 ] ) << 8 | std::uint32_t( p[ 3 ] );
+}
+
+// XXH64 with seed 0, see https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+// The digest is the hash in big endian byte order, which is how xxhsum prints it.
+class xxh64_hasher
+{
+public:
+    static constexpr std::size_t digest_size = 8;
+
+    void update( const unsigned char * data, std::size_t size ) noexcept
+    {
+        total += size;
+        if( buffered + size < stripe_size )
+        {
+            std::memcpy( buffer + buffered, data, size );
+            buffered += size;
+            return;
+        }
+        if( buffered )
+        {
+            const auto fill = stripe_size - buffered;
+            std::memcpy( buffer + buffered, data, fill );
+            consume_stripe( buffer );
+            data     += fill;
+            size     -= fill;
+            buffered  = 0;
+        }
+        for( ; size >= stripe_size ; data += stripe_size, size -= stripe_size )
+        {
+            consume_stripe( data );
+        }
+        std::memcpy( buffer, data, size );
+        buffered = size;
+    }
+
+    void digest( unsigned char * out ) const noexcept
+    {
+        const auto h = value();
+        for( std::size_t i = 0 ; i < digest_size ; ++i )
+        {
+            out[ i ] = static_cast< unsigned char >( h >> ( 56 - 8 * i ) );
+        }
+    }
+
+    std::uint64_t value() const noexcept
+    {
+        std::uint64_t h = total >= stripe_size ? rotl( v[ 0 ], 1 ) + rotl( v[ 1 ], 7 ) + rotl( v[ 2 ], 12 ) + rotl( v[ 3 ], 18 )
+                                               : prime5;
+        if( total >= stripe_size )
+        {
+            for( const auto lane : v )
+            {
+                h ^= round( 0, lane );
+                h  = h * prime1 + prime4;
+            }
+        }
+        h += total;
+
+        const unsigned char * p = buffer;
+        auto                  n = buffered;
+        for( ; n >= 8 ; p += 8, n -= 8 )
+        {
+            h ^= round( 0, load_le64( p ) );
+            h  = rotl( h, 27 ) * prime1 + prime4;
+        }
+        if( n >= 4 )
+        {
+            h ^= std::uint64_t( load_le32( p ) ) * prime1;
+            h  = rotl( h, 23 ) * prime2 + prime3;
+            p += 4;
+            n -= 4;
+        }
+        for( ; n > 0 ; ++p, --n )
+        {
+            h ^= *p * prime5;
+            h  = rotl( h, 11 ) * prime1;
+        }
+
+        h ^= h >> 33;
+        h *= prime2;
+        h ^= h >> 29;
+        h *= prime3;
+        h ^= h >> 32;
+
+        return h;
+    }
+
+private:
+    static constexpr std::uint64_t prime1      = 0x9E3779B185EBCA87ULL;
+    static constexpr std::uint64_t prime2      = 0xC2B2AE3D27D4EB4FULL;
+    static constexpr std::uint64_t prime3      = 0x165667B19E3779F9ULL;
+    static constexpr std::uint64_t prime4      = 0x85EBCA77C2B2AE63ULL;
+    static constexpr std::uint64_t prime5      = 0x27D4EB2F165667C5ULL;
+    static constexpr std::size_t   stripe_size = 32;
+
+    static std::uint64_t rotl( std::uint64_t x, int r ) noexcept
+    {
+        return ( x << r ) | ( x >> ( 64 - r ) );
+    }
+
+    static std::uint64_t round( std::uint64_t acc, std::uint64_t input ) noexcept
+    {
+        return rotl( acc + input * prime2, 31 ) * prime1;
+    }
+
+    void consume_stripe( const unsigned char * p ) noexcept
+    {
+        v[ 0 ] = round( v[ 0 ], load_le64( p ) );
+        v[ 1 ] = round( v[ 1 ], load_le64( p + 8 ) );
+        v[ 2 ] = round( v[ 2 ], load_le64( p + 16 ) );
+        v[ 3 ] = round( v[ 3 ], load_le64( p + 24 ) );
+    }
+
+    std::uint64_t v[ 4 ]                = { prime1 + prime2, prime2, 0, 0 - prime1 };
+    std::uint64_t total                 = 0;
+    unsigned char buffer[ stripe_size ] = {};
+    std::size_t   buffered              = 0;
+};
+
+static constexpr std::uint32_t sha256_k[ 64 ] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+inline void sha256_compress_generic( std::uint32_t * state, const unsigned char * data, std::size_t blocks ) noexcept
+{
+    const auto rotr = []( std::uint32_t x, int r ){ return ( x >> r ) | ( x << ( 32 - r ) ); };
+
+    for( ; blocks > 0 ; --blocks, data += 64 )
+    {
+        std::uint32_t w[ 64 ];
+        for( int i = 0 ; i < 16 ; ++i )
+        {
+            w[ i ] = load_be32( data + 4 * i );
+        }
+        for( int i = 16 ; i < 64 ; ++i )
+        {
+            const auto s0 = rotr( w[ i - 15 ], 7 ) ^ rotr( w[ i - 15 ], 18 ) ^ ( w[ i - 15 ] >> 3 );
+            const auto s1 = rotr( w[ i - 2 ], 17 ) ^ rotr( w[ i - 2 ], 19 ) ^ ( w[ i - 2 ] >> 10 );
+            w[ i ] = w[ i - 16 ] + s0 + w[ i - 7 ] + s1;
+        }
+
+        auto a = state[ 0 ], b = state[ 1 ], c = state[ 2 ], d = state[ 3 ];
+        auto e = state[ 4 ], f = state[ 5 ], g = state[ 6 ], h = state[ 7 ];
+        for( int i = 0 ; i < 64 ; ++i )
+        {
+            const auto t1 = h + ( rotr( e, 6 ) ^ rotr( e, 11 ) ^ rotr( e, 25 ) ) + ( ( e & f ) ^ ( ~e & g ) ) + sha256_k[ i ] + w[ i ];
+            const auto t2 = ( rotr( a, 2 ) ^ rotr( a, 13 ) ^ rotr( a, 22 ) ) + ( ( a & b ) ^ ( a & c ) ^ ( b & c ) );
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[ 0 ] += a; state[ 1 ] += b; state[ 2 ] += c; state[ 3 ] += d;
+        state[ 4 ] += e; state[ 5 ] += f; state[ 6 ] += g; state[ 7 ] += h;
+    }
+}
+
+#if defined( PG_SHA_NI )
+// SHA-256 with the SHA extensions of x86 processors, selected at runtime when the processor has them.
+__attribute__(( target( "sha,sse4.1,ssse3" ) ))
+inline void sha256_compress_sha_ni( std::uint32_t * state, const unsigned char * data, std::size_t blocks ) noexcept
+{
+    const __m128i byte_swap = _mm_set_epi64x( 0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL );
+
+    // The instructions take the state as ABEF and CDGH
+    __m128i tmp     = _mm_shuffle_epi32( _mm_loadu_si128( reinterpret_cast< const __m128i * >( state ) ), 0xB1 );
+    __m128i state1  = _mm_shuffle_epi32( _mm_loadu_si128( reinterpret_cast< const __m128i * >( state + 4 ) ), 0x1B );
+    __m128i state0  = _mm_alignr_epi8( tmp, state1, 8 );
+    state1          = _mm_blend_epi16( state1, tmp, 0xF0 );
+
+    for( ; blocks > 0 ; --blocks, data += 64 )
+    {
+        const __m128i abef = state0;
+        const __m128i cdgh = state1;
+        __m128i       w[ 4 ];
+
+        for( int g = 0 ; g < 16 ; ++g )
+        {
+            if( g < 4 )
+            {
+                w[ g ] = _mm_shuffle_epi8( _mm_loadu_si128( reinterpret_cast< const __m128i * >( data + 16 * g ) ), byte_swap );
+            }
+
+            __m128i msg = _mm_add_epi32( w[ g % 4 ], _mm_loadu_si128( reinterpret_cast< const __m128i * >( sha256_k + 4 * g ) ) );
+            state1      = _mm_sha256rnds2_epu32( state1, state0, msg );
+            if( g >= 3 && g <= 14 )
+            {
+                auto & next = w[ ( g + 1 ) % 4 ];
+                next        = _mm_add_epi32( next, _mm_alignr_epi8( w[ g % 4 ], w[ ( g + 3 ) % 4 ], 4 ) );
+                next        = _mm_sha256msg2_epu32( next, w[ g % 4 ] );
+            }
+            msg    = _mm_shuffle_epi32( msg, 0x0E );
+            state0 = _mm_sha256rnds2_epu32( state0, state1, msg );
+            if( g >= 1 && g <= 12 )
+            {
+                w[ ( g + 3 ) % 4 ] = _mm_sha256msg1_epu32( w[ ( g + 3 ) % 4 ], w[ g % 4 ] );
+            }
+        }
+
+        state0 = _mm_add_epi32( state0, abef );
+        state1 = _mm_add_epi32( state1, cdgh );
+    }
+
+    tmp    = _mm_shuffle_epi32( state0, 0x1B );
+    state1 = _mm_shuffle_epi32( state1, 0xB1 );
+    state0 = _mm_blend_epi16( tmp, state1, 0xF0 );
+    state1 = _mm_alignr_epi8( state1, tmp, 8 );
+    _mm_storeu_si128( reinterpret_cast< __m128i * >( state ), state0 );
+    _mm_storeu_si128( reinterpret_cast< __m128i * >( state + 4 ), state1 );
+}
+
+inline bool has_sha_ni() noexcept
+{
+    unsigned eax, ebx, ecx, edx;
+    if( !__get_cpuid( 1, &eax, &ebx, &ecx, &edx ) || !( ecx & bit_SSE4_1 ) || !( ecx & bit_SSSE3 ) )
+    {
+        return false;
+    }
+    return __get_cpuid_count( 7, 0, &eax, &ebx, &ecx, &edx ) && ( ebx & bit_SHA );
+}
+#endif
+
+class sha256_hasher
+{
+public:
+    static constexpr std::size_t digest_size = 32;
+
+    void update( const unsigned char * data, std::size_t size ) noexcept
+    {
+        total += size;
+        if( buffered )
+        {
+            const auto fill = std::min( block_size - buffered, size );
+            std::memcpy( buffer + buffered, data, fill );
+            buffered += fill;
+            data     += fill;
+            size     -= fill;
+            if( buffered < block_size )
+            {
+                return;
+            }
+            compress( state, buffer, 1 );
+            buffered = 0;
+        }
+        if( size >= block_size )
+        {
+            compress( state, data, size / block_size );
+            data += size - size % block_size;
+            size %= block_size;
+        }
+        std::memcpy( buffer, data, size );
+        buffered = size;
+    }
+
+    void digest( unsigned char * out ) const noexcept
+    {
+        auto          copy = *this;
+        unsigned char padding[ 2 * block_size ] = { 0x80 };
+        const auto    pad  = ( buffered < block_size - 8 ? block_size : 2 * block_size ) - buffered;
+        const auto    bits = total * 8;
+        for( int i = 0 ; i < 8 ; ++i )
+        {
+            padding[ pad - 1 - i ] = static_cast< unsigned char >( bits >> ( 8 * i ) );
+        }
+        copy.update( padding, pad );
+
+        for( std::size_t i = 0 ; i < digest_size ; ++i )
+        {
+            out[ i ] = static_cast< unsigned char >( copy.state[ i / 4 ] >> ( 24 - 8 * ( i % 4 ) ) );
+        }
+    }
+
+private:
+    static constexpr std::size_t block_size = 64;
+
+    using compress_function = void ( * )( std::uint32_t *, const unsigned char *, std::size_t ) noexcept;
+
+    static const compress_function compress;
+
+    std::uint32_t state[ 8 ]             = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    std::uint64_t total                  = 0;
+    unsigned char buffer[ block_size ]   = {};
+    std::size_t   buffered               = 0;
+};
+
+#if defined( PG_SHA_NI )
+inline const sha256_hasher::compress_function sha256_hasher::compress = has_sha_ni() ? sha256_compress_sha_ni : sha256_compress_generic;
+#else
+inline const sha256_hasher::compress_function sha256_hasher::compress = sha256_compress_generic;
+#endif
+
+enum class hash_algorithm
+{
+    xxh64,
+    sha256
+};
+
+static constexpr const char * const hash_algorithm_names[] = { "xxh64", "sha256", nullptr };
+
+template< typename Hasher >
+std::string hash_file_with( const std::filesystem::path & p )
+{
+    Hasher hasher;
+    pg::read_file_contents( p, "cannot hash file", [ &hasher ]( const unsigned char * data, std::size_t size ){ hasher.update( data, size ); } );
+
+    unsigned char digest[ Hasher::digest_size ];
+    hasher.digest( digest );
+
+    static constexpr char digits[] = "0123456789abcdef";
+    std::string           hex( 2 * Hasher::digest_size, '\0' );
+    for( std::size_t i = 0 ; i < Hasher::digest_size ; ++i )
+    {
+        hex[ 2 * i ]     = digits[ digest[ i ] >> 4 ];
+        hex[ 2 * i + 1 ] = digits[ digest[ i ] & 0xF ];
+    }
+
+    return hex;
+}
+
+// Returns the digest of the contents of file 'p' as a hexadecimal string.
+inline std::string hash_file( const std::filesystem::path & p, hash_algorithm algorithm )
+{
+    switch( algorithm )
+    {
+    case hash_algorithm::sha256:
+        return hash_file_with< sha256_hasher >( p );
+    case hash_algorithm::xxh64:
+    default:
+        return hash_file_with< xxh64_hasher >( p );
+    }
+}
+
+// A thread pool where every worker has its own task queue.
+// Tasks submitted by a worker are pushed on the queue of that worker and are taken from the back
+// (depth first). Idle workers steal tasks from the front of the queues of the other workers.
+// The first exception thrown by a task cancels the remaining tasks and is rethrown by 'wait'.
+class work_stealing_pool
+{
+public:
+    using task = std::function< void() >;
+
+    static constexpr std::size_t no_worker = static_cast< std::size_t >( -1 );
+
+    explicit work_stealing_pool( std::size_t thread_count )
+        : queues( std::max< std::size_t >( thread_count, 1 ) )
+    {
+        try
+        {
+            threads.reserve( queues.size() );
+            for( std::size_t i = 0 ; i < queues.size() ; ++i )
+            {
+                threads.emplace_back( [ this, i ]{ run( i ); } );
+            }
+        }
+        catch( ... )
+        {
+            stop_workers();
+            throw;
+        }
+    }
+
+    work_stealing_pool( const work_stealing_pool & ) = delete;
+    work_stealing_pool & operator =( const work_stealing_pool & ) = delete;
+
+    ~work_stealing_pool()
+    {
+        stop_workers();
+    }
+
+    std::size_t size() const noexcept
+    {
+        return queues.size();
+    }
+
+    // Index of the worker of this pool that executes the current task or 'no_worker'.
+    std::size_t worker_index() const noexcept
+    {
+        return current_pool == this ? current_worker : no_worker;
+    }
+
+    void submit( task t )
+    {
+        const auto worker = worker_index();
+        const auto index  = worker != no_worker ? worker : next_queue++ % queues.size();
+
+        ++pending;
+        {
+            std::lock_guard< std::mutex > lock( queues[ index ].mutex );
+            queues[ index ].tasks.push_back( std::move( t ) );
+        }
+        ++queued;
+
+        {
+            std::lock_guard< std::mutex > lock( mutex );
+        }
+        work_available.notify_one();
+    }
+
+    // Blocks until all submitted tasks, including the tasks they submitted, are finished.
+    void wait()
+    {
+        std::unique_lock< std::mutex > lock( mutex );
+        idle.wait( lock, [ this ]{ return pending == 0; } );
+
+        if( error )
+        {
+            std::rethrow_exception( std::exchange( error, nullptr ) );
+        }
+    }
+
+    // Tasks that didn't start yet are discarded, running tasks should check 'cancelled'.
+    void cancel() noexcept
+    {
+        cancelled_flag = true;
+    }
+
+    bool cancelled() const noexcept
+    {
+        return cancelled_flag;
+    }
+
+private:
+    struct task_queue
+    {
+        std::mutex        mutex;
+        std::deque< task > tasks;
+    };
+
+    bool pop( std::size_t index, task & t )
+    {
+        {
+            auto & own = queues[ index ];
+            std::lock_guard< std::mutex > lock( own.mutex );
+            if( !own.tasks.empty() )
+            {
+                t = std::move( own.tasks.back() );
+                own.tasks.pop_back();
+                --queued;
+                return true;
+            }
+        }
+
+        for( std::size_t i = 1 ; i < queues.size() ; ++i )
+        {
+            auto & victim = queues[ ( index + i ) % queues.size() ];
+            std::lock_guard< std::mutex > lock( victim.mutex );
+            if( !victim.tasks.empty() )
+            {
+                t = std::move( victim.tasks.front() );
+                victim.tasks.pop_front();
+                --queued;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void execute( task & t ) noexcept
+    {
+        if( !cancelled_flag )
+        {
+            try
+            {
+                t();
+            }
+            catch( ... )
+            {
+                std::lock_guard< std::mutex > lock( mutex );
+                if( !error )
+                {
+                    error = std::current_exception();
+                }
+                cancelled_flag = true;
+            }
+        }
+        t = nullptr;
+
+        if( --pending == 0 )
+        {
+            {
+                std::lock_guard< std::mutex > lock( mutex );
+            }
+            idle.notify_all();
+        }
+    }
+
+    void run( std::size_t index ) noexcept
+    {
+        current_pool   = this;
+        current_worker = index;
+
+        task t;
+        while( true )
+        {
+            if( pop( index, t ) )
+            {
+                execute( t );
+                continue;
+            }
+
+            std::unique_lock< std::mutex > lock( mutex );
+            work_available.wait( lock, [ this ]{ return stopping || queued > 0; } );
+            if( stopping )
+            {
+                return;
+            }
+        }
+    }
+
+    void stop_workers() noexcept
+    {
+        {
+            std::lock_guard< std::mutex > lock( mutex );
+            stopping = true;
+        }
+        work_available.notify_all();
+
+        for( auto & thread : threads )
+        {
+            thread.join();
+        }
+    }
+
+    static inline thread_local const work_stealing_pool * current_pool   = nullptr;
+    static inline thread_local std::size_t                current_worker = no_worker;
+
+    std::vector< task_queue >  queues;
+    std::vector< std::thread > threads;
+    std::mutex                 mutex;
+    std::condition_variable    work_available;
+    std::condition_variable    idle;
+    std::atomic< std::size_t > pending        = 0;
+    std::atomic< std::size_t > queued         = 0;
+    std::atomic< std::size_t > next_queue     = 0;
+    std::atomic< bool >        cancelled_flag = false;
+    bool                       stopping       = false;
+    std::exception_ptr         error;
+};
+
+// A bounded queue to pass values from producer threads to a consumer.
+// 'push' blocks while the queue is full and 'pop' blocks while it is empty until the channel is closed.
+template< typename T >
+class channel
+{
+public:
+    explicit channel( std::size_t capacity ) noexcept
+        : capacity( std::max< std::size_t >( capacity, 1 ) )
+    {}
+
+    bool push( T value )
+    {
+        std::unique_lock< std::mutex > lock( mutex );
+        not_full.wait( lock, [ this ]{ return closed || values.size() < capacity; } );
+        if( closed )
+        {
+            return false;
+        }
+
+        values.push_back( std::move( value ) );
+        lock.unlock();
+        not_empty.notify_one();
+
+        return true;
+    }
+
+    bool pop( T & value )
+    {
+        std::unique_lock< std::mutex > lock( mutex );
+        not_empty.wait( lock, [ this ]{ return closed || !values.empty(); } );
+        if( values.empty() )
+        {
+            return false;
+        }
+
+        value = std::move( values.front() );
+        values.pop_front();
+        lock.unlock();
+        not_full.notify_one();
+
+        return true;
+    }
+
+    // Wakes up all blocked producers and consumers, values that are already queued can still be popped.
+    void close() noexcept
+    {
+        {
+            std::lock_guard< std::mutex > lock( mutex );
+            closed = true;
+        }
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+
+private:
+    const std::size_t       capacity;
+    std::mutex              mutex;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+    std::deque< T >         values;
+    bool                    closed = false;
+};
+
+// Limits the number of file descriptors that are open at the same time by the tasks of a pool.
+class descriptor_budget
+{
+public:
+    explicit descriptor_budget( std::size_t count ) noexcept
+        : available( count )
+    {}
+
+    void acquire( std::size_t count )
+    {
+        std::unique_lock< std::mutex > lock( mutex );
+        released.wait( lock, [ this, count ]{ return available >= count; } );
+        available -= count;
+    }
+
+    void release( std::size_t count ) noexcept
+    {
+        {
+            std::lock_guard< std::mutex > lock( mutex );
+            available += count;
+        }
+        released.notify_all();
+    }
+
+private:
+    std::mutex              mutex;
+    std::condition_variable released;
+    std::size_t             available;
+};
+
+class descriptor_guard
+{
+public:
+    descriptor_guard( descriptor_budget & budget, std::size_t count )
+        : budget( budget )
+        , count( count )
+    {
+        budget.acquire( count );
+    }
+
+    descriptor_guard( const descriptor_guard & ) = delete;
+    descriptor_guard & operator =( const descriptor_guard & ) = delete;
+
+    ~descriptor_guard()
+    {
+        budget.release( count );
+    }
+
+private:
+    descriptor_budget & budget;
+    std::size_t         count;
+};
+
+// 'copy_entry' with the directories read and the files copied by the workers of 'pool'.
+// A directory is created by the task that reads its parent, before the task that reads the directory
+// itself is submitted, so directories are always created before their contents.
+// Reading a directory takes one descriptor of 'max_open_files' and copying a file two.
+inline void parallel_copy( work_stealing_pool & pool, const std::filesystem::path & from, const std::filesystem::path & to,
+                           std::filesystem::copy_options options, copy_strategy strategy, std::size_t max_open_files, copy_counts & counts )
+{
+    using std::filesystem::copy_options;
+
+    const bool no_follow = ( options & ( copy_options::skip_symlinks | copy_options::copy_symlinks ) ) != copy_options::none;
+
+    descriptor_budget         budget( std::max< std::size_t >( max_open_files, 2 ) );
+    std::vector< copy_counts > worker_counts( pool.size() + 1, copy_counts{} );
+    const auto                local_counts = [ & ]() -> copy_counts &
+    {
+        const auto worker = pool.worker_index();
+        return worker_counts[ worker == work_stealing_pool::no_worker ? pool.size() : worker ];
+    };
+
+    copy_directory_function copy_directory;
+    copy_directory = [ & ]( const std::filesystem::path & from_directory, const std::filesystem::path & to_directory )
+    {
+        pool.submit( [ &, from_directory, to_directory ]
+        {
+            descriptor_guard guard( budget, 1 );
+            for( const auto & entry : std::filesystem::directory_iterator( from_directory ) )
+            {
+                if( pool.cancelled() )
+                {
+                    return;
+                }
+
+                auto target = to_directory / entry.path().filename();
+                if( entry.is_directory() && !( no_follow && entry.is_symlink() ) )
+                {
+                    pg::copy_entry( entry.path(), target, options, strategy, local_counts(), true, copy_directory );
+                }
+                else
+                {
+                    pool.submit( [ &, source = entry.path(), target = std::move( target ) ]
+                    {
+                        descriptor_guard file_guard( budget, 2 );
+                        pg::copy_entry( source, target, options, strategy, local_counts(), true );
+                    } );
+                }
+            }
+        } );
+    };
+
+    try
+    {
+        pg::copy_entry( from, to, options, strategy, local_counts(), false, copy_directory );
+    }
+    catch( ... )
+    {
+        // The submitted tasks refer to the locals of this function
+        pool.cancel();
+        try { pool.wait(); } catch( ... ) {}
+        throw;
+    }
+    pool.wait();
+
+    for( const auto & c : worker_counts )
+    {
+        for( std::size_t i = 0 ; i < counts.size() ; ++i )
+        {
+            counts[ i ] += c[ i ];
+        }
+    }
+}
+
+#if defined( __linux__ )
+// remove_all with the directories read and emptied by the workers of 'pool'. The entries are removed
+// with unlinkat relative to the descriptor of their directory, so paths are never resolved again.
+// A directory stays open until its subdirectories are removed, after which the last task that finishes
+// removes the directory from its parent. 'max_open_files' bounds the directories that are open in their
+// own task, 'root' included. When that many are open the subdirectories are removed depth first by the
+// task that found them instead of by new tasks; these are not counted, as waiting for the budget there
+// could deadlock, and add at most one open directory per level of nesting to every task.
+// Returns the number of removed entries like std::filesystem::remove_all.
+inline std::uintmax_t parallel_remove_all( work_stealing_pool & pool, const std::filesystem::path & root, std::size_t max_open_files )
+{
+    struct stat st;
+    if( ::lstat( root.c_str(), &st ) != 0 )
+    {
+        if( errno == ENOENT || errno == ENOTDIR )
+        {
+            return 0;
+        }
+        throw std::filesystem::filesystem_error( "cannot remove all", root, std::error_code( errno, std::generic_category() ) );
+    }
+    if( !S_ISDIR( st.st_mode ) )
+    {
+        if( ::unlink( root.c_str() ) != 0 )
+        {
+            throw std::filesystem::filesystem_error( "cannot remove all", root, std::error_code( errno, std::generic_category() ) );
+        }
+        return 1;
+    }
+
+    struct node
+    {
+        std::shared_ptr< node >    parent;
+        std::string                name;
+        unique_fd                  fd;
+        std::atomic< std::size_t > pending{ 1 };    // Reading the directory itself plus the subdirectories that are not removed yet
+        bool                       budgeted = false;
+    };
+
+    struct remover
+    {
+        work_stealing_pool &          pool;
+        const std::filesystem::path & root;
+        std::atomic< std::uintmax_t > removed{ 0 };
+        std::atomic< std::size_t >    open_directories{ 0 };
+        std::size_t                   max_open_directories;
+
+        [[noreturn]] void fail( const std::shared_ptr< node > & n, int error ) const
+        {
+            auto p = std::filesystem::path( n->name );
+            for( auto parent = n->parent ; parent ; parent = parent->parent )
+            {
+                p = std::filesystem::path( parent->name ) / p;
+            }
+            throw std::filesystem::filesystem_error( "cannot remove all", p, std::error_code( error, std::generic_category() ) );
+        }
+
+        bool reserve_directory() noexcept
+        {
+            auto count = open_directories.load();
+            while( count < max_open_directories )
+            {
+                if( open_directories.compare_exchange_weak( count, count + 1 ) )
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Called when the directory or one of its subdirectories is done.
+        void finish( std::shared_ptr< node > n )
+        {
+            while( n && --n->pending == 0 )
+            {
+                n->fd.reset();
+                if( n->budgeted )
+                {
+                    --open_directories;
+                }
+
+                const int parent_fd = n->parent ? n->parent->fd.get() : AT_FDCWD;
+                if( ::unlinkat( parent_fd, n->name.c_str(), AT_REMOVEDIR ) != 0 && errno != ENOENT )
+                {
+                    fail( n, errno );
+                }
+                ++removed;
+
+                n = std::move( n->parent );
+            }
+        }
+
+        void remove_directory( const std::shared_ptr< node > & n )
+        {
+            if( pool.cancelled() )
+            {
+                return;
+            }
+
+            const int parent_fd = n->parent ? n->parent->fd.get() : AT_FDCWD;
+            n->fd = unique_fd( ::openat( parent_fd, n->name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC ) );
+            if( !n->fd )
+            {
+                fail( n, errno );
+            }
+
+            constexpr std::size_t buffer_size = 64 * 1024;
+            auto buffer = std::make_unique< char[] >( buffer_size );
+            for( ;; )
+            {
+                const auto length = ::syscall( SYS_getdents64, n->fd.get(), buffer.get(), buffer_size );
+                if( length < 0 )
+                {
+                    fail( n, errno );
+                }
+                if( length == 0 )
+                {
+                    break;
+                }
+
+                for( long position = 0 ; position < length ; )
+                {
+                    const auto entry = reinterpret_cast< const dirent64 * >( buffer.get() + position );
+                    position += entry->d_reclen;
+
+                    const char * const name = entry->d_name;
+                    if( name[ 0 ] == '.' && ( name[ 1 ] == '\0' || ( name[ 1 ] == '.' && name[ 2 ] == '\0' ) ) )
+                    {
+                        continue;
+                    }
+
+                    bool is_directory = entry->d_type == DT_DIR;
+                    if( entry->d_type == DT_UNKNOWN )
+                    {
+                        struct stat entry_st;
+                        is_directory = ::fstatat( n->fd.get(), name, &entry_st, AT_SYMLINK_NOFOLLOW ) == 0 && S_ISDIR( entry_st.st_mode );
+                    }
+
+                    if( !is_directory )
+                    {
+                        if( ::unlinkat( n->fd.get(), name, 0 ) != 0 && errno != ENOENT )
+                        {
+                            fail( n, errno );
+                        }
+                        ++removed;
+                        continue;
+                    }
+
+                    auto child    = std::make_shared< node >();
+                    child->parent = n;
+                    child->name   = name;
+                    ++n->pending;
+                    if( reserve_directory() )
+                    {
+                        child->budgeted = true;
+                        pool.submit( [ this, child = std::move( child ) ]{ remove_directory( child ); } );
+                    }
+                    else
+                    {
+                        remove_directory( child );
+                    }
+                }
+            }
+
+            finish( n );
+        }
+    };
+
+    remover r{ pool, root, {}, {}, std::max< std::size_t >( max_open_files, 1 ) };
+
+    auto top      = std::make_shared< node >();
+    top->name     = root.native();
+    top->budgeted = r.reserve_directory();
+    try
+    {
+        r.remove_directory( top );
+    }
+    catch( ... )
+    {
+        // The submitted tasks refer to 'r'
+        pool.cancel();
+        try { pool.wait(); } catch( ... ) {}
+        throw;
+    }
+    pool.wait();
+
+    return r.removed;
+}
+#endif
+
+// Walks the directory tree below 'root' on the workers of 'pool'; each directory is read by a single task.
+// 'visit' is called concurrently with a directory entry and its depth and returns if the walker should
+// recurse into the entry when it is a directory.
+template< typename Visitor >
+void parallel_walk( work_stealing_pool & pool, const std::filesystem::path & root,
+                    std::filesystem::directory_options options, Visitor visit )
+{
+    using std::filesystem::directory_options;
+
+    struct walker
+    {
+        work_stealing_pool & pool;
+        directory_options    options;
+        Visitor              visit;
+
+        void read_directory( const std::filesystem::path & directory, int depth )
+        {
+            const bool skip_permission_denied = ( options & directory_options::skip_permission_denied ) != directory_options::none;
+            const bool follow_symlinks        = ( options & directory_options::follow_directory_symlink ) != directory_options::none;
+
+            std::error_code ec;
+            auto it = std::filesystem::directory_iterator( directory, options, ec );
+            for( ; !ec && it != std::filesystem::directory_iterator() && !pool.cancelled() ; it.increment( ec ) )
+            {
+                const auto & entry = *it;
+                if( !visit( entry, depth ) )
+                {
+                    continue;
+                }
+
+                std::error_code type_ec;
+                if( entry.is_directory( type_ec ) && ( follow_symlinks || !entry.is_symlink( type_ec ) ) )
+                {
+                    pool.submit( [ this, path = entry.path(), depth ]{ read_directory( path, depth + 1 ); } );
+                }
+            }
+
+            if( ec )
+            {
+                if( skip_permission_denied && ec == std::errc::permission_denied )
+                {
+                    return;
+                }
+                throw std::filesystem::filesystem_error( "cannot read directory", directory, ec );
+            }
+        }
+    };
+
+    walker w{ pool, options, std::move( visit ) };
+    pool.submit( [ &w, &root ]{ w.read_directory( root, 0 ); } );
+    pool.wait();
+}
+
+// Hashes the first and the last 'block_size' bytes of file 'p' of 'size' bytes with XXH64.
+// This tells most files of the same size apart without reading them completely.
+inline std::uint64_t hash_file_ends( const std::filesystem::path & p, std::uintmax_t size, std::size_t block_size )
+{
+    const auto                         length = static_cast< std::size_t >( std::min< std::uintmax_t >( size, block_size ) );
+    const std::uintmax_t               offsets[] = { 0, size - length };
+    std::unique_ptr< unsigned char[] > buffer( new unsigned char[ length ] );
+    xxh64_hasher                       hasher;
+
+#if defined( __linux__ )
+    const unique_fd fd( ::open( p.c_str(), O_RDONLY | O_CLOEXEC ) );
+    if( !fd ) PG_UNLIKELY
+    {
+        throw std::filesystem::filesystem_error( "cannot hash file", p, std::error_code( errno, std::generic_category() ) );
+    }
+    for( const auto offset : offsets )
+    {
+        const auto n = ::pread( fd.get(), buffer.get(), length, static_cast< off_t >( offset ) );
+        if( n < 0 ) PG_UNLIKELY
+        {
+            throw std::filesystem::filesystem_error( "cannot hash file", p, std::error_code( errno, std::generic_category() ) );
+        }
+        hasher.update( buffer.get(), static_cast< std::size_t >( n ) );
+    }
+#else
+    std::ifstream file( p, std::ios::binary );
+    for( const auto offset : offsets )
+    {
+        file.seekg( static_cast< std::streamoff >( offset ) );
+        file.read( reinterpret_cast< char * >( buffer.get() ), static_cast< std::streamsize >( length ) );
+        if( file.bad() || file.gcount() <= 0 ) PG_UNLIKELY
+        {
+            throw std::filesystem::filesystem_error( "cannot hash file", p, std::make_error_code( std::errc::io_error ) );
+        }
+        hasher.update( buffer.get(), static_cast< std::size_t >( file.gcount() ) );
+    }
+#endif
+
+    return hasher.value();
+}
+
+struct duplicate_group
+{
+    std::uintmax_t                       size;
+    std::vector< std::filesystem::path > paths;
+};
+
+// Finds the regular files with the same contents in the trees 'roots'.
+// The files are grouped by size first, then by a hash of their first and last blocks and only the files that
+// still collide are hashed completely with 'algorithm'. Paths with the same device and inode, hard links or the same
+// file found through overlapping roots, count as one file. Files that can't be read are left out.
+// The groups are sorted by descending size and the paths of a group are sorted.
+inline std::vector< duplicate_group > find_duplicates( work_stealing_pool & pool, const std::vector< std::filesystem::path > & roots,
+                                                       std::filesystem::directory_options options, std::uintmax_t min_size,
+                                                       hash_algorithm algorithm )
+{
+    constexpr std::size_t end_block_size = 4096;
+
+    struct candidate
+    {
+        std::filesystem::path path;
+        std::uintmax_t        size;
+        std::uintmax_t        device;
+        std::uintmax_t        inode;
+        bool                  has_id;
+        std::string           key;
+        bool                  failed = false;
+    };
+    using group = std::vector< candidate * >;
+
+    std::vector< std::vector< candidate > > found( pool.size() + 1 );
+    const auto add = [ & ]( const std::filesystem::path & p )
+    {
+        const auto record = pg::stat_path( p, stat_size | stat_inode, false );
+        if( record.size && *record.size >= min_size )
+        {
+            const auto worker = pool.worker_index();
+            found[ worker == work_stealing_pool::no_worker ? pool.size() : worker ].push_back(
+                candidate{ p, *record.size, record.device.value_or( 0 ), record.inode.value_or( 0 ), record.device && record.inode, {} } );
+        }
+    };
+
+    for( const auto & root : roots )
+    {
+        std::error_code ec;
+        if( std::filesystem::is_directory( root, ec ) )
+        {
+            pg::parallel_walk( pool, root, options, [ &add ]( const std::filesystem::directory_entry & entry, int )
+            {
+                std::error_code type_ec;
+                if( pg::cached_symlink_type( entry, type_ec ) == std::filesystem::file_type::regular )
+                {
+                    add( entry.path() );
+                }
+                return true;
+            } );
+        }
+        else
+        {
+            add( root );
+        }
+    }
+
+    std::vector< candidate > files;
+    for( auto & f : found )
+    {
+        std::move( f.begin(), f.end(), std::back_inserter( files ) );
+        f = {};
+    }
+    std::sort( files.begin(), files.end(), []( const candidate & a, const candidate & b )
+    {
+        return std::tie( a.size, a.has_id, a.device, a.inode, a.path ) < std::tie( b.size, b.has_id, b.device, b.inode, b.path );
+    } );
+
+    std::vector< group > groups;
+    for( auto first = files.begin() ; first != files.end() ; )
+    {
+        const auto last = std::find_if( first, files.end(), [ &first ]( const candidate & c ){ return c.size != first->size; } );
+        group      g;
+        for( auto it = first ; it != last ; ++it )
+        {
+            const bool same_file = !g.empty() && it->has_id && g.back()->has_id && it->device == g.back()->device && it->inode == g.back()->inode;
+            if( !same_file )
+            {
+                g.push_back( &*it );
+            }
+        }
+        if( g.size() > 1 )
+        {
+            groups.push_back( std::move( g ) );
+        }
+        first = last;
+    }
+
+    // Splits every group by the key that 'compute' returns for its files and drops the files without a duplicate
+    const auto refine = [ &pool ]( std::vector< group > & groups, const std::function< std::string( const candidate & ) > & compute )
+    {
+        for( const auto & g : groups )
+        {
+            for( const auto c : g )
+            {
+                pool.submit( [ c, &compute ]
+                {
+                    try
+                    {
+                        c->key = compute( *c );
+                    }
+                    catch( const std::filesystem::filesystem_error & )
+                    {
+                        c->failed = true;
+                    }
+                } );
+            }
+        }
+        pool.wait();
+
+        std::vector< group > refined;
+        for( auto & g : groups )
+        {
+            g.erase( std::remove_if( g.begin(), g.end(), []( const candidate * c ){ return c->failed; } ), g.end() );
+            std::stable_sort( g.begin(), g.end(), []( const candidate * a, const candidate * b ){ return a->key < b->key; } );
+            for( auto first = g.begin() ; first != g.end() ; )
+            {
+                const auto last = std::find_if( first, g.end(), [ &first ]( const candidate * c ){ return c->key != ( *first )->key; } );
+                if( last - first > 1 )
+                {
+                    refined.emplace_back( first, last );
+                }
+                first = last;
+            }
+        }
+        groups = std::move( refined );
+    };
+
+    refine( groups, []( const candidate & c )
+    {
+        if( c.size <= 2 * end_block_size )
+        {
+            return std::string();   // Hashing the ends reads the whole file, leave it to the full hash
+        }
+        const auto h = pg::hash_file_ends( c.path, c.size, end_block_size );
+        return std::string( reinterpret_cast< const char * >( &h ), sizeof( h ) );
+    } );
+    refine( groups, [ algorithm ]( const candidate & c ){ return pg::hash_file( c.path, algorithm ); } );
+
+    std::vector< duplicate_group > result;
+    result.reserve( groups.size() );
+    for( const auto & g : groups )
+    {
+        duplicate_group d{ g.front()->size, {} };
+        d.paths.reserve( g.size() );
+        for( const auto c : g )
+        {
+            d.paths.push_back( c->path );
+        }
+        std::sort( d.paths.begin(), d.paths.end() );
+        result.push_back( std::move( d ) );
+    }
+    std::sort( result.begin(), result.end(), []( const duplicate_group & a, const duplicate_group & b )
+    {
+        return a.size != b.size ? a.size > b.size : a.paths.front() < b.paths.front();
+    } );
+
+    return result;
+}
+
+struct disk_usage
+{
+    std::filesystem::path path;
+    std::uintmax_t        size  = 0;    // Of the directory and everything below it
+    std::uintmax_t        files = 0;    // The number of entries below the directory that aren't directories
+    int                   depth = 0;
+};
+
+// Sums the sizes of the entries in the tree 'root' in parallel for every directory up to 'max_depth' levels below 'root'.
+// The size is the allocated size on disk or, when 'apparent' is set or the allocated size isn't known, the file size of
+// the regular files. Hard links to the same file, by device and inode, are counted once. With 'one_file_system' the
+// directories on other devices than 'root' are skipped.
+// Returns the totals ordered by path, starting with 'root' itself.
+inline std::vector< disk_usage > directory_disk_usage( work_stealing_pool & pool, const std::filesystem::path & root,
+                                                       std::filesystem::directory_options options, int max_depth,
+                                                       bool apparent, bool one_file_system )
+{
+    constexpr unsigned fields = stat_type | stat_size | stat_nlink | stat_inode | stat_device | stat_allocated;
+
+    const auto root_record = pg::stat_path( root, fields, true );
+    if( !root_record.exists ) PG_UNLIKELY
+    {
+        throw std::filesystem::filesystem_error( "cannot compute disk usage", root, root_record.error );
+    }
+
+    const auto size_of = [ apparent ]( const stat_record & r ) -> std::uintmax_t
+    {
+        return !apparent && r.allocated ? *r.allocated : r.size.value_or( 0 );
+    };
+
+    // The totals are collected per worker in buckets keyed by the part of the path below 'root',
+    // every entry goes to the bucket of its nearest ancestor with a depth of at most 'max_depth'
+    using key_type = std::filesystem::path::string_type;
+    using buckets  = std::unordered_map< key_type, disk_usage >;
+    std::vector< buckets > worker_buckets( pool.size() + 1 );
+    worker_buckets.back()[ {} ] = disk_usage{ {}, size_of( root_record ), root_record.type != std::filesystem::file_type::directory, 0 };
+
+    std::mutex                                              seen_mutex;
+    std::set< std::pair< std::uintmax_t, std::uintmax_t > > seen;
+
+    if( root_record.type == std::filesystem::file_type::directory )
+    {
+        const auto root_length = root.native().size();
+        pg::parallel_walk( pool, root, options, [ & ]( const std::filesystem::directory_entry & entry, int depth )
+        {
+            const auto record = pg::stat_path( entry.path(), fields, false );
+            if( !record.exists )
+            {
+                return false;
+            }
+
+            const bool is_directory = record.type == std::filesystem::file_type::directory;
+            if( is_directory && one_file_system && record.device != root_record.device )
+            {
+                return false;
+            }
+            if( !is_directory && record.hard_links > 1 && record.device && record.inode )
+            {
+                std::lock_guard< std::mutex > lock( seen_mutex );
+                if( !seen.emplace( *record.device, *record.inode ).second )
+                {
+                    return false;
+                }
+            }
+
+            // Cut the path below 'root' after the components of the bucket
+            const auto & native     = entry.path().native();
+            const auto   components = std::min( is_directory ? depth + 1 : depth, max_depth );
+            auto         begin      = native.find_first_not_of( std::filesystem::path::preferred_separator, root_length );
+            auto         end        = begin;
+            for( int i = 0 ; i < components ; ++i )
+            {
+                end = native.find( std::filesystem::path::preferred_separator, end + ( i > 0 ) );
+            }
+
+            const auto worker = pool.worker_index();
+            auto &     bucket = worker_buckets[ worker == work_stealing_pool::no_worker ? pool.size() : worker ][ components ? native.substr( begin, end - begin ) : key_type() ];
+            bucket.size  += size_of( record );
+            bucket.files += !is_directory;
+            bucket.depth  = components;
+
+            return is_directory;
+        } );
+    }
+
+    auto & totals = worker_buckets.back();
+    for( std::size_t i = 0 ; i + 1 < worker_buckets.size() ; ++i )
+    {
+        for( auto & [ key, usage ] : worker_buckets[ i ] )
+        {
+            auto & total  = totals[ key ];
+            total.size   += usage.size;
+            total.files  += usage.files;
+            total.depth   = usage.depth;
+        }
+        worker_buckets[ i ] = {};
+    }
+
+    // Add the totals of the directories to their parents, the deepest first
+    std::vector< buckets::value_type * > ordered;
+    for( auto & entry : totals )
+    {
+        ordered.push_back( &entry );
+    }
+    std::sort( ordered.begin(), ordered.end(), []( const auto * a, const auto * b ){ return a->second.depth > b->second.depth; } );
+    for( const auto entry : ordered )
+    {
+        if( entry->first.empty() )
+        {
+            continue;
+        }
+        const auto separator = entry->first.rfind( std::filesystem::path::preferred_separator );
+        auto &     parent    = totals[ separator == key_type::npos ? key_type() : entry->first.substr( 0, separator ) ];
+        parent.size  += entry->second.size;
+        parent.files += entry->second.files;
+        parent.depth  = entry->second.depth - 1;
+    }
+
+    std::vector< disk_usage > result;
+    result.reserve( totals.size() );
+    for( auto & [ key, usage ] : totals )
+    {
+        usage.path = key.empty() ? root : root / key;
+        result.push_back( std::move( usage ) );
+    }
+    std::sort( result.begin(), result.end(), []( const disk_usage & a, const disk_usage & b ){ return a.path < b.path; } );
+
+    return result;
+}
+
+// Runs a parallel walk in the background and passes the found entries in chunks to the consumer.
+// Every worker fills its own chunk so the workers don't contend on the channel for every entry.
+class parallel_walk_state
+{
+public:
+    using chunk = std::vector< std::filesystem::directory_entry >;
+
+    parallel_walk_state( std::filesystem::path root, std::filesystem::directory_options options,
+                         std::size_t threads, std::size_t chunk_size )
+        : pool( threads )
+        , chunks( 2 * pool.size() )
+        , buffers( pool.size() )
+        , chunk_size( chunk_size )
+    {
+        driver = std::thread( [ this, root = std::move( root ), options ]{ walk( root, options ); } );
+    }
+
+    parallel_walk_state( const parallel_walk_state & ) = delete;
+    parallel_walk_state & operator =( const parallel_walk_state & ) = delete;
+
+    ~parallel_walk_state()
+    {
+        pool.cancel();
+        chunks.close();
+        driver.join();
+    }
+
+    // Returns false when the walk finished; rethrows the error that stopped the walk, if any.
+    bool next( chunk & c )
+    {
+        if( chunks.pop( c ) )
+        {
+            return true;
+        }
+
+        if( error )
+        {
+            std::rethrow_exception( std::exchange( error, nullptr ) );
+        }
+
+        return false;
+    }
+
+private:
+    void walk( const std::filesystem::path & root, std::filesystem::directory_options options ) noexcept
+    {
+        try
+        {
+            pg::parallel_walk( pool, root, options, [ this ]( const std::filesystem::directory_entry & entry, int )
+            {
+                auto & buffer = buffers[ pool.worker_index() ];
+                buffer.push_back( entry );
+                if( buffer.size() >= chunk_size && !chunks.push( std::exchange( buffer, chunk() ) ) )
+                {
+                    // The consumer is gone
+                    pool.cancel();
+                }
+                return true;
+            } );
+
+            for( auto & buffer : buffers )
+            {
+                if( !buffer.empty() )
+                {
+                    chunks.push( std::move( buffer ) );
+                }
+            }
+        }
+        catch( ... )
+        {
+            error = std::current_exception();
+        }
+
+        chunks.close();
+    }
+
+    work_stealing_pool   pool;
+    channel< chunk >     chunks;
+    std::vector< chunk > buffers;
+    const std::size_t    chunk_size;
+    std::exception_ptr   error;
+    std::thread          driver;
+};
+
+
+enum class watch_event_type
+{
+    create,
+    modify,
+    attrib,
+    remove,
+    move,
+    overflow
+};
+
+static constexpr const char * const watch_event_type_names[] = { "create", "modify", "attrib", "delete", "move", "overflow" };
+
+struct watch_event
+{
+    watch_event_type      type;
+    std::filesystem::path path;
+    std::filesystem::path from;         // Only for move events
+    bool                  directory = false;
+};
+
+// Whether the path 'p' is 'directory' or a path below it, comparing the strings only.
+inline bool is_path_within( const std::filesystem::path::string_type & p, const std::filesystem::path::string_type & directory ) noexcept
+{
+    return p.compare( 0, directory.size(), directory ) == 0 &&
+           ( p.size() == directory.size() || p[ directory.size() ] == std::filesystem::path::preferred_separator );
+}
+
+// Watches files and directories for changes with inotify.
+// Directories that are created in a recursively watched directory are watched as well and
+// a create event is reported for the entries that were created in it before it was watched.
+// Directories that are moved into a watched directory are watched without reporting their entries.
+// Other platforms than Linux are not supported; the constructor throws.
+class file_watcher
+{
+public:
+    file_watcher( bool recursive, std::chrono::milliseconds coalesce )
+        : recursive( recursive )
+        , coalesce( coalesce )
+    {
+#if defined( __linux__ )
+        fd = unique_fd( ::inotify_init1( IN_NONBLOCK | IN_CLOEXEC ) );
+        if( !fd )
+        {
+            throw std::filesystem::filesystem_error( "cannot create watcher", std::error_code( errno, std::generic_category() ) );
+        }
+#else
+        throw std::filesystem::filesystem_error( "cannot create watcher", std::make_error_code( std::errc::function_not_supported ) );
+#endif
+    }
+
+    bool is_open() const noexcept
+    {
+#if defined( __linux__ )
+        return static_cast< bool >( fd );
+#else
+        return false;
+#endif
+    }
+
+    // The descriptor that becomes readable when events are available, -1 when closed.
+    int descriptor() const noexcept
+    {
+#if defined( __linux__ )
+        return fd.get();
+#else
+        return -1;
+#endif
+    }
+
+    void close() noexcept
+    {
+#if defined( __linux__ )
+        std::lock_guard< std::mutex > lock( mutex );
+        fd.reset();
+        watches.clear();
+#endif
+    }
+
+    // 'add' and 'remove' can be called by another thread than the one that reads the events.
+    void add( const std::filesystem::path & p )
+    {
+#if defined( __linux__ )
+        std::lock_guard< std::mutex > lock( mutex );
+        add_watch( p, nullptr, true, false );
+#else
+        static_cast< void >( p );
+#endif
+    }
+
+    // Stops watching 'p' and the watched directories below it.
+    void remove( const std::filesystem::path & p )
+    {
+#if defined( __linux__ )
+        std::lock_guard< std::mutex > lock( mutex );
+        remove_watches( p );
+#else
+        static_cast< void >( p );
+#endif
+    }
+
+    // Appends the events to 'events' that arrive within 'timeout', or wait indefinitely when it's negative.
+    // After the first event the events that arrive within the coalesce window are read as well. The events
+    // in that window are coalesced: repeated events for a path are reported once and moves within the
+    // window are reported as one move event.
+    void read( std::chrono::milliseconds timeout, std::vector< watch_event > & events )
+    {
+#if defined( __linux__ )
+        std::vector< watch_event > batch;
+        std::vector< move_source > moves;
+
+        if( !wait_readable( timeout ) )
+        {
+            return;
+        }
+        read_available( batch, moves );
+
+        const auto deadline = std::chrono::steady_clock::now() + coalesce;
+        for( auto now = std::chrono::steady_clock::now() ; now < deadline ; now = std::chrono::steady_clock::now() )
+        {
+            if( wait_readable( std::chrono::duration_cast< std::chrono::milliseconds >( deadline - now ) ) )
+            {
+                read_available( batch, moves );
+            }
+        }
+
+        // The kernel queues the halves of a rename one after the other, a read can end between them.
+        // A move source is only reported as removed when no destination follows shortly.
+        const auto move_deadline = std::chrono::steady_clock::now() + move_timeout;
+        for( auto now = std::chrono::steady_clock::now() ; !moves.empty() && now < move_deadline ; now = std::chrono::steady_clock::now() )
+        {
+            if( wait_readable( std::chrono::duration_cast< std::chrono::milliseconds >( move_deadline - now ) ) )
+            {
+                read_available( batch, moves );
+            }
+        }
+
+        for( auto & m : moves )
+        {
+            // A directory moved out of the watched paths is no longer watched
+            if( m.directory )
+            {
+                remove( m.path );
+            }
+            batch.push_back( watch_event{ watch_event_type::remove, std::move( m.path ), {}, m.directory } );
+        }
+
+        coalesce_events( batch, events );
+#else
+        static_cast< void >( timeout );
+        static_cast< void >( events );
+#endif
+    }
+
+private:
+#if defined( __linux__ )
+    static constexpr std::uint32_t watch_mask = IN_CREATE | IN_MODIFY | IN_ATTRIB | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                                IN_DELETE_SELF | IN_MOVE_SELF;
+
+    // How long the destination of a move is waited for after the source was read.
+    static constexpr std::chrono::milliseconds move_timeout{ 20 };
+
+    struct move_source
+    {
+        std::uint32_t         cookie;
+        std::filesystem::path path;
+        bool                  directory;
+    };
+
+    // Watches 'p' and, in a recursive watcher, the directories below it. The directories found are appended
+    // to 'created' when it's not null. 'moved' tells that 'p' is the destination of a move, after which the
+    // kernel reports IN_MOVE_SELF for a watch that existed. Called with 'mutex' locked.
+    void add_watch( const std::filesystem::path & p, std::vector< watch_event > * created, bool top, bool moved )
+    {
+        const int wd = ::inotify_add_watch( fd.get(), p.c_str(), watch_mask );
+        if( wd < 0 )
+        {
+            // Entries that disappear before they are watched are not an error.
+            if( !top && ( errno == ENOENT || errno == ENOTDIR ) )
+            {
+                return;
+            }
+            throw std::filesystem::filesystem_error( "cannot watch", p, std::error_code( errno, std::generic_category() ) );
+        }
+        std::error_code ec;
+        const bool      directory = std::filesystem::is_directory( std::filesystem::status( p, ec ) );
+        const auto      inserted  = watches.try_emplace( wd );
+        auto &          watch     = inserted.first->second;
+        watch.path      = p;
+        watch.directory = directory;
+        watch.top       = watch.top || top;
+        watch.moved     = watch.moved || ( moved && !inserted.second );
+        if( !recursive || !directory )
+        {
+            return;
+        }
+
+        for( auto it = std::filesystem::directory_iterator( p, ec ) ; !ec && it != std::filesystem::directory_iterator() ; it.increment( ec ) )
+        {
+            std::error_code type_ec;
+            const bool      directory = it->is_directory( type_ec ) && !it->is_symlink( type_ec );
+            if( created )
+            {
+                created->push_back( watch_event{ watch_event_type::create, it->path(), {}, directory } );
+            }
+            if( directory )
+            {
+                add_watch( it->path(), created, false, false );
+            }
+        }
+    }
+
+    // Called with 'mutex' locked.
+    void remove_watches( const std::filesystem::path & p )
+    {
+        for( auto it = watches.begin() ; it != watches.end() ; )
+        {
+            if( is_path_within( it->second.path.native(), p.native() ) )
+            {
+                ::inotify_rm_watch( fd.get(), it->first );
+                it = watches.erase( it );
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    bool wait_readable( std::chrono::milliseconds timeout )
+    {
+        pollfd pfd = { fd.get(), POLLIN, 0 };
+        for( ;; )
+        {
+            const int result = ::poll( &pfd, 1, timeout.count() < 0 ? -1 : static_cast< int >( std::min< long long >( timeout.count(), INT32_MAX ) ) );
+            if( result >= 0 )
+            {
+                return result > 0;
+            }
+            if( errno != EINTR )
+            {
+                throw std::filesystem::filesystem_error( "cannot read watcher events", std::error_code( errno, std::generic_category() ) );
+            }
+        }
+    }
+
+    void read_available( std::vector< watch_event > & batch, std::vector< move_source > & moves )
+    {
+        alignas( inotify_event ) char buffer[ 64 * 1024 ];
+        for( ;; )
+        {
+            const auto length = ::read( fd.get(), buffer, sizeof( buffer ) );
+            if( length < 0 )
+            {
+                if( errno == EINTR )
+                {
+                    continue;
+                }
+                if( errno == EAGAIN || errno == EWOULDBLOCK )
+                {
+                    return;
+                }
+                throw std::filesystem::filesystem_error( "cannot read watcher events", std::error_code( errno, std::generic_category() ) );
+            }
+
+            std::lock_guard< std::mutex > lock( mutex );
+            for( ssize_t position = 0 ; position < length ; )
+            {
+                const auto event = reinterpret_cast< const inotify_event * >( buffer + position );
+                position += static_cast< ssize_t >( sizeof( inotify_event ) + event->len );
+                handle_event( *event, batch, moves );
+            }
+        }
+    }
+
+    // Called with 'mutex' locked.
+    void handle_event( const inotify_event & event, std::vector< watch_event > & batch, std::vector< move_source > & moves )
+    {
+        if( event.mask & IN_Q_OVERFLOW )
+        {
+            batch.push_back( watch_event{ watch_event_type::overflow, {}, {}, false } );
+            return;
+        }
+
+        const auto watch = watches.find( event.wd );
+        if( watch == watches.end() )
+        {
+            return;
+        }
+
+        const bool directory = ( event.mask & IN_ISDIR ) != 0;
+        auto       p         = event.len > 0 && event.name[ 0 ] ? watch->second.path / event.name : watch->second.path;
+
+        // The watch ends when its entry is deleted, the kernel removed it or the entry is moved elsewhere.
+        // Subdirectories are reported by the watch of their parent; the paths added by the user are reported
+        // as removed here, unless their removal was reported already.
+        if( event.mask & ( IN_DELETE_SELF | IN_IGNORED ) )
+        {
+            if( watch->second.top )
+            {
+                batch.push_back( watch_event{ watch_event_type::remove, std::move( p ), {}, watch->second.directory } );
+            }
+            watches.erase( watch );
+            return;
+        }
+        if( event.mask & IN_MOVE_SELF )
+        {
+            // A directory moved within the tree was watched again at its new path by IN_MOVED_TO, which
+            // the kernel reports first.
+            if( watch->second.moved )
+            {
+                watch->second.moved = false;
+                return;
+            }
+            if( watch->second.top )
+            {
+                batch.push_back( watch_event{ watch_event_type::remove, p, {}, watch->second.directory } );
+            }
+            remove_watches( p );
+            return;
+        }
+        if( event.mask & IN_MOVED_FROM )
+        {
+            moves.push_back( move_source{ event.cookie, std::move( p ), directory } );
+            return;
+        }
+        if( event.mask & IN_MOVED_TO )
+        {
+            const auto source = std::find_if( moves.begin(), moves.end(), [ & ]( const move_source & m ){ return m.cookie == event.cookie; } );
+            if( source != moves.end() )
+            {
+                batch.push_back( watch_event{ watch_event_type::move, p, std::move( source->path ), directory } );
+                moves.erase( source );
+            }
+            else
+            {
+                batch.push_back( watch_event{ watch_event_type::create, p, {}, directory } );
+            }
+            // The entries of a moved directory existed before, they are not reported as created
+            if( directory && recursive )
+            {
+                add_watch( p, nullptr, false, true );
+            }
+            return;
+        }
+        if( event.mask & IN_CREATE )
+        {
+            batch.push_back( watch_event{ watch_event_type::create, p, {}, directory } );
+            if( directory && recursive )
+            {
+                add_watch( p, &batch, false, false );
+            }
+            return;
+        }
+
+        const auto type = ( event.mask & IN_MODIFY ) ? watch_event_type::modify
+                        : ( event.mask & IN_ATTRIB ) ? watch_event_type::attrib
+                                                     : watch_event_type::remove;
+        batch.push_back( watch_event{ type, std::move( p ), {}, directory } );
+    }
+
+    // Appends the events of 'batch' to 'events' without the events that repeat the previous event for the same path.
+    // Modifications of a path that was created just before in the same batch are dropped as well.
+    static void coalesce_events( std::vector< watch_event > & batch, std::vector< watch_event > & events )
+    {
+        std::unordered_map< std::string, watch_event_type > last;
+
+        for( auto & e : batch )
+        {
+            if( e.type != watch_event_type::move && e.type != watch_event_type::overflow )
+            {
+                const auto [ previous, first ] = last.try_emplace( e.path.native(), e.type );
+                if( !first )
+                {
+                    const bool modified = e.type == watch_event_type::modify || e.type == watch_event_type::attrib;
+                    if( previous->second == e.type || ( modified && previous->second == watch_event_type::create ) )
+                    {
+                        continue;
+                    }
+                    previous->second = e.type;
+                }
+            }
+            events.push_back( std::move( e ) );
+        }
+    }
+
+    struct watch_info
+    {
+        std::filesystem::path path;
+        bool                  directory = false;
+        bool                  top       = false;    // Added by the user instead of found in a watched directory
+        bool                  moved     = false;    // Watched again after a move, its IN_MOVE_SELF is still to come
+    };
+
+    unique_fd                                       fd;
+    std::mutex                                      mutex;      // Guards 'watches'
+    std::unordered_map< int, watch_info >           watches;
+#endif
+    bool                                            recursive;
+    std::chrono::milliseconds                       coalesce;
+};
+
+// Caches the status of paths for 'ttl'. On Linux the parent directories of the cached paths are watched
+// by a thread that drops the entries of the paths that changed, and of their parent directories.
+// Symbolic links are only invalidated by changes to the link itself, changes to the target expire with 'ttl'.
+class stat_cache
+{
+public:
+    struct counters
+    {
+        std::uintmax_t hits          = 0;
+        std::uintmax_t misses        = 0;
+        std::uintmax_t invalidations = 0;
+        std::size_t    entries       = 0;
+        std::size_t    watches       = 0;
+    };
+
+    stat_cache( std::chrono::steady_clock::duration ttl, bool watch )
+        : ttl( ttl )
+    {
+#if defined( __linux__ )
+        if( watch )
+        {
+            watcher.emplace( false, std::chrono::milliseconds( 0 ) );
+            wake = unique_fd( ::eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK ) );
+            if( !wake )
+            {
+                throw std::filesystem::filesystem_error( "cannot create stat cache", std::error_code( errno, std::generic_category() ) );
+            }
+            reader = std::thread( [ this ]{ read_events(); } );
+        }
+#else
+        static_cast< void >( watch );
+#endif
+    }
+
+    stat_cache( const stat_cache & ) = delete;
+    stat_cache & operator =( const stat_cache & ) = delete;
+
+    ~stat_cache()
+    {
+#if defined( __linux__ )
+        if( reader.joinable() )
+        {
+            const std::uint64_t one = 1;
+            static_cast< void >( ::write( wake.get(), &one, sizeof( one ) ) );
+            reader.join();
+        }
+#endif
+    }
+
+    // Returns the status of 'p' from the cache or queries and caches it.
+    stat_record get( const std::filesystem::path & p, bool follow_symlinks )
+    {
+        const auto    now = std::chrono::steady_clock::now();
+        std::uint64_t generation;
+        {
+            std::lock_guard< std::mutex > lock( mutex );
+            const auto [ it, inserted ] = entries.try_emplace( p.native() );
+            if( inserted )
+            {
+                // The directory is watched before the query so that no change after the query is missed
+                add_alias( p, it->second );
+            }
+            else
+            {
+                const auto & cached = it->second.records[ follow_symlinks ];
+                if( cached.valid && now - cached.time < ttl )
+                {
+                    ++stats.hits;
+                    return cached.record;
+                }
+            }
+            ++stats.misses;
+            generation = it->second.generation = ++generations;
+        }
+
+        constexpr unsigned fields = stat_type | stat_perms | stat_size | stat_mtime | stat_nlink;
+        auto               record = pg::stat_path( p, fields, follow_symlinks );
+
+        // The record is only cached when the entry wasn't invalidated, or queried again, in the meantime
+        std::lock_guard< std::mutex > lock( mutex );
+        const auto it = entries.find( p.native() );
+        if( it != entries.end() && it->second.generation == generation )
+        {
+            auto & cached = it->second.records[ follow_symlinks ];
+            cached.record = record;
+            cached.time   = now;
+            cached.valid  = true;
+        }
+
+        return record;
+    }
+
+    // Drops the entry of 'p' or all entries when 'p' is empty.
+    void invalidate( const std::filesystem::path & p )
+    {
+        std::lock_guard< std::mutex > lock( mutex );
+        if( p.empty() )
+        {
+            stats.invalidations += entries.size();
+            entries.clear();
+            aliases.clear();
+        }
+        else
+        {
+            const auto it = entries.find( p.native() );
+            if( it != entries.end() )
+            {
+                remove_alias( it->first, it->second.alias );
+                entries.erase( it );
+                ++stats.invalidations;
+            }
+        }
+    }
+
+    counters statistics()
+    {
+        std::lock_guard< std::mutex > lock( mutex );
+        auto result    = stats;
+        result.entries = entries.size();
+        result.watches = watched_directories.size();
+
+        return result;
+    }
+
+private:
+    struct cached_record
+    {
+        stat_record                           record;
+        std::chrono::steady_clock::time_point time;
+        bool                                  valid = false;
+    };
+
+    struct entry
+    {
+        cached_record                      records[ 2 ];    // Indexed by 'follow_symlinks'
+        std::filesystem::path::string_type alias;           // The key of the entry in 'aliases', empty when it has none
+        std::uint64_t                      generation = 0;  // Of the latest query of the entry
+    };
+
+    // Called with 'mutex' locked.
+    void add_alias( const std::filesystem::path & p, entry & e )
+    {
+        std::error_code ec;
+        auto            absolute = std::filesystem::absolute( p, ec ).lexically_normal();
+        if( ec )
+        {
+            return;
+        }
+#if defined( __linux__ )
+        watch_directory( absolute.parent_path() );
+#endif
+        e.alias = std::move( absolute ).native();
+        aliases.emplace( e.alias, p.native() );
+    }
+
+    // Called with 'mutex' locked.
+    void remove_alias( const std::filesystem::path::string_type & key, const std::filesystem::path::string_type & alias )
+    {
+        const auto range = aliases.equal_range( alias );
+        for( auto it = range.first ; it != range.second ; ++it )
+        {
+            if( it->second == key )
+            {
+                aliases.erase( it );
+                return;
+            }
+        }
+    }
+
+#if defined( __linux__ )
+    void watch_directory( const std::filesystem::path & directory )
+    {
+        if( !watcher || watched_directories.count( directory.native() ) )
+        {
+            return;
+        }
+        try
+        {
+            watcher->add( directory );
+            watched_directories.insert( directory.native() );
+        }
+        catch( const std::filesystem::filesystem_error & )
+        {
+            // Entries in directories that can't be watched only expire
+        }
+    }
+
+    void read_events() noexcept
+    {
+        std::vector< watch_event > events;
+        for( ;; )
+        {
+            pollfd fds[ 2 ] = { { watcher->descriptor(), POLLIN, 0 }, { wake.get(), POLLIN, 0 } };
+            if( ::poll( fds, 2, -1 ) < 0 && errno != EINTR )
+            {
+                return;
+            }
+            if( fds[ 1 ].revents )
+            {
+                return;
+            }
+
+            // The events are read without the lock, reading can wait for the second half of a move
+            bool failed = false;
+            try
+            {
+                events.clear();
+                watcher->read( std::chrono::milliseconds( 0 ), events );
+            }
+            catch( ... )
+            {
+                failed = true;
+            }
+
+            std::lock_guard< std::mutex > lock( mutex );
+            if( failed )
+            {
+                // Stop invalidating, the entries still expire
+                stats.invalidations += entries.size();
+                entries.clear();
+                aliases.clear();
+                return;
+            }
+
+            for( const auto & e : events )
+            {
+                if( e.type == watch_event_type::overflow )
+                {
+                    stats.invalidations += entries.size();
+                    entries.clear();
+                    aliases.clear();
+                    continue;
+                }
+                invalidate_path( e.path );
+                invalidate_path( e.path.parent_path() );
+                if( e.type == watch_event_type::move )
+                {
+                    invalidate_path( e.from );
+                    invalidate_path( e.from.parent_path() );
+                }
+                if( e.directory && ( e.type == watch_event_type::remove || e.type == watch_event_type::move ) )
+                {
+                    forget_directory( e.type == watch_event_type::move ? e.from : e.path );
+                }
+            }
+        }
+    }
+
+    // Drops the entries below the directory 'p' that was removed or moved elsewhere, and stops watching
+    // it and the directories below it; their watches refer to the old files. Called with 'mutex' locked.
+    void forget_directory( const std::filesystem::path & p )
+    {
+        for( auto it = aliases.begin() ; it != aliases.end() ; )
+        {
+            if( is_path_within( it->first, p.native() ) )
+            {
+                stats.invalidations += entries.erase( it->second );
+                it = aliases.erase( it );
+            }
+            else
+            {
+                ++it;
+            }
+        }
+
+        for( auto it = watched_directories.begin() ; it != watched_directories.end() ; )
+        {
+            if( is_path_within( *it, p.native() ) )
+            {
+                it = watched_directories.erase( it );
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        watcher->remove( p );
+    }
+
+    // The watcher reports absolute paths while the cache is keyed by the paths as they were queried.
+    void invalidate_path( const std::filesystem::path & p )
+    {
+        const auto range = aliases.equal_range( p.native() );
+        for( auto it = range.first ; it != range.second ; ++it )
+        {
+            stats.invalidations += entries.erase( it->second );
+        }
+        aliases.erase( range.first, range.second );
+    }
+#endif
+
+    const std::chrono::steady_clock::duration                  ttl;
+    std::mutex                                                 mutex;
+    std::unordered_map< std::filesystem::path::string_type, entry > entries;
+    std::unordered_multimap< std::filesystem::path::string_type, std::filesystem::path::string_type > aliases;    // Absolute path to key
+    counters                                                   stats;
+    std::uint64_t                                              generations = 0;
+    std::unordered_set< std::filesystem::path::string_type >   watched_directories;
+#if defined( __linux__ )
+    std::optional< file_watcher >                              watcher;
+    unique_fd                                                  wake;
+    std::thread                                                reader;
+#endif
+};
+
+
+// A file mapped in memory. Files of zero bytes are not mapped; 'data' is null for them.
+class mapped_file
+{
+public:
+    mapped_file( const std::filesystem::path & p, bool writable )
+        : writable( writable )
+    {
+#if defined( __linux__ )
+        const unique_fd fd( ::open( p.c_str(), ( writable ? O_RDWR : O_RDONLY ) | O_CLOEXEC ) );
+        struct stat     st;
+        if( !fd || ::fstat( fd.get(), &st ) != 0 ) PG_UNLIKELY
+        {
+            throw std::filesystem::filesystem_error( "cannot map file", p, std::error_code( errno, std::generic_category() ) );
+        }
+        if( !S_ISREG( st.st_mode ) ) PG_UNLIKELY
+        {
+            throw std::filesystem::filesystem_error( "cannot map file", p, std::make_error_code( std::errc::invalid_argument ) );
+        }
+
+        length = static_cast< std::size_t >( st.st_size );
+        if( length > 0 )
+        {
+            const auto address = ::mmap( nullptr, length, PROT_READ | ( writable ? PROT_WRITE : 0 ), MAP_SHARED, fd.get(), 0 );
+            if( address == MAP_FAILED ) PG_UNLIKELY
+            {
+                throw std::filesystem::filesystem_error( "cannot map file", p, std::error_code( errno, std::generic_category() ) );
+            }
+            address_ = static_cast< unsigned char * >( address );
+        }
+        open = true;
+#else
+        static_cast< void >( p );
+        throw std::filesystem::filesystem_error( "cannot map file", std::make_error_code( std::errc::function_not_supported ) );
+#endif
+    }
+
+    mapped_file( const mapped_file & ) = delete;
+    mapped_file & operator =( const mapped_file & ) = delete;
+
+    ~mapped_file()
+    {
+        close();
+    }
+
+    bool is_open() const noexcept
+    {
+        return open;
+    }
+
+    bool is_writable() const noexcept
+    {
+        return writable;
+    }
+
+    unsigned char * data() const noexcept
+    {
+        return address_;
+    }
+
+    std::size_t size() const noexcept
+    {
+        return length;
+    }
+
+    // Passes 'advice', a 'madvise' value, to the kernel for the whole mapping.
+    std::error_code advise( int advice ) noexcept
+    {
+#if defined( __linux__ )
+        if( address_ && ::madvise( address_, length, advice ) != 0 )
+        {
+            return std::error_code( errno, std::generic_category() );
+        }
+#else
+        static_cast< void >( advice );
+#endif
+        return {};
+    }
+
+    void close() noexcept
+    {
+#if defined( __linux__ )
+        if( address_ )
+        {
+            ::munmap( address_, length );
+        }
+#endif
+        address_ = nullptr;
+        length   = 0;
+        open     = false;
+    }
+
+private:
+    unsigned char * address_ = nullptr;
+    std::size_t     length   = 0;
+    bool            open     = false;
+    const bool      writable;
+};
+
+// Replaces files atomically and durably while paying for the synchronization once per batch.
+// Every file is written to a temporary file in the directory of its target, an unnamed O_TMPFILE
+// when the filesystem supports it. 'commit' starts the writeback of all staged files before it
+// waits for each of them with fdatasync, so the waits overlap, renames the files into place and
+// finally syncs every affected directory once, instead of once per file.
+// At most 'max_open_files' files are staged at a time; staging more first publishes the staged
+// files, their directories are still synced only by 'commit'.
+// Staged files that are not committed are discarded by 'discard' or the destructor.
+class atomic_batch
+{
+public:
+    explicit atomic_batch( std::size_t max_open_files = 256 )
+        : max_open_files( std::max< std::size_t >( max_open_files, 1 ) )
+    {}
+
+    atomic_batch( const atomic_batch & ) = delete;
+    atomic_batch & operator =( const atomic_batch & ) = delete;
+
+    ~atomic_batch()
+    {
+        discard();
+    }
+
+    // Stages 'size' bytes from 'data' as the new contents of 'p'.
+    void write( const std::filesystem::path & p, const char * data, std::size_t size )
+    {
+        if( staged.size() >= max_open_files )
+        {
+            publish();
+        }
+
+        staged_file file;
+        file.target    = p;
+        file.directory = p.has_parent_path() ? p.parent_path() : std::filesystem::path( "." );
+
+#if defined( __linux__ )
+        // New files get the permissions of the file they replace
+        mode_t      mode = 0666;
+        struct stat st;
+        const bool  replaces = ::stat( p.c_str(), &st ) == 0;
+        if( replaces )
+        {
+            mode = st.st_mode & 07777;
+        }
+
+# if defined( O_TMPFILE )
+        file.fd.reset( ::open( file.directory.c_str(), O_TMPFILE | O_WRONLY | O_CLOEXEC, mode ) );
+        if( !file.fd && errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL ) PG_UNLIKELY
+        {
+            throw std::filesystem::filesystem_error( "cannot write file", p, std::error_code( errno, std::generic_category() ) );
+        }
+# endif
+        if( !file.fd )
+        {
+            file.temporary = create_temporary( p, mode, file.fd );
+        }
+        // O_TMPFILE and O_CREAT apply the umask, the permissions of a replaced file are restored
+        if( replaces && ::fchmod( file.fd.get(), mode ) != 0 ) PG_UNLIKELY
+        {
+            file.discard();
+            throw std::filesystem::filesystem_error( "cannot write file", p, std::error_code( errno, std::generic_category() ) );
+        }
+        if( !write_all( file.fd.get(), data, size ) ) PG_UNLIKELY
+        {
+            const std::error_code ec( errno, std::generic_category() );
+            file.discard();
+            throw std::filesystem::filesystem_error( "cannot write file", p, ec );
+        }
+#else
+        file.temporary = p;
+        file.temporary += ".tmp";
+        std::ofstream out( file.temporary, std::ios::binary | std::ios::trunc );
+        if( out )
+        {
+            out.write( data, static_cast< std::streamsize >( size ) );
+            out.close();
+        }
+        if( !out ) PG_UNLIKELY
+        {
+            file.discard();
+            throw std::filesystem::filesystem_error( "cannot write file", p, std::make_error_code( std::errc::io_error ) );
+        }
+#endif
+        // The last write of a target wins, an earlier staged write of it is dropped
+        const auto earlier = std::find_if( staged.begin(), staged.end(), [ &p ]( const staged_file & f ){ return f.target == p; } );
+        if( earlier != staged.end() )
+        {
+            earlier->discard();
+            staged.erase( earlier );
+        }
+        staged.push_back( std::move( file ) );
+    }
+
+    // Publishes the staged files and syncs their directories, returns the number of files that
+    // were replaced since the previous commit.
+    std::size_t commit()
+    {
+        publish();
+
+#if defined( __linux__ )
+        for( const auto & directory : directories )
+        {
+            const unique_fd fd( ::open( directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC ) );
+            if( !fd || ::fsync( fd.get() ) != 0 ) PG_UNLIKELY
+            {
+                throw std::filesystem::filesystem_error( "cannot sync directory", directory, std::error_code( errno, std::generic_category() ) );
+            }
+        }
+#endif
+        directories.clear();
+
+        return std::exchange( published, 0 );
+    }
+
+    // Removes the staged files.
+    void discard() noexcept
+    {
+        for( auto & file : staged )
+        {
+            file.discard();
+        }
+        staged.clear();
+    }
+
+    std::size_t size() const noexcept
+    {
+        return staged.size();
+    }
+
+private:
+    struct staged_file
+    {
+        std::filesystem::path target;
+        std::filesystem::path directory;
+        // Empty for an unnamed temporary file
+        std::filesystem::path temporary;
+#if defined( __linux__ )
+        unique_fd             fd;
+#endif
+
+        void discard() noexcept
+        {
+#if defined( __linux__ )
+            fd.reset();
+#endif
+            if( !temporary.empty() )
+            {
+                std::error_code ec;
+                std::filesystem::remove( temporary, ec );
+                temporary.clear();
+            }
+        }
+    };
+
+#if defined( __linux__ )
+    // Returns a name for a temporary file next to 'p'.
+    static std::filesystem::path temporary_name( const std::filesystem::path & p )
+    {
+        static std::atomic< unsigned > counter{ 0 };
+
+        auto temporary = p;
+        temporary += "." + std::to_string( ::getpid() ) + "." + std::to_string( counter++ ) + ".tmp";
+        return temporary;
+    }
+
+    // Creates a file next to 'p' with a name that is not in use.
+    static std::filesystem::path create_temporary( const std::filesystem::path & p, mode_t mode, unique_fd & fd )
+    {
+        for( ;; )
+        {
+            auto temporary = temporary_name( p );
+            fd.reset( ::open( temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode ) );
+            if( fd )
+            {
+                return temporary;
+            }
+            if( errno != EEXIST ) PG_UNLIKELY
+            {
+                throw std::filesystem::filesystem_error( "cannot write file", p, std::error_code( errno, std::generic_category() ) );
+            }
+        }
+    }
+#endif
+
+    // Makes the data of the staged files durable and moves them into place.
+    void publish()
+    {
+#if defined( __linux__ )
+        // Starting the writeback of every file first lets the device work on all of them while
+        // fdatasync waits for the first one
+        for( const auto & file : staged )
+        {
+            ::sync_file_range( file.fd.get(), 0, 0, SYNC_FILE_RANGE_WRITE );
+        }
+        for( const auto & file : staged )
+        {
+            if( ::fdatasync( file.fd.get() ) != 0 ) PG_UNLIKELY
+            {
+                throw std::filesystem::filesystem_error( "cannot sync file", file.target, std::error_code( errno, std::generic_category() ) );
+            }
+        }
+#endif
+
+        // The files are published in the order they were written, so the last write of a target
+        // reached through different paths still wins
+        std::size_t done = 0;
+        try
+        {
+            for( ; done < staged.size() ; ++done )
+            {
+                auto & file = staged[ done ];
+#if defined( __linux__ )
+                if( file.temporary.empty() )
+                {
+                    // An unnamed file gets its name in one step when the target doesn't exist
+                    const auto proc = "/proc/self/fd/" + std::to_string( file.fd.get() );
+                    if( ::linkat( AT_FDCWD, proc.c_str(), AT_FDCWD, file.target.c_str(), AT_SYMLINK_FOLLOW ) != 0 )
+                    {
+                        if( errno != EEXIST ) PG_UNLIKELY
+                        {
+                            throw std::filesystem::filesystem_error( "cannot replace file", file.target, std::error_code( errno, std::generic_category() ) );
+                        }
+                        for( ;; )
+                        {
+                            auto temporary = temporary_name( file.target );
+                            if( ::linkat( AT_FDCWD, proc.c_str(), AT_FDCWD, temporary.c_str(), AT_SYMLINK_FOLLOW ) == 0 )
+                            {
+                                file.temporary = std::move( temporary );
+                                break;
+                            }
+                            if( errno != EEXIST ) PG_UNLIKELY
+                            {
+                                throw std::filesystem::filesystem_error( "cannot replace file", file.target, std::error_code( errno, std::generic_category() ) );
+                            }
+                        }
+                    }
+                }
+                if( !file.temporary.empty() && ::rename( file.temporary.c_str(), file.target.c_str() ) != 0 ) PG_UNLIKELY
+                {
+                    throw std::filesystem::filesystem_error( "cannot replace file", file.temporary, file.target, std::error_code( errno, std::generic_category() ) );
+                }
+#else
+                std::filesystem::rename( file.temporary, file.target );
+#endif
+                file.temporary.clear();
+                directories.insert( file.directory );
+                ++published;
+            }
+        }
+        catch( ... )
+        {
+            staged.erase( staged.begin(), staged.begin() + static_cast< std::ptrdiff_t >( done ) );
+            throw;
+        }
+        staged.clear();
+    }
+
+    const std::size_t                    max_open_files;
+    std::vector< staged_file >           staged;
+    std::set< std::filesystem::path >    directories;
+    std::size_t                          published = 0;
+};
+
+#if defined( PG_IO_URING )
+// A minimal io_uring submission and completion queue on top of the raw system calls.
+// 'valid' is false when the kernel doesn't provide io_uring or it's disabled.
+class io_uring_queue
+{
+public:
+    explicit io_uring_queue( unsigned entries ) noexcept
+    {
+        io_uring_params params;
+        std::memset( &params, 0, sizeof( params ) );
+        fd.reset( static_cast< int >( ::syscall( __NR_io_uring_setup, entries, &params ) ) );
+        if( !fd )
+        {
+            return;
+        }
+
+        sq_size = params.sq_off.array + params.sq_entries * sizeof( unsigned );
+        cq_size = params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe );
+        if( params.features & IORING_FEAT_SINGLE_MMAP )
+        {
+            sq_size = cq_size = std::max( sq_size, cq_size );
+        }
+        sqes_size = params.sq_entries * sizeof( io_uring_sqe );
+
+        sq_ring = map( sq_size, IORING_OFF_SQ_RING );
+        cq_ring = ( params.features & IORING_FEAT_SINGLE_MMAP ) ? sq_ring : map( cq_size, IORING_OFF_CQ_RING );
+        sqes    = static_cast< io_uring_sqe * >( map( sqes_size, IORING_OFF_SQES ) );
+        if( !sq_ring || !cq_ring || !sqes )
+        {
+            release();
+            return;
+        }
+
+        const auto at = []( void * ring, unsigned offset ){ return reinterpret_cast< unsigned * >( static_cast< char * >( ring ) + offset ); };
+        sq_tail  = at( sq_ring, params.sq_off.tail );
+        sq_mask  = *at( sq_ring, params.sq_off.ring_mask );
+        sq_array = at( sq_ring, params.sq_off.array );
+        cq_head  = at( cq_ring, params.cq_off.head );
+        cq_tail  = at( cq_ring, params.cq_off.tail );
+        cq_mask  = *at( cq_ring, params.cq_off.ring_mask );
+        cqes     = reinterpret_cast< io_uring_cqe * >( static_cast< char * >( cq_ring ) + params.cq_off.cqes );
+        capacity = params.sq_entries;
+        tail     = *sq_tail;
+
+        probe();
+    }
+
+    io_uring_queue( const io_uring_queue & ) = delete;
+    io_uring_queue & operator =( const io_uring_queue & ) = delete;
+
+    ~io_uring_queue()
+    {
+        release();
+    }
+
+    bool valid() const noexcept
+    {
+        return static_cast< bool >( fd );
+    }
+
+    bool supports( unsigned opcode ) const noexcept
+    {
+        return opcode < supported.size() && supported[ opcode ];
+    }
+
+    // The number of entries that can be in flight at the same time.
+    unsigned size() const noexcept
+    {
+        return capacity;
+    }
+
+    // Returns a cleared submission queue entry; the caller must not prepare more than 'size'
+    // entries before they're submitted.
+    io_uring_sqe & prepare() noexcept
+    {
+        const auto index = tail & sq_mask;
+        auto &     sqe   = sqes[ index ];
+        std::memset( &sqe, 0, sizeof( sqe ) );
+        sq_array[ index ] = index;
+        ++tail;
+        ++unsubmitted;
+        return sqe;
+    }
+
+    // Submits the prepared entries and waits until at least 'wait' entries are completed.
+    std::error_code submit( unsigned wait ) noexcept
+    {
+        __atomic_store_n( sq_tail, tail, __ATOMIC_RELEASE );
+        for( ;; )
+        {
+            const auto n = ::syscall( __NR_io_uring_enter, fd.get(), unsubmitted, wait, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0 );
+            if( n >= 0 )
+            {
+                unsubmitted -= static_cast< unsigned >( n );
+                if( unsubmitted == 0 )
+                {
+                    return {};
+                }
+            }
+            else if( errno != EINTR && errno != EAGAIN && errno != EBUSY )
+            {
+                return std::error_code( errno, std::generic_category() );
+            }
+        }
+    }
+
+    // Calls 'f( user_data, result )' for every completed entry.
+    template< typename F >
+    void complete( F && f )
+    {
+        auto       head = *cq_head;
+        const auto end  = __atomic_load_n( cq_tail, __ATOMIC_ACQUIRE );
+        while( head != end )
+        {
+            const auto & cqe = cqes[ head & cq_mask ];
+            f( cqe.user_data, cqe.res );
+            __atomic_store_n( cq_head, ++head, __ATOMIC_RELEASE );
+        }
+    }
+
+private:
+    void * map( std::size_t size, off_t offset ) noexcept
+    {
+        const auto address = ::mmap( nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd.get(), offset );
+        return address == MAP_FAILED ? nullptr : address;
+    }
+
+    void probe() noexcept
+    {
+        constexpr unsigned op_count = 256;
+
+        std::unique_ptr< char[] > buffer( new( std::nothrow ) char[ sizeof( io_uring_probe ) + op_count * sizeof( io_uring_probe_op ) ]() );
+        if( !buffer )
+        {
+            return;
+        }
+        const auto probe = reinterpret_cast< io_uring_probe * >( buffer.get() );
+        if( ::syscall( __NR_io_uring_register, fd.get(), IORING_REGISTER_PROBE, probe, op_count ) != 0 )
+        {
+            return;
+        }
+        for( unsigned op = 0 ; op <= probe->last_op && op < supported.size() ; ++op )
+        {
+            supported[ op ] = ( probe->ops[ op ].flags & IO_URING_OP_SUPPORTED ) != 0;
+        }
+    }
+
+    void release() noexcept
+    {
+        if( sqes )
+        {
+            ::munmap( sqes, sqes_size );
+        }
+        if( cq_ring && cq_ring != sq_ring )
+        {
+            ::munmap( cq_ring, cq_size );
+        }
+        if( sq_ring )
+        {
+            ::munmap( sq_ring, sq_size );
+        }
+        sq_ring = cq_ring = nullptr;
+        sqes    = nullptr;
+        fd.reset();
+    }
+
+    unique_fd                    fd;
+    void *                       sq_ring   = nullptr;
+    void *                       cq_ring   = nullptr;
+    io_uring_sqe *               sqes      = nullptr;
+    std::size_t                  sq_size   = 0;
+    std::size_t                  cq_size   = 0;
+    std::size_t                  sqes_size = 0;
+    unsigned *                   sq_tail   = nullptr;
+    unsigned *                   sq_array  = nullptr;
+    unsigned                     sq_mask   = 0;
+    unsigned *                   cq_head   = nullptr;
+    unsigned *                   cq_tail   = nullptr;
+    unsigned                     cq_mask   = 0;
+    io_uring_cqe *               cqes      = nullptr;
+    unsigned                     capacity  = 0;
+    unsigned                     tail      = 0;
+    unsigned                     unsubmitted = 0;
+    std::array< bool, IORING_OP_LAST > supported = {};
+};
+#endif
+
+enum class batch_backend
+{
+    automatic,
+    io_uring,
+    threads
+};
+
+static constexpr const char * batch_backend_names[] = { "auto", "io_uring", "threads", nullptr };
+
+// A list of filesystem operations that are submitted together.
+// On Linux the operations are submitted to io_uring, so thousands of them cost a few system
+// calls; operations that io_uring doesn't support, like copies, and all operations on other
+// platforms or when io_uring is not available run on a thread pool.
+// The operations run concurrently, so an operation must not depend on another one in the same
+// batch. Every operation gets its own result and error.
+class operation_batch
+{
+public:
+    enum class operation_type
+    {
+        stat,
+        remove,
+        rename,
+        copy,
+        create_directory
+    };
+
+    struct operation
+    {
+        operation_type                type;
+        std::filesystem::path         from;
+        std::filesystem::path         to;
+        std::filesystem::copy_options options         = std::filesystem::copy_options::none;
+        bool                          follow_symlinks = true;
+
+        // Results
+        bool                          value           = false;    // Whether 'remove' removed or 'create_directory' created
+        stat_record                   record;
+        std::error_code               error;
+#if defined( PG_IO_URING )
+        struct statx                  stx;
+        bool                          remove_directory = false;
+#endif
+    };
+
+    explicit operation_batch( std::size_t threads, batch_backend backend )
+        : threads( std::max< std::size_t >( threads, 1 ) )
+        , backend( backend )
+    {}
+
+    std::size_t add( operation op )
+    {
+        operations.push_back( std::move( op ) );
+        return operations.size();
+    }
+
+    std::size_t size() const noexcept
+    {
+        return operations.size();
+    }
+
+    // Runs the operations and returns them with their results; the batch is empty afterwards.
+    std::vector< operation > submit()
+    {
+        auto ops = std::move( operations );
+        operations.clear();
+        if( ops.empty() )
+        {
+            return ops;
+        }
+
+        std::vector< std::size_t > pooled;
+#if defined( PG_IO_URING )
+        if( backend != batch_backend::threads )
+        {
+            io_uring_queue ring( static_cast< unsigned >( std::min< std::size_t >( ops.size(), 256 ) ) );
+            if( ring.valid() )
+            {
+                std::vector< std::size_t > queued;
+                for( std::size_t i = 0 ; i < ops.size() ; ++i )
+                {
+                    ( ring.supports( opcode( ops[ i ].type ) ) ? queued : pooled ).push_back( i );
+                }
+                run_pooled_and( ops, pooled, [ & ]{ run_on_ring( ring, ops, queued ); } );
+                return ops;
+            }
+        }
+#endif
+        if( backend == batch_backend::io_uring ) PG_UNLIKELY
+        {
+            throw std::filesystem::filesystem_error( "cannot submit batch", std::make_error_code( std::errc::function_not_supported ) );
+        }
+
+        pooled.resize( ops.size() );
+        for( std::size_t i = 0 ; i < ops.size() ; ++i )
+        {
+            pooled[ i ] = i;
+        }
+        run_pooled_and( ops, pooled, []{} );
+        return ops;
+    }
+
+private:
+    // Runs the operation with the regular functions.
+    static void run( operation & op ) noexcept
+    {
+        try
+        {
+            switch( op.type )
+            {
+            case operation_type::stat:
+                op.record = stat_path( op.from, ~0u, op.follow_symlinks );
+                op.error  = op.record.error;
+                break;
+            case operation_type::remove:
+                op.value = std::filesystem::remove( op.from, op.error );
+                break;
+            case operation_type::rename:
+                std::filesystem::rename( op.from, op.to, op.error );
+                break;
+            case operation_type::copy:
+            {
+                copy_counts counts = {};
+                copy_entry( op.from, op.to, op.options, copy_strategy::automatic, counts );
+                break;
+            }
+            case operation_type::create_directory:
+                op.value = std::filesystem::create_directory( op.from, op.error );
+                break;
+            }
+        }
+        catch( const std::filesystem::filesystem_error & e )
+        {
+            op.error = e.code();
+        }
+        catch( const std::bad_alloc & )
+        {
+            op.error = std::make_error_code( std::errc::not_enough_memory );
+        }
+    }
+
+    // Runs the operations at 'indices' on the pool while 'f' runs on the calling thread.
+    template< typename F >
+    void run_pooled_and( std::vector< operation > & ops, const std::vector< std::size_t > & indices, F && f )
+    {
+        if( indices.empty() || threads == 1 )
+        {
+            f();
+            for( const auto i : indices )
+            {
+                run( ops[ i ] );
+            }
+            return;
+        }
+
+        work_stealing_pool pool( std::min( threads, indices.size() ) );
+        for( const auto i : indices )
+        {
+            pool.submit( [ &op = ops[ i ] ]{ run( op ); } );
+        }
+        f();
+        pool.wait();
+    }
+
+#if defined( PG_IO_URING )
+    static unsigned opcode( operation_type type ) noexcept
+    {
+        switch( type )
+        {
+        case operation_type::stat:             return IORING_OP_STATX;
+        case operation_type::remove:           return IORING_OP_UNLINKAT;
+        case operation_type::rename:           return IORING_OP_RENAMEAT;
+        case operation_type::create_directory: return IORING_OP_MKDIRAT;
+        case operation_type::copy:
+        default:                               return IORING_OP_LAST;
+        }
+    }
+
+    static void prepare( io_uring_queue & ring, operation & op, std::size_t index ) noexcept
+    {
+        auto & sqe = ring.prepare();
+        sqe.opcode    = static_cast< __u8 >( opcode( op.type ) );
+        sqe.fd        = AT_FDCWD;
+        sqe.addr      = reinterpret_cast< __u64 >( op.from.c_str() );
+        sqe.user_data = index;
+        switch( op.type )
+        {
+        case operation_type::stat:
+            sqe.len         = STATX_BASIC_STATS;
+            sqe.off         = reinterpret_cast< __u64 >( &op.stx );
+            sqe.statx_flags = AT_STATX_SYNC_AS_STAT | ( op.follow_symlinks ? 0 : AT_SYMLINK_NOFOLLOW );
+            break;
+        case operation_type::remove:
+            sqe.unlink_flags = op.remove_directory ? AT_REMOVEDIR : 0;
+            break;
+        case operation_type::rename:
+            sqe.len   = static_cast< __u32 >( AT_FDCWD );
+            sqe.addr2 = reinterpret_cast< __u64 >( op.to.c_str() );
+            break;
+        case operation_type::create_directory:
+            sqe.len = 0777;
+            break;
+        case operation_type::copy:
+            break;
+        }
+    }
+
+    // Completes 'op' with 'result', returns true when the operation must be submitted again.
+    static bool finish( operation & op, int result ) noexcept
+    {
+        if( result == -EINTR || result == -EAGAIN )
+        {
+            return true;
+        }
+
+        switch( op.type )
+        {
+        case operation_type::stat:
+            if( result == 0 )
+            {
+                op.record = stat_record_from_statx( op.stx );
+            }
+            break;
+        case operation_type::remove:
+            // As std::filesystem::remove, a directory is removed when it's empty and a missing file is not an error
+            if( result == -EISDIR && !op.remove_directory )
+            {
+                op.remove_directory = true;
+                return true;
+            }
+            if( result == -ENOENT )
+            {
+                return false;
+            }
+            op.value = result == 0;
+            break;
+        case operation_type::create_directory:
+            // As std::filesystem::create_directory, an existing directory is not an error
+            if( result == -EEXIST )
+            {
+                std::error_code ec;
+                if( std::filesystem::is_directory( op.from, ec ) )
+                {
+                    return false;
+                }
+            }
+            op.value = result == 0;
+            break;
+        case operation_type::rename:
+        case operation_type::copy:
+            break;
+        }
+
+        if( result < 0 )
+        {
+            op.error = std::error_code( -result, std::generic_category() );
+        }
+        return false;
+    }
+
+    static void run_on_ring( io_uring_queue & ring, std::vector< operation > & ops, std::vector< std::size_t > pending )
+    {
+        // Submitted in order, 'pending' is used as a stack
+        std::reverse( pending.begin(), pending.end() );
+
+        std::size_t in_flight = 0;
+        while( !pending.empty() || in_flight )
+        {
+            while( !pending.empty() && in_flight < ring.size() )
+            {
+                prepare( ring, ops[ pending.back() ], pending.back() );
+                pending.pop_back();
+                ++in_flight;
+            }
+
+            if( const auto ec = ring.submit( 1 ) ) PG_UNLIKELY
+            {
+                throw std::filesystem::filesystem_error( "cannot submit batch", ec );
+            }
+
+            ring.complete( [ & ]( __u64 index, int result )
+            {
+                --in_flight;
+                if( finish( ops[ index ], result ) )
+                {
+                    pending.push_back( static_cast< std::size_t >( index ) );
+                }
+            } );
+        }
+    }
+#endif
+
+    const std::size_t        threads;
+    const batch_backend      backend;
+    std::vector< operation > operations;
+};
+
+// An operation that runs on a background thread, shared by the task that runs it and the Lua handle
+// that waits for it. The result is kept as a function that pushes it, so it's converted to Lua
+// values by the thread that owns the Lua state.
+// On Linux the eventfd returned by 'descriptor' becomes readable when the operation finishes and stays
+// readable, so an event loop can wait for it next to its other descriptors.
+class async_operation
+{
+public:
+    using result_function = std::function< int( lua_State * ) >;
+
+    async_operation()
+    {
+#if defined( __linux__ )
+        event.reset( ::eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK ) );
+        if( !event ) PG_UNLIKELY
+        {
+            throw std::filesystem::filesystem_error( "cannot create event", std::error_code( errno, std::generic_category() ) );
+        }
+#endif
+    }
+
+    // Runs 'f', which returns the result function, and stores its result or its exception.
+    template< typename F >
+    void run( F && f ) noexcept
+    {
+        result_function result;
+        std::exception_ptr  exception;
+        try
+        {
+            result = f();
+        }
+        catch( ... )
+        {
+            exception = std::current_exception();
+        }
+
+        {
+            std::lock_guard< std::mutex > lock( mutex );
+            push_result = std::move( result );
+            error       = std::move( exception );
+            finished    = true;
+        }
+        finished_condition.notify_all();
+#if defined( __linux__ )
+        const std::uint64_t one = 1;
+        static_cast< void >( ::write( event.get(), &one, sizeof( one ) ) );
+#endif
+    }
+
+    bool done() const
+    {
+        std::lock_guard< std::mutex > lock( mutex );
+        return finished;
+    }
+
+    // Waits until the operation finishes or 'timeout' expires, waits without limit when 'timeout' is negative.
+    bool wait( std::chrono::milliseconds timeout ) const
+    {
+        std::unique_lock< std::mutex > lock( mutex );
+        if( timeout.count() < 0 )
+        {
+            finished_condition.wait( lock, [ this ]{ return finished; } );
+            return true;
+        }
+        return finished_condition.wait_for( lock, timeout, [ this ]{ return finished; } );
+    }
+
+    // Pushes the result of a finished operation or rethrows its exception.
+    int push( lua_State * const L ) const
+    {
+        std::unique_lock< std::mutex > lock( mutex );
+        assert( finished );
+        if( error )
+        {
+            std::rethrow_exception( error );
+        }
+        const auto result = push_result;
+        lock.unlock();
+
+        return result( L );
+    }
+
+    int descriptor() const noexcept
+    {
+#if defined( __linux__ )
+        return event.get();
+#else
+        return -1;
+#endif
+    }
+
+private:
+    mutable std::mutex              mutex;
+    mutable std::condition_variable finished_condition;
+    bool                            finished = false;
+    result_function                 push_result;
+    std::exception_ptr              error;
+#if defined( __linux__ )
+    unique_fd                       event;
+#endif
+};
+
+// The Lua handle of an async_operation.
+struct async_handle
+{
+    std::shared_ptr< async_operation > operation;
+};
+
+// The pool that runs the async operations of a Lua state, created by the first operation.
+struct async_pool
+{
+    explicit async_pool( std::size_t threads )
+        : pool( threads )
+    {}
+
+    work_stealing_pool pool;
+};
+
+// An entry of a tree snapshot. 'path' is relative to the root of the snapshot with '/' as separator.
+struct snapshot_entry
+{
+    std::string                path;
+    std::filesystem::file_type type        = std::filesystem::file_type::none;
+    std::filesystem::perms     permissions = std::filesystem::perms::none;
+    std::uintmax_t             size        = 0;     // 0 for other entries than regular files
+    std::int64_t               mtime       = 0;     // Nanoseconds since the epoch of file_time_type
+    std::uintmax_t             inode       = 0;     // 0 when not available
+
+    bool same_status( const snapshot_entry & other ) const noexcept
+    {
+        return type == other.type && permissions == other.permissions && size == other.size && mtime == other.mtime && inode == other.inode;
+    }
+};
+
+// The snapshot format starts with an 8 bytes signature and the number of entries as 8 bytes little
+// endian integer. The entries follow sorted by their path; every entry is stored as LEB128 integers:
+// the length of the prefix shared with the previous path, the length of the rest of the path, the
+// rest of the path itself, the type, the permissions, the size, the zigzag encoded mtime and the inode.
+constexpr const char snapshot_signature[ 8 ] = { 'P', 'G', 'S', 'N', 'A', 'P', '0', '1' };
+
+inline void append_varint( std::string & out, std::uint64_t value )
+{
+    while( value >= 0x80 )
+    {
+        out.push_back( static_cast< char >( value | 0x80 ) );
+        value >>= 7;
+    }
+    out.push_back( static_cast< char >( value ) );
+}
+
+// Returns the entries of the tree below 'root' sorted by their path.
+// The tree is walked and stat'ed on the workers of 'pool'; symbolic links are not followed.
+inline std::vector< snapshot_entry > collect_tree( work_stealing_pool & pool, const std::filesystem::path & root,
+                                                   std::filesystem::directory_options options )
+{
+    const auto root_string = root.generic_string();
+    const auto prefix      = root_string.size() + ( !root_string.empty() && root_string.back() != '/' ? 1 : 0 );
+
+    std::vector< std::vector< snapshot_entry > > found( pool.size() + 1 );
+    pg::parallel_walk( pool, root, options, [ & ]( const std::filesystem::directory_entry & entry, int )
+    {
+        const auto record = pg::stat_path( entry.path(), stat_type | stat_perms | stat_size | stat_mtime | stat_inode, false );
+        if( record.exists )
+        {
+            const auto worker = pool.worker_index();
+            found[ worker == work_stealing_pool::no_worker ? pool.size() : worker ].push_back( snapshot_entry{
+                entry.path().generic_string().substr( prefix ),
+                record.type,
+                record.permissions,
+                record.size.value_or( 0 ),
+                std::chrono::duration_cast< std::chrono::nanoseconds >( record.mtime.time_since_epoch() ).count(),
+                record.inode.value_or( 0 ) } );
+        }
+        return true;
+    } );
+
+    std::vector< snapshot_entry > entries;
+    for( auto & f : found )
+    {
+        std::move( f.begin(), f.end(), std::back_inserter( entries ) );
+        f = {};
+    }
+    std::sort( entries.begin(), entries.end(), []( const snapshot_entry & a, const snapshot_entry & b ){ return a.path < b.path; } );
+
+    return entries;
+}
+
+// Writes a snapshot of the tree below 'root' to file 'out', returns the number of entries.
+inline std::uint64_t write_snapshot( work_stealing_pool & pool, const std::filesystem::path & root,
+                                     std::filesystem::directory_options options, const std::filesystem::path & out )
+{
+    const auto entries = pg::collect_tree( pool, root, options );
+
+    std::string data( snapshot_signature, sizeof( snapshot_signature ) );
+    for( int i = 0 ; i < 8 ; ++i )
+    {
+        data.push_back( static_cast< char >( static_cast< std::uint64_t >( entries.size() ) >> ( 8 * i ) ) );
+    }
+
+    std::string_view previous;
+    for( const auto & entry : entries )
+    {
+        const auto shared = static_cast< std::size_t >( std::mismatch( previous.begin(), previous.end(), entry.path.begin(), entry.path.end() ).first - previous.begin() );
+        append_varint( data, shared );
+        append_varint( data, entry.path.size() - shared );
+        data.append( entry.path, shared, std::string::npos );
+        append_varint( data, static_cast< std::uint64_t >( entry.type ) );
+        append_varint( data, static_cast< std::uint64_t >( entry.permissions ) );
+        append_varint( data, entry.size );
+        append_varint( data, ( static_cast< std::uint64_t >( entry.mtime ) << 1 ) ^ static_cast< std::uint64_t >( entry.mtime >> 63 ) );
+        append_varint( data, entry.inode );
+        previous = entry.path;
+    }
+
+    write_file( out, data.data(), data.size(), write_file_options() );
+
+    return entries.size();
+}
+
+// Reads the entries of a snapshot written by 'write_snapshot' from a memory mapping.
+class snapshot_reader
+{
+public:
+    explicit snapshot_reader( const std::filesystem::path & p )
+        : p( p )
+        , file( p, false )
+    {
+        constexpr std::size_t header_size = sizeof( snapshot_signature ) + 8;
+        if( file.size() < header_size || std::memcmp( file.data(), snapshot_signature, sizeof( snapshot_signature ) ) != 0 ) PG_UNLIKELY
+        {
+            invalid();
+        }
+        remaining = load_le64( file.data() + sizeof( snapshot_signature ) );
+        position  = header_size;
+    }
+
+    // Decodes the next entry into 'entry', returns false after the last entry.
+    bool next()
+    {
+        if( remaining == 0 )
+        {
+            return false;
+        }
+
+        const auto shared = read_varint();
+        const auto rest   = read_varint();
+        if( shared > current.path.size() || rest > file.size() - position ) PG_UNLIKELY
+        {
+            invalid();
+        }
+        current.path.resize( static_cast< std::size_t >( shared ) );
+        current.path.append( reinterpret_cast< const char * >( file.data() ) + position, static_cast< std::size_t >( rest ) );
+        position += static_cast< std::size_t >( rest );
+
+        current.type        = static_cast< std::filesystem::file_type >( read_varint() );
+        current.permissions = static_cast< std::filesystem::perms >( read_varint() );
+        current.size        = read_varint();
+        const auto mtime    = read_varint();
+        current.mtime       = static_cast< std::int64_t >( ( mtime >> 1 ) ^ ( ~( mtime & 1 ) + 1 ) );
+        current.inode       = read_varint();
+
+        --remaining;
+        return true;
+    }
+
+    const snapshot_entry & entry() const noexcept
+    {
+        return current;
+    }
+
+private:
+    std::uint64_t read_varint()
+    {
+        std::uint64_t value = 0;
+        for( unsigned shift = 0 ; shift < 64 ; shift += 7 )
+        {
+            if( position == file.size() ) PG_UNLIKELY
+            {
+                break;
+            }
+            const auto byte = file.data()[ position++ ];
+            value |= std::uint64_t( byte & 0x7F ) << shift;
+            if( !( byte & 0x80 ) )
+            {
+                return value;
+            }
+        }
+        invalid();
+    }
+
+    [[noreturn]] void invalid() const
+    {
+        throw std::filesystem::filesystem_error( "invalid snapshot", p, std::make_error_code( std::errc::invalid_argument ) );
+    }
+
+    const std::filesystem::path p;
+    mapped_file                 file;
+    std::size_t                 position  = 0;
+    std::uint64_t               remaining = 0;
+    snapshot_entry              current;
+};
+
+// Merges two snapshots in one pass, reporting the paths that were added, removed or changed from
+// snapshot 'a' to snapshot 'b'.
+class snapshot_diff
+{
+public:
+    enum class change
+    {
+        added,
+        removed,
+        changed
+    };
+
+    snapshot_diff( const std::filesystem::path & a, const std::filesystem::path & b )
+        : a( a )
+        , b( b )
+    {
+        has_a = this->a.next();
+        has_b = this->b.next();
+    }
+
+    // Sets 'kind' and 'path' to the next difference, returns false when there are no more differences.
+    bool next( change & kind, std::string & path )
+    {
+        while( has_a || has_b )
+        {
+            const int order = !has_a ? 1 : !has_b ? -1 : a.entry().path.compare( b.entry().path );
+            if( order < 0 )
+            {
+                kind  = change::removed;
+                path  = a.entry().path;
+                has_a = a.next();
+                return true;
+            }
+            if( order > 0 )
+            {
+                kind  = change::added;
+                path  = b.entry().path;
+                has_b = b.next();
+                return true;
+            }
+
+            const bool same = a.entry().same_status( b.entry() );
+            if( !same )
+            {
+                kind = change::changed;
+                path = a.entry().path;
+            }
+            has_a = a.next();
+            has_b = b.next();
+            if( !same )
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    snapshot_reader a;
+    snapshot_reader b;
+    bool            has_a = false;
+    bool            has_b = false;
+};
+
+static constexpr const char * snapshot_change_names[] = { "added", "removed", "changed", nullptr };
+
+enum class sync_action_type
+{
+    remove,
+    create_directory,
+    copy,
+    symlink,
+    update
+};
+
+static constexpr const char * sync_action_names[] = { "remove", "create_directory", "copy", "symlink", "update", nullptr };
+
+// An action of a tree synchronization. 'entry' is the entry of the source tree, or of the destination tree for removals.
+struct sync_action
+{
+    sync_action_type type;
+    snapshot_entry   entry;
+};
+
+struct sync_options
+{
+    bool                               remove_extraneous = false;
+    bool                               permissions       = true;
+    bool                               times             = true;
+    bool                               dry_run           = false;
+    copy_strategy                      strategy          = copy_strategy::automatic;
+    std::filesystem::directory_options directory_options = std::filesystem::directory_options::none;
+};
+
+// Whether the regular files 'a' and 'b' have the same contents. Reading stops at the first block that differs;
+// a file that can't be read counts as different.
+inline bool same_file_contents( const std::filesystem::path & a, const std::filesystem::path & b )
+{
+    constexpr std::size_t block_size = std::size_t( 1 ) << 16;
+
+    std::ifstream first( a, std::ios::binary );
+    std::ifstream second( b, std::ios::binary );
+    if( !first || !second )
+    {
+        return false;
+    }
+
+    const std::unique_ptr< char[] > first_block( new char[ block_size ] );
+    const std::unique_ptr< char[] > second_block( new char[ block_size ] );
+    for( ;; )
+    {
+        first.read( first_block.get(), static_cast< std::streamsize >( block_size ) );
+        second.read( second_block.get(), static_cast< std::streamsize >( block_size ) );
+        const auto n = first.gcount();
+        if( n != second.gcount() || first.bad() || second.bad() || std::memcmp( first_block.get(), second_block.get(), static_cast< std::size_t >( n ) ) != 0 )
+        {
+            return false;
+        }
+        if( n < static_cast< std::streamsize >( block_size ) )
+        {
+            return true;
+        }
+    }
+}
+
+// Plans the actions that make the tree with the sorted entries 'dst' like the tree with the sorted entries 'src'.
+// Regular files of another size are copied, files of the same size and mtime are taken to be the same. With
+// 'times' a file with another mtime is copied; without it the copies keep the mtime of when they were copied,
+// so these files are compared by contents on the workers of 'pool' and only copied when they differ.
+// The actions are ordered like they are performed: the removals, the directories to create, the files and
+// symbolic links to copy, then the entries whose metadata is updated.
+inline std::vector< sync_action > plan_sync( work_stealing_pool & pool, const std::filesystem::path & src_root, const std::filesystem::path & dst_root,
+                                             const std::vector< snapshot_entry > & src, const std::vector< snapshot_entry > & dst,
+                                             const sync_options & options )
+{
+    using std::filesystem::file_type;
+
+    std::vector< sync_action >             actions;
+    std::unordered_set< std::string_view > removed;     // The directories of 'dst' removed with their contents
+    std::unordered_set< std::string_view > touched;     // The directories in which entries are created or removed
+    std::vector< const snapshot_entry * >  unchanged;   // The directories with the same metadata in both trees
+
+    // The files of the same size in both trees that are compared by contents
+    std::vector< std::pair< const snapshot_entry *, const snapshot_entry * > > compared;
+
+    const auto touch = [ & ]( std::string_view p )
+    {
+        const auto slash = p.rfind( '/' );
+        if( slash != std::string_view::npos )
+        {
+            touched.insert( p.substr( 0, slash ) );
+        }
+    };
+    const auto in_removed_directory = [ & ]( std::string_view p )
+    {
+        for( auto slash = p.find( '/' ) ; slash != std::string_view::npos ; slash = p.find( '/', slash + 1 ) )
+        {
+            if( removed.count( p.substr( 0, slash ) ) )
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+    const auto remove = [ & ]( const snapshot_entry & entry )
+    {
+        actions.push_back( { sync_action_type::remove, entry } );
+        if( entry.type == file_type::directory )
+        {
+            removed.insert( entry.path );
+        }
+        touch( entry.path );
+    };
+    const auto create = [ & ]( const snapshot_entry & entry )
+    {
+        switch( entry.type )
+        {
+        case file_type::directory: actions.push_back( { sync_action_type::create_directory, entry } ); break;
+        case file_type::regular:   actions.push_back( { sync_action_type::copy, entry } );             break;
+        case file_type::symlink:   actions.push_back( { sync_action_type::symlink, entry } );          break;
+        default:                   return;
+        }
+        touch( entry.path );
+    };
+
+    std::size_t i = 0;
+    std::size_t j = 0;
+    while( i < src.size() || j < dst.size() )
+    {
+        const int order = i == src.size() ? 1 : j == dst.size() ? -1 : src[ i ].path.compare( dst[ j ].path );
+        if( order < 0 )
+        {
+            create( src[ i++ ] );
+            continue;
+        }
+        if( order > 0 )
+        {
+            const auto & entry = dst[ j++ ];
+            if( options.remove_extraneous && !in_removed_directory( entry.path ) )
+            {
+                remove( entry );
+            }
+            continue;
+        }
+
+        const auto & s = src[ i++ ];
+        const auto & d = dst[ j++ ];
+        if( s.type != d.type )
+        {
+            remove( d );
+            create( s );
+            continue;
+        }
+
+        const bool metadata_changed = ( options.permissions && s.permissions != d.permissions ) || ( options.times && s.mtime != d.mtime );
+        switch( s.type )
+        {
+        case file_type::regular:
+            if( s.size != d.size || ( options.times && s.mtime != d.mtime ) )
+            {
+                create( s );
+            }
+            else if( s.mtime != d.mtime )
+            {
+                compared.emplace_back( &s, &d );
+            }
+            else if( metadata_changed )
+            {
+                actions.push_back( { sync_action_type::update, s } );
+            }
+            break;
+        case file_type::symlink:
+        {
+            std::error_code src_ec;
+            std::error_code dst_ec;
+            if( std::filesystem::read_symlink( src_root / s.path, src_ec ) != std::filesystem::read_symlink( dst_root / d.path, dst_ec ) || src_ec )
+            {
+                create( s );
+            }
+            break;
+        }
+        case file_type::directory:
+            if( metadata_changed )
+            {
+                actions.push_back( { sync_action_type::update, s } );
+            }
+            else
+            {
+                unchanged.push_back( &s );
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    std::unique_ptr< bool[] > same( new bool[ compared.size() ] );
+    for( std::size_t k = 0 ; k < compared.size() ; ++k )
+    {
+        pool.submit( [ &, k ]{ same[ k ] = same_file_contents( src_root / compared[ k ].first->path, dst_root / compared[ k ].second->path ); } );
+    }
+    pool.wait();
+    for( std::size_t k = 0 ; k < compared.size() ; ++k )
+    {
+        const auto & [ s, d ] = compared[ k ];
+        if( !same[ k ] )
+        {
+            create( *s );
+        }
+        else if( options.permissions && s->permissions != d->permissions )
+        {
+            actions.push_back( { sync_action_type::update, *s } );
+        }
+    }
+
+    // Creating or removing entries changes the mtime of their directory, which is set again afterwards.
+    if( options.times )
+    {
+        for( const auto * directory : unchanged )
+        {
+            if( touched.count( directory->path ) )
+            {
+                actions.push_back( { sync_action_type::update, *directory } );
+            }
+        }
+    }
+
+    std::sort( actions.begin(), actions.end(), []( const sync_action & a, const sync_action & b )
+    {
+        return a.type != b.type ? a.type < b.type : a.entry.path < b.entry.path;
+    } );
+    return actions;
+}
+
+// Copies the regular file 'from' to a temporary file next to 'to', sets its mtime to 'mtime' when given and
+// renames it over 'to'. 'to' is the old or the new file at any time, also when the copy fails, and other hard
+// links to the old file are left alone.
+inline void replace_file( const std::filesystem::path & from, const std::filesystem::path & to, copy_strategy strategy,
+                          std::optional< std::filesystem::file_time_type > mtime )
+{
+    static std::atomic< unsigned > counter{ 0 };
+
+    for( ;; )
+    {
+        auto temporary = to;
+        temporary += ".sync." + std::to_string( counter++ ) + ".tmp";
+        try
+        {
+            pg::copy_file_contents( from, temporary, std::filesystem::copy_options::none, strategy );
+        }
+        catch( const std::filesystem::filesystem_error & e )
+        {
+            // A file with that name was left by another process or an earlier run, it's not ours to remove
+            if( e.code() == std::errc::file_exists )
+            {
+                continue;
+            }
+            std::error_code ec;
+            std::filesystem::remove( temporary, ec );
+            throw;
+        }
+
+        try
+        {
+            if( mtime )
+            {
+                std::filesystem::last_write_time( temporary, *mtime );
+            }
+            std::filesystem::rename( temporary, to );
+        }
+        catch( ... )
+        {
+            std::error_code ec;
+            std::filesystem::remove( temporary, ec );
+            throw;
+        }
+        return;
+    }
+}
+
+// Makes the tree 'dst' like the tree 'src': the files that differ and the missing entries are copied, the entries
+// of another type are replaced and, with 'remove_extraneous', the entries that are not in 'src' are removed. See
+// 'plan_sync' for how the files are compared. Both trees are walked and the files copied on the workers of 'pool'.
+// Existing files are replaced with a rename rather than rewritten, see 'replace_file'. Returns the planned
+// actions, which are only performed without 'dry_run'.
+inline std::vector< sync_action > sync_trees( work_stealing_pool & pool, const std::filesystem::path & src,
+                                              const std::filesystem::path & dst, const sync_options & options )
+{
+    using std::filesystem::file_type;
+
+    const auto src_record = pg::stat_path( src, stat_type, true );
+    if( !src_record.exists || src_record.type != file_type::directory )
+    {
+        throw std::filesystem::filesystem_error( "cannot synchronize", src, dst,
+                                                 src_record.exists ? std::make_error_code( std::errc::not_a_directory ) : src_record.error );
+    }
+    const auto dst_record = pg::stat_path( dst, stat_type, true );
+    if( dst_record.exists && dst_record.type != file_type::directory )
+    {
+        throw std::filesystem::filesystem_error( "cannot synchronize", src, dst, std::make_error_code( std::errc::not_a_directory ) );
+    }
+
+    const auto src_entries = pg::collect_tree( pool, src, options.directory_options );
+    const auto dst_entries = dst_record.exists ? pg::collect_tree( pool, dst, options.directory_options ) : std::vector< snapshot_entry >();
+    auto       actions     = pg::plan_sync( pool, src, dst, src_entries, dst_entries, options );
+    if( options.dry_run )
+    {
+        return actions;
+    }
+
+    if( !dst_record.exists )
+    {
+        std::filesystem::create_directories( dst );
+    }
+
+    const auto file_time = []( std::int64_t ns )
+    {
+        return std::filesystem::file_time_type( std::chrono::duration_cast< std::filesystem::file_time_type::duration >( std::chrono::nanoseconds( ns ) ) );
+    };
+
+    for( const auto & action : actions )
+    {
+        if( action.type == sync_action_type::remove )
+        {
+            pool.submit( [ & ]{ std::filesystem::remove_all( dst / action.entry.path ); } );
+        }
+    }
+    pool.wait();
+
+    for( const auto & action : actions )
+    {
+        if( action.type == sync_action_type::create_directory )
+        {
+            std::filesystem::create_directory( dst / action.entry.path );
+        }
+    }
+
+    for( const auto & action : actions )
+    {
+        if( action.type == sync_action_type::copy )
+        {
+            pool.submit( [ & ]
+            {
+                pg::replace_file( src / action.entry.path, dst / action.entry.path, options.strategy,
+                                  options.times ? std::optional( file_time( action.entry.mtime ) ) : std::nullopt );
+            } );
+        }
+        else if( action.type == sync_action_type::symlink )
+        {
+            pool.submit( [ & ]
+            {
+                const auto to = dst / action.entry.path;
+                std::filesystem::remove( to );
+                std::filesystem::copy_symlink( src / action.entry.path, to );
+            } );
+        }
+    }
+    pool.wait();
+
+    // The metadata is set from the deepest entries up, as changing the permissions of a directory can deny
+    // the access to its contents.
+    std::vector< const sync_action * > metadata;
+    for( const auto & action : actions )
+    {
+        if( action.type == sync_action_type::create_directory || action.type == sync_action_type::update )
+        {
+            metadata.push_back( &action );
+        }
+    }
+    std::sort( metadata.begin(), metadata.end(), []( const sync_action * a, const sync_action * b ){ return a->entry.path > b->entry.path; } );
+    for( const auto * action : metadata )
+    {
+        const auto to = dst / action->entry.path;
+        if( options.times )
+        {
+            std::filesystem::last_write_time( to, file_time( action->entry.mtime ) );
+        }
+        if( options.permissions )
+        {
+            std::filesystem::permissions( to, action->entry.permissions );
+        }
+    }
+
+    return actions;
+}
+}
+
+BEGIN_FUNCTION( path_to_string )
+    const auto & path = pg::check_user_data_arg< std::filesystem::path >( L, 1 );
+    const auto & str  = path.string();
+
+    lua_settop( L, 0 );
+    lua_pushlstring( L, str.c_str(), str.size() );
+
+    return 1;
+END_FUNCTION
+
+BEGIN_FUNCTION( path_gc )
+    auto & self = pg::to_user_data< std::filesystem::path >( L, 1 );
+
+    self.~path();
+
+    return 0;
+END_FUNCTION
+
+#define PATH_COMPARE( NAME, OP )\
+BEGIN_PROTECTED_FUNCTION( path_##NAME )\
+    if( lua_type( L, 1 ) == LUA_TSTRING )\
+    {\
+        auto p1 = pg::to_string_view( L, 1 );\
+        if( lua_type( L, 2 ) == LUA_TSTRING )\
+        {\
+            return pg::return_boolean( L, std::filesystem::path( p1 ) OP  pg::to_string_view( L, 2 ) );\
+        }\
+        else\
+        {\
+            const auto & p2 = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );\
+            return pg::return_boolean( L, p1 OP p2 );\
+        }\
+    }\
+    else\
+    {\
+        const auto & p1 = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );\
+        if( lua_type( L, 2 ) == LUA_TSTRING )\
+        {\
+            return pg::return_boolean( L, p1 OP pg::to_string_view( L, 2 ) );\
+        }\
+        else\
+        {\
+            const auto & p2 = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );\
+            return pg::return_boolean( L, p1 OP p2 );\
+        }\
+    }\
+CATCH_BAD_ALLOC \
+END_PROTECTED_FUNCTION
+
+PATH_COMPARE( eq, == )
+PATH_COMPARE( lt, < )
+PATH_COMPARE( le, <= )
+
+BEGIN_PROTECTED_FUNCTION( path_concat )
+    auto & self = pg::check_user_data_arg< std::filesystem::path >( L, 1 );
+
+    if( lua_type( L, 2 ) == LUA_TSTRING )
+    {
+        self.concat( pg::to_string_view( L, 2 ) );
+    }
+    else
+    {
+        const auto & path = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
+
+        self += path;
+    }
+
+    lua_settop( L, 1 );
+    return 1;
+CATCH_BAD_ALLOC
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( path_append )
+    auto & self = pg::check_user_data_arg< std::filesystem::path >( L, 1 );
+
+    if( lua_type( L, 2 ) == LUA_TSTRING )
+    {
+        self.append( pg::to_string_view( L, 2 ) );
+    }
+    else
+    {
+        const auto & path = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
+
+        self /= path;
+    }
+
+    lua_settop( L, 1 );
+    return 1;
+CATCH_BAD_ALLOC
+END_PROTECTED_FUNCTION
+
+static int path_clear( lua_State * const L ) noexcept
+{
+    auto & self = pg::check_user_data_arg< std::filesystem::path >( L, 1 );
+
+    self.clear();
+
+    return 0;
+}
+
+#define PATH_METHOD( METHOD )\
+BEGIN_PROTECTED_FUNCTION( path_##METHOD )\
+    auto & self = pg::check_user_data_arg< std::filesystem::path >( L, 1 );\
+    self.METHOD();\
+    return 1;\
+END_PROTECTED_FUNCTION
+
+PATH_METHOD( make_preferred )
+PATH_METHOD( remove_filename )
+
+BEGIN_PROTECTED_FUNCTION( path_replace_filename )
+    auto & self = pg::check_user_data_arg< std::filesystem::path >( L, 1 );
+
+    if( lua_type( L, 2 ) == LUA_TSTRING )
+    {
+        self.replace_filename( pg::to_string_view( L, 2 ) );
+    }
+    else
+    {
+        const auto & path = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
+
+        self.replace_filename( path );
+    }
+
+    lua_settop( L, 1 );
+    return 1;
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( path_replace_extension )
+    auto & self = pg::check_user_data_arg< std::filesystem::path >( L, 1 );
+
+    const int type = lua_type( L, 2 );
+    if( type == LUA_TSTRING )
+    {
+        self.replace_extension( pg::to_string_view( L, 2 ) );
+    }
+    else if( type == LUA_TNONE || type == LUA_TNIL )
+    {
+        self.replace_extension();
+    }
+    else
+    {
+        const auto & path = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path, string or nil" );
+
+        self.replace_extension( path );
+    }
+
+    lua_settop( L, 1 );
+    return 1;
+END_PROTECTED_FUNCTION
+
+#define PATH_METHOD_RETURN_NEW( METHOD )\
+BEGIN_PROTECTED_FUNCTION( path_##METHOD )\
+    const auto & self = pg::check_user_data_arg< std::filesystem::path >( L, 1 );\
+    return pg::return_new_user_data< std::filesystem::path >( L, self.METHOD() );\
+END_PROTECTED_FUNCTION
+
+PATH_METHOD_RETURN_NEW( root_name )
+PATH_METHOD_RETURN_NEW( root_directory )
+PATH_METHOD_RETURN_NEW( root_path )
+PATH_METHOD_RETURN_NEW( relative_path )
+PATH_METHOD_RETURN_NEW( parent_path )
+PATH_METHOD_RETURN_NEW( filename )
+PATH_METHOD_RETURN_NEW( stem )
+PATH_METHOD_RETURN_NEW( extension )
+
+#define PATH_PROPERTY( METHOD )\
+BEGIN_PROTECTED_FUNCTION( path_##METHOD )\
+    const auto & self = pg::check_user_data_arg< std::filesystem::path >( L, 1 );\
+    return pg::return_boolean( L, self.METHOD() );\
+END_PROTECTED_FUNCTION
+
+PATH_PROPERTY( empty )
+PATH_PROPERTY( has_root_path )
+PATH_PROPERTY( has_root_name )
+PATH_PROPERTY( has_root_directory )
+PATH_PROPERTY( has_relative_path )
+PATH_PROPERTY( has_parent_path )
+PATH_PROPERTY( has_filename )
+PATH_PROPERTY( has_stem )
+PATH_PROPERTY( has_extension )
+PATH_PROPERTY( is_absolute )
+PATH_PROPERTY( is_relative )
+
+BEGIN_PROTECTED_FUNCTION( path_lexically_relative )
+    const auto & self = pg::check_user_data_arg< std::filesystem::path >( L, 1 );
+
+    if( lua_type( L, 2 ) == LUA_TSTRING )
+    {
+        return pg::return_new_user_data< std::filesystem::path >( L, self.lexically_relative( pg::to_string_view( L, 2 ) ) );
+    }
+    else
+    {
+        const auto & path = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
+
+        return pg::return_new_user_data< std::filesystem::path >( L, self.lexically_relative( path ) );
+    }
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( path_lexically_proximate )
+    auto & self = pg::check_user_data_arg< std::filesystem::path >( L, 1 );
+
+    if( lua_type( L, 2 ) == LUA_TSTRING )
+    {
+        return pg::return_new_user_data< std::filesystem::path >( L, self.lexically_proximate( pg::to_string_view( L, 2 ) ) );
+    }
+    else
+    {
+        const auto & path = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
+
+        return pg::return_new_user_data< std::filesystem::path >( L, self.lexically_proximate( path ) );
+    }
+END_PROTECTED_FUNCTION
+
+PATH_METHOD_RETURN_NEW( lexically_normal )
+
+BEGIN_FUNCTION( path_iterator_gc )
+    auto self = &pg::to_user_data< pg::path_iterator >( L, 1 );
+
+    self->~pair< std::filesystem::path::iterator, const std::filesystem::path::iterator >();
+
+    return 0;
+END_FUNCTION
+
+struct path_iterator_state
+{
+    static constexpr luaL_Reg operators[] =
+    {
+        { "__gc", path_iterator_gc },
+        { NULL,   NULL }
+    };
+
+    static constexpr const luaL_Reg * methods = nullptr;
+};
+
+BEGIN_PROTECTED_FUNCTION( next_path_element )
+    auto & self = pg::check_user_data_arg< pg::path_iterator >( L, 1 );
+    if( self.first == self.second )
+    {
+        return pg::return_nil( L );
+    }
+
+    return pg::return_new_user_data< std::filesystem::path >( L, *self.first++ );
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( path_elements )
+    auto & self     = pg::check_user_data_arg< std::filesystem::path >( L, 1 );
+    auto   it_begin = self.begin();
+    auto   it_end   = self.end();
+
+    lua_settop( L, 0 );
+    lua_pushcfunction( L, next_path_element );
+    pg::new_user_data< pg::path_iterator >( L, it_begin, it_end );
+
+    return 2;
+END_PROTECTED_FUNCTION
+
+struct path
+{
+    static constexpr const luaL_Reg operators[] =
+    {
+        { "__tostring", path_to_string },
+        { "__gc",       path_gc },
+        { "__eq",       path_eq },
+        { "__lt",       path_lt },
+        { "__le",       path_le },
+        { NULL,         NULL }
+    };
+
+    static constexpr const luaL_Reg methods[] =
+    {
+        { "concat",              path_concat },
+        { "append",              path_append },
+        { "clear",               path_clear },
+        { "make_preferred",      path_make_preferred },
+        { "remove_filename",     path_remove_filename },
+        { "replace_filename",    path_replace_filename },
+        { "replace_extension",   path_replace_extension },
+        { "root_name",           path_root_name },
+        { "root_directory",      path_root_directory },
+        { "root_path",           path_root_path },
+        { "relative_path",       path_relative_path },
+        { "parent_path",         path_parent_path },
+        { "filename",            path_filename },
+        { "stem",                path_stem },
+        { "extension",           path_extension },
+        { "empty",               path_empty },
+        { "has_root_path",       path_has_root_path },
+        { "has_root_name",       path_has_root_name },
+        { "has_root_directory",  path_has_root_directory },
+        { "has_relative_path",   path_has_relative_path },
+        { "has_parent_path",     path_has_parent_path },
+        { "has_filename",        path_has_filename },
+        { "has_stem",            path_has_stem },
+        { "has_extension",       path_has_extension },
+        { "is_absolute",         path_is_absolute },
+        { "is_relative",         path_is_relative },
+        { "lexically_normal",    path_lexically_normal },
+        { "lexically_relative",  path_lexically_relative },
+        { "lexically_proximate", path_lexically_proximate },
+        { "elements",            path_elements },
+        { NULL,                  NULL }
+    };
+};
+
+BEGIN_FUNCTION( ft_gc )
+    auto & self = pg::to_user_data< std::filesystem::file_time_type >( L, 1 );
+
+    typedef std::filesystem::file_time_type file_time_type;
+    self.~file_time_type();
+
+    return 0;
+END_FUNCTION
+
+BEGIN_FUNCTION( ft_eq )
+    const auto & left  = pg::check_user_data_arg< std::filesystem::file_time_type >( L, 1 );
+    const auto & right = pg::check_user_data_arg< std::filesystem::file_time_type >( L, 2 );
+
+    return pg::return_boolean( L, left == right );
+END_FUNCTION
+
+BEGIN_FUNCTION( ft_lt )
+    const auto & left  = pg::check_user_data_arg< std::filesystem::file_time_type >( L, 1 );
+    const auto & right = pg::check_user_data_arg< std::filesystem::file_time_type >( L, 2 );
+
+    return pg::return_boolean( L, left < right );
+END_FUNCTION
+
+BEGIN_FUNCTION( ft_le )
+    const auto & left  = pg::check_user_data_arg< std::filesystem::file_time_type >( L, 1 );
+    const auto & right = pg::check_user_data_arg< std::filesystem::file_time_type >( L, 2 );
+
+    return pg::return_boolean( L, left <= right );
+END_FUNCTION
+
+BEGIN_FUNCTION( ft_add )
+    using duration = std::filesystem::file_time_type::duration;
+    using period   = std::filesystem::file_time_type::period;
+    using rep      = std::filesystem::file_time_type::rep;
+
+    const auto & self = pg::check_user_data_arg< std::filesystem::file_time_type >( L, 1 );
+
+    if( auto right = pg::test_user_data< duration >( L, 2 ) )
+    {
+        return pg::return_new_user_data< std::filesystem::file_time_type >( L, self + *right );
+    }
+    else if( lua_isinteger( L, 2 ) )
+    {
+        const auto seconds = static_cast< rep >( lua_tointeger( L, 2 ) );
+        const auto count   = seconds * period::den / period::num;
+
+        return pg::return_new_user_data< std::filesystem::file_time_type >( L, self + duration( count ) );
+    }
+    else if( lua_isnumber( L, 2 ) )
+    {
+        const auto seconds = lua_tonumber( L, 2 );
+        const auto count   = static_cast< rep >( seconds * period::den / period::num );
+
+        return pg::return_new_user_data< std::filesystem::file_time_type >( L, self + duration( count ) );
+    }
+    else
+    {
+        return pg::type_error( L, 2, "file time duration, number or integer" );
+    }
+END_FUNCTION
+
+BEGIN_FUNCTION( ft_sub )
+    using duration = std::filesystem::file_time_type::duration;
+    using period   = std::filesystem::file_time_type::period;
+    using rep      = std::filesystem::file_time_type::rep;
+
+    const auto & self  = pg::check_user_data_arg< std::filesystem::file_time_type >( L, 1 );
+
+    if( auto right_duration = pg::test_user_data< duration >( L, 2 ) )
+    {
+        return pg::return_new_user_data< std::filesystem::file_time_type >( L, self - *right_duration );
+    }
+    else if( lua_isnumber( L, 2 ) )
+    {
+        const auto seconds = lua_tonumber( L, 2 );
+        const auto count   = static_cast< rep >( seconds * period::den / period::num );
+        
+        return pg::return_new_user_data< std::filesystem::file_time_type >( L, self - duration( count ) );
+    }
+    else
+    {
+        const auto & right_file_time = pg::check_user_data_arg< std::filesystem::file_time_type >( L, 2, "number, file time or file time duration" );
+
+        return pg::return_new_user_data< duration >( L, self - right_file_time );
+    }
+END_FUNCTION
+
+struct fs_file_time
+{
+    static constexpr const luaL_Reg operators[] =
+    {
+        { "__gc",  ft_gc },
+        { "__eq",  ft_eq },
+        { "__lt",  ft_lt },
+        { "__le",  ft_le },
+        { "__add", ft_add },
+        { "__sub", ft_sub },
+        { NULL,    NULL }
+    };
+
+    static constexpr const luaL_Reg * methods = nullptr;
+};
+
+BEGIN_FUNCTION( ftd_gc )
+    auto & self = pg::to_user_data< std::filesystem::file_time_type::duration >( L, 1 );
+
+    typedef std::filesystem::file_time_type::duration file_time_type;
+    self.~file_time_type();
+
+    return 0;
+END_FUNCTION
+
+BEGIN_FUNCTION( ftd_eq )
+    const auto & left  = pg::check_user_data_arg< std::filesystem::file_time_type::duration >( L, 1 );
+    const auto & right = pg::check_user_data_arg< std::filesystem::file_time_type::duration >( L, 2 );
+
+    return pg::return_boolean( L, left == right );
+END_FUNCTION
+
+BEGIN_FUNCTION( ftd_lt )
+    const auto & left  = pg::check_user_data_arg< std::filesystem::file_time_type::duration >( L, 1 );
+    const auto & right = pg::check_user_data_arg< std::filesystem::file_time_type::duration >( L, 2 );
+
+    return pg::return_boolean( L, left < right );
+END_FUNCTION
+
+BEGIN_FUNCTION( ftd_le )
+    const auto & left  = pg::check_user_data_arg< std::filesystem::file_time_type::duration >( L, 1 );
+    const auto & right = pg::check_user_data_arg< std::filesystem::file_time_type::duration >( L, 2 );
+
+    return pg::return_boolean( L, left <= right );
+END_FUNCTION
+
+BEGIN_FUNCTION( ftd_add )
+    using duration = std::filesystem::file_time_type::duration;
+    using period   = std::filesystem::file_time_type::period;
+    using rep      = std::filesystem::file_time_type::rep;
+
+    if( const auto self = pg::test_user_data< duration >( L, 1 ) )
+    {
+        if( const auto right_duration = pg::test_user_data< duration >( L, 2 ) )
+        {
+            return pg::return_new_user_data< duration >( L, *self + *right_duration );
+        }
+        else if( const auto right_file_time = pg::test_user_data< std::filesystem::file_time_type >( L, 2 ) )
+        {
+            return pg::return_new_user_data< std::filesystem::file_time_type >( L, *self + *right_file_time );
+        }
+        else if( lua_isinteger( L, 2 ) )
+        {
+            const auto seconds = static_cast< rep >( lua_tointeger( L, 2 ) );
+            const auto count   = seconds * period::den / period::num;
+
+            return pg::return_new_user_data< duration >( L, *self + duration( count ) );
+        }
+        else if( lua_isnumber( L, 2 ) )
+        {
+            const auto seconds = lua_tonumber( L, 2 );
+            const auto count   = static_cast< rep >( seconds * period::den / period::num );
+
+            return pg::return_new_user_data< duration >( L, *self + duration( count ) );
+        }
+        else
+        {
+            return pg::type_error( L, 2, "file time duration, number or integer" );
+        }
+    }
+    else
+    {
+        const auto right = pg::check_user_data_arg< duration >( L, 2 );
+
+        if( lua_isinteger( L, 1 ) )
+        {
+            const auto seconds = static_cast< rep >( lua_tointeger( L, 1 ) );
+            const auto count   = seconds * period::den / period::num;
+
+            return pg::return_new_user_data< duration >( L, duration( count ) + right );
+        }
+        else if( lua_isnumber( L, 1 ) )
+        {
+            const auto seconds = lua_tonumber( L, 1 );
+            const auto count   = static_cast< rep >( seconds * period::den / period::num );
+
+            return pg::return_new_user_data< duration >( L, duration( count ) + right );
+        }
+        else
+        {
+            return pg::type_error( L, 1, "file time duration, number or integer" );
+        }
+    }
+END_FUNCTION
+
+BEGIN_FUNCTION( ftd_sub )
+    using duration = std::filesystem::file_time_type::duration;
+    using period   = std::filesystem::file_time_type::period;
+    using rep      = std::filesystem::file_time_type::rep;
+
+    const auto & self = pg::check_user_data_arg< duration >( L, 1 );
+
+    if( lua_isinteger( L, 2 ) )
+    {
+        const auto seconds = lua_tointeger( L, 2 );
+        const auto count   = seconds * period::den / period::num;
+
+        return pg::return_new_user_data< duration >( L, self - duration( count ) );
+    }
+    else if( lua_isnumber( L, 2 ) )
+    {
+        const auto seconds = lua_tonumber( L, 2 );
+        const auto count   = static_cast< rep >( seconds * period::den / period::num );
+
+        return pg::return_new_user_data< duration >( L, self - duration( count ) );
+    }
+    else
+    {
+        const auto right = pg::check_user_data_arg< duration >( L, 2, "number, file time or file time duration" );
+
+        return pg::return_new_user_data< duration >( L, self - right );
+    }
+END_FUNCTION
+
+BEGIN_FUNCTION( ftd_seconds )
+    const auto & duration = pg::check_user_data_arg< std::filesystem::file_time_type::duration >( L, 1 );
+
+    const auto count_num = static_cast< lua_Number >( duration.count() ) * std::filesystem::file_time_type::period::num;
+    const auto seconds   = count_num / std::filesystem::file_time_type::period::den;
+
+    return pg::return_number( L, seconds );
+END_FUNCTION
+
+struct fs_file_time_duration
+{
+    static constexpr const luaL_Reg operators[] =
+    {
+        { "__gc",  ftd_gc },
+        { "__eq",  ftd_eq },
+        { "__lt",  ftd_lt },
+        { "__le",  ftd_le },
+        { "__add", ftd_add },
+        { "__sub", ftd_sub },
+        { NULL,    NULL }
+    };
+
+    static constexpr const luaL_Reg methods[] =
+    {
+        { "seconds", ftd_seconds },
+        { NULL,      NULL }
+    };
+};
+
+BEGIN_FUNCTION( de_to_string )
+    const auto & path = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 1 ).path();
+    const auto & str  = path.string();
+
+    lua_settop( L, 0 );
+    lua_pushlstring( L, str.c_str(), str.size() );
+
+    return 1;
+END_FUNCTION
+
+BEGIN_FUNCTION( de_gc )
+    auto & self = pg::to_user_data< std::filesystem::directory_entry >( L, 1 );
+
+    self.~directory_entry();
+
+    return 0;
+END_FUNCTION
+
+BEGIN_FUNCTION( de_eq )
+    const auto & left  = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 1 );
+    const auto & right = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 2 );
+
+    return pg::return_boolean( L, left == right );
+END_FUNCTION
+
+BEGIN_FUNCTION( de_lt )
+    const auto & left  = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 1 );
+    const auto & right = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 2 );
+
+    return pg::return_boolean( L, left < right );
+END_FUNCTION
+
+BEGIN_FUNCTION( de_le )
+    const auto & left  = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 1 );
+    const auto & right = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 2 );
+
+    return pg::return_boolean( L, left <= right );
+END_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( de_assign )
+    auto & self = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 1 );
+    if( lua_type( L, 2 ) == LUA_TSTRING )
+    {
+        self.assign( pg::to_string_view( L, 2 ) );
+    }
+    else
+    {
+        const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
+        self.assign( p );
+    }
+    return pg::return_nothing( L );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( de_replace_filename )
+    auto & self = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 1 );
+    if( lua_type( L, 2 ) == LUA_TSTRING )
+    {
+        self.replace_filename( pg::to_string_view( L, 2 ) );
+    }
+    else
+    {
+        const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
+        self.replace_filename( p );
+    }
+    return pg::return_nothing( L );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( de_refresh )
+    auto & self = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 1 );
+    self.refresh();
+    return pg::return_nothing( L );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( de_path )
+    const auto & self = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 1 );
+    return pg::return_new_user_data< std::filesystem::path >( L, self.path() );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+#define DE_CHECK_PROPERTY( PROPERTY )\
+BEGIN_PROTECTED_FUNCTION( de_##PROPERTY )\
+    const auto & self = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 1 );\
+    return pg::return_boolean( L, self.PROPERTY() );\
+CATCH_BAD_ALLOC \
+CATCH_FILESYSTEM_ERROR \
+END_PROTECTED_FUNCTION
+
+DE_CHECK_PROPERTY( exists )
+DE_CHECK_PROPERTY( is_block_file )
+DE_CHECK_PROPERTY( is_character_file )
+DE_CHECK_PROPERTY( is_directory )
+DE_CHECK_PROPERTY( is_fifo )
+DE_CHECK_PROPERTY( is_other )
+DE_CHECK_PROPERTY( is_regular_file )
+DE_CHECK_PROPERTY( is_socket )
+DE_CHECK_PROPERTY( is_symlink )
+
+BEGIN_PROTECTED_FUNCTION( de_file_size )
+    const auto & self = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 1 );
+    return pg::return_integer( L, self.file_size() );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( de_hard_link_count )
+    const auto & self = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 1 );
+    return pg::return_integer( L, self.hard_link_count() );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( de_last_write_time )
+    const auto & self = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 1 );
+    return pg::return_new_user_data< std::filesystem::file_time_type >( L, self.last_write_time() );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+#define DE_X_STATUS( FUNCTION )\
+BEGIN_PROTECTED_FUNCTION( de_##FUNCTION )\
+    const auto & self        = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 1 );\
+    return pg::return_file_status( L, self.FUNCTION(), lua_toboolean( L, 2 ) );\
+CATCH_BAD_ALLOC \
+CATCH_FILESYSTEM_ERROR \
+END_PROTECTED_FUNCTION
+
+DE_X_STATUS( status )
+DE_X_STATUS( symlink_status )
+
+struct directory_entry
+{
+    static constexpr const luaL_Reg operators[] =
+    {
+        { "__tostring", de_to_string },
+        { "__gc",       de_gc },
+        { "__eq",       de_eq },
+        { "__lt",       de_lt },
+        { "__le",       de_le },
+        { NULL,         NULL }
+    };
+
+    static constexpr const luaL_Reg methods[] =
+    {
+        { "assign",             de_assign },
+        { "replace_filename",   de_replace_filename },
+        { "refresh",            de_refresh },
+        { "path",               de_path },
+        { "exists",             de_exists },
+        { "is_block_file",      de_is_block_file },
+        { "is_character_file",  de_is_character_file },
+        { "is_directory",       de_is_directory },
+        { "is_fifo",            de_is_fifo },
+        { "is_other",           de_is_other },
+        { "is_regular_file",    de_is_regular_file },
+        { "is_socket",          de_is_socket },
+        { "is_symlink",         de_is_symlink },
+        { "file_size",          de_file_size },
+        { "hard_link_count",    de_hard_link_count },
+        { "last_write_time",    de_last_write_time },
+        { "status",             de_status },
+        { "symlink_status",     de_symlink_status },
+        { NULL,                 NULL }
+    };
+};
+
+using directory_options = pg::enum_flags< std::filesystem::directory_options >;
+
+BEGIN_FUNCTION( directory_iterator_gc )
+    auto self = &pg::to_user_data< pg::directory_iterator >( L, 1 );
+
+    self->~pair< std::filesystem::directory_iterator, const std::filesystem::directory_iterator >();
+
+    return 0;
+END_FUNCTION
+
+struct directory_iterator_state
+{
+    static constexpr const luaL_Reg operators[] =
+    {
+        { "__gc", directory_iterator_gc },
+        { NULL,   NULL }
+    };
+
+    static constexpr const luaL_Reg * methods = nullptr;
+};
+
+BEGIN_PROTECTED_FUNCTION( next_directory_element )
+    auto & self = pg::check_user_data_arg< pg::directory_iterator >( L, 1 );
+    if( self.first == self.second )
+    {
+        return pg::return_nil( L );
+    }
+
+    return pg::return_new_user_data< std::filesystem::directory_entry >( L, *self.first++ );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( fs_directory )
+    std::filesystem::directory_iterator di;
+    if( lua_gettop( L ) <= 1 )
+    {
+        if( lua_type( L, 1 ) == LUA_TSTRING )
+        {
+             di = std::filesystem::directory_iterator( pg::to_string_view( L, 1 ) );
+        }
+        else
+        {
+            const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
+
+            di = std::filesystem::directory_iterator( p );
+        }
+    }
+    else
+    {
+        const auto options = pg::check_user_data_arg< std::filesystem::directory_options >( L, 2 );
+        if( lua_type( L, 1 ) == LUA_TSTRING )
+        {
+             di = std::filesystem::directory_iterator( pg::to_string_view( L, 1 ), options );
+        }
+        else
+        {
+            const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
+
+             di = std::filesystem::directory_iterator( p, options );
+        }
+    }
+
+    lua_settop( L, 0 );
+    lua_pushcfunction( L, next_directory_element );
+    pg::new_user_data< pg::directory_iterator >( L, std::move( di ), std::filesystem::directory_iterator() );
+    return 2;
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_FUNCTION( directory_batch_iterator_gc )
+    auto & self = pg::to_user_data< pg::directory_batch_iterator >( L, 1 );
+
+    self.~directory_batch_iterator();
+
+    return 0;
+END_FUNCTION
+
+struct directory_batch_iterator_state
+{
+    static constexpr const luaL_Reg operators[] =
+    {
+        { "__gc", directory_batch_iterator_gc },
+        { NULL,   NULL }
+    };
+
+    static constexpr const luaL_Reg * methods = nullptr;
+};
+
+// The user value of the iterator state is a table that holds the reused batch table at index 1
+// and a cache with the file_type objects at index 2, so a batch doesn't create a file_type per entry.
+BEGIN_PROTECTED_FUNCTION( next_directory_batch )
+    auto & self = pg::check_user_data_arg< pg::directory_batch_iterator >( L, 1 );
+
+    lua_settop( L, 1 );
+    lua_getuservalue( L, 1 );
+    lua_rawgeti( L, 2, 1 );             // 3: batch
+    lua_rawgeti( L, 2, 2 );             // 4: file type cache
+    lua_getfield( L, 3, "name" );       // 5
+    lua_getfield( L, 3, "type" );       // 6
+    lua_getfield( L, 3, "size" );       // 7
+    lua_getfield( L, 3, "mtime" );      // 8
+
+    std::size_t count = 0;
+    while( count < self.batch_size && self.walk.next() )
+    {
+        const auto index = static_cast< lua_Integer >( ++count );
+        const auto name  = self.walk.relative_path();
+
+        lua_pushlstring( L, name.data(), name.size() );
+        lua_rawseti( L, 5, index );
+
+        if( self.as_integers )
+        {
+            lua_pushinteger( L, static_cast< lua_Integer >( self.walk.type() ) );
+        }
+        else
+        {
+            pg::push_cached_enum( L, 4, self.walk.type() );
+        }
+        lua_rawseti( L, 6, index );
+
+        if( self.with_size )
+        {
+            if( const auto size = self.walk.file_size() )
+            {
+                lua_pushinteger( L, static_cast< lua_Integer >( *size ) );
+            }
+            else
+            {
+                lua_pushnil( L );
+            }
+            lua_rawseti( L, 7, index );
+        }
+
+        if( self.with_mtime )
+        {
+            if( const auto mtime = self.walk.last_write_time() )
+            {
+                pg::new_user_data< std::filesystem::file_time_type >( L, *mtime );
+            }
+            else
+            {
+                lua_pushnil( L );
+            }
+            lua_rawseti( L, 8, index );
+        }
+    }
+
+    // Clear the entries that are left behind by a larger previous batch
+    for( auto i = count + 1 ; i <= self.previous_count ; ++i )
+    {
+        for( int column = 5 ; column <= 8 ; ++column )
+        {
+            if( lua_type( L, column ) == LUA_TTABLE )
+            {
+                lua_pushnil( L );
+                lua_rawseti( L, column, static_cast< lua_Integer >( i ) );
+            }
+        }
+    }
+    self.previous_count = count;
+
+    if( count == 0 )
+    {
+        return pg::return_nil( L );
+    }
+
+    lua_pushinteger( L, static_cast< lua_Integer >( count ) );
+    lua_setfield( L, 3, "n" );
+    lua_pushinteger( L, static_cast< lua_Integer >( self.walk.stat_calls ) );
+    lua_setfield( L, 3, "stat_calls" );
+    lua_pushinteger( L, static_cast< lua_Integer >( self.walk.stats_avoided ) );
+    lua_setfield( L, 3, "stats_avoided" );
+    lua_settop( L, 3 );
+    return 1;
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( fs_directory_batch )
+    const auto batch_size = luaL_checkinteger( L, 2 );
+    if( batch_size < 1 ) PG_UNLIKELY
+    {
+        return luaL_error( L, "batch size must be at least 1" );
+    }
+    if( !lua_isnoneornil( L, 3 ) )
+    {
+        luaL_checktype( L, 3, LUA_TTABLE );
+    }
+
+    const auto options    = pg::opt_user_data_field( L, 3, "directory_options", std::filesystem::directory_options::none );
+    const bool with_size  = pg::opt_boolean_field( L, 3, "size", false );
+    const bool with_mtime = pg::opt_boolean_field( L, 3, "mtime", false );
+    const bool recursive  = pg::opt_boolean_field( L, 3, "recursive", false );
+    const bool integers   = pg::opt_boolean_field( L, 3, "integers", false );
+
+    pg::raw_directory_walk walk( pg::check_path_arg( L, 1 ), options, recursive );
+
+    lua_settop( L, 0 );
+    lua_pushcfunction( L, next_directory_batch );
+    pg::new_user_data< pg::directory_batch_iterator >( L, pg::directory_batch_iterator{ std::move( walk ), static_cast< std::size_t >( batch_size ), with_size, with_mtime, integers } );
+
+    const auto array_size = static_cast< int >( std::min< lua_Integer >( batch_size, 1 << 16 ) );
+    lua_createtable( L, 2, 0 );
+    lua_createtable( L, 0, 5 );
+    lua_createtable( L, array_size, 0 );
+    lua_setfield( L, -2, "name" );
+    lua_createtable( L, array_size, 0 );
+    lua_setfield( L, -2, "type" );
+    if( with_size )
+    {
+        lua_createtable( L, array_size, 0 );
+        lua_setfield( L, -2, "size" );
+    }
+    if( with_mtime )
+    {
+        lua_createtable( L, array_size, 0 );
+        lua_setfield( L, -2, "mtime" );
+    }
+    lua_rawseti( L, -2, 1 );
+    lua_newtable( L );
+    lua_rawseti( L, -2, 2 );
+    lua_setuservalue( L, 2 );
+
+    return 2;
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_FUNCTION( glob_iterator_gc )
+    auto & self = pg::to_user_data< pg::glob_iterator >( L, 1 );
+
+    self.~glob_iterator();
+
+    return 0;
+END_FUNCTION
+
+struct glob_iterator_state
+{
+    static constexpr const luaL_Reg operators[] =
+    {
+        { "__gc", glob_iterator_gc },
+        { NULL,   NULL }
+    };
+
+    static constexpr const luaL_Reg * methods = nullptr;
+};
+
+BEGIN_PROTECTED_FUNCTION( next_glob_batch )
+    auto & self = pg::check_user_data_arg< pg::glob_iterator >( L, 1 );
+
+    lua_settop( L, 0 );
+    lua_newtable( L );
+
+    std::filesystem::path match;
+    lua_Integer           count = 0;
+    while( static_cast< std::size_t >( count ) < self.batch_size && self.walk.next( match ) )
+    {
+        pg::new_user_data< std::filesystem::path >( L, std::move( match ) );
+        lua_rawseti( L, 1, ++count );
+    }
+
+    if( count == 0 )
+    {
+        return pg::return_nil( L );
+    }
+
+    return 1;
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+// 'patterns' is a pattern or an array of patterns, see 'pg::glob_matcher' for the syntax.
+BEGIN_PROTECTED_FUNCTION( fs_glob )
+    const bool        list  = lua_type( L, 1 ) == LUA_TTABLE;
+    const lua_Integer count = list ? luaL_len( L, 1 ) : 0;
+    if( list )
+    {
+        for( lua_Integer i = 1 ; i <= count ; ++i )
+        {
+            lua_rawgeti( L, 1, i );
+            if( lua_type( L, -1 ) != LUA_TSTRING ) PG_UNLIKELY
+            {
+                return luaL_error( L, "string expected at index %d of the patterns, got %s", static_cast< int >( i ), luaL_typename( L, -1 ) );
+            }
+            lua_pop( L, 1 );
+        }
+    }
+    else
+    {
+        luaL_checkstring( L, 1 );
+    }
+    if( !lua_isnoneornil( L, 2 ) )
+    {
+        luaL_checktype( L, 2, LUA_TTABLE );
+    }
+
+    const auto options    = pg::opt_user_data_field( L, 2, "directory_options", std::filesystem::directory_options::none );
+    const auto batch_size = pg::opt_integer_field( L, 2, "batch", 256 );
+    const bool hidden     = pg::opt_boolean_field( L, 2, "hidden", false );
+    if( batch_size < 1 ) PG_UNLIKELY
+    {
+        return luaL_error( L, "batch size must be at least 1" );
+    }
+
+    int root_arg = 0;
+    if( lua_istable( L, 2 ) )
+    {
+        lua_getfield( L, 2, "root" );
+        if( !lua_isnil( L, -1 ) )
+        {
+            root_arg = lua_gettop( L );
+            pg::check_path_type( L, root_arg );
+        }
+    }
+
+    std::vector< std::string > patterns;
+    if( list )
+    {
+        for( lua_Integer i = 1 ; i <= count ; ++i )
+        {
+            lua_rawgeti( L, 1, i );
+            patterns.emplace_back( pg::to_string_view( L, -1 ) );
+            lua_pop( L, 1 );
+        }
+    }
+    else
+    {
+        patterns.emplace_back( pg::to_string_view( L, 1 ) );
+    }
+
+    std::optional< std::filesystem::path > root;
+    if( root_arg != 0 )
+    {
+        root = pg::check_path_arg( L, root_arg );
+    }
+
+    pg::glob_walk walk( pg::glob_matcher( patterns, hidden ), std::move( root ), options );
+
+    lua_settop( L, 0 );
+    lua_pushcfunction( L, next_glob_batch );
+    pg::new_user_data< pg::glob_iterator >( L, pg::glob_iterator{ std::move( walk ), static_cast< std::size_t >( batch_size ) } );
+    return 2;
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_FUNCTION( lines_iterator_gc )
+    auto & self = pg::to_user_data< pg::lines_iterator >( L, 1 );
+
+    self.~lines_iterator();
+
+    return 0;
+END_FUNCTION
+
+struct lines_iterator_state
+{
+    static constexpr const luaL_Reg operators[] =
+    {
+        { "__gc", lines_iterator_gc },
+        { NULL,   NULL }
+    };
+
+    static constexpr const luaL_Reg * methods = nullptr;
+};
+
+BEGIN_PROTECTED_FUNCTION( next_line )
+    auto & self = pg::check_user_data_arg< pg::lines_iterator >( L, 1 );
+
+    std::string_view line;
+    if( !self.reader.next( line ) )
+    {
+        return pg::return_nil( L );
+    }
+
+    lua_settop( L, 0 );
+    lua_pushlstring( L, line.data(), line.size() );
+    return 1;
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( next_lines_batch )
+    auto & self = pg::check_user_data_arg< pg::lines_iterator >( L, 1 );
+
+    lua_settop( L, 0 );
+    lua_createtable( L, static_cast< int >( std::min< std::size_t >( self.batch_size, 1024 ) ), 0 );
+
+    std::string_view line;
+    lua_Integer      count = 0;
+    while( static_cast< std::size_t >( count ) < self.batch_size && self.reader.next( line ) )
+    {
+        lua_pushlstring( L, line.data(), line.size() );
+        lua_rawseti( L, 1, ++count );
+    }
+
+    if( count == 0 )
+    {
+        return pg::return_nil( L );
+    }
+
+    return 1;
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+// The second argument is an optional table with the fields 'buffer', 'batch', 'max_line' and 'crlf'.
+BEGIN_PROTECTED_FUNCTION( fs_lines )
+    pg::check_path_type( L, 1 );
+    if( !lua_isnoneornil( L, 2 ) )
+    {
+        luaL_checktype( L, 2, LUA_TTABLE );
+    }
+
+    const auto buffer_size = pg::opt_integer_field( L, 2, "buffer", lua_Integer( 4 ) << 20 );
+    const auto batch_size  = pg::opt_integer_field( L, 2, "batch", 0 );
+    const auto max_line    = pg::opt_integer_field( L, 2, "max_line", 0 );
+    const bool crlf        = pg::opt_boolean_field( L, 2, "crlf", false );
+    if( buffer_size < 1 ) PG_UNLIKELY
+    {
+        return luaL_error( L, "buffer size must be at least 1" );
+    }
+    if( batch_size < 0 ) PG_UNLIKELY
+    {
+        return luaL_error( L, "batch size must not be negative" );
+    }
+    if( max_line < 0 ) PG_UNLIKELY
+    {
+        return luaL_error( L, "max_line must not be negative" );
+    }
+
+    pg::line_reader reader( pg::check_path_arg( L, 1 ), static_cast< std::size_t >( buffer_size ), static_cast< std::size_t >( max_line ), crlf );
+
+    lua_settop( L, 0 );
+    lua_pushcfunction( L, batch_size > 0 ? next_lines_batch : next_line );
+    pg::new_user_data< pg::lines_iterator >( L, pg::lines_iterator{ std::move( reader ), static_cast< std::size_t >( batch_size ) } );
+    return 2;
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_FUNCTION( rdi_gc )
+    auto self = &pg::to_user_data< pg::recursive_directory_iterator >( L, 1 );
+
+    self->~recursive_directory_iterator();
+
+    return 0;
+END_FUNCTION
+
+BEGIN_FUNCTION( rdi_options )
+    const auto & self = pg::to_user_data< pg::recursive_directory_iterator >( L, 1 );
+    if( self.first == self.second )
+    {
+        return pg::return_nothing( L );
+    }
+    else
+    {
+        return pg::return_enum( L, self.first.options() );
+    }
+END_FUNCTION
+
+BEGIN_FUNCTION( rdi_depth )
+    const auto & self = pg::to_user_data< pg::recursive_directory_iterator >( L, 1 );
+    if( self.first == self.second )
+    {
+        return pg::return_nothing( L );
+    }
+    else
+    {
+        return pg::return_integer( L, self.first.depth() );
+    }
+END_FUNCTION
+
+BEGIN_FUNCTION( rdi_recursion_pending )
+    const auto & self = pg::to_user_data< pg::recursive_directory_iterator >( L, 1 );
+    if( self.first == self.second )
+    {
+        return pg::return_nothing( L );
+    }
+    else
+    {
+        return pg::return_boolean( L, self.first.recursion_pending() );
+    }
+END_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( rdi_pop )
+    auto & self = pg::to_user_data< pg::recursive_directory_iterator >( L, 1 );
+    if( self.first != self.second )
+    {
+        self.first.pop();
+    }
+    return pg::return_nothing( L );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_FUNCTION( rdi_disable_recursion_pending )
+    auto & self = pg::to_user_data< pg::recursive_directory_iterator >( L, 1 );
+    if( self.first != self.second )
+    {
+        self.first.disable_recursion_pending();
+    }
+    return pg::return_nothing( L );
+END_FUNCTION
+
+struct recursive_directory_iterator_state
+{
+    static constexpr const luaL_Reg operators[] =
+    {
+        { "__gc", rdi_gc },
+        { NULL,   NULL }
+    };
+
+    static constexpr const luaL_Reg methods[] =
+    {
+        { "options",                   rdi_options },
+        { "depth",                     rdi_depth },
+        { "recursion_pending",         rdi_recursion_pending },
+        { "pop",                       rdi_pop },
+        { "disable_recursion_pending", rdi_disable_recursion_pending },
+        { NULL,   NULL }
+    };
+};
+
+BEGIN_PROTECTED_FUNCTION( next_recursive_directory_element )
+    auto & self = pg::check_user_data_arg< pg::recursive_directory_iterator >( L, 1 );
+    if( self.first == self.second )
+    {
+        // Finished iteration in previous call
+        return pg::return_nil( L );
+    }
+    else if( lua_type( L, 2 ) == LUA_TNIL )
+    {
+        // First call of next with the current state
+        if( self.first == self.second )
+        {
+            // Nothing to iterate
+            return pg::return_nil( L );
+        }
+    }
+    else
+    {
+        ++self.first;
+    }
+
+    self.skip_rejected();
+    if( self.first == self.second )
+    {
+        // Finished iteration
+        return pg::return_nil( L );
+    }
+    lua_settop( L, 1 );
+    pg::new_user_data< std::filesystem::directory_entry >( L, *self.first );
+    return 2;
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+// Calls 'f' with the index of every element of the array in field 'key' of the table at 'index', while the
+// element is on the top of the stack. A nil field is an empty array.
+template< typename F >
+static void for_each_field_element( lua_State * const L, int index, const char * const key, F && f )
+{
+    lua_getfield( L, index, key );
+    if( !lua_isnil( L, -1 ) )
+    {
+        luaL_checktype( L, -1, LUA_TTABLE );
+        const auto count = static_cast< lua_Integer >( lua_rawlen( L, -1 ) );
+        for( lua_Integer i = 1 ; i <= count ; ++i )
+        {
+            lua_rawgeti( L, -1, i );
+            f( i );
+            lua_pop( L, 1 );
+        }
+    }
+    lua_pop( L, 1 );
+}
+
+static std::optional< std::filesystem::file_time_type > opt_file_time_field( lua_State * const L, int index, const char * const key )
+{
+    lua_getfield( L, index, key );
+    std::optional< std::filesystem::file_time_type > result;
+    if( !lua_isnil( L, -1 ) )
+    {
+        result = pg::check_user_data_arg< std::filesystem::file_time_type >( L, lua_gettop( L ) );
+    }
+    lua_pop( L, 1 );
+
+    return result;
+}
+
+static std::optional< std::uintmax_t > opt_size_field( lua_State * const L, int index, const char * const key )
+{
+    lua_getfield( L, index, key );
+    const bool is_set = !lua_isnil( L, -1 );
+    lua_pop( L, 1 );
+    if( !is_set )
+    {
+        return std::nullopt;
+    }
+
+    const auto size = pg::opt_integer_field( L, index, key, 0 );
+    if( size < 0 ) PG_UNLIKELY
+    {
+        luaL_error( L, "option '%s' must not be negative", key );
+    }
+
+    return static_cast< std::uintmax_t >( size );
+}
+
+// Reads the filter table of 'recursive_directory' at 'arg', see 'pg::directory_filter'.
+static pg::directory_filter check_directory_filter( lua_State * const L, int arg )
+{
+    luaL_checktype( L, arg, LUA_TTABLE );
+
+    // Every field is checked before the filter is created, a Lua error would skip its destructor.
+    for_each_field_element( L, arg, "types", [ L ]( lua_Integer i )
+    {
+        if( !pg::test_user_data< std::filesystem::file_type >( L, -1 ) && !lua_isinteger( L, -1 ) ) PG_UNLIKELY
+        {
+            luaL_error( L, "file_type expected at index %d of 'types', got %s", static_cast< int >( i ), luaL_typename( L, -1 ) );
+        }
+    } );
+    for( const char * const key : { "extensions", "skip_dirs" } )
+    {
+        for_each_field_element( L, arg, key, [ L, key ]( lua_Integer i )
+        {
+            if( lua_type( L, -1 ) != LUA_TSTRING ) PG_UNLIKELY
+            {
+                luaL_error( L, "string expected at index %d of '%s', got %s", static_cast< int >( i ), key, luaL_typename( L, -1 ) );
+            }
+        } );
+    }
+    const auto min_size   = opt_size_field( L, arg, "min_size" );
+    const auto max_size   = opt_size_field( L, arg, "max_size" );
+    const auto newer_than = opt_file_time_field( L, arg, "newer_than" );
+    const auto older_than = opt_file_time_field( L, arg, "older_than" );
+
+    pg::directory_filter filter;
+    for_each_field_element( L, arg, "types", [ L, &filter ]( lua_Integer )
+    {
+        const auto type = pg::test_user_data< std::filesystem::file_type >( L, -1 );
+        filter.types.push_back( type ? *type : static_cast< std::filesystem::file_type >( lua_tointeger( L, -1 ) ) );
+    } );
+    for_each_field_element( L, arg, "extensions", [ L, &filter ]( lua_Integer )
+    {
+        const auto e = pg::to_string_view( L, -1 );
+        filter.extensions.insert( ( e.empty() || e.front() == '.' ? std::filesystem::path( e ) : std::filesystem::path( "." ).concat( e ) ).native() );
+    } );
+    for_each_field_element( L, arg, "skip_dirs", [ L, &filter ]( lua_Integer )
+    {
+        filter.skip_directories.insert( std::filesystem::path( pg::to_string_view( L, -1 ) ).native() );
+    } );
+
+    filter.min_size   = min_size;
+    filter.max_size   = max_size;
+    filter.newer_than = newer_than;
+    filter.older_than = older_than;
+
+    return filter;
+}
+
+// The optional arguments of the recursive directory functions from 'arg'; directory options, a filter table or both in that order.
+static std::pair< std::filesystem::directory_options, std::optional< pg::directory_filter > > opt_recursive_directory_arguments( lua_State * const L, int arg )
+{
+    auto options = std::filesystem::directory_options::none;
+    if( lua_istable( L, arg ) )
+    {
+        return { options, check_directory_filter( L, arg ) };
+    }
+    if( !lua_isnoneornil( L, arg ) )
+    {
+        options = pg::check_user_data_arg< std::filesystem::directory_options >( L, arg );
+    }
+    if( !lua_isnoneornil( L, arg + 1 ) )
+    {
+        return { options, check_directory_filter( L, arg + 1 ) };
+    }
+
+    return { options, std::nullopt };
+}
+
+BEGIN_PROTECTED_FUNCTION( fs_recursive_directory )
+    pg::check_path_type( L, 1 );
+    auto [ options, filter ] = opt_recursive_directory_arguments( L, 2 );
+    const auto p             = pg::check_path_arg( L, 1 );
+    auto       rdi           = std::filesystem::recursive_directory_iterator( p, options );
+
+    lua_settop( L, 0 );
+    lua_pushcfunction( L, next_recursive_directory_element );
+    pg::new_user_data< pg::recursive_directory_iterator >( L, begin( rdi ), end( rdi ), std::move( filter ) );
+    return 2;
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_FUNCTION( parallel_walk_gc )
+    auto & self = pg::to_user_data< pg::parallel_walk_state >( L, 1 );
+
+    self.~parallel_walk_state();
+
+    return 0;
+END_FUNCTION
+
+struct parallel_walk_state
+{
+    static constexpr const luaL_Reg operators[] =
+    {
+        { "__gc", parallel_walk_gc },
+        { NULL,   NULL }
+    };
+
+    static constexpr const luaL_Reg * methods = nullptr;
+};
+
+BEGIN_PROTECTED_FUNCTION( next_parallel_walk_chunk )
+    auto & self = pg::check_user_data_arg< pg::parallel_walk_state >( L, 1 );
+
+    pg::parallel_walk_state::chunk entries;
+    if( !self.next( entries ) )
+    {
+        return pg::return_nil( L );
+    }
+
+    lua_settop( L, 0 );
+    lua_createtable( L, static_cast< int >( entries.size() ), 0 );
+    for( std::size_t i = 0 ; i < entries.size() ; ++i )
+    {
+        pg::new_user_data< std::filesystem::directory_entry >( L, std::move( entries[ i ] ) );
+        lua_rawseti( L, 1, static_cast< lua_Integer >( i + 1 ) );
+    }
+    return 1;
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( fs_walk_parallel )
+    auto options = std::filesystem::directory_options::none;
+    if( const auto o = pg::test_user_data< std::filesystem::directory_options >( L, 2 ) )
+    {
+        options = *o;
+    }
+    else if( !lua_isnoneornil( L, 2 ) )
+    {
+        luaL_checktype( L, 2, LUA_TTABLE );
+        options = pg::opt_user_data_field( L, 2, "directory_options", options );
+    }
+
+    const auto threads    = pg::opt_thread_count( L, 2 );
+    const auto chunk_size = pg::opt_integer_field( L, 2, "chunk_size", 1024 );
+    if( chunk_size < 1 ) PG_UNLIKELY
+    {
+        return luaL_error( L, "chunk size must be at least 1" );
+    }
+
+    auto root = pg::check_path_arg( L, 1 );
+
+    lua_settop( L, 0 );
+    lua_pushcfunction( L, next_parallel_walk_chunk );
+    pg::new_user_data< pg::parallel_walk_state >( L, std::move( root ), options, threads, static_cast< std::size_t >( chunk_size ) );
+    return 2;
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_FUNCTION( watcher_gc )
+    auto & self = pg::to_user_data< pg::file_watcher >( L, 1 );
+
+    self.~file_watcher();
+
+    return 0;
+END_FUNCTION
+
+static pg::file_watcher & check_open_watcher( lua_State * const L )
+{
+    auto & self = pg::check_user_data_arg< pg::file_watcher >( L, 1 );
+    if( !self.is_open() ) PG_UNLIKELY
+    {
+        luaL_error( L, "attempt to use a closed watcher" );
+    }
+
+    return self;
+}
+
+static std::chrono::milliseconds opt_seconds_as_milliseconds( lua_State * const L, int arg, std::chrono::milliseconds def )
+{
+    if( lua_isnoneornil( L, arg ) )
+    {
+        return def;
+    }
+
+    const auto seconds = luaL_checknumber( L, arg );
+    if( seconds < 0 ) PG_UNLIKELY
+    {
+        luaL_argerror( L, arg, "negative duration" );
+    }
+
+    return std::chrono::milliseconds( static_cast< long long >( seconds * 1000 ) );
+}
+
+// Returns an array with the events that arrived within 'timeout' seconds, waits indefinitely without a timeout.
+BEGIN_PROTECTED_FUNCTION( watcher_poll )
+    auto &     self    = check_open_watcher( L );
+    const auto timeout = opt_seconds_as_milliseconds( L, 2, std::chrono::milliseconds( -1 ) );
+
+    std::vector< pg::watch_event > events;
+    self.read( timeout, events );
+
+    lua_settop( L, 0 );
+    lua_createtable( L, static_cast< int >( events.size() ), 0 );
+    for( std::size_t i = 0 ; i < events.size() ; ++i )
+    {
+        const auto & e = events[ i ];
+
+        lua_createtable( L, 0, 4 );
+        lua_pushstring( L, pg::watch_event_type_names[ static_cast< int >( e.type ) ] );
+        lua_setfield( L, -2, "type" );
+        if( e.type != pg::watch_event_type::overflow )
+        {
+            pg::new_user_data< std::filesystem::path >( L, e.path );
+            lua_setfield( L, -2, "path" );
+            lua_pushboolean( L, e.directory );
+            lua_setfield( L, -2, "directory" );
+        }
+        if( e.type == pg::watch_event_type::move )
+        {
+            pg::new_user_data< std::filesystem::path >( L, e.from );
+            lua_setfield( L, -2, "from" );
+        }
+        lua_rawseti( L, 1, static_cast< lua_Integer >( i + 1 ) );
+    }
+    lua_settop( L, 1 );
+    return 1;
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( watcher_add )
+    auto & self = check_open_watcher( L );
+    self.add( pg::check_path_arg( L, 2 ) );
+    return pg::return_nothing( L );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_FUNCTION( watcher_fd )
+    const auto & self = pg::check_user_data_arg< pg::file_watcher >( L, 1 );
+    return self.is_open() ? pg::return_integer( L, self.descriptor() ) : pg::return_nil( L );
+END_FUNCTION
+
+BEGIN_FUNCTION( watcher_close )
+    auto & self = pg::check_user_data_arg< pg::file_watcher >( L, 1 );
+    self.close();
+    return pg::return_nothing( L );
+END_FUNCTION
+
+struct watcher
+{
+    static constexpr const luaL_Reg operators[] =
+    {
+        { "__gc",    watcher_gc },
+        { "__close", watcher_close },
+        { NULL,      NULL }
+    };
+
+    static constexpr const luaL_Reg methods[] =
+    {
+        { "poll",  watcher_poll },
+        { "add",   watcher_add },
+        { "fd",    watcher_fd },
+        { "close", watcher_close },
+        { NULL,    NULL }
+    };
+};
+
+// 'paths' is a path or an array of paths. The options are 'recursive' and 'coalesce', the window in seconds
+// in which events are collected and coalesced after the first event.
+BEGIN_PROTECTED_FUNCTION( fs_watch )
+    auto coalesce = std::chrono::milliseconds( 0 );
+    if( !lua_isnoneornil( L, 2 ) )
+    {
+        luaL_checktype( L, 2, LUA_TTABLE );
+        lua_getfield( L, 2, "coalesce" );
+        coalesce = opt_seconds_as_milliseconds( L, lua_gettop( L ), coalesce );
+        lua_pop( L, 1 );
+    }
+    const bool recursive = pg::opt_boolean_field( L, 2, "recursive", false );
+
+    const bool        list  = lua_type( L, 1 ) == LUA_TTABLE;
+    const lua_Integer count = list ? luaL_len( L, 1 ) : 0;
+    if( list )
+    {
+        for( lua_Integer i = 1 ; i <= count ; ++i )
+        {
+            lua_rawgeti( L, 1, i );
+            pg::check_path_type( L, lua_gettop( L ) );
+            lua_pop( L, 1 );
+        }
+    }
+    else
+    {
+        pg::check_path_type( L, 1 );
+    }
+
+    std::vector< std::filesystem::path > paths;
+    if( list )
+    {
+        for( lua_Integer i = 1 ; i <= count ; ++i )
+        {
+            lua_rawgeti( L, 1, i );
+            paths.push_back( pg::check_path_arg( L, lua_gettop( L ) ) );
+            lua_pop( L, 1 );
+        }
+    }
+    else
+    {
+        paths.push_back( pg::check_path_arg( L, 1 ) );
+    }
+
+    lua_settop( L, 0 );
+    auto & self = pg::new_user_data< pg::file_watcher >( L, recursive, coalesce );
+    for( const auto & p : paths )
+    {
+        self.add( p );
+    }
+    return 1;
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_FUNCTION( stat_cache_gc )
+    auto & self = pg::to_user_data< pg::stat_cache >( L, 1 );
+
+    self.~stat_cache();
+
+    return 0;
+END_FUNCTION
+
+// Returns the cached status of the path at argument 2; raises an error like the std::filesystem functions
+// when the status could not be queried for another reason than that the path doesn't exist.
+static pg::stat_record cached_status( lua_State * const L, bool follow_symlinks, const char * const what )
+{
+    auto &     self   = pg::check_user_data_arg< pg::stat_cache >( L, 1 );
+    const auto p      = pg::check_path_arg( L, 2 );
+    auto       record = self.get( p, follow_symlinks );
+    if( !record.exists && record.error != std::errc::no_such_file_or_directory && record.error != std::errc::not_a_directory )
+    {
+        throw std::filesystem::filesystem_error( what, p, record.error );
+    }
+
+    return record;
+}
+
+#define STAT_CACHE_IS_TYPE( FUNCTION, TYPE, FOLLOW )\
+BEGIN_PROTECTED_FUNCTION( stat_cache_##FUNCTION )\
+    return pg::return_boolean( L, cached_status( L, FOLLOW, "status" ).type == std::filesystem::file_type::TYPE );\
+CATCH_BAD_ALLOC \
+CATCH_FILESYSTEM_ERROR \
+END_PROTECTED_FUNCTION
+
+STAT_CACHE_IS_TYPE( is_block_file, block, true )
+STAT_CACHE_IS_TYPE( is_character_file, character, true )
+STAT_CACHE_IS_TYPE( is_directory, directory, true )
+STAT_CACHE_IS_TYPE( is_fifo, fifo, true )
+STAT_CACHE_IS_TYPE( is_regular_file, regular, true )
+STAT_CACHE_IS_TYPE( is_socket, socket, true )
+STAT_CACHE_IS_TYPE( is_symlink, symlink, false )
+
+BEGIN_PROTECTED_FUNCTION( stat_cache_exists )
+    return pg::return_boolean( L, cached_status( L, true, "status" ).exists );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( stat_cache_is_other )
+    using std::filesystem::file_type;
+
+    const auto type = cached_status( L, true, "status" ).type;
+    return pg::return_boolean( L, type != file_type::not_found && type != file_type::regular &&
+                                  type != file_type::directory && type != file_type::symlink );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+// Raises the error of a status query of a path that doesn't exist.
+static void check_exists( lua_State * const L, const pg::stat_record & record, const char * const what )
+{
+    if( !record.exists )
+    {
+        throw std::filesystem::filesystem_error( what, pg::check_path_arg( L, 2 ), record.error );
+    }
+}
+
+BEGIN_PROTECTED_FUNCTION( stat_cache_file_size )
+    const auto record = cached_status( L, true, "cannot get file size" );
+    check_exists( L, record, "cannot get file size" );
+    if( !record.size )
+    {
+        throw std::filesystem::filesystem_error( "cannot get file size", pg::check_path_arg( L, 2 ),
+                                                 std::make_error_code( record.type == std::filesystem::file_type::directory ? std::errc::is_a_directory
+                                                                                                                            : std::errc::not_supported ) );
+    }
+    return pg::return_integer( L, static_cast< lua_Integer >( *record.size ) );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
 END_PROTECTED_FUNCTION
 
-BEGIN_PROTECTED_FUNCTION( de_hard_link_count )
-    const auto & self = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 1 );
-    return pg::return_integer( L, self.hard_link_count() );
+BEGIN_PROTECTED_FUNCTION( stat_cache_hard_link_count )
+    const auto record = cached_status( L, true, "cannot get link count" );
+    check_exists( L, record, "cannot get link count" );
+    return pg::return_integer( L, static_cast< lua_Integer >( record.hard_links ) );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( stat_cache_last_write_time )
+    const auto record = cached_status( L, true, "cannot get file time" );
+    check_exists( L, record, "cannot get file time" );
+    return pg::return_new_user_data< std::filesystem::file_time_type >( L, record.mtime );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+#define STAT_CACHE_X_STATUS( FUNCTION, FOLLOW )\
+BEGIN_PROTECTED_FUNCTION( stat_cache_##FUNCTION )\
+    const auto record = cached_status( L, FOLLOW, "status" );\
+    return pg::return_file_status( L, std::filesystem::file_status( record.type, record.permissions ), lua_toboolean( L, 3 ) );\
+CATCH_BAD_ALLOC \
+CATCH_FILESYSTEM_ERROR \
+END_PROTECTED_FUNCTION
+
+STAT_CACHE_X_STATUS( status, true )
+STAT_CACHE_X_STATUS( symlink_status, false )
+
+// Drops the cached status of the path or of all paths when called without a path.
+BEGIN_PROTECTED_FUNCTION( stat_cache_invalidate )
+    auto & self = pg::check_user_data_arg< pg::stat_cache >( L, 1 );
+    self.invalidate( lua_isnoneornil( L, 2 ) ? std::filesystem::path() : pg::check_path_arg( L, 2 ) );
+    return pg::return_nothing( L );
+CATCH_BAD_ALLOC
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( stat_cache_stats )
+    auto &     self  = pg::check_user_data_arg< pg::stat_cache >( L, 1 );
+    const auto stats = self.statistics();
+
+    lua_settop( L, 0 );
+    lua_createtable( L, 0, 5 );
+    lua_pushinteger( L, static_cast< lua_Integer >( stats.hits ) );
+    lua_setfield( L, 1, "hits" );
+    lua_pushinteger( L, static_cast< lua_Integer >( stats.misses ) );
+    lua_setfield( L, 1, "misses" );
+    lua_pushinteger( L, static_cast< lua_Integer >( stats.invalidations ) );
+    lua_setfield( L, 1, "invalidations" );
+    lua_pushinteger( L, static_cast< lua_Integer >( stats.entries ) );
+    lua_setfield( L, 1, "entries" );
+    lua_pushinteger( L, static_cast< lua_Integer >( stats.watches ) );
+    lua_setfield( L, 1, "watches" );
+    return 1;
+CATCH_BAD_ALLOC
+END_PROTECTED_FUNCTION
+
+struct stat_cache
+{
+    static constexpr const luaL_Reg operators[] =
+    {
+        { "__gc", stat_cache_gc },
+        { NULL,   NULL }
+    };
+
+    static constexpr const luaL_Reg methods[] =
+    {
+        { "exists",            stat_cache_exists },
+        { "file_size",         stat_cache_file_size },
+        { "hard_link_count",   stat_cache_hard_link_count },
+        { "is_block_file",     stat_cache_is_block_file },
+        { "is_character_file", stat_cache_is_character_file },
+        { "is_directory",      stat_cache_is_directory },
+        { "is_fifo",           stat_cache_is_fifo },
+        { "is_other",          stat_cache_is_other },
+        { "is_regular_file",   stat_cache_is_regular_file },
+        { "is_socket",         stat_cache_is_socket },
+        { "is_symlink",        stat_cache_is_symlink },
+        { "last_write_time",   stat_cache_last_write_time },
+        { "status",            stat_cache_status },
+        { "symlink_status",    stat_cache_symlink_status },
+        { "invalidate",        stat_cache_invalidate },
+        { "stats",             stat_cache_stats },
+        { NULL,                NULL }
+    };
+};
+
+// The options are 'ttl', the time in seconds that a status is cached, and 'watch' to invalidate
+// the cached status of changed paths with inotify.
+BEGIN_PROTECTED_FUNCTION( fs_stat_cache )
+    auto ttl = std::chrono::milliseconds( 1000 );
+    if( !lua_isnoneornil( L, 1 ) )
+    {
+        luaL_checktype( L, 1, LUA_TTABLE );
+        lua_getfield( L, 1, "ttl" );
+        ttl = opt_seconds_as_milliseconds( L, lua_gettop( L ), ttl );
+        lua_pop( L, 1 );
+    }
+    const bool watch = pg::opt_boolean_field( L, 1, "watch", true );
+
+    return pg::return_new_user_data< pg::stat_cache >( L, ttl, watch );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+static pg::mapped_file & check_open_mapping( lua_State * const L )
+{
+    auto & self = pg::check_user_data_arg< pg::mapped_file >( L, 1 );
+    if( !self.is_open() ) PG_UNLIKELY
+    {
+        luaL_error( L, "attempt to use a closed mapped file" );
+    }
+
+    return self;
+}
+
+// Converts the 1 based position 'pos' in a view of 'size' bytes, which counts from the end when negative, to a position
+// from 0 to 'size' + 1, like the indices of 'string.sub'.
+static lua_Integer absolute_position( lua_Integer pos, std::size_t size ) noexcept
+{
+    const auto n = static_cast< lua_Integer >( size );
+    if( pos < 0 )
+    {
+        return std::max< lua_Integer >( n + pos + 1, 0 );
+    }
+
+    return std::min( pos, n + 1 );
+}
+
+// Returns the 0 based offset of the 'count' bytes at position 'arg', raises an error when they aren't all in the mapping
+static std::size_t check_range( lua_State * const L, const pg::mapped_file & self, int arg, std::size_t count )
+{
+    const auto pos = luaL_checkinteger( L, arg );
+    if( pos < 1 || static_cast< std::size_t >( pos - 1 ) > self.size() || self.size() - static_cast< std::size_t >( pos - 1 ) < count ) PG_UNLIKELY
+    {
+        luaL_argerror( L, arg, "out of range" );
+    }
+
+    return static_cast< std::size_t >( pos - 1 );
+}
+
+BEGIN_FUNCTION( mapped_file_size )
+    return pg::return_integer( L, static_cast< lua_Integer >( check_open_mapping( L ).size() ) );
+END_FUNCTION
+
+BEGIN_FUNCTION( mapped_file_sub )
+    const auto & self  = check_open_mapping( L );
+    const auto   first = std::max< lua_Integer >( absolute_position( luaL_optinteger( L, 2, 1 ), self.size() ), 1 );
+    const auto   last  = std::min< lua_Integer >( absolute_position( luaL_optinteger( L, 3, -1 ), self.size() ), static_cast< lua_Integer >( self.size() ) );
+
+    if( first > last )
+    {
+        lua_pushliteral( L, "" );
+    }
+    else
+    {
+        lua_pushlstring( L, reinterpret_cast< const char * >( self.data() ) + first - 1, static_cast< std::size_t >( last - first + 1 ) );
+    }
+
+    return 1;
+END_FUNCTION
+
+BEGIN_FUNCTION( mapped_file_byte )
+    const auto & self  = check_open_mapping( L );
+    const auto   first = std::max< lua_Integer >( absolute_position( luaL_optinteger( L, 2, 1 ), self.size() ), 1 );
+    const auto   last  = std::min< lua_Integer >( absolute_position( luaL_optinteger( L, 3, first ), self.size() ), static_cast< lua_Integer >( self.size() ) );
+
+    if( first > last )
+    {
+        return 0;
+    }
+    if( last - first >= std::numeric_limits< int >::max() || !lua_checkstack( L, static_cast< int >( last - first + 1 ) ) ) PG_UNLIKELY
+    {
+        return luaL_error( L, "byte range too large" );
+    }
+    for( auto i = first ; i <= last ; ++i )
+    {
+        lua_pushinteger( L, self.data()[ i - 1 ] );
+    }
+
+    return static_cast< int >( last - first + 1 );
+END_FUNCTION
+
+// Finds 'needle' as plain text from position 'init', returns the positions of the first and last byte of the match
+BEGIN_FUNCTION( mapped_file_find )
+    const auto & self = check_open_mapping( L );
+    luaL_checkstring( L, 2 );
+    const auto   needle = pg::to_string_view( L, 2 );
+    const auto   pos    = luaL_optinteger( L, 3, 1 );
+    const auto   init   = std::max< lua_Integer >( absolute_position( pos, self.size() ), 1 );
+
+    if( pos > static_cast< lua_Integer >( self.size() ) + 1 )
+    {
+        return pg::return_nil( L );
+    }
+
+    const std::string_view haystack( reinterpret_cast< const char * >( self.data() ), self.size() );
+    const auto             found = haystack.find( needle, static_cast< std::size_t >( init - 1 ) );
+    if( found == std::string_view::npos )
+    {
+        return pg::return_nil( L );
+    }
+
+    lua_pushinteger( L, static_cast< lua_Integer >( found + 1 ) );
+    lua_pushinteger( L, static_cast< lua_Integer >( found + needle.size() ) );
+    return 2;
+END_FUNCTION
+
+// Reads the integer of 'size' bytes at position 'pos', little endian unless 'big_endian' is true
+static int read_mapped_integer( lua_State * const L, bool is_signed )
+{
+    const auto & self = check_open_mapping( L );
+    const auto   size = luaL_checkinteger( L, 3 );
+    luaL_argcheck( L, size >= 1 && size <= 8, 3, "size must be from 1 to 8 bytes" );
+    const auto   offset     = check_range( L, self, 2, static_cast< std::size_t >( size ) );
+    const bool   big_endian = lua_toboolean( L, 4 );
+
+    const auto    bytes = self.data() + offset;
+    std::uint64_t value = 0;
+    for( lua_Integer i = 0 ; i < size ; ++i )
+    {
+        value |= std::uint64_t( bytes[ big_endian ? size - 1 - i : i ] ) << ( 8 * i );
+    }
+    if( is_signed && size < 8 && ( value >> ( 8 * size - 1 ) ) & 1 )
+    {
+        value |= ~std::uint64_t( 0 ) << ( 8 * size );
+    }
+
+    return pg::return_integer( L, static_cast< lua_Integer >( value ) );
+}
+
+BEGIN_FUNCTION( mapped_file_read_int )
+    return read_mapped_integer( L, true );
+END_FUNCTION
+
+BEGIN_FUNCTION( mapped_file_read_uint )
+    return read_mapped_integer( L, false );
+END_FUNCTION
+
+BEGIN_FUNCTION( mapped_file_write )
+    auto & self = check_open_mapping( L );
+    luaL_checkstring( L, 3 );
+    const auto data = pg::to_string_view( L, 3 );
+    if( !self.is_writable() ) PG_UNLIKELY
+    {
+        return luaL_error( L, "attempt to write to a read only mapped file" );
+    }
+    const auto offset = check_range( L, self, 2, data.size() );
+
+    std::memcpy( self.data() + offset, data.data(), data.size() );
+    return pg::return_nothing( L );
+END_FUNCTION
+
+BEGIN_FUNCTION( mapped_file_advise )
+    static const char * const names[] = { "normal", "sequential", "random", "willneed", "dontneed", NULL };
+#if defined( __linux__ )
+    static const int          values[] = { MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED, MADV_DONTNEED };
+#else
+    static const int          values[] = { 0, 0, 0, 0, 0 };
+#endif
+
+    auto &     self   = check_open_mapping( L );
+    const auto advice = luaL_checkoption( L, 2, NULL, names );
+    const auto ec     = self.advise( values[ advice ] );
+    if( ec ) PG_UNLIKELY
+    {
+        return luaL_error( L, "cannot advise mapped file: %s", ec.message().c_str() );
+    }
+
+    return pg::return_nothing( L );
+END_FUNCTION
+
+BEGIN_FUNCTION( mapped_file_close )
+    auto & self = pg::check_user_data_arg< pg::mapped_file >( L, 1 );
+    self.close();
+    return pg::return_nothing( L );
+END_FUNCTION
+
+BEGIN_FUNCTION( mapped_file_gc )
+    auto & self = pg::to_user_data< pg::mapped_file >( L, 1 );
+
+    self.~mapped_file();
+
+    return 0;
+END_FUNCTION
+
+struct mapped_file
+{
+    static constexpr const luaL_Reg operators[] =
+    {
+        { "__gc",    mapped_file_gc },
+        { "__close", mapped_file_close },
+        { "__len",   mapped_file_size },
+        { NULL,      NULL }
+    };
+
+    static constexpr const luaL_Reg methods[] =
+    {
+        { "size",      mapped_file_size },
+        { "sub",       mapped_file_sub },
+        { "byte",      mapped_file_byte },
+        { "find",      mapped_file_find },
+        { "read_int",  mapped_file_read_int },
+        { "read_uint", mapped_file_read_uint },
+        { "write",     mapped_file_write },
+        { "advise",    mapped_file_advise },
+        { "close",     mapped_file_close },
+        { NULL,        NULL }
+    };
+};
+
+// 'mode' is "r" for a read only mapping or "rw" for a mapping of which the writes go to the file.
+BEGIN_PROTECTED_FUNCTION( fs_map )
+    static const char * const modes[] = { "r", "rw", NULL };
+
+    const bool writable = luaL_checkoption( L, 2, "r", modes ) == 1;
+    const auto p        = pg::check_path_arg( L, 1 );
+
+    return pg::return_new_user_data< pg::mapped_file >( L, p, writable );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( atomic_batch_write )
+    auto &      self = pg::check_user_data_arg< pg::atomic_batch >( L, 1 );
+    std::size_t size = 0;
+    const auto  data = luaL_checklstring( L, 3, &size );
+    const auto  p    = pg::check_path_arg( L, 2 );
+
+    self.write( p, data, size );
+    return pg::return_nothing( L );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( atomic_batch_commit )
+    auto & self = pg::check_user_data_arg< pg::atomic_batch >( L, 1 );
+    return pg::return_integer( L, static_cast< lua_Integer >( self.commit() ) );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_FUNCTION( atomic_batch_discard )
+    auto & self = pg::check_user_data_arg< pg::atomic_batch >( L, 1 );
+    self.discard();
+    return pg::return_nothing( L );
+END_FUNCTION
+
+BEGIN_FUNCTION( atomic_batch_size )
+    const auto & self = pg::check_user_data_arg< pg::atomic_batch >( L, 1 );
+    return pg::return_integer( L, static_cast< lua_Integer >( self.size() ) );
+END_FUNCTION
+
+BEGIN_FUNCTION( atomic_batch_gc )
+    auto & self = pg::to_user_data< pg::atomic_batch >( L, 1 );
+
+    self.~atomic_batch();
+
+    return 0;
+END_FUNCTION
+
+struct atomic_batch
+{
+    static constexpr const luaL_Reg operators[] =
+    {
+        { "__gc",    atomic_batch_gc },
+        { "__close", atomic_batch_discard },
+        { "__len",   atomic_batch_size },
+        { NULL,      NULL }
+    };
+
+    static constexpr const luaL_Reg methods[] =
+    {
+        { "write",   atomic_batch_write },
+        { "commit",  atomic_batch_commit },
+        { "discard", atomic_batch_discard },
+        { NULL,      NULL }
+    };
+};
+
+// The first argument is an optional table with the field 'max_open_files'.
+BEGIN_PROTECTED_FUNCTION( fs_atomic_batch )
+    if( !lua_isnoneornil( L, 1 ) )
+    {
+        luaL_checktype( L, 1, LUA_TTABLE );
+    }
+    const auto max_open_files = pg::opt_integer_field( L, 1, "max_open_files", 256 );
+    if( max_open_files < 1 ) PG_UNLIKELY
+    {
+        return luaL_error( L, "max_open_files must be at least 1" );
+    }
+
+    return pg::return_new_user_data< pg::atomic_batch >( L, static_cast< std::size_t >( max_open_files ) );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( fs_atomic_write )
+    std::size_t size = 0;
+    const auto  data = luaL_checklstring( L, 2, &size );
+    const auto  p    = pg::check_path_arg( L, 1 );
+
+    pg::atomic_batch batch( 1 );
+    batch.write( p, data, size );
+    batch.commit();
+    return pg::return_nothing( L );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( fs_read_file )
+    const auto p        = pg::check_path_arg( L, 1 );
+    const auto contents = pg::read_file( p );
+
+    lua_pushlstring( L, contents.data.get(), contents.size );
+    return 1;
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+// The third argument is an optional table with the fields 'append', 'preallocate' and 'sync'.
+BEGIN_PROTECTED_FUNCTION( fs_write_file )
+    pg::check_path_type( L, 1 );
+    std::size_t size = 0;
+    const auto  data = luaL_checklstring( L, 2, &size );
+    if( !lua_isnoneornil( L, 3 ) )
+    {
+        luaL_checktype( L, 3, LUA_TTABLE );
+    }
+
+    pg::write_file_options options;
+    options.append      = pg::opt_boolean_field( L, 3, "append", false );
+    options.preallocate = pg::opt_boolean_field( L, 3, "preallocate", false );
+    options.sync        = pg::opt_boolean_field( L, 3, "sync", false );
+
+    const auto p = pg::check_path_arg( L, 1 );
+
+    pg::write_file( p, data, size, options );
+    return pg::return_nothing( L );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( fs_make_directory_entry )
+    const std::filesystem::path            * other_path = nullptr;
+    const std::filesystem::directory_entry * other_de   = nullptr;
+
+    const int type = lua_type( L, 1 );
+    switch( type )
+    {
+    case LUA_TUSERDATA:
+        if( other_path = pg::test_user_data< std::filesystem::path >( L, 1 ) ; other_path )
+        {
+            break;
+        }
+        if( other_de = pg::test_user_data< std::filesystem::directory_entry >( L, 1 ) ; other_de )
+        {
+            break;
+        }
+        [[fallthrough]];
+    case LUA_TNUMBER:
+    case LUA_TBOOLEAN:
+    case LUA_TTABLE:
+    case LUA_TFUNCTION:
+    case LUA_TTHREAD:
+    case LUA_TLIGHTUSERDATA:
+        pg::type_error( L, 1, "directory entry, path, string or nil" );
+    }
+
+    if( type == LUA_TNIL || type == LUA_TNONE )
+    {
+        return pg::return_new_user_data< std::filesystem::directory_entry >( L );
+    }
+    else if( type == LUA_TSTRING )
+    {
+        return pg::return_new_user_data< std::filesystem::directory_entry >( L, pg::to_string_view( L, 1 ) );
+    }
+
+    assert( type == LUA_TUSERDATA );
+
+    if( other_path )
+    {
+        return pg::return_new_user_data< std::filesystem::directory_entry >( L, *other_path );
+    }
+    else
+    {
+        assert( other_de );
+
+        return pg::return_new_user_data< std::filesystem::directory_entry >( L, *other_de );
+    }
 CATCH_BAD_ALLOC
 CATCH_FILESYSTEM_ERROR
 END_PROTECTED_FUNCTION
 
-BEGIN_PROTECTED_FUNCTION( de_last_write_time )
-    const auto & self = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 1 );
-    return pg::return_new_user_data< std::filesystem::file_time_type >( L, self.last_write_time() );
-CATCH_BAD_ALLOC
-CATCH_FILESYSTEM_ERROR
+BEGIN_PROTECTED_FUNCTION( fs_make_path )
+    const std::filesystem::path * other_path = nullptr;
+    
+    const int type = lua_type( L, 1 );
+    switch( type )
+    {
+    case LUA_TUSERDATA:
+        if( other_path = pg::test_user_data< std::filesystem::path >( L, 1 ) ; other_path )
+        {
+            break;
+        }
+        [[fallthrough]];
+    case LUA_TNUMBER:
+    case LUA_TBOOLEAN:
+    case LUA_TTABLE:
+    case LUA_TFUNCTION:
+    case LUA_TTHREAD:
+    case LUA_TLIGHTUSERDATA:
+        pg::type_error( L, 1, "path, string or nil" );
+    }
+
+    if( type == LUA_TNIL || type == LUA_TNONE )
+    {
+        return pg::return_new_user_data< std::filesystem::path >( L );
+    }
+    else if( type == LUA_TSTRING )
+    {
+        return pg::return_new_user_data< std::filesystem::path >( L, pg::to_string_view( L, 1 ) );
+    }
+    else
+    {
+        assert( type == LUA_TUSERDATA );
+
+        return pg::return_new_user_data< std::filesystem::path >( L, *other_path );
+    }
 END_PROTECTED_FUNCTION
 
-#define DE_X_STATUS( FUNCTION )\
-BEGIN_PROTECTED_FUNCTION( de_##FUNCTION )\
-    const auto & self        = pg::check_user_data_arg< std::filesystem::directory_entry >( L, 1 );\
-    const auto   file_status = self.FUNCTION();\
-    lua_settop( L, 0 );\
-    pg::new_user_data< std::filesystem::perms >( L, file_status.permissions() );\
-    pg::new_user_data< std::filesystem::file_type >( L, file_status.type() );\
-    return 2;\
+#define FS_TRANSFORM_PATH( TRANSFORMATION )\
+BEGIN_PROTECTED_FUNCTION( fs_##TRANSFORMATION )\
+    if( lua_type( L, 1 ) == LUA_TSTRING )\
+    {\
+        return pg::return_new_user_data< std::filesystem::path >( L, std::filesystem::TRANSFORMATION( pg::to_string_view( L, 1 ) ) );\
+    }\
+    const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );\
+    return pg::return_new_user_data< std::filesystem::path >( L, std::filesystem::TRANSFORMATION( p ) );\
 CATCH_BAD_ALLOC \
 CATCH_FILESYSTEM_ERROR \
 END_PROTECTED_FUNCTION
 
-DE_X_STATUS( status )
-DE_X_STATUS( symlink_status )
+FS_TRANSFORM_PATH( absolute )
+FS_TRANSFORM_PATH( canonical )
+FS_TRANSFORM_PATH( weakly_canonical )
 
-struct directory_entry
+using copy_options = pg::enum_flags< std::filesystem::copy_options >;
+
+static pg::copy_strategy check_copy_strategy( lua_State * const L, int arg )
 {
-    static constexpr const luaL_Reg operators[] =
-    {
-        { "__tostring", de_to_string },
-        { "__gc",       de_gc },
-        { "__eq",       de_eq },
-        { "__lt",       de_lt },
-        { "__le",       de_le },
-        { NULL,         NULL }
-    };
+    return static_cast< pg::copy_strategy >( luaL_checkoption( L, arg, "auto", pg::copy_strategy_names ) );
+}
 
-    static constexpr const luaL_Reg methods[] =
-    {
-        { "assign",             de_assign },
-        { "replace_filename",   de_replace_filename },
-        { "refresh",            de_refresh },
-        { "path",               de_path },
-        { "exists",             de_exists },
-        { "is_block_file",      de_is_block_file },
-        { "is_character_file",  de_is_character_file },
-        { "is_directory",       de_is_directory },
-        { "is_fifo",            de_is_fifo },
-        { "is_other",           de_is_other },
-        { "is_regular_file",    de_is_regular_file },
-        { "is_socket",          de_is_socket },
-        { "is_symlink",         de_is_symlink },
-        { "file_size",          de_file_size },
-        { "hard_link_count",    de_hard_link_count },
-        { "last_write_time",    de_last_write_time },
-        { "status",             de_status },
-        { "symlink_status",     de_symlink_status },
-        { NULL,                 NULL }
-    };
-};
+static std::filesystem::copy_options opt_copy_options( lua_State * const L, int arg )
+{
+    return lua_isnoneornil( L, arg ) ? std::filesystem::copy_options::none
+                                     : pg::check_user_data_arg< std::filesystem::copy_options >( L, arg );
+}
 
-using directory_options = pg::enum_flags< std::filesystem::directory_options >;
+struct copy_arguments
+{
+    std::filesystem::path         from;
+    std::filesystem::path         to;
+    std::filesystem::copy_options options;
+    pg::copy_strategy             strategy       = pg::copy_strategy::automatic;
+    std::size_t                   threads        = 1;
+    std::size_t                   max_open_files = 256;
+};
 
-BEGIN_FUNCTION( directory_iterator_gc )
-    auto self = &pg::to_user_data< pg::directory_iterator >( L, 1 );
+// The fourth argument is the strategy or a table with the fields 'strategy', 'threads' and 'max_open_files'.
+static copy_arguments check_copy_arguments( lua_State * const L )
+{
+    pg::check_path_type( L, 1 );
+    pg::check_path_type( L, 2 );
+    const auto  options        = opt_copy_options( L, 3 );
+    auto        strategy       = pg::copy_strategy::automatic;
+    std::size_t threads        = 1;
+    lua_Integer max_open_files = 256;
+
+    if( lua_type( L, 4 ) == LUA_TTABLE )
+    {
+        lua_getfield( L, 4, "strategy" );
+        strategy       = check_copy_strategy( L, lua_gettop( L ) );
+        threads        = pg::opt_thread_count( L, 4 );
+        max_open_files = pg::opt_integer_field( L, 4, "max_open_files", 256 );
+        if( max_open_files < 2 ) PG_UNLIKELY
+        {
+            luaL_error( L, "max_open_files must be at least 2" );
+        }
+    }
+    else
+    {
+        strategy = check_copy_strategy( L, 4 );
+    }
 
-    self->~pair< std::filesystem::directory_iterator, const std::filesystem::directory_iterator >();
+    return { pg::check_path_arg( L, 1 ), pg::check_path_arg( L, 2 ), options, strategy, threads,
+             static_cast< std::size_t >( max_open_files ) };
+}
 
-    return 0;
-END_FUNCTION
+static pg::copy_counts run_copy( const copy_arguments & args )
+{
+    pg::copy_counts counts = {};
+    if( args.threads > 1 && ( args.options & std::filesystem::copy_options::recursive ) != std::filesystem::copy_options::none )
+    {
+        pg::work_stealing_pool pool( args.threads );
+        pg::parallel_copy( pool, args.from, args.to, args.options, args.strategy, args.max_open_files, counts );
+    }
+    else
+    {
+        pg::copy_entry( args.from, args.to, args.options, args.strategy, counts );
+    }
+    return counts;
+}
 
-struct directory_iterator_state
+// Returns a table with the number of files copied by every strategy that was used.
+static int return_copy_counts( lua_State * const L, const pg::copy_counts & counts )
 {
-    static constexpr const luaL_Reg operators[] =
+    lua_settop( L, 0 );
+    lua_createtable( L, 0, 2 );
+    for( std::size_t i = 0 ; i < counts.size() ; ++i )
     {
-        { "__gc", directory_iterator_gc },
-        { NULL,   NULL }
-    };
+        if( counts[ i ] )
+        {
+            lua_pushinteger( L, static_cast< lua_Integer >( counts[ i ] ) );
+            lua_setfield( L, 1, pg::copy_strategy_names[ i ] );
+        }
+    }
+    return 1;
+}
 
-    static constexpr const luaL_Reg * methods = nullptr;
-};
+BEGIN_PROTECTED_FUNCTION( fs_copy )
+    const auto args = check_copy_arguments( L );
+    return return_copy_counts( L, run_copy( args ) );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
 
-BEGIN_PROTECTED_FUNCTION( next_directory_element )
-    auto & self = pg::check_user_data_arg< pg::directory_iterator >( L, 1 );
-    if( self.first == self.second )
+#define FS_RELATIVE_PROXIMATE( TRANSFORM )\
+BEGIN_PROTECTED_FUNCTION( fs_##TRANSFORM )\
+    if( lua_type( L, 1 ) == LUA_TSTRING )\
+    {\
+        auto p1 = pg::to_string_view( L, 1 );\
+        if( lua_gettop( L ) == 1 )\
+        {\
+            return pg::return_new_user_data< std::filesystem::path >( L, std::filesystem::TRANSFORM( p1 ) );\
+        }\
+        else if( lua_type( L, 2 ) == LUA_TSTRING )\
+        {\
+            return pg::return_new_user_data< std::filesystem::path >( L, std::filesystem::TRANSFORM( p1, pg::to_string_view( L, 2 ) ) );\
+        }\
+        else\
+        {\
+            const auto & p2 = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );\
+            return pg::return_new_user_data< std::filesystem::path >( L, std::filesystem::TRANSFORM( p1, p2 ) );\
+        }\
+    }\
+    else\
+    {\
+        const auto & p1 = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );\
+        if( lua_gettop( L ) == 1 )\
+        {\
+            return pg::return_new_user_data< std::filesystem::path >( L, std::filesystem::TRANSFORM( p1 ) );\
+        }\
+        else if( lua_type( L, 2 ) == LUA_TSTRING )\
+        {\
+            return pg::return_new_user_data< std::filesystem::path >( L, std::filesystem::TRANSFORM( p1, pg::to_string_view( L, 2 ) ) );\
+        }\
+        else\
+        {\
+            const auto & p2 = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );\
+            return pg::return_new_user_data< std::filesystem::path >( L, std::filesystem::TRANSFORM( p1, p2 ) );\
+        }\
+    }\
+CATCH_BAD_ALLOC \
+CATCH_FILESYSTEM_ERROR \
+END_PROTECTED_FUNCTION
+
+FS_RELATIVE_PROXIMATE( relative )
+FS_RELATIVE_PROXIMATE( proximate )
+    
+BEGIN_PROTECTED_FUNCTION( fs_copy_file )
+    pg::check_path_type( L, 1 );
+    pg::check_path_type( L, 2 );
+    const auto options  = opt_copy_options( L, 3 );
+    const auto strategy = check_copy_strategy( L, 4 );
+    const auto from     = pg::check_path_arg( L, 1 );
+    const auto to       = pg::check_path_arg( L, 2 );
+    const auto result   = pg::copy_file_contents( from, to, options, strategy );
+    if( !result.copied )
     {
-        return pg::return_nil( L );
+        return pg::return_boolean( L, false );
     }
 
-    return pg::return_new_user_data< std::filesystem::directory_entry >( L, *self.first++ );
+    lua_pushboolean( L, true );
+    lua_pushstring( L, pg::copy_strategy_names[ static_cast< int >( result.strategy ) ] );
+    return 2;
 CATCH_BAD_ALLOC
 CATCH_FILESYSTEM_ERROR
 END_PROTECTED_FUNCTION
 
-BEGIN_PROTECTED_FUNCTION( fs_directory )
-    std::filesystem::directory_iterator di;
-    if( lua_gettop( L ) <= 1 )
+#define FS_X_LINK( FUNCTION )\
+BEGIN_PROTECTED_FUNCTION( fs_##FUNCTION )\
+    if( lua_type( L, 1 ) == LUA_TSTRING )\
+    {\
+        auto p1 = pg::to_string_view( L, 1 );\
+        if( lua_type( L, 2 ) == LUA_TSTRING )\
+        {\
+            std::filesystem::FUNCTION( p1, pg::to_string_view( L, 2 ) );\
+        }\
+        else\
+        {\
+            const auto & p2 = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );\
+            std::filesystem::FUNCTION( p1, p2 );\
+        }\
+    }\
+    else\
+    {\
+        const auto & p1 = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );\
+        if( lua_type( L, 2 ) == LUA_TSTRING )\
+        {\
+            std::filesystem::FUNCTION( p1, pg::to_string_view( L, 2 ) );\
+        }\
+        else\
+        {\
+            const auto & p2 = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );\
+            std::filesystem::FUNCTION( p1, p2 );\
+        }\
+    }\
+    return pg::return_nothing( L );\
+CATCH_BAD_ALLOC \
+CATCH_FILESYSTEM_ERROR \
+END_PROTECTED_FUNCTION
+
+FS_X_LINK( copy_symlink )
+FS_X_LINK( create_hard_link )
+FS_X_LINK( create_symlink )
+FS_X_LINK( create_directory_symlink )
+
+BEGIN_PROTECTED_FUNCTION( fs_create_directory )
+    if( lua_type( L, 1 ) == LUA_TSTRING )
     {
-        if( lua_type( L, 1 ) == LUA_TSTRING )
+        if( lua_gettop( L ) > 1 )
         {
-             di = std::filesystem::directory_iterator( pg::to_string_view( L, 1 ) );
+            if( lua_type( L, 2 ) == LUA_TSTRING )
+            {
+                return pg::return_boolean( L, std::filesystem::create_directory( pg::to_string_view( L, 1 ), pg::to_string_view( L, 2 ) ) );
+            }
+            else
+            {
+                const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
+                return pg::return_boolean( L, std::filesystem::create_directory( pg::to_string_view( L, 1 ), p ) );
+            }
         }
         else
         {
-            const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
-
-            di = std::filesystem::directory_iterator( p );
+            return pg::return_boolean( L, std::filesystem::create_directory( pg::to_string_view( L, 1 ) ) );
         }
     }
     else
     {
-        const auto options = pg::check_user_data_arg< std::filesystem::directory_options >( L, 2 );
-        if( lua_type( L, 1 ) == LUA_TSTRING )
+        const auto & p1 = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
+        if( lua_gettop( L ) > 1 )
         {
-             di = std::filesystem::directory_iterator( pg::to_string_view( L, 1 ), options );
+            if( lua_type( L, 2 ) == LUA_TSTRING )
+            {
+                return pg::return_boolean( L, std::filesystem::create_directory( p1, pg::to_string_view( L, 2 ) ) );
+            }
+            else
+            {
+                const auto & p2 = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
+                return pg::return_boolean( L, std::filesystem::create_directory( p1, p2 ) );
+            }
         }
         else
         {
-            const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
-
-             di = std::filesystem::directory_iterator( p, options );
+            return pg::return_boolean( L, std::filesystem::create_directory( p1 ) );
         }
     }
-
-    lua_settop( L, 0 );
-    lua_pushcfunction( L, next_directory_element );
-    pg::new_user_data< pg::directory_iterator >( L, std::move( di ), std::filesystem::directory_iterator() );
-    return 2;
 CATCH_BAD_ALLOC
 CATCH_FILESYSTEM_ERROR
 END_PROTECTED_FUNCTION
 
-BEGIN_FUNCTION( rdi_gc )
-    auto self = &pg::to_user_data< pg::recursive_directory_iterator >( L, 1 );
-
-    self->~pair< std::filesystem::recursive_directory_iterator, const std::filesystem::recursive_directory_iterator >();
-
-    return 0;
-END_FUNCTION
-
-BEGIN_FUNCTION( rdi_options )
-    const auto & self = pg::to_user_data< pg::recursive_directory_iterator >( L, 1 );
-    if( self.first == self.second )
+BEGIN_PROTECTED_FUNCTION( fs_create_directories )
+    if( lua_type( L, 1 ) == LUA_TSTRING )
     {
-        return pg::return_nothing( L );
+        return pg::return_boolean( L, std::filesystem::create_directories( pg::to_string_view( L, 1 ) ) );
     }
     else
     {
-        return pg::return_new_user_data< std::filesystem::directory_options >( L, self.first.options() );
+        const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
+        return pg::return_boolean( L, std::filesystem::create_directories( p ) );
     }
-END_FUNCTION
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
 
-BEGIN_FUNCTION( rdi_depth )
-    const auto & self = pg::to_user_data< pg::recursive_directory_iterator >( L, 1 );
-    if( self.first == self.second )
-    {
-        return pg::return_nothing( L );
-    }
-    else
+BEGIN_PROTECTED_FUNCTION( fs_current_path )
+    if( lua_gettop( L ) == 0 )
     {
-        return pg::return_integer( L, self.first.depth() );
+        return pg::return_new_user_data< std::filesystem::path >( L, std::filesystem::current_path() );
     }
-END_FUNCTION
 
-BEGIN_FUNCTION( rdi_recursion_pending )
-    const auto & self = pg::to_user_data< pg::recursive_directory_iterator >( L, 1 );
-    if( self.first == self.second )
+    if( lua_type( L, 1 ) == LUA_TSTRING )
     {
-        return pg::return_nothing( L );
+        std::filesystem::current_path( pg::to_string_view( L, 1 ) );
     }
     else
     {
-        return pg::return_boolean( L, self.first.recursion_pending() );
+        const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
+        std::filesystem::current_path( p );
     }
-END_FUNCTION
 
-BEGIN_PROTECTED_FUNCTION( rdi_pop )
-    auto & self = pg::to_user_data< pg::recursive_directory_iterator >( L, 1 );
-    if( self.first != self.second )
+    lua_settop( L, 0 );
+    return 0;
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( fs_exists )
+    if( lua_type( L, 1 ) == LUA_TSTRING )
     {
-        self.first.pop();
+        return pg::return_boolean( L, std::filesystem::exists( pg::to_string_view( L, 1 ) ) );
+    }
+    else
+    {
+        const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
+        return pg::return_boolean( L, std::filesystem::exists( p ) );
     }
-    return pg::return_nothing( L );
 CATCH_BAD_ALLOC
 CATCH_FILESYSTEM_ERROR
 END_PROTECTED_FUNCTION
 
-BEGIN_FUNCTION( rdi_disable_recursion_pending )
-    auto & self = pg::to_user_data< pg::recursive_directory_iterator >( L, 1 );
-    if( self.first != self.second )
+BEGIN_PROTECTED_FUNCTION( fs_equivalent )
+    if( lua_type( L, 1 ) == LUA_TSTRING )
     {
-        self.first.disable_recursion_pending();
+        auto p1 = pg::to_string_view( L, 1 );
+        if( lua_type( L, 2 ) == LUA_TSTRING )
+        {
+            return pg::return_boolean( L, std::filesystem::equivalent( p1, pg::to_string_view( L, 2 ) ) );
+        }
+        else
+        {
+            const auto & p2 = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
+            return pg::return_boolean( L, std::filesystem::equivalent( p1, p2 ) );
+        }
     }
-    return pg::return_nothing( L );
-END_FUNCTION
-
-struct recursive_directory_iterator_state
-{
-    static constexpr const luaL_Reg operators[] =
+    else
     {
-        { "__gc", rdi_gc },
-        { NULL,   NULL }
-    };
+        const auto & p1 = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
+        if( lua_type( L, 2 ) == LUA_TSTRING )
+        {
+            return pg::return_boolean( L, std::filesystem::equivalent( p1, pg::to_string_view( L, 2 ) ) );
+        }
+        else
+        {
+            const auto & p2 = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
+            return pg::return_boolean( L, std::filesystem::equivalent( p1, p2 ) );
+        }
+    }
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
 
-    static constexpr const luaL_Reg methods[] =
+BEGIN_PROTECTED_FUNCTION( fs_file_size )
+    if( lua_type( L, 1 ) == LUA_TSTRING )
     {
-        { "options",                   rdi_options },
-        { "depth",                     rdi_depth },
-        { "recursion_pending",         rdi_recursion_pending },
-        { "pop",                       rdi_pop },
-        { "disable_recursion_pending", rdi_disable_recursion_pending },
-        { NULL,   NULL }
-    };
-};
-
-BEGIN_PROTECTED_FUNCTION( next_recursive_directory_element )
-    auto & self = pg::check_user_data_arg< pg::recursive_directory_iterator >( L, 1 );
-    if( self.first == self.second )
+        return pg::return_integer( L, std::filesystem::file_size( pg::to_string_view( L, 1 ) ) );
+    }
+    else
     {
-        // Finished iteration in previous call
-        return pg::return_nil( L );
+        const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
+        return pg::return_integer( L, std::filesystem::file_size( p ) );
     }
-    else if( lua_type( L, 2 ) == LUA_TNIL )
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( fs_hard_link_count )
+    if( lua_type( L, 1 ) == LUA_TSTRING )
     {
-        // First call of next with the current state
-        if( self.first == self.second )
-        {
-            // Nothing to iterate
-            return pg::return_nil( L );
-        }
+        return pg::return_integer( L, std::filesystem::hard_link_count( pg::to_string_view( L, 1 ) ) );
     }
-    else if( ++self.first == self.second )
+    else
     {
-        // Finished iteration
-        return pg::return_nil( L );
+        const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
+        return pg::return_integer( L, std::filesystem::hard_link_count( p ) );
     }
-    lua_settop( L, 1 );
-    pg::new_user_data< std::filesystem::directory_entry >( L, *self.first );
-    return 2;
 CATCH_BAD_ALLOC
 CATCH_FILESYSTEM_ERROR
 END_PROTECTED_FUNCTION
 
-BEGIN_PROTECTED_FUNCTION( fs_recursive_directory )
-    std::filesystem::recursive_directory_iterator rdi;
+BEGIN_PROTECTED_FUNCTION( fs_last_write_time )
     if( lua_gettop( L ) <= 1 )
     {
         if( lua_type( L, 1 ) == LUA_TSTRING )
         {
-             rdi = std::filesystem::recursive_directory_iterator( pg::to_string_view( L, 1 ) );
+            return pg::return_new_user_data< std::filesystem::file_time_type >( L, std::filesystem::last_write_time( pg::to_string_view( L, 1 ) ) );
         }
         else
         {
             const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
-
-            rdi = std::filesystem::recursive_directory_iterator( p );
+            return pg::return_new_user_data< std::filesystem::file_time_type >( L, std::filesystem::last_write_time( p ) );
         }
     }
     else
     {
-        const auto options = pg::check_user_data_arg< std::filesystem::directory_options >( L, 2 );
         if( lua_type( L, 1 ) == LUA_TSTRING )
         {
-             rdi = std::filesystem::recursive_directory_iterator( pg::to_string_view( L, 1 ), options );
+            std::filesystem::last_write_time( pg::to_string_view( L, 1 ), pg::check_user_data_arg< std::filesystem::file_time_type >( L, 2 ) );
         }
         else
         {
             const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
-
-             rdi = std::filesystem::recursive_directory_iterator( p, options );
+            std::filesystem::last_write_time( p, pg::check_user_data_arg< std::filesystem::file_time_type >( L, 2 ) );
         }
-    }
 
-    lua_settop( L, 0 );
-    lua_pushcfunction( L, next_recursive_directory_element );
-    pg::new_user_data< pg::recursive_directory_iterator >( L, begin( rdi ), end( rdi ) );
-    return 2;
+        return pg::return_nothing( L );
+    }
 CATCH_BAD_ALLOC
 CATCH_FILESYSTEM_ERROR
 END_PROTECTED_FUNCTION
 
-BEGIN_PROTECTED_FUNCTION( fs_make_directory_entry )
-    const std::filesystem::path            * other_path = nullptr;
-    const std::filesystem::directory_entry * other_de   = nullptr;
+BEGIN_FUNCTION( fs_file_time_now )
+        return pg::return_new_user_data< std::filesystem::file_time_type >( L, std::filesystem::file_time_type::clock::now() );
+END_FUNCTION
 
-    const int type = lua_type( L, 1 );
-    switch( type )
-    {
-    case LUA_TUSERDATA:
-        if( other_path = pg::test_user_data< std::filesystem::path >( L, 1 ) ; other_path )
-        {
-            break;
-        }
-        if( other_de = pg::test_user_data< std::filesystem::directory_entry >( L, 1 ) ; other_de )
-        {
-            break;
-        }
-        [[fallthrough]];
-    case LUA_TNUMBER:
-    case LUA_TBOOLEAN:
-    case LUA_TTABLE:
-    case LUA_TFUNCTION:
-    case LUA_TTHREAD:
-    case LUA_TLIGHTUSERDATA:
-        pg::type_error( L, 1, "directory entry, path, string or nil" );
-    }
+using fs_perms        = pg::enum_flags< std::filesystem::perms >;
+using fs_perm_options = pg::enum_flags< std::filesystem::perm_options >;
 
-    if( type == LUA_TNIL || type == LUA_TNONE )
+BEGIN_PROTECTED_FUNCTION( fs_permissions )
+    const auto perms   = pg::check_user_data_arg< std::filesystem::perms >( L, 2 );
+    const auto options = lua_gettop( L ) < 3 ? std::filesystem::perm_options::replace
+                                             : pg::check_user_data_arg< std::filesystem::perm_options >( L, 3 );
+    if( lua_type( L, 1 ) == LUA_TSTRING )
     {
-        return pg::return_new_user_data< std::filesystem::directory_entry >( L );
+        std::filesystem::permissions( pg::to_string_view( L, 1 ), perms, options );
     }
-    else if( type == LUA_TSTRING )
+    else
     {
-        return pg::return_new_user_data< std::filesystem::directory_entry >( L, pg::to_string_view( L, 1 ) );
+        const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
+        std::filesystem::permissions( p, perms, options );
     }
+    return pg::return_nothing( L );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
 
-    assert( type == LUA_TUSERDATA );
-
-    if( other_path )
+BEGIN_PROTECTED_FUNCTION( fs_read_symlink )
+    if( lua_type( L, 1 ) == LUA_TSTRING )
     {
-        return pg::return_new_user_data< std::filesystem::directory_entry >( L, *other_path );
+        return pg::return_new_user_data< std::filesystem::path >( L, std::filesystem::read_symlink( pg::to_string_view( L, 1 ) ) );
     }
     else
     {
-        assert( other_de );
-
-        return pg::return_new_user_data< std::filesystem::directory_entry >( L, *other_de );
+        const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
+        return pg::return_new_user_data< std::filesystem::path >( L, std::filesystem::read_symlink( p ) );
     }
 CATCH_BAD_ALLOC
 CATCH_FILESYSTEM_ERROR
-END_PROTECTED_FUNCTION
-
-BEGIN_PROTECTED_FUNCTION( fs_make_path )
-    const std::filesystem::path * other_path = nullptr;
-    
-    const int type = lua_type( L, 1 );
-    switch( type )
-    {
-    case LUA_TUSERDATA:
-        if( other_path = pg::test_user_data< std::filesystem::path >( L, 1 ) ; other_path )
-        {
-            break;
-        }
-        [[fallthrough]];
-    case LUA_TNUMBER:
-    case LUA_TBOOLEAN:
-    case LUA_TTABLE:
-    case LUA_TFUNCTION:
-    case LUA_TTHREAD:
-    case LUA_TLIGHTUSERDATA:
-        pg::type_error( L, 1, "path, string or nil" );
-    }
+END_PROTECTED_FUNCTION
 
-    if( type == LUA_TNIL || type == LUA_TNONE )
+BEGIN_PROTECTED_FUNCTION( fs_remove )
+    if( lua_type( L, 1 ) == LUA_TSTRING )
     {
-        return pg::return_new_user_data< std::filesystem::path >( L );
+        return pg::return_boolean( L, std::filesystem::remove( pg::to_string_view( L, 1 ) ) );
     }
-    else if( type == LUA_TSTRING )
+    else
     {
-        return pg::return_new_user_data< std::filesystem::path >( L, pg::to_string_view( L, 1 ) );
+        const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
+        return pg::return_boolean( L, std::filesystem::remove( p ) );
     }
-    else
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+// With an options table the tree is removed by a pool of worker threads on Linux.
+struct remove_all_arguments
+{
+    std::filesystem::path p;
+    bool                  parallel       = false;
+    std::size_t           threads        = 1;
+    std::size_t           max_open_files = 256;
+};
+
+// The second argument is an optional table with the fields 'threads' and 'max_open_files'.
+static remove_all_arguments check_remove_all_arguments( lua_State * const L )
+{
+    pg::check_path_type( L, 1 );
+    if( lua_isnoneornil( L, 2 ) )
     {
-        assert( type == LUA_TUSERDATA );
+        return { pg::check_path_arg( L, 1 ) };
+    }
 
-        return pg::return_new_user_data< std::filesystem::path >( L, *other_path );
+    luaL_checktype( L, 2, LUA_TTABLE );
+    const auto threads        = pg::opt_thread_count( L, 2 );
+    const auto max_open_files = pg::opt_integer_field( L, 2, "max_open_files", 256 );
+    if( max_open_files < 1 ) PG_UNLIKELY
+    {
+        luaL_error( L, "max_open_files must be at least 1" );
     }
-END_PROTECTED_FUNCTION
 
-#define FS_TRANSFORM_PATH( TRANSFORMATION )\
-BEGIN_PROTECTED_FUNCTION( fs_##TRANSFORMATION )\
-    if( lua_type( L, 1 ) == LUA_TSTRING )\
-    {\
-        return pg::return_new_user_data< std::filesystem::path >( L, std::filesystem::TRANSFORMATION( pg::to_string_view( L, 1 ) ) );\
-    }\
-    const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );\
-    return pg::return_new_user_data< std::filesystem::path >( L, std::filesystem::TRANSFORMATION( p ) );\
-CATCH_BAD_ALLOC \
-CATCH_FILESYSTEM_ERROR \
-END_PROTECTED_FUNCTION
+    return { pg::check_path_arg( L, 1 ), true, threads, static_cast< std::size_t >( max_open_files ) };
+}
 
-FS_TRANSFORM_PATH( absolute )
-FS_TRANSFORM_PATH( canonical )
-FS_TRANSFORM_PATH( weakly_canonical )
+static std::uintmax_t run_remove_all( const remove_all_arguments & args )
+{
+#if defined( __linux__ )
+    if( args.parallel )
+    {
+        pg::work_stealing_pool pool( args.threads );
+        return pg::parallel_remove_all( pool, args.p, args.max_open_files );
+    }
+#endif
+    return std::filesystem::remove_all( args.p );
+}
 
-using copy_options = pg::enum_flags< std::filesystem::copy_options >;
+BEGIN_PROTECTED_FUNCTION( fs_remove_all )
+    const auto args = check_remove_all_arguments( L );
+    return pg::return_integer( L, static_cast< lua_Integer >( run_remove_all( args ) ) );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
 
-BEGIN_PROTECTED_FUNCTION( fs_copy )
-    const auto options = lua_gettop( L ) < 3 ? std::filesystem::copy_options::none
-                                             : pg::check_user_data_arg< std::filesystem::copy_options >( L, 3 );
+BEGIN_PROTECTED_FUNCTION( fs_rename )
     if( lua_type( L, 1 ) == LUA_TSTRING )
     {
         auto p1 = pg::to_string_view( L, 1 );
         if( lua_type( L, 2 ) == LUA_TSTRING )
         {
-            std::filesystem::copy( p1, pg::to_string_view( L, 2 ), options );
+            std::filesystem::rename( p1, pg::to_string_view( L, 2 ) );
         }
         else
         {
             const auto & p2 = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
-            std::filesystem::copy( p1, p2, options );
+            std::filesystem::rename( p1, p2 );
         }
     }
     else
@@ -1442,493 +9134,902 @@ BEGIN_PROTECTED_FUNCTION( fs_copy )
         const auto & p1 = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
         if( lua_type( L, 2 ) == LUA_TSTRING )
         {
-            std::filesystem::copy( p1, pg::to_string_view( L, 2 ), options );
+            std::filesystem::rename( p1, pg::to_string_view( L, 2 ) );
         }
         else
         {
             const auto & p2 = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
-            std::filesystem::copy( p1, p2, options );
+            std::filesystem::rename( p1, p2 );
         }
     }
+
     return pg::return_nothing( L );
 CATCH_BAD_ALLOC
 CATCH_FILESYSTEM_ERROR
 END_PROTECTED_FUNCTION
 
-#define FS_RELATIVE_PROXIMATE( TRANSFORM )\
-BEGIN_PROTECTED_FUNCTION( fs_##TRANSFORM )\
-    if( lua_type( L, 1 ) == LUA_TSTRING )\
-    {\
-        auto p1 = pg::to_string_view( L, 1 );\
-        if( lua_gettop( L ) == 1 )\
-        {\
-            return pg::return_new_user_data< std::filesystem::path >( L, std::filesystem::TRANSFORM( p1 ) );\
-        }\
-        else if( lua_type( L, 2 ) == LUA_TSTRING )\
-        {\
-            return pg::return_new_user_data< std::filesystem::path >( L, std::filesystem::TRANSFORM( p1, pg::to_string_view( L, 2 ) ) );\
-        }\
-        else\
-        {\
-            const auto & p2 = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );\
-            return pg::return_new_user_data< std::filesystem::path >( L, std::filesystem::TRANSFORM( p1, p2 ) );\
-        }\
-    }\
-    else\
-    {\
-        const auto & p1 = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );\
-        if( lua_gettop( L ) == 1 )\
-        {\
-            return pg::return_new_user_data< std::filesystem::path >( L, std::filesystem::TRANSFORM( p1 ) );\
-        }\
-        else if( lua_type( L, 2 ) == LUA_TSTRING )\
-        {\
-            return pg::return_new_user_data< std::filesystem::path >( L, std::filesystem::TRANSFORM( p1, pg::to_string_view( L, 2 ) ) );\
-        }\
-        else\
-        {\
-            const auto & p2 = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );\
-            return pg::return_new_user_data< std::filesystem::path >( L, std::filesystem::TRANSFORM( p1, p2 ) );\
-        }\
-    }\
-CATCH_BAD_ALLOC \
-CATCH_FILESYSTEM_ERROR \
+BEGIN_PROTECTED_FUNCTION( fs_resize_file )
+    const auto new_size = luaL_checkinteger( L, 2 );
+    if( new_size < 0 ) PG_UNLIKELY
+    {
+        return luaL_error( L, "new file size cannot be negative" );
+    }
+    const auto new_size_unsigned = static_cast<  std::uintmax_t >( new_size );
+
+    if( lua_type( L, 1 ) == LUA_TSTRING )
+    {
+        std::filesystem::resize_file( pg::to_string_view( L, 1 ), new_size_unsigned );
+    }
+    else
+    {
+        const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
+        std::filesystem::resize_file( p, new_size_unsigned );
+    }
+    return pg::return_nothing( L );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
 END_PROTECTED_FUNCTION
 
-FS_RELATIVE_PROXIMATE( relative )
-FS_RELATIVE_PROXIMATE( proximate )
-    
-BEGIN_PROTECTED_FUNCTION( fs_copy_file )
-    const auto options = lua_gettop( L ) < 3 ? std::filesystem::copy_options::none
-                                             : pg::check_user_data_arg< std::filesystem::copy_options >( L, 3 );
+BEGIN_PROTECTED_FUNCTION( fs_space )
     if( lua_type( L, 1 ) == LUA_TSTRING )
     {
-        auto p1 = pg::to_string_view( L, 1 );
-        if( lua_type( L, 2 ) == LUA_TSTRING )
-        {
-            return pg::return_boolean( L, std::filesystem::copy_file( p1, pg::to_string_view( L, 2 ), options ) );
-        }
-        else
-        {
-            const auto & p2 = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
-            return pg::return_boolean( L, std::filesystem::copy_file( p1, p2, options ) );
-        }
+        const auto info = std::filesystem::space( pg::to_string_view( L, 1 ) );
+
+        lua_settop( L, 0 );
+        lua_pushinteger( L, info.capacity );
+        lua_pushinteger( L, info.free );
+        lua_pushinteger( L, info.available );
+        return 3;
     }
     else
     {
-        const auto & p1 = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
-        if( lua_type( L, 2 ) == LUA_TSTRING )
+        const auto & p  = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
+        const auto info = std::filesystem::space( p );
+
+        lua_settop( L, 0 );
+        lua_pushinteger( L, info.free );
+        lua_pushinteger( L, info.available );
+        lua_pushinteger( L, info.capacity );
+        return 3;
+    }
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+static int async_pool_key = 0;
+
+// Returns the pool of the async operations, which is kept in the registry and joined when the Lua state is closed.
+static pg::work_stealing_pool & async_pool( lua_State * const L )
+{
+    if( lua_rawgetp( L, LUA_REGISTRYINDEX, &async_pool_key ) == LUA_TNIL )
+    {
+        lua_pop( L, 1 );
+        const auto threads = std::max( std::thread::hardware_concurrency(), 2u );
+        pg::new_user_data< pg::async_pool >( L, threads );
+        lua_pushvalue( L, -1 );
+        lua_rawsetp( L, LUA_REGISTRYINDEX, &async_pool_key );
+    }
+    auto & pool = pg::to_user_data< pg::async_pool >( L, -1 ).pool;
+    lua_pop( L, 1 );
+
+    return pool;
+}
+
+// Runs 'f', which returns the function that pushes its result, on the async pool and returns its handle.
+template< typename F >
+static int return_async_operation( lua_State * const L, F && f )
+{
+    auto operation = std::make_shared< pg::async_operation >();
+    async_pool( L ).submit( [ operation, f = std::forward< F >( f ) ]() mutable { operation->run( f ); } );
+
+    lua_settop( L, 0 );
+    pg::new_user_data< pg::async_handle >( L, pg::async_handle{ std::move( operation ) } );
+    return 1;
+}
+
+BEGIN_PROTECTED_FUNCTION( async_copy )
+    return return_async_operation( L, [ args = check_copy_arguments( L ) ]
+    {
+        const auto counts = run_copy( args );
+        return pg::async_operation::result_function( [ counts ]( lua_State * const L ){ return return_copy_counts( L, counts ); } );
+    } );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( async_remove_all )
+    return return_async_operation( L, [ args = check_remove_all_arguments( L ) ]
+    {
+        const auto count = run_remove_all( args );
+        return pg::async_operation::result_function( [ count ]( lua_State * const L ){ return pg::return_integer( L, static_cast< lua_Integer >( count ) ); } );
+    } );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+// Unlike 'space' the values are returned in the documented order for paths and strings.
+BEGIN_PROTECTED_FUNCTION( async_space )
+    return return_async_operation( L, [ p = pg::check_path_arg( L, 1 ) ]
+    {
+        const auto info = std::filesystem::space( p );
+        return pg::async_operation::result_function( [ info ]( lua_State * const L )
+        {
+            lua_settop( L, 0 );
+            lua_pushinteger( L, static_cast< lua_Integer >( info.capacity ) );
+            lua_pushinteger( L, static_cast< lua_Integer >( info.free ) );
+            lua_pushinteger( L, static_cast< lua_Integer >( info.available ) );
+            return 3;
+        } );
+    } );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+static const pg::async_operation & check_async_operation( lua_State * const L )
+{
+    return *pg::check_user_data_arg< pg::async_handle >( L, 1 ).operation;
+}
+
+BEGIN_FUNCTION( async_handle_done )
+    return pg::return_boolean( L, check_async_operation( L ).done() );
+END_FUNCTION
+
+BEGIN_FUNCTION( async_handle_fd )
+    const auto fd = check_async_operation( L ).descriptor();
+    return fd >= 0 ? pg::return_integer( L, fd ) : pg::return_nil( L );
+END_FUNCTION
+
+// Returns the results of the operation or raises its error; raises an error when it's not finished.
+BEGIN_PROTECTED_FUNCTION( async_handle_result )
+    const auto & operation = check_async_operation( L );
+    if( !operation.done() ) PG_UNLIKELY
+    {
+        return luaL_error( L, "operation not finished" );
+    }
+    return operation.push( L );
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+// Waits at most 'timeout' seconds, without limit when it's not given, and returns whether the operation finished.
+BEGIN_FUNCTION( async_handle_wait )
+    const auto & operation = check_async_operation( L );
+    const auto   timeout   = opt_seconds_as_milliseconds( L, 2, std::chrono::milliseconds( -1 ) );
+    return pg::return_boolean( L, operation.wait( timeout ) );
+END_FUNCTION
+
+static int async_handle_await_continuation( lua_State * const L, int, lua_KContext );
+
+// Returns the results of the operation. In a coroutine the handle is yielded until the operation is
+// finished, so the scheduler can wait for its fd; elsewhere it blocks.
+BEGIN_FUNCTION( async_handle_await )
+    const auto & operation = check_async_operation( L );
+    if( !operation.done() )
+    {
+        if( !lua_isyieldable( L ) )
         {
-            return pg::return_boolean( L, std::filesystem::copy_file( p1, pg::to_string_view( L, 2 ), options ) );
+            operation.wait( std::chrono::milliseconds( -1 ) );
         }
         else
         {
-            const auto & p2 = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
-            return pg::return_boolean( L, std::filesystem::copy_file( p1, p2, options ) );
+            lua_settop( L, 1 );
+            lua_pushvalue( L, 1 );
+            return lua_yieldk( L, 1, 0, async_handle_await_continuation );
         }
     }
-CATCH_BAD_ALLOC
-CATCH_FILESYSTEM_ERROR
-END_PROTECTED_FUNCTION
+    lua_settop( L, 1 );
+    return async_handle_result( L );
+END_FUNCTION
 
-#define FS_X_LINK( FUNCTION )\
+static int async_handle_await_continuation( lua_State * const L, int, lua_KContext )
+{
+    lua_settop( L, 1 );
+    return async_handle_await( L );
+}
+
+BEGIN_FUNCTION( async_handle_gc )
+    auto & self = pg::to_user_data< pg::async_handle >( L, 1 );
+
+    self.~async_handle();
+
+    return 0;
+END_FUNCTION
+
+BEGIN_FUNCTION( async_pool_gc )
+    auto & self = pg::to_user_data< pg::async_pool >( L, 1 );
+
+    self.~async_pool();
+
+    return 0;
+END_FUNCTION
+
+struct async_handle
+{
+    static constexpr const luaL_Reg operators[] =
+    {
+        { "__gc", async_handle_gc },
+        { NULL,   NULL }
+    };
+
+    static constexpr const luaL_Reg methods[] =
+    {
+        { "done",   async_handle_done },
+        { "fd",     async_handle_fd },
+        { "result", async_handle_result },
+        { "wait",   async_handle_wait },
+        { "await",  async_handle_await },
+        { NULL,     NULL }
+    };
+};
+
+struct async_pool
+{
+    static constexpr const luaL_Reg operators[] =
+    {
+        { "__gc", async_pool_gc },
+        { NULL,   NULL }
+    };
+
+    static constexpr const luaL_Reg * methods = nullptr;
+};
+
+using fs_file_type =  pg::enumeration< std::filesystem::file_type >;
+
+#define FS_X_STATUS( FUNCTION )\
 BEGIN_PROTECTED_FUNCTION( fs_##FUNCTION )\
     if( lua_type( L, 1 ) == LUA_TSTRING )\
     {\
-        auto p1 = pg::to_string_view( L, 1 );\
-        if( lua_type( L, 2 ) == LUA_TSTRING )\
-        {\
-            std::filesystem::FUNCTION( p1, pg::to_string_view( L, 2 ) );\
-        }\
-        else\
-        {\
-            const auto & p2 = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );\
-            std::filesystem::FUNCTION( p1, p2 );\
-        }\
+        return pg::return_file_status( L, std::filesystem::FUNCTION( pg::to_string_view( L, 1 ) ), lua_toboolean( L, 2 ) );\
     }\
     else\
     {\
-        const auto & p1 = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );\
-        if( lua_type( L, 2 ) == LUA_TSTRING )\
-        {\
-            std::filesystem::FUNCTION( p1, pg::to_string_view( L, 2 ) );\
-        }\
-        else\
-        {\
-            const auto & p2 = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );\
-            std::filesystem::FUNCTION( p1, p2 );\
-        }\
+        const auto & p           = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );\
+        return pg::return_file_status( L, std::filesystem::FUNCTION( p ), lua_toboolean( L, 2 ) );\
     }\
-    return pg::return_nothing( L );\
 CATCH_BAD_ALLOC \
 CATCH_FILESYSTEM_ERROR \
 END_PROTECTED_FUNCTION
 
-FS_X_LINK( copy_symlink )
-FS_X_LINK( create_hard_link )
-FS_X_LINK( create_symlink )
-FS_X_LINK( create_directory_symlink )
+FS_X_STATUS( status )
+FS_X_STATUS( symlink_status )
 
-BEGIN_PROTECTED_FUNCTION( fs_create_directory )
-    if( lua_type( L, 1 ) == LUA_TSTRING )
+static unsigned check_stat_fields( lua_State * const L, int arg )
+{
+    if( lua_isnoneornil( L, arg ) )
     {
-        if( lua_gettop( L ) > 1 )
+        return pg::stat_type | pg::stat_size | pg::stat_mtime;
+    }
+    luaL_checktype( L, arg, LUA_TTABLE );
+
+    static const char * const names[]  = { "type", "perms", "size", "mtime", "hard_link_count", "inode", "device", "allocated", NULL };
+    static const unsigned     fields[] = { pg::stat_type, pg::stat_perms, pg::stat_size, pg::stat_mtime, pg::stat_nlink, pg::stat_inode, pg::stat_device,
+                                           pg::stat_allocated };
+
+    unsigned   result = 0;
+    const auto count  = luaL_len( L, arg );
+    for( lua_Integer i = 1 ; i <= count ; ++i )
+    {
+        lua_rawgeti( L, arg, i );
+        const auto name  = lua_tostring( L, -1 );
+        int        index = 0;
+        while( name && names[ index ] && std::strcmp( names[ index ], name ) != 0 )
         {
-            if( lua_type( L, 2 ) == LUA_TSTRING )
-            {
-                return pg::return_boolean( L, std::filesystem::create_directory( pg::to_string_view( L, 1 ), pg::to_string_view( L, 2 ) ) );
-            }
-            else
-            {
-                const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
-                return pg::return_boolean( L, std::filesystem::create_directory( pg::to_string_view( L, 1 ), p ) );
-            }
+            ++index;
         }
-        else
+        if( !name || !names[ index ] ) PG_UNLIKELY
         {
-            return pg::return_boolean( L, std::filesystem::create_directory( pg::to_string_view( L, 1 ) ) );
+            luaL_error( L, "invalid status field '%s'", name ? name : luaL_typename( L, -1 ) );
         }
+        result |= fields[ index ];
+        lua_pop( L, 1 );
     }
-    else
+
+    return result;
+}
+
+static void push_stat_field_array( lua_State * const L, const char * const name, const std::vector< pg::stat_record > & records,
+                                   void ( *push )( lua_State *, int, const pg::stat_record & ) )
+{
+    lua_createtable( L, static_cast< int >( records.size() ), 0 );
+    lua_newtable( L );      // Cache for enum objects
+    for( std::size_t i = 0 ; i < records.size() ; ++i )
     {
-        const auto & p1 = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
-        if( lua_gettop( L ) > 1 )
-        {
-            if( lua_type( L, 2 ) == LUA_TSTRING )
-            {
-                return pg::return_boolean( L, std::filesystem::create_directory( p1, pg::to_string_view( L, 2 ) ) );
-            }
-            else
-            {
-                const auto & p2 = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
-                return pg::return_boolean( L, std::filesystem::create_directory( p1, p2 ) );
-            }
-        }
-        else
+        if( records[ i ].exists )
         {
-            return pg::return_boolean( L, std::filesystem::create_directory( p1 ) );
+            push( L, lua_gettop( L ), records[ i ] );
+            lua_rawseti( L, -3, static_cast< lua_Integer >( i + 1 ) );
         }
     }
-CATCH_BAD_ALLOC
-CATCH_FILESYSTEM_ERROR
-END_PROTECTED_FUNCTION
+    lua_pop( L, 1 );
+    lua_setfield( L, -2, name );
+}
 
-BEGIN_PROTECTED_FUNCTION( fs_create_directories )
-    if( lua_type( L, 1 ) == LUA_TSTRING )
+static void push_optional_integer( lua_State * const L, const std::optional< std::uintmax_t > & value )
+{
+    if( value )
     {
-        return pg::return_boolean( L, std::filesystem::create_directories( pg::to_string_view( L, 1 ) ) );
+        lua_pushinteger( L, static_cast< lua_Integer >( *value ) );
     }
     else
     {
-        const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
-        return pg::return_boolean( L, std::filesystem::create_directories( p ) );
+        lua_pushnil( L );
     }
-CATCH_BAD_ALLOC
-CATCH_FILESYSTEM_ERROR
-END_PROTECTED_FUNCTION
+}
 
-BEGIN_PROTECTED_FUNCTION( fs_current_path )
-    if( lua_gettop( L ) == 0 )
+// Returns the paths in the sequence at 'arg' which may contain path objects and strings.
+static std::vector< std::filesystem::path > check_path_list( lua_State * const L, int arg )
+{
+    const auto count = static_cast< std::size_t >( luaL_len( L, arg ) );
+
+    for( std::size_t i = 1 ; i <= count ; ++i )
     {
-        return pg::return_new_user_data< std::filesystem::path >( L, std::filesystem::current_path() );
+        lua_rawgeti( L, arg, static_cast< lua_Integer >( i ) );
+        if( lua_type( L, -1 ) != LUA_TSTRING && !pg::test_user_data< std::filesystem::path >( L, -1 ) ) PG_UNLIKELY
+        {
+            luaL_error( L, "path or string expected at index %d of the paths, got %s", static_cast< int >( i ), luaL_typename( L, -1 ) );
+        }
+        lua_pop( L, 1 );
     }
 
-    if( lua_type( L, 1 ) == LUA_TSTRING )
+    std::vector< std::filesystem::path > paths;
+    paths.reserve( count );
+    for( std::size_t i = 1 ; i <= count ; ++i )
     {
-        std::filesystem::current_path( pg::to_string_view( L, 1 ) );
+        lua_rawgeti( L, arg, static_cast< lua_Integer >( i ) );
+        paths.push_back( pg::check_path_arg( L, -1 ) );
+        lua_pop( L, 1 );
+    }
+
+    return paths;
+}
+
+BEGIN_PROTECTED_FUNCTION( fs_stat_many )
+    luaL_checktype( L, 1, LUA_TTABLE );
+    const auto fields = check_stat_fields( L, 2 );
+    if( !lua_isnoneornil( L, 3 ) )
+    {
+        luaL_checktype( L, 3, LUA_TTABLE );
+    }
+    const auto threads         = pg::opt_thread_count( L, 3 );
+    const bool follow_symlinks = pg::opt_boolean_field( L, 3, "follow_symlinks", true );
+    const bool integers        = pg::opt_boolean_field( L, 3, "integers", false );
+    const auto paths           = check_path_list( L, 1 );
+    const auto count           = paths.size();
+
+    std::vector< pg::stat_record > records( count );
+    const auto stat_range = [ & ]( std::size_t begin, std::size_t end )
+    {
+        for( auto i = begin ; i < end ; ++i )
+        {
+            records[ i ] = pg::stat_path( paths[ i ], fields, follow_symlinks );
+        }
+    };
+
+    constexpr std::size_t paths_per_task = 256;
+    if( threads == 1 || count <= paths_per_task )
+    {
+        stat_range( 0, count );
     }
     else
     {
-        const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
-        std::filesystem::current_path( p );
+        pg::work_stealing_pool pool( threads );
+        for( std::size_t begin = 0 ; begin < count ; begin += paths_per_task )
+        {
+            pool.submit( [ &stat_range, begin, end = std::min( begin + paths_per_task, count ) ]{ stat_range( begin, end ); } );
+        }
+        pool.wait();
     }
 
     lua_settop( L, 0 );
-    return 0;
-CATCH_BAD_ALLOC
-CATCH_FILESYSTEM_ERROR
-END_PROTECTED_FUNCTION
+    lua_createtable( L, 0, 8 );
+    lua_pushinteger( L, static_cast< lua_Integer >( count ) );
+    lua_setfield( L, 1, "n" );
 
-BEGIN_PROTECTED_FUNCTION( fs_exists )
-    if( lua_type( L, 1 ) == LUA_TSTRING )
+    if( fields & pg::stat_type )
     {
-        return pg::return_boolean( L, std::filesystem::exists( pg::to_string_view( L, 1 ) ) );
+        push_stat_field_array( L, "type", records, integers ? +[]( lua_State * L, int, const pg::stat_record & r ){ lua_pushinteger( L, static_cast< lua_Integer >( r.type ) ); }
+                                                            : +[]( lua_State * L, int cache, const pg::stat_record & r ){ pg::push_cached_enum( L, cache, r.type ); } );
     }
-    else
+    if( fields & pg::stat_perms )
     {
-        const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
-        return pg::return_boolean( L, std::filesystem::exists( p ) );
+        push_stat_field_array( L, "perms", records, integers ? +[]( lua_State * L, int, const pg::stat_record & r ){ lua_pushinteger( L, static_cast< lua_Integer >( r.permissions ) ); }
+                                                             : +[]( lua_State * L, int cache, const pg::stat_record & r ){ pg::push_cached_enum( L, cache, r.permissions ); } );
+    }
+    if( fields & pg::stat_size )
+    {
+        push_stat_field_array( L, "size", records, []( lua_State * L, int, const pg::stat_record & r ){ push_optional_integer( L, r.size ); } );
+    }
+    if( fields & pg::stat_mtime )
+    {
+        push_stat_field_array( L, "mtime", records, []( lua_State * L, int, const pg::stat_record & r ){ pg::new_user_data< std::filesystem::file_time_type >( L, r.mtime ); } );
+    }
+    if( fields & pg::stat_nlink )
+    {
+        push_stat_field_array( L, "hard_link_count", records, []( lua_State * L, int, const pg::stat_record & r ){ lua_pushinteger( L, static_cast< lua_Integer >( r.hard_links ) ); } );
     }
+    if( fields & pg::stat_inode )
+    {
+        push_stat_field_array( L, "inode", records, []( lua_State * L, int, const pg::stat_record & r ){ push_optional_integer( L, r.inode ); } );
+    }
+    if( fields & pg::stat_device )
+    {
+        push_stat_field_array( L, "device", records, []( lua_State * L, int, const pg::stat_record & r ){ push_optional_integer( L, r.device ); } );
+    }
+    if( fields & pg::stat_allocated )
+    {
+        push_stat_field_array( L, "allocated", records, []( lua_State * L, int, const pg::stat_record & r ){ push_optional_integer( L, r.allocated ); } );
+    }
+
+    return 1;
 CATCH_BAD_ALLOC
 CATCH_FILESYSTEM_ERROR
 END_PROTECTED_FUNCTION
 
-BEGIN_PROTECTED_FUNCTION( fs_equivalent )
-    if( lua_type( L, 1 ) == LUA_TSTRING )
+static int add_batch_operation( lua_State * const L, pg::operation_batch::operation_type type )
+{
+    auto &     self   = pg::check_user_data_arg< pg::operation_batch >( L, 1 );
+    const bool has_to = type == pg::operation_batch::operation_type::rename || type == pg::operation_batch::operation_type::copy;
+    pg::check_path_type( L, 2 );
+    if( has_to )
     {
-        auto p1 = pg::to_string_view( L, 1 );
-        if( lua_type( L, 2 ) == LUA_TSTRING )
-        {
-            return pg::return_boolean( L, std::filesystem::equivalent( p1, pg::to_string_view( L, 2 ) ) );
-        }
-        else
-        {
-            const auto & p2 = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
-            return pg::return_boolean( L, std::filesystem::equivalent( p1, p2 ) );
-        }
+        pg::check_path_type( L, 3 );
     }
-    else
+    const auto options = type == pg::operation_batch::operation_type::copy ? opt_copy_options( L, 4 ) : std::filesystem::copy_options::none;
+
+    pg::operation_batch::operation op;
+    op.type    = type;
+    op.from    = pg::check_path_arg( L, 2 );
+    op.options = options;
+    if( has_to )
     {
-        const auto & p1 = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
-        if( lua_type( L, 2 ) == LUA_TSTRING )
+        op.to = pg::check_path_arg( L, 3 );
+    }
+    if( type == pg::operation_batch::operation_type::stat )
+    {
+        op.follow_symlinks = lua_isnoneornil( L, 3 ) || lua_toboolean( L, 3 );
+    }
+
+    return pg::return_integer( L, static_cast< lua_Integer >( self.add( std::move( op ) ) ) );
+}
+
+#define BATCH_OPERATION( NAME )\
+BEGIN_PROTECTED_FUNCTION( batch_##NAME )\
+    return add_batch_operation( L, pg::operation_batch::operation_type::NAME );\
+CATCH_BAD_ALLOC \
+CATCH_FILESYSTEM_ERROR \
+END_PROTECTED_FUNCTION
+
+BATCH_OPERATION( stat )
+BATCH_OPERATION( remove )
+BATCH_OPERATION( rename )
+BATCH_OPERATION( copy )
+BATCH_OPERATION( create_directory )
+
+static void push_stat_record( lua_State * const L, const pg::stat_record & record )
+{
+    lua_createtable( L, 0, 8 );
+    pg::push_enum( L, record.type );
+    lua_setfield( L, -2, "type" );
+    pg::push_enum( L, record.permissions );
+    lua_setfield( L, -2, "perms" );
+    push_optional_integer( L, record.size );
+    lua_setfield( L, -2, "size" );
+    pg::new_user_data< std::filesystem::file_time_type >( L, record.mtime );
+    lua_setfield( L, -2, "mtime" );
+    lua_pushinteger( L, static_cast< lua_Integer >( record.hard_links ) );
+    lua_setfield( L, -2, "hard_link_count" );
+    push_optional_integer( L, record.inode );
+    lua_setfield( L, -2, "inode" );
+    push_optional_integer( L, record.device );
+    lua_setfield( L, -2, "device" );
+    push_optional_integer( L, record.allocated );
+    lua_setfield( L, -2, "allocated" );
+}
+
+// Returns a table with the results in the order the operations were added and a table with
+// the error messages of the operations that failed.
+BEGIN_PROTECTED_FUNCTION( batch_submit )
+    auto &     self  = pg::check_user_data_arg< pg::operation_batch >( L, 1 );
+    const auto ops   = self.submit();
+    const auto count = ops.size();
+
+    lua_settop( L, 0 );
+    lua_createtable( L, static_cast< int >( count ), 1 );
+    lua_pushinteger( L, static_cast< lua_Integer >( count ) );
+    lua_setfield( L, 1, "n" );
+    lua_newtable( L );
+    for( std::size_t i = 0 ; i < count ; ++i )
+    {
+        const auto & op = ops[ i ];
+        if( op.error )
         {
-            return pg::return_boolean( L, std::filesystem::equivalent( p1, pg::to_string_view( L, 2 ) ) );
+            const auto message = op.error.message();
+            lua_pushlstring( L, message.c_str(), message.size() );
+            lua_rawseti( L, 2, static_cast< lua_Integer >( i + 1 ) );
+            continue;
         }
-        else
+
+        switch( op.type )
         {
-            const auto & p2 = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
-            return pg::return_boolean( L, std::filesystem::equivalent( p1, p2 ) );
+        case pg::operation_batch::operation_type::stat:
+            push_stat_record( L, op.record );
+            break;
+        case pg::operation_batch::operation_type::remove:
+        case pg::operation_batch::operation_type::create_directory:
+            lua_pushboolean( L, op.value );
+            break;
+        case pg::operation_batch::operation_type::rename:
+        case pg::operation_batch::operation_type::copy:
+            lua_pushboolean( L, true );
+            break;
         }
+        lua_rawseti( L, 1, static_cast< lua_Integer >( i + 1 ) );
     }
+
+    return 2;
 CATCH_BAD_ALLOC
 CATCH_FILESYSTEM_ERROR
 END_PROTECTED_FUNCTION
 
-BEGIN_PROTECTED_FUNCTION( fs_file_size )
-    if( lua_type( L, 1 ) == LUA_TSTRING )
+BEGIN_FUNCTION( batch_size )
+    const auto & self = pg::check_user_data_arg< pg::operation_batch >( L, 1 );
+    return pg::return_integer( L, static_cast< lua_Integer >( self.size() ) );
+END_FUNCTION
+
+BEGIN_FUNCTION( batch_gc )
+    auto & self = pg::to_user_data< pg::operation_batch >( L, 1 );
+
+    self.~operation_batch();
+
+    return 0;
+END_FUNCTION
+
+struct operation_batch
+{
+    static constexpr const luaL_Reg operators[] =
     {
-        return pg::return_integer( L, std::filesystem::file_size( pg::to_string_view( L, 1 ) ) );
+        { "__gc",  batch_gc },
+        { "__len", batch_size },
+        { NULL,    NULL }
+    };
+
+    static constexpr const luaL_Reg methods[] =
+    {
+        { "stat",             batch_stat },
+        { "remove",           batch_remove },
+        { "rename",           batch_rename },
+        { "copy",             batch_copy },
+        { "create_directory", batch_create_directory },
+        { "submit",           batch_submit },
+        { NULL,               NULL }
+    };
+};
+
+// The first argument is an optional table with the fields 'threads' and 'backend'.
+BEGIN_PROTECTED_FUNCTION( fs_batch )
+    if( !lua_isnoneornil( L, 1 ) )
+    {
+        luaL_checktype( L, 1, LUA_TTABLE );
     }
-    else
+    const auto threads = pg::opt_thread_count( L, 1 );
+    auto       backend = pg::batch_backend::automatic;
+    if( lua_istable( L, 1 ) )
     {
-        const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
-        return pg::return_integer( L, std::filesystem::file_size( p ) );
+        lua_getfield( L, 1, "backend" );
+        backend = static_cast< pg::batch_backend >( luaL_checkoption( L, lua_gettop( L ), "auto", pg::batch_backend_names ) );
+        lua_pop( L, 1 );
     }
+
+    return pg::return_new_user_data< pg::operation_batch >( L, threads, backend );
 CATCH_BAD_ALLOC
 CATCH_FILESYSTEM_ERROR
 END_PROTECTED_FUNCTION
 
-BEGIN_PROTECTED_FUNCTION( fs_hard_link_count )
-    if( lua_type( L, 1 ) == LUA_TSTRING )
-    {
-        return pg::return_integer( L, std::filesystem::hard_link_count( pg::to_string_view( L, 1 ) ) );
-    }
-    else
-    {
-        const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
-        return pg::return_integer( L, std::filesystem::hard_link_count( p ) );
-    }
+static pg::hash_algorithm check_hash_algorithm( lua_State * const L, int arg )
+{
+    return static_cast< pg::hash_algorithm >( luaL_checkoption( L, arg, "xxh64", pg::hash_algorithm_names ) );
+}
+
+BEGIN_PROTECTED_FUNCTION( fs_hash_file )
+    const auto algorithm = check_hash_algorithm( L, 2 );
+    const auto p         = pg::check_path_arg( L, 1 );
+    const auto hash      = pg::hash_file( p, algorithm );
+
+    lua_pushlstring( L, hash.c_str(), hash.size() );
+    return 1;
 CATCH_BAD_ALLOC
 CATCH_FILESYSTEM_ERROR
 END_PROTECTED_FUNCTION
 
-BEGIN_PROTECTED_FUNCTION( fs_last_write_time )
-    if( lua_gettop( L ) <= 1 )
+BEGIN_PROTECTED_FUNCTION( fs_hash_many )
+    luaL_checktype( L, 1, LUA_TTABLE );
+    const auto algorithm = check_hash_algorithm( L, 2 );
+    if( !lua_isnoneornil( L, 3 ) )
     {
-        if( lua_type( L, 1 ) == LUA_TSTRING )
+        luaL_checktype( L, 3, LUA_TTABLE );
+    }
+    const auto threads = pg::opt_thread_count( L, 3 );
+    const auto paths   = check_path_list( L, 1 );
+    const auto count   = paths.size();
+
+    std::vector< std::string >     hashes( count );
+    std::vector< std::error_code > errors( count );
+    const auto hash = [ & ]( std::size_t i )
+    {
+        try
         {
-            return pg::return_new_user_data< std::filesystem::file_time_type >( L, std::filesystem::last_write_time( pg::to_string_view( L, 1 ) ) );
+            hashes[ i ] = pg::hash_file( paths[ i ], algorithm );
         }
-        else
+        catch( const std::filesystem::filesystem_error & e )
         {
-            const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
-            return pg::return_new_user_data< std::filesystem::file_time_type >( L, std::filesystem::last_write_time( p ) );
+            errors[ i ] = e.code();
+        }
+    };
+
+    if( threads == 1 || count <= 1 )
+    {
+        for( std::size_t i = 0 ; i < count ; ++i )
+        {
+            hash( i );
         }
     }
     else
     {
-        if( lua_type( L, 1 ) == LUA_TSTRING )
+        pg::work_stealing_pool pool( std::min( threads, count ) );
+        for( std::size_t i = 0 ; i < count ; ++i )
         {
-            std::filesystem::last_write_time( pg::to_string_view( L, 1 ), pg::check_user_data_arg< std::filesystem::file_time_type >( L, 2 ) );
+            pool.submit( [ &hash, i ]{ hash( i ); } );
+        }
+        pool.wait();
+    }
+
+    lua_settop( L, 0 );
+    lua_createtable( L, static_cast< int >( count ), 1 );
+    lua_pushinteger( L, static_cast< lua_Integer >( count ) );
+    lua_setfield( L, 1, "n" );
+    lua_newtable( L );
+    for( std::size_t i = 0 ; i < count ; ++i )
+    {
+        if( errors[ i ] )
+        {
+            const auto message = errors[ i ].message();
+            lua_pushlstring( L, message.c_str(), message.size() );
+            lua_rawseti( L, 2, static_cast< lua_Integer >( i + 1 ) );
         }
         else
         {
-            const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
-            std::filesystem::last_write_time( p, pg::check_user_data_arg< std::filesystem::file_time_type >( L, 2 ) );
+            lua_pushlstring( L, hashes[ i ].c_str(), hashes[ i ].size() );
+            lua_rawseti( L, 1, static_cast< lua_Integer >( i + 1 ) );
         }
-
-        return pg::return_nothing( L );
     }
+
+    return 2;
 CATCH_BAD_ALLOC
 CATCH_FILESYSTEM_ERROR
 END_PROTECTED_FUNCTION
 
-BEGIN_FUNCTION( fs_file_time_now )
-        return pg::return_new_user_data< std::filesystem::file_time_type >( L, std::filesystem::file_time_type::clock::now() );
-END_FUNCTION
-
-using fs_perms        = pg::enum_flags< std::filesystem::perms >;
-using fs_perm_options = pg::enum_flags< std::filesystem::perm_options >;
-
-BEGIN_PROTECTED_FUNCTION( fs_permissions )
-    const auto perms   = pg::check_user_data_arg< std::filesystem::perms >( L, 2 );
-    const auto options = lua_gettop( L ) < 3 ? std::filesystem::perm_options::replace
-                                             : pg::check_user_data_arg< std::filesystem::perm_options >( L, 3 );
-    if( lua_type( L, 1 ) == LUA_TSTRING )
+BEGIN_PROTECTED_FUNCTION( fs_find_duplicates )
+    if( lua_type( L, 1 ) != LUA_TTABLE )
     {
-        std::filesystem::permissions( pg::to_string_view( L, 1 ), perms, options );
+        pg::check_path_type( L, 1 );
     }
-    else
+    auto algorithm = pg::hash_algorithm::xxh64;
+    if( !lua_isnoneornil( L, 2 ) )
+    {
+        luaL_checktype( L, 2, LUA_TTABLE );
+        lua_getfield( L, 2, "algorithm" );
+        algorithm = check_hash_algorithm( L, lua_gettop( L ) );
+        lua_pop( L, 1 );
+    }
+    const auto threads  = pg::opt_thread_count( L, 2 );
+    const auto options  = pg::opt_user_data_field( L, 2, "directory_options", std::filesystem::directory_options::none );
+    const auto min_size = pg::opt_integer_field( L, 2, "min_size", 1 );
+    if( min_size < 0 ) PG_UNLIKELY
+    {
+        return luaL_error( L, "minimum size must not be negative" );
+    }
+
+    const auto             roots = lua_type( L, 1 ) == LUA_TTABLE ? check_path_list( L, 1 ) : std::vector< std::filesystem::path >{ pg::check_path_arg( L, 1 ) };
+    pg::work_stealing_pool pool( threads );
+    const auto             groups = pg::find_duplicates( pool, roots, options, static_cast< std::uintmax_t >( min_size ), algorithm );
+
+    lua_settop( L, 0 );
+    lua_createtable( L, static_cast< int >( groups.size() ), 0 );
+    for( std::size_t i = 0 ; i < groups.size() ; ++i )
     {
-        const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
-        std::filesystem::permissions( p, perms, options );
+        const auto & group = groups[ i ];
+        lua_createtable( L, static_cast< int >( group.paths.size() ), 1 );
+        for( std::size_t j = 0 ; j < group.paths.size() ; ++j )
+        {
+            pg::new_user_data< std::filesystem::path >( L, group.paths[ j ] );
+            lua_rawseti( L, -2, static_cast< lua_Integer >( j + 1 ) );
+        }
+        lua_pushinteger( L, static_cast< lua_Integer >( group.size ) );
+        lua_setfield( L, -2, "size" );
+        lua_rawseti( L, 1, static_cast< lua_Integer >( i + 1 ) );
     }
-    return pg::return_nothing( L );
+
+    return 1;
 CATCH_BAD_ALLOC
 CATCH_FILESYSTEM_ERROR
 END_PROTECTED_FUNCTION
 
-BEGIN_PROTECTED_FUNCTION( fs_read_symlink )
-    if( lua_type( L, 1 ) == LUA_TSTRING )
-    {
-        return pg::return_new_user_data< std::filesystem::path >( L, std::filesystem::read_symlink( pg::to_string_view( L, 1 ) ) );
-    }
-    else
+// The third argument is an optional table with the fields 'threads' and 'directory_options'.
+BEGIN_PROTECTED_FUNCTION( fs_snapshot )
+    pg::check_path_type( L, 1 );
+    pg::check_path_type( L, 2 );
+    if( !lua_isnoneornil( L, 3 ) )
     {
-        const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
-        return pg::return_new_user_data< std::filesystem::path >( L, std::filesystem::read_symlink( p ) );
+        luaL_checktype( L, 3, LUA_TTABLE );
     }
+    const auto threads = pg::opt_thread_count( L, 3 );
+    const auto options = pg::opt_user_data_field( L, 3, "directory_options", std::filesystem::directory_options::none );
+
+    const auto             root = pg::check_path_arg( L, 1 );
+    const auto             out  = pg::check_path_arg( L, 2 );
+    pg::work_stealing_pool pool( threads );
+    return pg::return_integer( L, static_cast< lua_Integer >( pg::write_snapshot( pool, root, options, out ) ) );
 CATCH_BAD_ALLOC
 CATCH_FILESYSTEM_ERROR
 END_PROTECTED_FUNCTION
 
-BEGIN_PROTECTED_FUNCTION( fs_remove )
-    if( lua_type( L, 1 ) == LUA_TSTRING )
+BEGIN_FUNCTION( snapshot_diff_gc )
+    auto & self = pg::to_user_data< pg::snapshot_diff >( L, 1 );
+
+    self.~snapshot_diff();
+
+    return 0;
+END_FUNCTION
+
+struct snapshot_diff_state
+{
+    static constexpr const luaL_Reg operators[] =
     {
-        return pg::return_boolean( L, std::filesystem::remove( pg::to_string_view( L, 1 ) ) );
-    }
-    else
+        { "__gc", snapshot_diff_gc },
+        { NULL,   NULL }
+    };
+
+    static constexpr const luaL_Reg * methods = nullptr;
+};
+
+BEGIN_PROTECTED_FUNCTION( next_snapshot_change )
+    auto & self = pg::check_user_data_arg< pg::snapshot_diff >( L, 1 );
+
+    pg::snapshot_diff::change kind;
+    std::string               path;
+    if( !self.next( kind, path ) )
     {
-        const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
-        return pg::return_boolean( L, std::filesystem::remove( p ) );
+        return pg::return_nil( L );
     }
+
+    lua_settop( L, 0 );
+    lua_pushstring( L, pg::snapshot_change_names[ static_cast< int >( kind ) ] );
+    lua_pushlstring( L, path.c_str(), path.size() );
+    return 2;
 CATCH_BAD_ALLOC
 CATCH_FILESYSTEM_ERROR
 END_PROTECTED_FUNCTION
 
-BEGIN_PROTECTED_FUNCTION( fs_remove_all )
-    if( lua_type( L, 1 ) == LUA_TSTRING )
-    {
-        return pg::return_integer( L, std::filesystem::remove_all( pg::to_string_view( L, 1 ) ) );
-    }
-    else
-    {
-        const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
-        return pg::return_integer( L, std::filesystem::remove_all( p ) );
-    }
+BEGIN_PROTECTED_FUNCTION( fs_diff_snapshots )
+    pg::check_path_type( L, 2 );
+    const auto a = pg::check_path_arg( L, 1 );
+    const auto b = pg::check_path_arg( L, 2 );
+
+    lua_settop( L, 0 );
+    lua_pushcfunction( L, next_snapshot_change );
+    pg::new_user_data< pg::snapshot_diff >( L, a, b );
+    return 2;
 CATCH_BAD_ALLOC
 CATCH_FILESYSTEM_ERROR
 END_PROTECTED_FUNCTION
 
-BEGIN_PROTECTED_FUNCTION( fs_rename )
-    if( lua_type( L, 1 ) == LUA_TSTRING )
+// The third argument is an optional table with the fields 'threads', 'delete', 'permissions', 'times',
+// 'dry_run', 'strategy' and 'directory_options'.
+BEGIN_PROTECTED_FUNCTION( fs_sync )
+    pg::check_path_type( L, 1 );
+    pg::check_path_type( L, 2 );
+    if( !lua_isnoneornil( L, 3 ) )
     {
-        auto p1 = pg::to_string_view( L, 1 );
-        if( lua_type( L, 2 ) == LUA_TSTRING )
-        {
-            std::filesystem::rename( p1, pg::to_string_view( L, 2 ) );
-        }
-        else
-        {
-            const auto & p2 = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
-            std::filesystem::rename( p1, p2 );
-        }
+        luaL_checktype( L, 3, LUA_TTABLE );
     }
-    else
+    const auto       threads = pg::opt_thread_count( L, 3 );
+    pg::sync_options options;
+    options.remove_extraneous = pg::opt_boolean_field( L, 3, "delete", false );
+    options.permissions       = pg::opt_boolean_field( L, 3, "permissions", true );
+    options.times             = pg::opt_boolean_field( L, 3, "times", true );
+    options.dry_run           = pg::opt_boolean_field( L, 3, "dry_run", false );
+    options.directory_options = pg::opt_user_data_field( L, 3, "directory_options", std::filesystem::directory_options::none );
+    if( lua_istable( L, 3 ) )
     {
-        const auto & p1 = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
-        if( lua_type( L, 2 ) == LUA_TSTRING )
-        {
-            std::filesystem::rename( p1, pg::to_string_view( L, 2 ) );
-        }
-        else
+        lua_getfield( L, 3, "strategy" );
+        options.strategy = check_copy_strategy( L, lua_gettop( L ) );
+    }
+
+    const auto             src = pg::check_path_arg( L, 1 );
+    const auto             dst = pg::check_path_arg( L, 2 );
+    pg::work_stealing_pool pool( threads );
+    const auto             actions = pg::sync_trees( pool, src, dst, options );
+
+    std::array< lua_Integer, std::size( pg::sync_action_names ) - 1 > counts = {};
+    lua_Integer                                                      bytes  = 0;
+    for( const auto & action : actions )
+    {
+        ++counts[ static_cast< std::size_t >( action.type ) ];
+        if( action.type == pg::sync_action_type::copy )
         {
-            const auto & p2 = pg::check_user_data_arg< std::filesystem::path >( L, 2, "path or string" );
-            std::filesystem::rename( p1, p2 );
+            bytes += static_cast< lua_Integer >( action.entry.size );
         }
     }
 
-    return pg::return_nothing( L );
-CATCH_BAD_ALLOC
-CATCH_FILESYSTEM_ERROR
-END_PROTECTED_FUNCTION
-
-BEGIN_PROTECTED_FUNCTION( fs_resize_file )
-    const auto new_size = luaL_checkinteger( L, 2 );
-    if( new_size < 0 ) PG_UNLIKELY
+    lua_settop( L, 0 );
+    lua_createtable( L, 0, static_cast< int >( counts.size() + 1 ) );
+    for( std::size_t i = 0 ; i < counts.size() ; ++i )
     {
-        return luaL_error( L, "new file size cannot be negative" );
+        lua_pushinteger( L, counts[ i ] );
+        lua_setfield( L, 1, pg::sync_action_names[ i ] );
     }
-    const auto new_size_unsigned = static_cast<  std::uintmax_t >( new_size );
+    lua_pushinteger( L, bytes );
+    lua_setfield( L, 1, "bytes" );
 
-    if( lua_type( L, 1 ) == LUA_TSTRING )
+    if( !options.dry_run )
     {
-        std::filesystem::resize_file( pg::to_string_view( L, 1 ), new_size_unsigned );
+        return 1;
     }
-    else
+
+    lua_createtable( L, static_cast< int >( actions.size() ), 0 );
+    for( std::size_t i = 0 ; i < actions.size() ; ++i )
     {
-        const auto & p = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
-        std::filesystem::resize_file( p, new_size_unsigned );
+        lua_createtable( L, 0, 2 );
+        lua_pushstring( L, pg::sync_action_names[ static_cast< int >( actions[ i ].type ) ] );
+        lua_setfield( L, -2, "action" );
+        lua_pushlstring( L, actions[ i ].entry.path.c_str(), actions[ i ].entry.path.size() );
+        lua_setfield( L, -2, "path" );
+        lua_rawseti( L, 2, static_cast< lua_Integer >( i + 1 ) );
     }
-    return pg::return_nothing( L );
+    return 2;
 CATCH_BAD_ALLOC
 CATCH_FILESYSTEM_ERROR
 END_PROTECTED_FUNCTION
 
-BEGIN_PROTECTED_FUNCTION( fs_space )
-    if( lua_type( L, 1 ) == LUA_TSTRING )
+BEGIN_PROTECTED_FUNCTION( fs_du )
+    pg::check_path_type( L, 1 );
+    if( !lua_isnoneornil( L, 2 ) )
     {
-        const auto info = std::filesystem::space( pg::to_string_view( L, 1 ) );
-
-        lua_settop( L, 0 );
-        lua_pushinteger( L, info.capacity );
-        lua_pushinteger( L, info.free );
-        lua_pushinteger( L, info.available );
-        return 3;
+        luaL_checktype( L, 2, LUA_TTABLE );
     }
-    else
+    const auto threads         = pg::opt_thread_count( L, 2 );
+    const auto options         = pg::opt_user_data_field( L, 2, "directory_options", std::filesystem::directory_options::none );
+    const auto depth           = pg::opt_integer_field( L, 2, "depth", 0 );
+    const bool apparent        = pg::opt_boolean_field( L, 2, "apparent", false );
+    const bool one_file_system = pg::opt_boolean_field( L, 2, "one_file_system", false );
+    if( depth < 0 || depth > std::numeric_limits< int >::max() ) PG_UNLIKELY
     {
-        const auto & p  = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );
-        const auto info = std::filesystem::space( p );
+        return luaL_error( L, "depth out of range" );
+    }
 
-        lua_settop( L, 0 );
-        lua_pushinteger( L, info.free );
-        lua_pushinteger( L, info.available );
-        lua_pushinteger( L, info.capacity );
-        return 3;
+    const auto             root = pg::check_path_arg( L, 1 );
+    pg::work_stealing_pool pool( threads );
+    const auto             usage = pg::directory_disk_usage( pool, root, options, static_cast< int >( depth ), apparent, one_file_system );
+
+    lua_settop( L, 0 );
+    lua_pushinteger( L, static_cast< lua_Integer >( usage.front().size ) );
+    lua_createtable( L, static_cast< int >( usage.size() ), 0 );
+    for( std::size_t i = 0 ; i < usage.size() ; ++i )
+    {
+        lua_createtable( L, 0, 4 );
+        pg::new_user_data< std::filesystem::path >( L, usage[ i ].path );
+        lua_setfield( L, -2, "path" );
+        pg::set_integer_field( L, "size", usage[ i ].size );
+        pg::set_integer_field( L, "files", usage[ i ].files );
+        pg::set_integer_field( L, "depth", usage[ i ].depth );
+        lua_rawseti( L, 2, static_cast< lua_Integer >( i + 1 ) );
     }
+
+    return 2;
 CATCH_BAD_ALLOC
 CATCH_FILESYSTEM_ERROR
 END_PROTECTED_FUNCTION
 
-using fs_file_type =  pg::enumeration< std::filesystem::file_type >;
-
-#define FS_X_STATUS( FUNCTION )\
-BEGIN_PROTECTED_FUNCTION( fs_##FUNCTION )\
-    if( lua_type( L, 1 ) == LUA_TSTRING )\
-    {\
-        const auto file_status = std::filesystem::FUNCTION( pg::to_string_view( L, 1 ) );\
-        lua_settop( L, 0 );\
-        pg::new_user_data< std::filesystem::perms >( L, file_status.permissions() );\
-        pg::new_user_data< std::filesystem::file_type >( L, file_status.type() );\
-        return 2;\
-    }\
-    else\
-    {\
-        const auto & p           = pg::check_user_data_arg< std::filesystem::path >( L, 1, "path or string" );\
-        const auto   file_status = std::filesystem::FUNCTION( p );\
-        lua_settop( L, 0 );\
-        pg::new_user_data< std::filesystem::perms >( L, file_status.permissions() );\
-        pg::new_user_data< std::filesystem::file_type >( L, file_status.type() );\
-        return 2;\
-    }\
-CATCH_BAD_ALLOC \
-CATCH_FILESYSTEM_ERROR \
-END_PROTECTED_FUNCTION
-
-FS_X_STATUS( status )
-FS_X_STATUS( symlink_status )
-
 BEGIN_PROTECTED_FUNCTION( fs_temp_directory_path )
     return pg::return_new_user_data< std::filesystem::path >( L, std::filesystem::temp_directory_path() );
 CATCH_BAD_ALLOC
@@ -1959,10 +10060,290 @@ FS_CHECK_PATH_PROPERTY( is_regular_file )
 FS_CHECK_PATH_PROPERTY( is_socket )
 FS_CHECK_PATH_PROPERTY( is_symlink )
 
+// The functions of the 'nothrow' table use the std::error_code overloads of std::filesystem and return
+// nil, a message and an error code on failure instead of raising an error.
+
+#define NOTHROW_PATH_BOOLEAN( FUNCTION )\
+BEGIN_PROTECTED_FUNCTION( nothrow_##FUNCTION )\
+    const auto      p      = pg::check_path_arg( L, 1 );\
+    std::error_code ec;\
+    const bool      result = std::filesystem::FUNCTION( p, ec );\
+    if( ec )\
+    {\
+        return pg::return_error_code( L, ec, p );\
+    }\
+    return pg::return_boolean( L, result );\
+CATCH_BAD_ALLOC \
+END_PROTECTED_FUNCTION
+
+NOTHROW_PATH_BOOLEAN( exists )
+NOTHROW_PATH_BOOLEAN( remove )
+NOTHROW_PATH_BOOLEAN( create_directories )
+NOTHROW_PATH_BOOLEAN( is_empty )
+
+// The error_code overloads of status report a missing file as an error, while the throwing
+// variants just return false. Only fail when the status could not be determined at all.
+#define NOTHROW_PATH_IS_TYPE( FUNCTION, STATUS )\
+BEGIN_PROTECTED_FUNCTION( nothrow_##FUNCTION )\
+    const auto      p = pg::check_path_arg( L, 1 );\
+    std::error_code ec;\
+    const auto      s = std::filesystem::STATUS( p, ec );\
+    if( s.type() == std::filesystem::file_type::none )\
+    {\
+        return pg::return_error_code( L, ec, p );\
+    }\
+    return pg::return_boolean( L, std::filesystem::FUNCTION( s ) );\
+CATCH_BAD_ALLOC \
+END_PROTECTED_FUNCTION
+
+NOTHROW_PATH_IS_TYPE( is_directory, status )
+NOTHROW_PATH_IS_TYPE( is_regular_file, status )
+NOTHROW_PATH_IS_TYPE( is_symlink, symlink_status )
+
+#define NOTHROW_PATH_INTEGER( FUNCTION )\
+BEGIN_PROTECTED_FUNCTION( nothrow_##FUNCTION )\
+    const auto      p      = pg::check_path_arg( L, 1 );\
+    std::error_code ec;\
+    const auto      result = std::filesystem::FUNCTION( p, ec );\
+    if( ec )\
+    {\
+        return pg::return_error_code( L, ec, p );\
+    }\
+    return pg::return_integer( L, static_cast< lua_Integer >( result ) );\
+CATCH_BAD_ALLOC \
+END_PROTECTED_FUNCTION
+
+NOTHROW_PATH_INTEGER( file_size )
+NOTHROW_PATH_INTEGER( hard_link_count )
+NOTHROW_PATH_INTEGER( remove_all )
+
+#define NOTHROW_TRANSFORM_PATH( TRANSFORMATION )\
+BEGIN_PROTECTED_FUNCTION( nothrow_##TRANSFORMATION )\
+    const auto      p = pg::check_path_arg( L, 1 );\
+    std::error_code ec;\
+    auto            result = std::filesystem::TRANSFORMATION( p, ec );\
+    if( ec )\
+    {\
+        return pg::return_error_code( L, ec, p );\
+    }\
+    return pg::return_new_user_data< std::filesystem::path >( L, std::move( result ) );\
+CATCH_BAD_ALLOC \
+END_PROTECTED_FUNCTION
+
+NOTHROW_TRANSFORM_PATH( absolute )
+NOTHROW_TRANSFORM_PATH( canonical )
+NOTHROW_TRANSFORM_PATH( weakly_canonical )
+NOTHROW_TRANSFORM_PATH( read_symlink )
+
+#define NOTHROW_X_STATUS( FUNCTION )\
+BEGIN_PROTECTED_FUNCTION( nothrow_##FUNCTION )\
+    const auto      p = pg::check_path_arg( L, 1 );\
+    std::error_code ec;\
+    const auto      file_status = std::filesystem::FUNCTION( p, ec );\
+    if( file_status.type() == std::filesystem::file_type::none )\
+    {\
+        return pg::return_error_code( L, ec, p );\
+    }\
+    return pg::return_file_status( L, file_status, lua_toboolean( L, 2 ) );\
+CATCH_BAD_ALLOC \
+END_PROTECTED_FUNCTION
+
+NOTHROW_X_STATUS( status )
+NOTHROW_X_STATUS( symlink_status )
+
+#define NOTHROW_X_PATHS( FUNCTION )\
+BEGIN_PROTECTED_FUNCTION( nothrow_##FUNCTION )\
+    pg::check_path_type( L, 2 );\
+    const auto      p1 = pg::check_path_arg( L, 1 );\
+    const auto      p2 = pg::check_path_arg( L, 2 );\
+    std::error_code ec;\
+    std::filesystem::FUNCTION( p1, p2, ec );\
+    if( ec )\
+    {\
+        return pg::return_error_code( L, ec, p1 );\
+    }\
+    return pg::return_boolean( L, true );\
+CATCH_BAD_ALLOC \
+END_PROTECTED_FUNCTION
+
+NOTHROW_X_PATHS( rename )
+NOTHROW_X_PATHS( create_hard_link )
+NOTHROW_X_PATHS( create_symlink )
+NOTHROW_X_PATHS( create_directory_symlink )
+NOTHROW_X_PATHS( copy_symlink )
+
+BEGIN_PROTECTED_FUNCTION( nothrow_equivalent )
+    pg::check_path_type( L, 2 );
+    const auto      p1 = pg::check_path_arg( L, 1 );
+    const auto      p2 = pg::check_path_arg( L, 2 );
+    std::error_code ec;
+    const bool      result = std::filesystem::equivalent( p1, p2, ec );
+    if( ec )
+    {
+        return pg::return_error_code( L, ec, p1 );
+    }
+    return pg::return_boolean( L, result );
+CATCH_BAD_ALLOC
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( nothrow_copy )
+    const auto options = lua_gettop( L ) < 3 ? std::filesystem::copy_options::none
+                                             : pg::check_user_data_arg< std::filesystem::copy_options >( L, 3 );
+    pg::check_path_type( L, 2 );
+    const auto      p1 = pg::check_path_arg( L, 1 );
+    const auto      p2 = pg::check_path_arg( L, 2 );
+    std::error_code ec;
+    std::filesystem::copy( p1, p2, options, ec );
+    if( ec )
+    {
+        return pg::return_error_code( L, ec, p1 );
+    }
+    return pg::return_boolean( L, true );
+CATCH_BAD_ALLOC
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( nothrow_copy_file )
+    const auto options = lua_gettop( L ) < 3 ? std::filesystem::copy_options::none
+                                             : pg::check_user_data_arg< std::filesystem::copy_options >( L, 3 );
+    pg::check_path_type( L, 2 );
+    const auto      p1 = pg::check_path_arg( L, 1 );
+    const auto      p2 = pg::check_path_arg( L, 2 );
+    std::error_code ec;
+    const bool      copied = std::filesystem::copy_file( p1, p2, options, ec );
+    if( ec )
+    {
+        return pg::return_error_code( L, ec, p1 );
+    }
+    return pg::return_boolean( L, copied );
+CATCH_BAD_ALLOC
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( nothrow_create_directory )
+    if( lua_gettop( L ) > 1 )
+    {
+        pg::check_path_type( L, 2 );
+    }
+    const auto      p = pg::check_path_arg( L, 1 );
+    std::error_code ec;
+    bool            created;
+    if( lua_gettop( L ) > 1 )
+    {
+        created = std::filesystem::create_directory( p, pg::check_path_arg( L, 2 ), ec );
+    }
+    else
+    {
+        created = std::filesystem::create_directory( p, ec );
+    }
+    if( ec )
+    {
+        return pg::return_error_code( L, ec, p );
+    }
+    return pg::return_boolean( L, created );
+CATCH_BAD_ALLOC
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( nothrow_last_write_time )
+    const auto * const new_time = lua_gettop( L ) > 1 ? &pg::check_user_data_arg< std::filesystem::file_time_type >( L, 2 ) : nullptr;
+    const auto      p = pg::check_path_arg( L, 1 );
+    std::error_code ec;
+    if( new_time == nullptr )
+    {
+        const auto time = std::filesystem::last_write_time( p, ec );
+        if( ec )
+        {
+            return pg::return_error_code( L, ec, p );
+        }
+        return pg::return_new_user_data< std::filesystem::file_time_type >( L, time );
+    }
+
+    std::filesystem::last_write_time( p, *new_time, ec );
+    if( ec )
+    {
+        return pg::return_error_code( L, ec, p );
+    }
+    return pg::return_boolean( L, true );
+CATCH_BAD_ALLOC
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( nothrow_directory )
+    const auto options = lua_gettop( L ) < 2 ? std::filesystem::directory_options::none
+                                             : pg::check_user_data_arg< std::filesystem::directory_options >( L, 2 );
+    const auto      p = pg::check_path_arg( L, 1 );
+    std::error_code ec;
+    auto            di = std::filesystem::directory_iterator( p, options, ec );
+    if( ec )
+    {
+        return pg::return_error_code( L, ec, p );
+    }
+
+    lua_settop( L, 0 );
+    lua_pushcfunction( L, next_directory_element );
+    pg::new_user_data< pg::directory_iterator >( L, std::move( di ), std::filesystem::directory_iterator() );
+    return 2;
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+BEGIN_PROTECTED_FUNCTION( nothrow_recursive_directory )
+    pg::check_path_type( L, 1 );
+    auto [ options, filter ] = opt_recursive_directory_arguments( L, 2 );
+    const auto      p        = pg::check_path_arg( L, 1 );
+    std::error_code ec;
+    auto            rdi      = std::filesystem::recursive_directory_iterator( p, options, ec );
+    if( ec )
+    {
+        return pg::return_error_code( L, ec, p );
+    }
+
+    lua_settop( L, 0 );
+    lua_pushcfunction( L, next_recursive_directory_element );
+    pg::new_user_data< pg::recursive_directory_iterator >( L, begin( rdi ), end( rdi ), std::move( filter ) );
+    return 2;
+CATCH_BAD_ALLOC
+CATCH_FILESYSTEM_ERROR
+END_PROTECTED_FUNCTION
+
+static constexpr const luaL_Reg nothrow_functions[] =
+{
+    { "directory",                  nothrow_directory },
+    { "recursive_directory",        nothrow_recursive_directory },
+    { "absolute",                   nothrow_absolute },
+    { "canonical",                  nothrow_canonical },
+    { "weakly_canonical",           nothrow_weakly_canonical },
+    { "copy",                       nothrow_copy },
+    { "copy_file",                  nothrow_copy_file },
+    { "copy_symlink",               nothrow_copy_symlink },
+    { "create_directory",           nothrow_create_directory },
+    { "create_directories",         nothrow_create_directories },
+    { "create_hard_link",           nothrow_create_hard_link },
+    { "create_symlink",             nothrow_create_symlink },
+    { "create_directory_symlink",   nothrow_create_directory_symlink },
+    { "exists",                     nothrow_exists },
+    { "equivalent",                 nothrow_equivalent },
+    { "file_size",                  nothrow_file_size },
+    { "hard_link_count",            nothrow_hard_link_count },
+    { "last_write_time",            nothrow_last_write_time },
+    { "read_symlink",               nothrow_read_symlink },
+    { "remove",                     nothrow_remove },
+    { "remove_all",                 nothrow_remove_all },
+    { "rename",                     nothrow_rename },
+    { "status",                     nothrow_status },
+    { "symlink_status",             nothrow_symlink_status },
+    { "is_directory",               nothrow_is_directory },
+    { "is_empty",                   nothrow_is_empty },
+    { "is_regular_file",            nothrow_is_regular_file },
+    { "is_symlink",                 nothrow_is_symlink },
+    { NULL,                         NULL }
+};
+
 static constexpr const luaL_Reg fs_functions[] =
 {
     { "directory",                  fs_directory },
+    { "directory_batch",            fs_directory_batch },
+    { "glob",                       fs_glob },
     { "recursive_directory",        fs_recursive_directory },
+    { "walk_parallel",              fs_walk_parallel },
+    { "watch",                      fs_watch },
     { "directory_entry",            fs_make_directory_entry },
     { "path",                       fs_make_path },
     { "absolute",                   fs_absolute },
@@ -1970,6 +10351,9 @@ static constexpr const luaL_Reg fs_functions[] =
     { "weakly_canonical",           fs_weakly_canonical },
     { "relative",                   fs_relative },
     { "proximate",                  fs_proximate },
+    { "atomic_batch",               fs_atomic_batch },
+    { "atomic_write",               fs_atomic_write },
+    { "batch",                      fs_batch },
     { "copy",                       fs_copy },
     { "copy_file",                  fs_copy_file },
     { "copy_symlink",               fs_copy_symlink },
@@ -1979,22 +10363,35 @@ static constexpr const luaL_Reg fs_functions[] =
     { "create_symlink",             fs_create_symlink },
     { "create_directory_symlink",   fs_create_directory_symlink },
     { "current_path",               fs_current_path },
+    { "diff_snapshots",             fs_diff_snapshots },
+    { "du",                         fs_du },
     { "exists",                     fs_exists },
     { "equivalent",                 fs_equivalent },
     { "file_size",                  fs_file_size },
+    { "find_duplicates",            fs_find_duplicates },
     { "hard_link_count",            fs_hard_link_count },
+    { "hash_file",                  fs_hash_file },
+    { "hash_many",                  fs_hash_many },
     { "last_write_time",            fs_last_write_time },
+    { "lines",                      fs_lines },
+    { "map",                        fs_map },
     { "file_time_now",              fs_file_time_now },
     { "permissions",                fs_permissions },
+    { "read_file",                  fs_read_file },
     { "read_symlink",               fs_read_symlink },
     { "remove",                     fs_remove },
     { "remove_all",                 fs_remove_all },
     { "rename",                     fs_rename },
     { "resize_file",                fs_resize_file },
+    { "snapshot",                   fs_snapshot },
     { "space",                      fs_space },
     { "status",                     fs_status },
     { "symlink_status",             fs_symlink_status },
+    { "sync",                       fs_sync },
+    { "stat_cache",                 fs_stat_cache },
+    { "stat_many",                  fs_stat_many },
     { "temp_directory_path",        fs_temp_directory_path },
+    { "write_file",                 fs_write_file },
     { "is_block_file",              fs_is_block_file },
     { "is_character_file",          fs_is_character_file },
     { "is_directory",               fs_is_directory },
@@ -2098,6 +10495,49 @@ static void register_file_types( lua_State * const L ) noexcept
     lua_setfield( L, -2, "file_type" );
 }
 
+// Adds a table with the integer values of the enum objects in the table 'enum_name' of the module.
+template< typename E >
+static void register_enum_values( lua_State * const L, const char * const enum_name, const char * const values_name ) noexcept
+{
+    lua_getfield( L, -1, enum_name );
+    lua_newtable( L );
+    lua_pushnil( L );
+    while( lua_next( L, -3 ) )
+    {
+        const auto value = pg::to_user_data< E >( L, -1 );
+        lua_pop( L, 1 );
+        lua_pushvalue( L, -1 );
+        lua_pushinteger( L, static_cast< lua_Integer >( value ) );
+        lua_rawset( L, -4 );
+    }
+    lua_setfield( L, -3, values_name );
+    lua_pop( L, 1 );
+}
+
+static constexpr const luaL_Reg async_functions[] =
+{
+    { "copy",       async_copy },
+    { "remove_all", async_remove_all },
+    { "space",      async_space },
+    { NULL,         NULL }
+};
+
+static void register_async_functions( lua_State * const L ) noexcept
+{
+    lua_createtable( L, 0, sizeof( async_functions ) / sizeof( async_functions[ 0 ] ) - 1 );
+    luaL_setfuncs( L, async_functions, 0 );
+
+    lua_setfield( L, -2, "async" );
+}
+
+static void register_nothrow_functions( lua_State * const L ) noexcept
+{
+    lua_createtable( L, 0, sizeof( nothrow_functions ) / sizeof( nothrow_functions[ 0 ] ) - 1 );
+    luaL_setfuncs( L, nothrow_functions, 0 );
+
+    lua_setfield( L, -2, "nothrow" );
+}
+
 static void register_metatable( lua_State * const L, const char * table_name, const luaL_Reg * operators, const luaL_Reg * methods )
 {
     if( luaL_newmetatable( L, table_name ) )
@@ -2134,7 +10574,19 @@ EXPORT int luaopen_filesystem( lua_State * const L ) noexcept
     register_metatable( L, pg::path_meta_traits,                         path::operators,                               path::methods );
     register_metatable( L, pg::path_iterator_meta_traits,                path_iterator_state::operators,                path_iterator_state::methods );
     register_metatable( L, pg::directory_iterator_meta_traits,           directory_iterator_state::operators,           directory_iterator_state::methods );
+    register_metatable( L, pg::directory_batch_iterator_meta_traits,     directory_batch_iterator_state::operators,     directory_batch_iterator_state::methods );
+    register_metatable( L, pg::glob_iterator_meta_traits,                glob_iterator_state::operators,                glob_iterator_state::methods );
+    register_metatable( L, pg::lines_iterator_meta_traits,               lines_iterator_state::operators,               lines_iterator_state::methods );
     register_metatable( L, pg::recursive_directory_iterator_meta_traits, recursive_directory_iterator_state::operators, recursive_directory_iterator_state::methods );
+    register_metatable( L, pg::parallel_walk_state_meta_traits,          parallel_walk_state::operators,                parallel_walk_state::methods );
+    register_metatable( L, pg::file_watcher_meta_traits,                 watcher::operators,                            watcher::methods );
+    register_metatable( L, pg::stat_cache_meta_traits,                   stat_cache::operators,                         stat_cache::methods );
+    register_metatable( L, pg::mapped_file_meta_traits,                  mapped_file::operators,                        mapped_file::methods );
+    register_metatable( L, pg::atomic_batch_meta_traits,                 atomic_batch::operators,                       atomic_batch::methods );
+    register_metatable( L, pg::operation_batch_meta_traits,              operation_batch::operators,                    operation_batch::methods );
+    register_metatable( L, pg::async_handle_meta_traits,                 async_handle::operators,                       async_handle::methods );
+    register_metatable( L, pg::async_pool_meta_traits,                   async_pool::operators,                         async_pool::methods );
+    register_metatable( L, pg::snapshot_diff_meta_traits,                snapshot_diff_state::operators,                snapshot_diff_state::methods );
     register_metatable( L, pg::directory_entry_meta_traits,              directory_entry::operators,                    directory_entry::methods );
     register_metatable( L, pg::directory_options_meta_traits,            directory_options::operators,                  directory_options::methods );
     register_metatable( L, pg::copy_options_meta_traits,                 copy_options::operators,                       copy_options::methods );
@@ -2153,6 +10605,10 @@ EXPORT int luaopen_filesystem( lua_State * const L ) noexcept
     register_perms( L );
     register_perm_options( L );
     register_file_types( L );
+    register_enum_values< std::filesystem::perms >( L, "perms", "perms_values" );
+    register_enum_values< std::filesystem::file_type >( L, "file_type", "file_type_values" );
+    register_nothrow_functions( L );
+    register_async_functions( L );
 
     return 1;
 }
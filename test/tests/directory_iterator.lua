@@ -60,11 +60,231 @@ local function _recursive_directory_iterator()
     end
 end
 
+local function _recursive_directory_filter()
+    local function count( ... )
+        local n = 0
+        for _, e in fs.recursive_directory( ... ) do
+            n = n + 1
+        end
+        return n
+    end
+
+    local root = "./test/tests/foo"
+    test.is_same( count( root, { types = { fs.file_type.directory } } ), 3 )
+    test.is_same( count( root, fs.directory_options.none, { types = { fs.file_type_values.regular }, extensions = { "txt" } } ), 10 )
+    test.is_same( count( root, { extensions = { ".md" } } ), 0 )
+    test.is_same( count( root, { skip_dirs = { "buz" } } ), 5 )
+    test.is_same( count( root, { skip_dirs = { "bar" }, types = { fs.file_type.regular } } ), 2 )
+    test.is_same( count( root, { min_size = 2, max_size = 2 } ), 10 )
+    test.is_same( count( root, { min_size = 3 } ), 0 )
+
+    local now = fs.file_time_now()
+    test.is_same( count( root, { newer_than = now } ), 0 )
+    test.is_same( count( root, { older_than = now, types = { fs.file_type.regular } } ), 10 )
+
+    for _, e in fs.recursive_directory( root, { extensions = { ".txt" }, skip_dirs = { "bar" } } ) do
+        test.is_same( tostring( e:path():extension() ), ".txt" )
+    end
+
+    test.is_false( pcall( fs.recursive_directory, root, { types = { "regular" } } ) )
+    test.is_false( pcall( fs.recursive_directory, root, { min_size = -1 } ) )
+    local n = 0
+    for _ in fs.nothrow.recursive_directory( root, { skip_dirs = { "buz" } } ) do
+        n = n + 1
+    end
+    test.is_same( n, 5 )
+end
+
+local function _directory_batch()
+    local t     = {}
+    local count = 0
+    for batch in fs.directory_batch( _current_test_path( "test/tests/foo" ), 2, { size = true, mtime = true } ) do
+        test.is_true( batch.n <= 2 )
+        test.is_nil( batch.name[ batch.n + 1 ] )
+        for i = 1, batch.n do
+            local p = _current_test_path( "test/tests/foo/" .. batch.name[ i ] )
+            t[ p ] = batch.type[ i ]
+            count  = count + 1
+            if batch.type[ i ] == fs.file_type.regular then
+                test.is_same( batch.size[ i ], fs.file_size( p ) )
+                test.is_same( batch.mtime[ i ], fs.last_write_time( p ) )
+            end
+        end
+    end
+
+    test.is_same( count, 3 )
+    for p, d in pairs( _test_paths ) do
+        if d == 0 then
+            test.is_not_nil( t[ p ] )
+        end
+    end
+    test.is_same( t[ _current_test_path( "test/tests/foo/bar" ) ], fs.file_type.directory )
+end
+
+local function _recursive_directory_batch()
+    local root  = _current_test_path( "test/tests/foo" )
+    local count = 0
+    local stats = 0
+    for batch in fs.directory_batch( root, 5, { recursive = true } ) do
+        for i = 1, batch.n do
+            local p = tostring( fs.path( root ):append( batch.name[ i ] ):make_preferred() )
+            test.is_not_nil( _test_paths[ p ] )
+            count = count + 1
+        end
+        stats = batch.stat_calls + batch.stats_avoided
+    end
+
+    test.is_same( count, 13 )
+    test.is_true( stats >= count )
+end
+
+local function _walk_parallel()
+    local t = {}
+    for entries in fs.walk_parallel( _current_test_path( "test/tests/foo" ), { threads = 4, chunk_size = 3 } ) do
+        test.is_true( #entries <= 3 )
+        for _, e in ipairs( entries ) do
+            test.is_nil( t[ tostring( e ) ] )
+            t[ tostring( e ) ] = true
+        end
+    end
+
+    for p in pairs( _test_paths ) do
+        test.is_true( t[ p ] )
+    end
+
+    local n = 0
+    for entries in fs.walk_parallel( "test/tests/foo", fs.directory_options.skip_permission_denied ) do
+        n = n + #entries
+    end
+    test.is_same( n, 13 )
+end
+
+local function _glob()
+    local function collect( patterns, options )
+        local result = {}
+        for batch in fs.glob( patterns, options ) do
+            for _, p in ipairs( batch ) do
+                result[ #result + 1 ] = tostring( p )
+            end
+        end
+        table.sort( result )
+        return result
+    end
+
+    local r = collect( "test/tests/foo/**/*.txt", { batch = 3 } )
+    test.is_same( #r, 10 )
+    test.is_same( r[ 1 ], "test/tests/foo/bar/buz/Datei.txt" )
+
+    r = collect( "foo/*/{file,plik}.{txt,md}", { root = "test/tests" } )
+    test.is_same( #r, 2 )
+    test.is_same( r[ 1 ], tostring( fs.path( "test/tests" ):append( "foo/bar/file.txt" ) ) )
+
+    r = collect( { "test/tests/foo/ba[!r]", "test/tests/foo/b?r/buz/[a-f]*" } )
+    test.is_same( #r, 4 )
+    test.is_same( r[ 1 ], "test/tests/foo/bar/buz/bestand.txt" )
+    test.is_same( r[ 4 ], "test/tests/foo/baz" )
+
+    test.is_same( #collect( "test/tests/missing/**" ), 0 )
+    test.is_same( #collect( "test/tests/foo/*.TXT" ), 0 )
+    test.is_false( pcall( fs.glob, { "/foo/*", "foo/*" } ) )
+    test.is_false( pcall( fs.glob, "" ) )
+end
+
+local function _watch()
+    local dir = fs.path( "test/tests/watched" )
+    fs.create_directory( dir )
+
+    local w = fs.watch( dir, { recursive = true, coalesce = 0.01 } )
+    test.is_same( math.type( w:fd() ), "integer" )
+    test.is_same( #w:poll( 0 ), 0 )
+
+    local function write( p, s )
+        local f = io.open( tostring( p ), "w" )
+        f:write( s )
+        f:close()
+    end
+
+    fs.create_directories( fs.path( dir ):append( "sub" ) )
+    write( fs.path( dir ):append( "sub/file.txt" ), "x" )
+
+    local created = {}
+    for _ = 1, 10 do
+        for _, e in ipairs( w:poll( 0.1 ) ) do
+            if e.type == "create" then
+                created[ tostring( e.path:filename() ) ] = e.directory
+            end
+        end
+        if created[ "file.txt" ] ~= nil then
+            break
+        end
+    end
+    test.is_true( created[ "sub" ] )
+    test.is_false( created[ "file.txt" ] )
+
+    fs.rename( fs.path( dir ):append( "sub/file.txt" ), fs.path( dir ):append( "moved.txt" ) )
+    local moves = 0
+    for _, e in ipairs( w:poll( 1 ) ) do
+        if e.type == "move" then
+            moves = moves + 1
+            test.is_same( e.from:filename(), fs.path( "file.txt" ) )
+            test.is_same( e.path:filename(), fs.path( "moved.txt" ) )
+        end
+    end
+    test.is_same( moves, 1 )
+
+    local outside = fs.path( "test/tests/outside" )
+    fs.create_directories( fs.path( outside ):append( "inner" ) )
+    write( fs.path( outside ):append( "inner/old.txt" ), "x" )
+    fs.rename( outside, fs.path( dir ):append( "outside" ) )
+    local moved_in = {}
+    for _, e in ipairs( w:poll( 1 ) ) do
+        moved_in[ #moved_in + 1 ] = e.type .. " " .. tostring( e.path:filename() )
+    end
+    test.is_same( #moved_in, 1 )
+    test.is_same( moved_in[ 1 ], "create outside" )
+
+    write( fs.path( dir ):append( "outside/inner/new.txt" ), "x" )
+    local found = false
+    for _, e in ipairs( w:poll( 1 ) ) do
+        found = found or ( e.type == "create" and e.path:filename() == fs.path( "new.txt" ) )
+    end
+    test.is_true( found )
+
+    fs.rename( fs.path( dir ):append( "outside" ), fs.path( dir ):append( "renamed" ) )
+    w:poll( 1 )
+    write( fs.path( dir ):append( "renamed/inner/x.txt" ), "x" )
+    local events = w:poll( 1 )
+    test.is_same( #events, 1 )
+    test.is_same( tostring( events[ 1 ].path ), tostring( fs.path( dir ):append( "renamed/inner/x.txt" ) ) )
+
+    local away = fs.path( "test/tests/away" )
+    fs.rename( fs.path( dir ):append( "renamed" ), away )
+    events = w:poll( 1 )
+    test.is_same( #events, 1 )
+    test.is_same( events[ 1 ].type, "delete" )
+    write( fs.path( away ):append( "inner/y.txt" ), "y" )
+    test.is_same( #w:poll( 0.1 ), 0 )
+    fs.remove_all( away )
+
+    w:close()
+    test.is_nil( w:fd() )
+    test.is_false( pcall( w.poll, w, 0 ) )
+    test.is_false( pcall( fs.watch, "test/tests/missing" ) )
+
+    fs.remove_all( dir )
+end
+
 local tests =
 {
     directory_iterator              = _directory_iterator,
     directory_iterator_with_options = _directory_iterator_with_options,
-    recursive_directory_iterator    = _recursive_directory_iterator
+    recursive_directory_iterator    = _recursive_directory_iterator,
+    recursive_directory_filter      = _recursive_directory_filter,
+    directory_batch                 = _directory_batch,
+    recursive_directory_batch       = _recursive_directory_batch,
+    walk_parallel                   = _walk_parallel,
+    glob                            = _glob,
+    watch                           = _watch
 }
 
 return tests
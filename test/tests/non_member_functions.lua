@@ -47,12 +47,96 @@ local function _proximate()
     test.is_same( p2, p2 )
 end
 
+local function _async()
+    local dir = "./test/tests/async"
+
+    local copy = fs.async.copy( "./test/tests/foo", dir, fs.copy_options.recursive )
+    test.is_same( math.type( copy:fd() ), "integer" )
+    test.is_true( copy:wait() )
+    test.is_true( copy:done() )
+    test.is_same( type( copy:result() ), "table" )
+    test.is_true( fs.exists( dir .. "/file.txt" ) )
+
+    local capacity, free, available = fs.async.space( fs.path( dir ) ):await()
+    test.is_true( capacity >= free )
+    test.is_true( free >= available )
+
+    -- A coroutine yields the handle until the operation is finished
+    local remove = fs.async.remove_all( dir )
+    local co     = coroutine.wrap( function() return remove:await() end )
+    local result = co()
+    while result == remove do
+        test.is_true( result:wait( 1 ) )
+        result = co()
+    end
+    test.is_true( result > 1 )
+    test.is_false( fs.exists( dir ) )
+
+    local failed = fs.async.copy( "./test/tests/foo/missing.txt", dir )
+    failed:wait()
+    test.is_false( pcall( failed.result, failed ) )
+    test.is_false( pcall( failed.await, failed ) )
+    test.is_false( pcall( fs.async.copy, "./test/tests/foo" ) )
+end
+
+local function _batch()
+    local dir = "./test/tests/batch"
+
+    for _, backend in ipairs( { "auto", "threads" } ) do
+        fs.create_directory( dir )
+        fs.write_file( dir .. "/a.txt", "abc" )
+        fs.write_file( dir .. "/r.txt", "rename" )
+        fs.create_directory( dir .. "/empty" )
+        fs.create_directory( dir .. "/existing" )
+
+        local b = fs.batch( { backend = backend, threads = 2 } )
+        test.is_same( b:stat( dir .. "/a.txt" ), 1 )
+        b:stat( dir .. "/missing.txt" )
+        b:create_directory( dir .. "/new" )
+        b:create_directory( dir .. "/existing" )
+        b:rename( dir .. "/r.txt", dir .. "/b.txt" )
+        b:remove( dir .. "/empty" )
+        b:remove( dir .. "/missing.txt" )
+        b:copy( "./test/tests/foo/file.txt", fs.path( dir .. "/copy.txt" ) )
+        test.is_same( #b, 8 )
+
+        local results, errors = b:submit()
+        test.is_same( #b, 0 )
+        test.is_same( results.n, 8 )
+        test.is_same( results[ 1 ].type, fs.file_type.regular )
+        test.is_same( results[ 1 ].size, 3 )
+        test.is_nil( results[ 2 ] )
+        test.is_same( type( errors[ 2 ] ), "string" )
+        test.is_true( results[ 3 ] )
+        test.is_false( results[ 4 ] )
+        test.is_true( results[ 5 ] )
+        test.is_true( results[ 6 ] )
+        test.is_false( results[ 7 ] )
+        test.is_true( results[ 8 ] )
+        test.is_nil( next( errors, 2 ) )
+
+        test.is_true( fs.is_directory( dir .. "/new" ) )
+        test.is_false( fs.exists( dir .. "/empty" ) )
+        test.is_same( fs.read_file( dir .. "/b.txt" ), "rename" )
+        test.is_false( fs.exists( dir .. "/r.txt" ) )
+        test.is_same( fs.read_file( dir .. "/copy.txt" ), fs.read_file( "./test/tests/foo/file.txt" ) )
+
+        results = b:submit()
+        test.is_same( results.n, 0 )
+        fs.remove_all( dir )
+    end
+
+    test.is_false( pcall( fs.batch, { backend = "aio" } ) )
+end
+
 local function _copy()
     local src = "./test/tests/foo"
     local dst = fs.path( "./test/tests/bar" )
     
-    fs.copy( src, dst )
+    local counts = fs.copy( src, dst )
     test.is_true( fs.exists( fs.path( dst ):append( "file.txt" ) ) )
+    test.is_false( fs.exists( fs.path( dst ):append( "bar/buz" ) ) )
+    test.is_not_nil( next( counts ) )
 
     fs.remove_all( dst )
 
@@ -60,6 +144,16 @@ local function _copy()
     test.is_true( fs.exists( fs.path( dst ):append( "bar/buz" ) ) )
 
     fs.remove_all( dst )
+
+    local options = { threads = 4, max_open_files = 4, strategy = "readwrite" }
+    counts        = fs.copy( src, dst, fs.copy_options.recursive, options )
+    test.is_same( counts.readwrite, 10 )
+    test.is_true( fs.exists( fs.path( dst ):append( "bar/buz/plik.txt" ) ) )
+    test.is_false( pcall( fs.copy, src, dst, fs.copy_options.recursive, options ) )
+    test.is_nil( next( fs.copy( src, dst, fs.copy_options.recursive | fs.copy_options.skip_existing, options ) ) )
+    test.is_same( fs.copy( src, dst, fs.copy_options.recursive | fs.copy_options.overwrite_existing, options ).readwrite, 10 )
+
+    fs.remove_all( dst )
 end
 
 local function _copy_file()
@@ -71,6 +165,16 @@ local function _copy_file()
 
     test.is_false( fs.copy_file( src, dst, fs.copy_options.skip_existing ) )
 
+    for _, strategy in ipairs( { "auto", "reflink", "copy_file_range", "sendfile", "readwrite", "copy_file" } ) do
+        local copied, used = fs.copy_file( src, dst, fs.copy_options.overwrite_existing, strategy )
+        test.is_true( copied )
+        test.is_same( type( used ), "string" )
+        test.is_same( fs.file_size( tostring( dst ) ), fs.file_size( src ) )
+    end
+    test.is_same( select( 2, fs.copy_file( src, dst, fs.copy_options.overwrite_existing, "readwrite" ) ), "readwrite" )
+    test.is_false( pcall( fs.copy_file, src, dst, nil, "teleport" ) )
+    test.is_false( pcall( fs.copy_file, src, src, fs.copy_options.overwrite_existing ) )
+
     fs.remove( dst )
 end
 
@@ -116,6 +220,12 @@ local function _create_directories_remove_all()
 
     fs.remove_all( _current_test_path( "./test/tests/bar" ) )
     test.is_false( fs.exists( dir ) )
+
+    local copy = _current_test_path( "./test/tests/bar" )
+    fs.copy( "./test/tests/foo", copy, fs.copy_options.recursive )
+    test.is_same( fs.remove_all( copy, { threads = 4, max_open_files = 2 } ), 14 )
+    test.is_false( fs.exists( copy ) )
+    test.is_same( fs.remove_all( copy, { threads = 4 } ), 0 )
 end
 
 local function _create_hard_link_and_count()
@@ -151,6 +261,207 @@ local function _current_path()
     test.is_same( p1, p2 )
 end
 
+local function _du()
+    local root = fs.path( "./test/tests/du" )
+    fs.create_directories( fs.path( root ):append( "a/b" ) )
+
+    local function write( name, size )
+        local f = io.open( tostring( fs.path( root ):append( name ) ), "wb" )
+        f:write( string.rep( "x", size ) )
+        f:close()
+    end
+
+    write( "1.bin", 100 )
+    write( "a/2.bin", 20 )
+    write( "a/b/3.bin", 3 )
+    fs.create_hard_link( fs.path( root ):append( "a/2.bin" ), fs.path( root ):append( "a/b/link.bin" ) )
+
+    local total, dirs = fs.du( root, { apparent = true, depth = 1, threads = 2 } )
+    test.is_same( total, 123 )
+    test.is_same( #dirs, 2 )
+    test.is_same( dirs[ 1 ].path, root )
+    test.is_same( dirs[ 1 ].files, 3 )
+    test.is_same( dirs[ 1 ].depth, 0 )
+    test.is_same( dirs[ 2 ].path, fs.path( root ):append( "a" ) )
+    test.is_same( dirs[ 2 ].size, 23 )
+    test.is_same( dirs[ 2 ].depth, 1 )
+
+    total, dirs = fs.du( root, { depth = 5 } )
+    test.is_same( #dirs, 3 )
+    test.is_true( total >= dirs[ 2 ].size and dirs[ 2 ].size >= dirs[ 3 ].size )
+
+    test.is_same( fs.du( fs.path( root ):append( "1.bin" ), { apparent = true } ), 100 )
+    test.is_false( pcall( fs.du, fs.path( root ):append( "missing" ) ) )
+    test.is_false( pcall( fs.du, root, { depth = -1 } ) )
+
+    fs.remove_all( root )
+end
+
+local function _map()
+    local p = "./test/tests/map.bin"
+    local f = io.open( p, "wb" )
+    f:write( "hello world\1\2\3\4\255\254" )
+    f:close()
+
+    local m = fs.map( fs.path( p ) )
+    test.is_same( m:size(), 17 )
+    test.is_same( #m, 17 )
+    test.is_same( m:sub( 1, 5 ), "hello" )
+    test.is_same( m:sub( 7, 11 ), "world" )
+    test.is_same( m:sub( -2 ), "\255\254" )
+    test.is_same( m:sub( 20 ), "" )
+    test.is_same( m:byte( 1 ), 104 )
+    test.is_same( select( "#", m:byte( 1, 3 ) ), 3 )
+    test.is_same( m:byte( -1 ), 254 )
+
+    local first, last = m:find( "world" )
+    test.is_same( first, 7 )
+    test.is_same( last, 11 )
+    test.is_same( m:find( "o", 6 ), 8 )
+    test.is_nil( m:find( "xyz" ) )
+
+    test.is_same( m:read_uint( 12, 4 ), 0x04030201 )
+    test.is_same( m:read_uint( 12, 4, true ), 0x01020304 )
+    test.is_same( m:read_uint( 16, 2 ), 0xFEFF )
+    test.is_same( m:read_int( 16, 2 ), -257 )
+    test.is_false( pcall( m.read_int, m, 16, 4 ) )
+    test.is_false( pcall( m.write, m, 1, "J" ) )
+    m:advise( "sequential" )
+    m:close()
+    test.is_false( pcall( m.size, m ) )
+
+    local w = fs.map( p, "rw" )
+    w:write( 1, "J" )
+    w:close()
+    test.is_same( fs.map( p ):sub( 1, 5 ), "Jello" )
+
+    fs.remove( p )
+    test.is_false( pcall( fs.map, p ) )
+end
+
+local function _read_write_file()
+    local p = "./test/tests/read_write.bin"
+    local data = string.rep( "0123456789\0", 10000 )
+
+    fs.write_file( p, data )
+    test.is_same( fs.file_size( p ), #data )
+    test.is_same( fs.read_file( p ), data )
+    test.is_same( fs.read_file( fs.path( p ) ), data )
+
+    fs.write_file( fs.path( p ), "tail", { append = true, preallocate = true, sync = true } )
+    test.is_same( fs.read_file( p ), data .. "tail" )
+
+    fs.write_file( p, "short", { preallocate = true } )
+    test.is_same( fs.read_file( p ), "short" )
+    fs.write_file( p, "" )
+    test.is_same( fs.read_file( p ), "" )
+
+    fs.remove( p )
+    test.is_false( pcall( fs.read_file, p ) )
+    test.is_false( pcall( fs.read_file, "./test/tests/foo/bar" ) )
+    test.is_false( pcall( fs.write_file, "./test/tests/foo/bar", "x" ) )
+    test.is_false( pcall( fs.write_file, p, "x", 1 ) )
+    test.is_false( fs.exists( p ) )
+end
+
+local function _atomic_write()
+    local dir = "./test/tests/atomic"
+    fs.create_directory( dir )
+
+    fs.atomic_write( dir .. "/a.txt", "first" )
+    test.is_same( fs.read_file( dir .. "/a.txt" ), "first" )
+    fs.permissions( dir .. "/a.txt", fs.perms.owner_read | fs.perms.owner_write )
+    fs.atomic_write( fs.path( dir .. "/a.txt" ), "second" )
+    test.is_same( fs.read_file( dir .. "/a.txt" ), "second" )
+    test.is_same( fs.status( dir .. "/a.txt" ), fs.perms.owner_read | fs.perms.owner_write )
+
+    local batch = fs.atomic_batch( { max_open_files = 2 } )
+    for i = 1, 5 do
+        batch:write( dir .. "/" .. i .. ".txt", tostring( i ) )
+    end
+    test.is_same( batch:commit(), 5 )
+    test.is_same( #batch, 0 )
+    for i = 1, 5 do
+        test.is_same( fs.read_file( dir .. "/" .. i .. ".txt" ), tostring( i ) )
+    end
+
+    local twice = fs.atomic_batch()
+    twice:write( dir .. "/twice.txt", "first" )
+    twice:write( dir .. "/twice.txt", "second" )
+    twice:write( dir .. "/1.txt", "third" )
+    twice:write( dir .. "/./1.txt", "fourth" )
+    test.is_same( #twice, 3 )
+    test.is_same( twice:commit(), 3 )
+    test.is_same( fs.read_file( dir .. "/twice.txt" ), "second" )
+    test.is_same( fs.read_file( dir .. "/1.txt" ), "fourth" )
+    fs.remove( dir .. "/twice.txt" )
+
+    do
+        local discarded <close> = fs.atomic_batch()
+        discarded:write( dir .. "/a.txt", "discarded" )
+        discarded:write( dir .. "/new.txt", "discarded" )
+        test.is_same( #discarded, 2 )
+    end
+    test.is_same( fs.read_file( dir .. "/a.txt" ), "second" )
+    test.is_false( fs.exists( dir .. "/new.txt" ) )
+
+    local count = 0
+    for _ in fs.directory( dir ) do
+        count = count + 1
+    end
+    test.is_same( count, 6 )
+
+    test.is_false( pcall( fs.atomic_write, dir .. "/missing/a.txt", "x" ) )
+    test.is_false( pcall( fs.atomic_batch, { max_open_files = 0 } ) )
+    fs.remove_all( dir )
+end
+
+local function _lines()
+    local p = "./test/tests/lines.txt"
+    fs.write_file( p, "first\r\n\nthird line\n" .. string.rep( "x", 100 ) .. "\nlast" )
+
+    local function collect( options )
+        local lines = {}
+        for line in fs.lines( p, options ) do
+            lines[ #lines + 1 ] = line
+        end
+        return lines
+    end
+
+    local lines = collect()
+    test.is_same( #lines, 5 )
+    test.is_same( lines[ 1 ], "first\r" )
+    test.is_same( lines[ 2 ], "" )
+    test.is_same( lines[ 3 ], "third line" )
+    test.is_same( #lines[ 4 ], 100 )
+    test.is_same( lines[ 5 ], "last" )
+
+    lines = collect( { buffer = 4, crlf = true } )
+    test.is_same( #lines, 5 )
+    test.is_same( lines[ 1 ], "first" )
+    test.is_same( #lines[ 4 ], 100 )
+    test.is_same( lines[ 5 ], "last" )
+
+    local batches, count = 0, 0
+    for batch in fs.lines( fs.path( p ), { batch = 2 } ) do
+        batches = batches + 1
+        count   = count + #batch
+    end
+    test.is_same( batches, 3 )
+    test.is_same( count, 5 )
+
+    test.is_same( #collect( { max_line = 100 } ), 5 )
+    test.is_false( pcall( collect, { max_line = 99 } ) )
+    test.is_false( pcall( collect, { max_line = 99, buffer = 8 } ) )
+
+    fs.write_file( p, "" )
+    test.is_same( #collect(), 0 )
+
+    fs.remove( p )
+    test.is_false( pcall( fs.lines, p ) )
+    test.is_false( pcall( fs.lines, p, { buffer = 0 } ) )
+end
+
 local function _equivalent()
     local p1 = fs.path( _current_test_path( "test/tests/foo/file.txt" ) )
     local p2 = _current_test_path( "././test/../test/tests/foo/file.txt" )
@@ -174,6 +485,70 @@ local function _file_size_resize()
     fs.resize_file( p, size )
 end
 
+local function _find_duplicates()
+    local root = fs.path( "./test/tests/dups" )
+    fs.create_directories( fs.path( root ):append( "sub" ) )
+
+    local function write( name, contents )
+        local f = io.open( tostring( fs.path( root ):append( name ) ), "wb" )
+        f:write( contents )
+        f:close()
+    end
+
+    local big = string.rep( "0123456789abcdef", 1024 )
+    write( "a.bin", big .. "x" .. big )
+    write( "sub/b.bin", big .. "x" .. big )
+    write( "c.bin", big .. "y" .. big )         -- Same size and ends, other contents
+    write( "d.bin", big .. "x" .. big .. "!" )  -- Other size
+    write( "e.txt", "small" )
+    write( "sub/f.txt", "small" )
+    write( "g.txt", "" )
+    write( "sub/h.txt", "" )
+    fs.create_hard_link( fs.path( root ):append( "a.bin" ), fs.path( root ):append( "sub/a_link.bin" ) )
+
+    local groups = fs.find_duplicates( root, { threads = 2 } )
+    test.is_same( #groups, 2 )
+    test.is_same( groups[ 1 ].size, 2 * #big + 1 )
+    test.is_same( #groups[ 1 ], 2 )
+    test.is_same( tostring( groups[ 1 ][ 2 ]:filename() ), "b.bin" )
+    test.is_same( groups[ 2 ].size, 5 )
+    test.is_same( #groups[ 2 ], 2 )
+
+    groups = fs.find_duplicates( { root, fs.path( root ):append( "sub" ) }, { algorithm = "sha256", min_size = 0, threads = 1 } )
+    test.is_same( #groups, 3 )
+    test.is_same( groups[ 3 ].size, 0 )
+
+    test.is_same( #fs.find_duplicates( root, { min_size = 100000 } ), 0 )
+    test.is_false( pcall( fs.find_duplicates, root, { algorithm = "md5" } ) )
+
+    fs.remove_all( root )
+end
+
+local function _hash_file()
+    local p = "./test/tests/hash.txt"
+    local f = io.open( p, "wb" )
+    f:write( "abc" )
+    f:close()
+
+    test.is_same( fs.hash_file( p ), "44bc2cf5ad770999" )
+    test.is_same( fs.hash_file( fs.path( p ), "xxh64" ), "44bc2cf5ad770999" )
+    test.is_same( fs.hash_file( p, "sha256" ), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" )
+    test.is_same( fs.hash_file( "./test/tests/foo/file.txt", "sha256" ), "e16f1596201850fd4a63680b27f603cb64e67176159be3d8ed78a4403fdb1700" )
+
+    local hashes, errors = fs.hash_many( { p, "./test/tests/foo/missing.txt", fs.path( "./test/tests/foo/file.txt" ) }, "sha256", { threads = 2 } )
+    test.is_same( hashes.n, 3 )
+    test.is_same( hashes[ 1 ], "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" )
+    test.is_nil( hashes[ 2 ] )
+    test.is_same( type( errors[ 2 ] ), "string" )
+    test.is_same( hashes[ 3 ], fs.hash_file( "./test/tests/foo/file.txt", "sha256" ) )
+    test.is_nil( errors[ 3 ] )
+
+    fs.remove( p )
+
+    test.is_false( pcall( fs.hash_file, "./test/tests/foo/missing.txt" ) )
+    test.is_false( pcall( fs.hash_file, "./test/tests/foo/file.txt", "md5" ) )
+end
+
 local function _status_permissions()
     local p         = fs.path( "./test/tests/foo/file.txt" )
     local perm1, t1 = fs.status( p )
@@ -203,6 +578,49 @@ local function _rename()
     test.is_true( fs.exists( p1 ) )
 end
 
+local function _snapshot()
+    local dir = "./test/tests/snapshot"
+    local a   = "./test/tests/a.snap"
+    local b   = "./test/tests/b.snap"
+
+    fs.create_directories( dir .. "/sub/deeper" )
+    fs.write_file( dir .. "/keep.txt", "keep" )
+    fs.write_file( dir .. "/change.txt", "change" )
+    fs.write_file( dir .. "/sub/remove.txt", "remove" )
+    fs.write_file( dir .. "/sub/deeper/file.txt", "file" )
+
+    local sub_time = fs.last_write_time( dir .. "/sub" )
+    test.is_same( fs.snapshot( dir, a ), 6 )
+    test.is_same( fs.snapshot( fs.path( dir ), b, { threads = 1 } ), 6 )
+    local next_change, state = fs.diff_snapshots( a, b )
+    test.is_nil( next_change( state ) )
+
+    fs.write_file( dir .. "/change.txt", "changed" )
+    fs.remove( dir .. "/sub/remove.txt" )
+    fs.write_file( dir .. "/sub/added.txt", "added" )
+    -- Timestamps may be too coarse for the changes above to move the mtime of the directory
+    fs.last_write_time( dir .. "/sub", sub_time + 10 )
+    fs.snapshot( dir, b )
+
+    local changes = {}
+    for kind, path in fs.diff_snapshots( a, fs.path( b ) ) do
+        changes[ #changes + 1 ] = kind .. " " .. path
+    end
+    test.is_same( #changes, 4 )
+    test.is_same( changes[ 1 ], "changed change.txt" )
+    test.is_same( changes[ 2 ], "changed sub" )
+    test.is_same( changes[ 3 ], "added sub/added.txt" )
+    test.is_same( changes[ 4 ], "removed sub/remove.txt" )
+
+    fs.write_file( b, "not a snapshot" )
+    test.is_false( pcall( fs.diff_snapshots, a, b ) )
+    test.is_false( pcall( fs.snapshot, dir .. "/missing", b ) )
+
+    fs.remove( a )
+    fs.remove( b )
+    fs.remove_all( dir )
+end
+
 local function _space()
     local p                         = fs.path( "./test/tests/foo" )
     local free, available, capacity = fs.space( p )
@@ -212,6 +630,172 @@ local function _space()
     test.is_not_nil( capacity )
 end
 
+local function _stat_many()
+    local paths = { "./test/tests/foo/file.txt", fs.path( "./test/tests/foo/bar" ), "./test/tests/foo/missing.txt" }
+    local r     = fs.stat_many( paths, { "type", "perms", "size", "mtime", "hard_link_count" } )
+
+    test.is_same( r.n, 3 )
+    test.is_same( r.type[ 1 ], fs.file_type.regular )
+    test.is_same( r.type[ 2 ], fs.file_type.directory )
+    test.is_nil( r.type[ 3 ] )
+    test.is_same( r.perms[ 1 ], ( fs.status( paths[ 1 ] ) ) )
+    test.is_same( r.size[ 1 ], fs.file_size( paths[ 1 ] ) )
+    test.is_nil( r.size[ 2 ] )
+    test.is_same( r.mtime[ 1 ], fs.last_write_time( paths[ 1 ] ) )
+    test.is_same( r.hard_link_count[ 1 ], fs.hard_link_count( paths[ 1 ] ) )
+    test.is_nil( r.inode )
+
+    local many = {}
+    for i = 1, 1000 do
+        many[ i ] = paths[ i % 3 + 1 ]
+    end
+    local r2         = fs.stat_many( many, { "size" }, { threads = 4 } )
+    local mismatches = 0
+    for i = 1, 1000 do
+        if r2.size[ i ] ~= r.size[ i % 3 + 1 ] then
+            mismatches = mismatches + 1
+        end
+    end
+    test.is_same( mismatches, 0 )
+
+    test.is_false( pcall( fs.stat_many, { 42 } ) )
+    test.is_false( pcall( fs.stat_many, paths, { "colour" } ) )
+end
+
+local function _nothrow()
+    local missing = "./test/tests/foo/missing.txt"
+
+    local value, msg, code = fs.nothrow.file_size( missing )
+    test.is_nil( value )
+    test.is_same( type( msg ), "string" )
+    test.is_same( math.type( code ), "integer" )
+
+    test.is_same( fs.nothrow.file_size( "./test/tests/foo/file.txt" ), fs.file_size( "./test/tests/foo/file.txt" ) )
+    test.is_false( fs.nothrow.exists( missing ) )
+    test.is_false( fs.nothrow.is_directory( missing ) )
+    test.is_true( fs.nothrow.is_directory( "./test/tests/foo/bar" ) )
+    test.is_same( select( 2, fs.nothrow.status( missing ) ), fs.file_type.not_found )
+    test.is_nil( fs.nothrow.canonical( missing ) )
+    test.is_nil( fs.nothrow.directory( missing ) )
+    test.is_nil( fs.nothrow.copy_file( missing, "./test/tests/foo/copy.txt" ) )
+    test.is_same( fs.nothrow.remove_all( missing ), 0 )
+
+    for entry in fs.nothrow.directory( "./test/tests/foo" ) do
+        test.is_true( entry:exists() )
+    end
+end
+
+local function _stat_cache()
+    local file  = "./test/tests/foo/file.txt"
+    local cache = fs.stat_cache( { ttl = 60, watch = false } )
+
+    test.is_true( cache:exists( file ) )
+    test.is_true( cache:is_regular_file( file ) )
+    test.is_false( cache:is_directory( file ) )
+    test.is_true( cache:is_directory( "./test/tests/foo" ) )
+    test.is_same( cache:file_size( file ), fs.file_size( file ) )
+    test.is_same( cache:last_write_time( file ), fs.last_write_time( file ) )
+    test.is_same( select( 2, cache:status( file ) ), fs.file_type.regular )
+    test.is_false( cache:exists( "./test/tests/foo/missing.txt" ) )
+    test.is_false( pcall( cache.file_size, cache, "./test/tests/foo/missing.txt" ) )
+    test.is_false( pcall( cache.file_size, cache, "./test/tests/foo" ) )
+
+    local stats = cache:stats()
+    test.is_same( stats.misses, 3 )
+    test.is_same( stats.hits, 7 )
+    test.is_same( stats.entries, 3 )
+
+    cache:invalidate( file )
+    cache:exists( file )
+    test.is_same( cache:stats().misses, 4 )
+    cache:invalidate()
+    test.is_same( cache:stats().entries, 0 )
+
+    local dir      = "./test/tests/cached"
+    local new_file = dir .. "/new.txt"
+    fs.create_directory( dir )
+    local watched = fs.stat_cache( { ttl = 60 } )
+    test.is_false( watched:exists( new_file ) )
+    io.open( new_file, "w" ):close()
+    local deadline = os.clock() + 1
+    while not watched:exists( new_file ) and os.clock() < deadline do end
+    test.is_true( watched:exists( new_file ) )
+    test.is_true( watched:stats().invalidations > 0 )
+
+    local deep_file = dir .. "/sub/deep.txt"
+    fs.create_directory( dir .. "/sub" )
+    io.open( deep_file, "w" ):close()
+    test.is_true( watched:exists( deep_file ) )
+    local watches = watched:stats().watches
+    fs.rename( dir .. "/sub", "./test/tests/cached_moved" )
+    deadline = os.clock() + 1
+    while watched:exists( deep_file ) and os.clock() < deadline do end
+    test.is_false( watched:exists( deep_file ) )
+    test.is_same( watched:stats().watches, watches - 1 )
+    fs.remove_all( "./test/tests/cached_moved" )
+    fs.remove_all( dir )
+end
+
+local function _sync()
+    local src = "./test/tests/sync_src"
+    local dst = "./test/tests/sync_dst"
+
+    fs.create_directories( src .. "/sub/deeper" )
+    fs.write_file( src .. "/a.txt", "a" )
+    fs.write_file( src .. "/sub/b.txt", "b" )
+    fs.write_file( src .. "/sub/deeper/c.txt", "c" )
+    fs.create_directories( dst .. "/extra" )
+    fs.write_file( dst .. "/extra/x.txt", "x" )
+    fs.write_file( dst .. "/sub", "not a directory" )
+
+    local summary, actions = fs.sync( src, dst, { delete = true, dry_run = true } )
+    test.is_same( summary.remove, 2 )
+    test.is_same( summary.create_directory, 2 )
+    test.is_same( summary.copy, 3 )
+    test.is_same( summary.bytes, 3 )
+    test.is_same( #actions, 7 )
+    test.is_same( actions[ 1 ].action, "remove" )
+    test.is_same( actions[ 1 ].path, "extra" )
+    test.is_same( actions[ 3 ].action, "create_directory" )
+    test.is_same( actions[ 3 ].path, "sub" )
+    test.is_true( fs.exists( dst .. "/extra/x.txt" ) )
+
+    summary = fs.sync( src, fs.path( dst ), { delete = true, threads = 2 } )
+    test.is_same( summary.copy, 3 )
+    test.is_false( fs.exists( dst .. "/extra" ) )
+    test.is_same( fs.read_file( dst .. "/sub/deeper/c.txt" ), "c" )
+    test.is_same( fs.last_write_time( dst .. "/sub/b.txt" ), fs.last_write_time( src .. "/sub/b.txt" ) )
+    test.is_same( fs.last_write_time( dst .. "/sub" ), fs.last_write_time( src .. "/sub" ) )
+
+    summary = fs.sync( src, dst )
+    test.is_same( summary.copy + summary.update + summary.create_directory + summary.remove, 0 )
+
+    fs.write_file( src .. "/a.txt", "changed" )
+    fs.write_file( dst .. "/only.txt", "kept" )
+    summary = fs.sync( src, dst )
+    test.is_same( summary.copy, 1 )
+    test.is_same( fs.read_file( dst .. "/a.txt" ), "changed" )
+    test.is_true( fs.exists( dst .. "/only.txt" ) )
+
+    local plain = dst .. "_plain"
+    test.is_same( fs.sync( src, plain, { times = false } ).copy, 3 )
+    test.is_same( fs.sync( src, plain, { times = false } ).copy, 0 )
+    fs.write_file( src .. "/sub/b.txt", "B" )
+    fs.last_write_time( src .. "/sub/b.txt", fs.last_write_time( plain .. "/sub/b.txt" ) + 10 )
+    test.is_same( fs.sync( src, plain, { times = false } ).copy, 1 )
+    test.is_same( fs.read_file( plain .. "/sub/b.txt" ), "B" )
+    for e in fs.directory( plain .. "/sub" ) do
+        test.is_not_same( e:path():extension(), fs.path( ".tmp" ) )
+    end
+
+    test.is_false( pcall( fs.sync, src .. "/missing", dst ) )
+    test.is_false( pcall( fs.sync, src, dst .. "/a.txt" ) )
+
+    fs.remove_all( src )
+    fs.remove_all( dst )
+    fs.remove_all( plain )
+end
+
 local function _temp_directory_path()
     local tmp = fs.temp_directory_path()
 
@@ -338,6 +922,22 @@ local function _enum_binary_operators()
     test.is_same( none | all, fs.perms.all )
 end
 
+local function _interned_enums()
+    local perms, file_type = fs.status( "./test/tests/foo/file.txt" )
+    local _, dir_type      = fs.status( "./test/tests/foo/bar" )
+
+    test.is_true( rawequal( file_type, fs.file_type.regular ) )
+    test.is_true( rawequal( dir_type, fs.file_type.directory ) )
+    test.is_true( rawequal( perms, ( fs.symlink_status( "./test/tests/foo/file.txt" ) ) ) )
+    test.is_true( rawequal( fs.perms.owner_all & fs.perms.owner_read, fs.perms.owner_read ) )
+    test.is_same( fs.perms.owner_read | fs.perms.owner_write | fs.perms.owner_exec, fs.perms.owner_all )
+
+    local perms_value, type_value = fs.status( "./test/tests/foo/file.txt", true )
+    test.is_same( type_value, fs.file_type_values.regular )
+    test.is_same( perms_value & fs.perms_values.owner_read, fs.perms_values.owner_read )
+    test.is_same( fs.stat_many( { "./test/tests/foo/bar" }, { "type" }, { integers = true } ).type[ 1 ], fs.file_type_values.directory )
+end
+
 local tests =
 {
     absolute                        = _absolute,
@@ -345,6 +945,9 @@ local tests =
     weakly_canonical                = _weakly_canonical,
     relative                        = _relative,
     proximate                       = _proximate,
+    atomic_write                    = _atomic_write,
+    async                           = _async,
+    batch                           = _batch,
     copy                            = _copy,
     copy_file                       = _copy_file,
     create_copy_read_symlink_status = _create_copy_read_symlink_status,
@@ -353,19 +956,31 @@ local tests =
     create_hard_link_and_count      = _create_hard_link_and_count,
     create_directory_symlink        = _create_directory_symlink,
     current_path                    = _current_path,
+    du                              = _du,
     equivalent                      = _equivalent,
     file_size_resize                = _file_size_resize,
+    map                             = _map,
+    read_write_file                 = _read_write_file,
+    find_duplicates                 = _find_duplicates,
+    hash_file                       = _hash_file,
     permissions                     = _permissions,
     status_permissions              = _status_permissions,
     rename                          = _rename,
+    snapshot                        = _snapshot,
     space                           = _space,
+    nothrow                         = _nothrow,
+    stat_cache                      = _stat_cache,
+    stat_many                       = _stat_many,
+    sync                            = _sync,
     temp_directory_path             = _temp_directory_path,
     last_write_time                 = _last_write_time,
+    lines                           = _lines,
     file_time                       = _file_time,
     file_time_now                   = _file_time_now,
     file_time_duraion               = _file_time_duraion,
     is_xyzz                         = _is_xyz,
-    enum_binary_operators           = _enum_binary_operators
+    enum_binary_operators           = _enum_binary_operators,
+    interned_enums                  = _interned_enums
 }
 
 return tests